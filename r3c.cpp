@@ -2,7 +2,12 @@
 // R3C is a C++ client for redis based on hiredis (https://github.com/redis/hiredis)
 #include "r3c.h"
 #include "utils.h"
+#include <arpa/inet.h>
 #include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <algorithm>
 
 #define R3C_ASSERT assert
 #define THROW_REDIS_EXCEPTION(errinfo) \
@@ -69,6 +74,18 @@ enum
     CLUSTER_SLOTS = 16384 // number of slots, defined in cluster.h
 };
 
+enum
+{
+    BLOCKING_POOL_SIZE = 2 // Max number of idle connections for blocking commands per node
+};
+
+enum
+{
+    HEDGE_LATENCY_SAMPLES = 1024, // Size of the ring of the recent read latencies
+    HEDGE_MIN_SAMPLES = 100,      // Not to hedge until the number of samples reaches
+    HEDGE_UPDATE_INTERVAL = 64    // Recalculate the percentile every HEDGE_UPDATE_INTERVAL samples
+};
+
 std::string zaddflag2str(ZADDFLAG zaddflag)
 {
     std::string zaddflag_str;
@@ -101,7 +118,10 @@ size_t NodeHasher::operator ()(const Node& node) const
 
 std::string& node2string(const Node& node, std::string* str)
 {
-    *str = node.first + std::string(":") + int2string(node.second);
+    if (is_unix_socket_node(node))
+        *str = node.first;
+    else
+        *str = node.first + std::string(":") + int2string(node.second);
     return *str;
 }
 
@@ -111,6 +131,11 @@ std::string node2string(const Node& node)
     return node2string(node, &nodestr);
 }
 
+bool is_unix_socket_node(const Node& node)
+{
+    return (0 == node.second) && (0 == node.first.compare(0, sizeof("unix:")-1, "unix:"));
+}
+
 std::string NodeInfo::str() const
 {
     return format_string("nodeinfo://%s/%s:%d/%s", id.c_str(), node.first.c_str(), node.second, flags.c_str());
@@ -134,11 +159,84 @@ bool NodeInfo::is_fail() const
     return (pos != std::string::npos);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// CommandCost
+
+// Where the thread counts the costs of CommandArgs and get_value(s) to,
+// set by CRedisClient::enable_accounting, NULL not to count
+static __thread struct CommandCost* sg_build_cost = NULL;
+static __thread struct CommandCost* sg_decode_cost = NULL;
+
+// Where the hooked operator new counts the allocations of the thread to, set by AllocationScope
+static __thread struct CommandCost* sg_allocation_cost = NULL;
+
+// Count the allocations made by the thread in the scope to cost (NULL not to count),
+// only if the program is linked with the allocation hook
+class AllocationScope
+{
+public:
+    AllocationScope(struct CommandCost* cost)
+        : _prev_cost(sg_allocation_cost)
+    {
+        sg_allocation_cost = cost;
+    }
+
+    ~AllocationScope()
+    {
+        sg_allocation_cost = _prev_cost;
+    }
+
+private:
+    struct CommandCost* _prev_cost;
+};
+
+void count_allocation(size_t bytes)
+{
+    struct CommandCost* cost = sg_allocation_cost;
+
+    if (cost != NULL)
+    {
+        ++cost->num_allocations;
+        cost->allocated_bytes += bytes;
+    }
+}
+
+static inline void model_copy(struct CommandCost* cost, size_t bytes)
+{
+    if (cost != NULL)
+        cost->modelled_copied_bytes += bytes;
+}
+
+CommandCost::CommandCost()
+{
+    clear();
+}
+
+void CommandCost::clear()
+{
+    num_commands = 0;
+    num_allocations = 0;
+    allocated_bytes = 0;
+    modelled_copied_bytes = 0;
+    num_reads = 0;
+    num_writes = 0;
+}
+
+void CommandCost::add(const struct CommandCost& other)
+{
+    __sync_fetch_and_add(&num_commands, other.num_commands);
+    __sync_fetch_and_add(&num_allocations, other.num_allocations);
+    __sync_fetch_and_add(&allocated_bytes, other.allocated_bytes);
+    __sync_fetch_and_add(&modelled_copied_bytes, other.modelled_copied_bytes);
+    __sync_fetch_and_add(&num_reads, other.num_reads);
+    __sync_fetch_and_add(&num_writes, other.num_writes);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // CCommandArgs
 
 CommandArgs::CommandArgs()
-    : _argc(0), _argv(NULL), _argvlen(NULL)
+    : _block_milliseconds(-1), _argc(0), _argv(NULL), _argvlen(NULL)
 {
 }
 
@@ -152,38 +250,54 @@ CommandArgs::~CommandArgs()
 
 void CommandArgs::set_key(const std::string& key)
 {
+    AllocationScope allocation_scope(sg_build_cost);
     _key = key;
 }
 
 void CommandArgs::set_command(const std::string& command)
 {
+    AllocationScope allocation_scope(sg_build_cost);
     _command = command;
 }
 
+void CommandArgs::set_block_milliseconds(int64_t block_milliseconds)
+{
+    _block_milliseconds = block_milliseconds;
+}
+
 void CommandArgs::add_arg(const std::string& arg)
 {
+    AllocationScope allocation_scope(sg_build_cost);
     _args.push_back(arg);
+    model_copy(sg_build_cost, arg.size());
 }
 
 void CommandArgs::add_arg(char arg)
 {
+    AllocationScope allocation_scope(sg_build_cost);
     const std::string str(&arg, 1);
     add_arg(str);
 }
 
 void CommandArgs::add_arg(int32_t arg)
 {
+    AllocationScope allocation_scope(sg_build_cost);
     _args.push_back(int2string(arg));
+    model_copy(sg_build_cost, _args.back().size());
 }
 
 void CommandArgs::add_arg(uint32_t arg)
 {
+    AllocationScope allocation_scope(sg_build_cost);
     _args.push_back(int2string(arg));
+    model_copy(sg_build_cost, _args.back().size());
 }
 
 void CommandArgs::add_arg(int64_t arg)
 {
+    AllocationScope allocation_scope(sg_build_cost);
     _args.push_back(int2string(arg));
+    model_copy(sg_build_cost, _args.back().size());
 }
 
 void CommandArgs::add_args(const std::vector<std::string>& args)
@@ -244,6 +358,8 @@ void CommandArgs::add_args(const std::vector<FVPair>& fvpairs)
 
 void CommandArgs::final()
 {
+    AllocationScope allocation_scope(sg_build_cost);
+
     _argc = static_cast<int>(_args.size());
     _argv = new char*[_argc];
     _argvlen = new size_t[_argc];
@@ -254,6 +370,7 @@ void CommandArgs::final()
         _argv[i] = new char[_argvlen[i]+1];
         memcpy(_argv[i], _args[i].c_str(), _argvlen[i]); // Support binary key&value.
         _argv[i][_argvlen[i]] = '\0';
+        model_copy(sg_build_cost, _argvlen[i]);
     }
 }
 
@@ -282,25 +399,123 @@ const std::string& CommandArgs::get_key() const
     return _key;
 }
 
+int64_t CommandArgs::get_block_milliseconds() const
+{
+    return _block_milliseconds;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // CRedisNode
 // CRedisMasterNode
 // CRedisReplicaNode
 
+// The metrics of a command on a node, see CRedisClient::get_metrics
+struct CommandMetricsEntry
+{
+    LatencyHistogram latency;
+    uint64_t num_errors;
+    struct CommandCost cost;
+};
+
+// The I/O statistics of a node shared by its CRedisNode objects across the refreshes,
+// updated by the thread using the client and read by CRedisClient::get_node_stats.
+struct NodeStatsEntry
+{
+    bool master;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t num_replies;
+    int64_t inflight;
+    uint64_t num_connects;
+    uint64_t num_reconnects;
+    int num_connections;
+    int64_t connected_milliseconds;
+
+    // Protected by CRedisClient::_metrics_mutex
+    std::deque<int64_t> reconnect_milliseconds; // At most MAX_RECONNECTS, the oldest first
+    std::string last_error;
+    int64_t last_error_milliseconds;
+
+    // Command -> Metrics of CRedisClient::_command_metrics, only accessed by the thread using the client,
+    // to record the latency without building the key of _command_metrics
+    std::map<std::string, struct CommandMetricsEntry*> command_metrics;
+
+    static const size_t MAX_RECONNECTS = 16;
+
+    NodeStatsEntry(bool master_)
+        : master(master_), bytes_sent(0), bytes_received(0), num_replies(0), inflight(0),
+          num_connects(0), num_reconnects(0), num_connections(0), connected_milliseconds(0),
+          last_error_milliseconds(0)
+    {
+    }
+
+    void on_connected()
+    {
+        __sync_fetch_and_add(&num_connects, 1);
+        __sync_fetch_and_add(&num_connections, 1);
+        connected_milliseconds = get_current_milliseconds();
+    }
+
+    // The replies pending on the connection are never read
+    void on_closed(unsigned int pending_replies)
+    {
+        __sync_fetch_and_sub(&num_connections, 1);
+        add_inflight(-static_cast<int64_t>(pending_replies));
+    }
+
+    void add_inflight(int64_t n)
+    {
+        if (n != 0)
+            __sync_fetch_and_add(&inflight, n);
+    }
+
+    void add_sent(size_t bytes)
+    {
+        __sync_fetch_and_add(&bytes_sent, static_cast<uint64_t>(bytes));
+    }
+
+    void add_received(size_t bytes)
+    {
+        __sync_fetch_and_add(&bytes_received, static_cast<uint64_t>(bytes));
+        __sync_fetch_and_add(&num_replies, 1);
+    }
+};
+
+// One of the connections to a node
+struct RedisConnection
+{
+    redisContext* redis_context;
+    unsigned int conn_errors; // 连续连接失败数
+    int readwrite_timeout_milliseconds; // The receive and send timeout currently set to redis_context
+    unsigned int pending_replies; // 对冲读输掉后未读取的响应数
+
+    RedisConnection()
+        : redis_context(NULL), conn_errors(0), readwrite_timeout_milliseconds(-1), pending_replies(0)
+    {
+    }
+};
+
+// A node has one or more connections (see CRedisClient::set_connections_per_node),
+// the methods about the connection operate the connection selected by select_connection.
 class CRedisNode
 {
 public:
-    CRedisNode(const NodeId& nodeid, const Node& node, redisContext* redis_context)
+    CRedisNode(const NodeId& nodeid, const Node& node, redisContext* redis_context, NodeStatsEntry* stats)
         : _nodeid(nodeid),
           _node(node),
-          _redis_context(redis_context),
-          _conn_errors(0)
+          _connections(1),
+          _index(0),
+          _stats(stats)
     {
+        _connections[0].redis_context = redis_context;
+        if (redis_context != NULL)
+            _stats->on_connected();
     }
 
     ~CRedisNode()
     {
-        close();
+        close_all();
+        close_blocking_contexts();
     }
 
     const NodeId& get_nodeid() const
@@ -313,65 +528,220 @@ public:
         return _node;
     }
 
+    NodeStatsEntry* get_stats() const
+    {
+        return _stats;
+    }
+
+    unsigned int get_num_connections() const
+    {
+        return static_cast<unsigned int>(_connections.size());
+    }
+
+    // The connections beyond num_connections are closed
+    void set_num_connections(unsigned int num_connections)
+    {
+        if (num_connections < 1)
+            num_connections = 1;
+        for (std::vector<RedisConnection>::size_type i=num_connections; i<_connections.size(); ++i)
+        {
+            if (_connections[i].redis_context != NULL)
+            {
+                redisFree(_connections[i].redis_context);
+                _stats->on_closed(_connections[i].pending_replies);
+            }
+        }
+        _connections.resize(num_connections);
+        if (_index >= num_connections)
+            _index = 0;
+    }
+
+    // Select the connection by the hash of key
+    void select_connection(unsigned int key_hash)
+    {
+        _index = key_hash % static_cast<unsigned int>(_connections.size());
+    }
+
+    unsigned int get_connection_index() const
+    {
+        return _index;
+    }
+
+    // Select the connection by the index returned by get_connection_index
+    void select_connection_index(unsigned int index)
+    {
+        _index = index % static_cast<unsigned int>(_connections.size());
+    }
+
     redisContext* get_redis_context() const
     {
-        return _redis_context;
+        return _connections[_index].redis_context;
+    }
+
+    // Returns true if any connection established
+    bool is_connected() const
+    {
+        for (std::vector<RedisConnection>::size_type i=0; i<_connections.size(); ++i)
+        {
+            if (_connections[i].redis_context != NULL)
+                return true;
+        }
+        return false;
     }
 
     void set_redis_context(redisContext* redis_context)
     {
-        _redis_context = redis_context;
-        if (NULL == _redis_context)
+        RedisConnection& connection = _connections[_index];
+
+        if (redis_context != connection.redis_context)
+        {
+            if (connection.redis_context != NULL)
+                _stats->on_closed(connection.pending_replies);
+            if (redis_context != NULL)
+                _stats->on_connected();
+            connection.readwrite_timeout_milliseconds = -1;
+            connection.pending_replies = 0;
+        }
+        connection.redis_context = redis_context;
+        if (NULL == connection.redis_context)
         {
-            ++_conn_errors;
+            ++connection.conn_errors;
             //(*g_debug_log)("%s\n", str().c_str());
         }
     }
 
     void close()
     {
-        if (_redis_context != NULL)
+        RedisConnection& connection = _connections[_index];
+
+        if (connection.redis_context != NULL)
+        {
+            redisFree(connection.redis_context);
+            connection.redis_context = NULL;
+            _stats->on_closed(connection.pending_replies);
+        }
+        connection.readwrite_timeout_milliseconds = -1;
+        connection.pending_replies = 0;
+    }
+
+    void close_all()
+    {
+        const unsigned int index = _index;
+
+        for (_index=0; _index<_connections.size(); ++_index)
+            close();
+        _index = index;
+    }
+
+    // -1 means the timeout set when connected
+    int get_readwrite_timeout() const
+    {
+        return _connections[_index].readwrite_timeout_milliseconds;
+    }
+
+    void set_readwrite_timeout(int readwrite_timeout_milliseconds)
+    {
+        _connections[_index].readwrite_timeout_milliseconds = readwrite_timeout_milliseconds;
+    }
+
+    // Check out an idle connection for blocking commands, returns NULL if no any
+    redisContext* pop_blocking_context()
+    {
+        redisContext* redis_context = NULL;
+
+        if (!_blocking_contexts.empty())
+        {
+            redis_context = _blocking_contexts.back();
+            _blocking_contexts.pop_back();
+        }
+        return redis_context;
+    }
+
+    // Return the connection checked out by pop_blocking_context,
+    // it is closed if the pool is full.
+    void push_blocking_context(redisContext* redis_context)
+    {
+        if (_blocking_contexts.size() < BLOCKING_POOL_SIZE)
+            _blocking_contexts.push_back(redis_context);
+        else
+            redisFree(redis_context);
+    }
+
+    void close_blocking_contexts()
+    {
+        for (std::vector<redisContext*>::size_type i=0; i<_blocking_contexts.size(); ++i)
+            redisFree(_blocking_contexts[i]);
+        _blocking_contexts.clear();
+    }
+
+    // Number of the replies not read yet, left by the hedged reads lost
+    unsigned int get_pending_replies() const
+    {
+        return _connections[_index].pending_replies;
+    }
+
+    // Returns true if any connection has replies not read yet
+    bool has_pending_replies() const
+    {
+        for (std::vector<RedisConnection>::size_type i=0; i<_connections.size(); ++i)
         {
-            redisFree(_redis_context);
-            _redis_context = NULL;
+            if (_connections[i].pending_replies > 0)
+                return true;
         }
+        return false;
+    }
+
+    void inc_pending_replies()
+    {
+        ++_connections[_index].pending_replies;
+        _stats->add_inflight(1);
+    }
+
+    void dec_pending_replies()
+    {
+        --_connections[_index].pending_replies;
+        _stats->add_inflight(-1);
     }
 
     std::string str() const
     {
-        return format_string("node://(connerrors:%u)%s:%d", _conn_errors, _node.first.c_str(), _node.second);
+        return format_string("node://(connerrors:%u,connection:%u/%u)%s:%d",
+                get_conn_errors(), _index, get_num_connections(), _node.first.c_str(), _node.second);
     }
 
     unsigned int get_conn_errors() const
     {
-        return _conn_errors;
+        return _connections[_index].conn_errors;
     }
 
     void inc_conn_errors()
     {
-        ++_conn_errors;
+        ++_connections[_index].conn_errors;
     }
 
     void reset_conn_errors()
     {
-        _conn_errors = 0;
+        _connections[_index].conn_errors = 0;
     }
 
     void set_conn_errors(unsigned int conn_errors)
     {
-        _conn_errors = conn_errors;
+        _connections[_index].conn_errors = conn_errors;
     }
 
     bool need_refresh_master() const
     {
-        return ((_conn_errors>3 && 0==_conn_errors%3) || (_conn_errors>2018));
+        const unsigned int conn_errors = get_conn_errors();
+        return ((conn_errors>3 && 0==conn_errors%3) || (conn_errors>2018));
     }
 
 protected:
     NodeId _nodeid;
     Node _node;
-    redisContext* _redis_context;
-    unsigned int _conn_errors; // 连续连接失败数
+    std::vector<RedisConnection> _connections;
+    unsigned int _index; // The connection selected
+    std::vector<redisContext*> _blocking_contexts; // 阻塞命令专用的空闲连接
+    NodeStatsEntry* _stats; // Owned by CRedisClient
 };
 
 class CRedisMasterNode;
@@ -379,8 +749,8 @@ class CRedisMasterNode;
 class CRedisReplicaNode: public CRedisNode
 {
 public:
-    CRedisReplicaNode(const NodeId& node_id, const Node& node, redisContext* redis_context)
-        : CRedisNode(node_id, node, redis_context),
+    CRedisReplicaNode(const NodeId& node_id, const Node& node, redisContext* redis_context, NodeStatsEntry* stats)
+        : CRedisNode(node_id, node, redis_context, stats),
           _redis_master_node(NULL)
     {
     }
@@ -392,8 +762,8 @@ private:
 class CRedisMasterNode: public CRedisNode
 {
 public:
-    CRedisMasterNode(const NodeId& node_id, const Node& node, redisContext* redis_context)
-        : CRedisNode(node_id, node, redis_context),
+    CRedisMasterNode(const NodeId& node_id, const Node& node, redisContext* redis_context, NodeStatsEntry* stats)
+        : CRedisNode(node_id, node, redis_context, stats),
           _index(0)
     {
     }
@@ -426,6 +796,23 @@ public:
     }
 
     CRedisNode* choose_node(ReadPolicy read_policy)
+    {
+        const unsigned int num_redis_replica_nodes = static_cast<unsigned int>(_redis_replica_nodes.size());
+        const unsigned int start = _index++;
+        CRedisNode* redis_node = NULL;
+
+        // 跳过有对冲读残留响应的节点，以免命令排在慢响应之后，除非都有
+        for (unsigned int i=0; i<=num_redis_replica_nodes && (NULL==redis_node || redis_node->has_pending_replies()); ++i)
+        {
+            CRedisNode* candidate = get_candidate_node(read_policy, start+i);
+            if (NULL==redis_node || !candidate->has_pending_replies())
+                redis_node = candidate;
+        }
+        return redis_node;
+    }
+
+    // The K-th candidate of choose_node in turns
+    CRedisNode* get_candidate_node(ReadPolicy read_policy, unsigned int K)
     {
         const unsigned int num_redis_replica_nodes = static_cast<unsigned int>(_redis_replica_nodes.size());
         CRedisNode* redis_node = NULL;
@@ -436,7 +823,7 @@ public:
         }
         else
         {
-            unsigned int K = _index++ % (num_redis_replica_nodes+1); // Included master
+            K = K % (num_redis_replica_nodes+1); // Included master
 
             if (RP_READ_REPLICA==read_policy && K==num_redis_replica_nodes)
             {
@@ -465,6 +852,60 @@ public:
         return redis_node;
     }
 
+    int get_num_replica_nodes() const
+    {
+        return static_cast<int>(_redis_replica_nodes.size());
+    }
+
+    int get_num_connected_replica_nodes() const
+    {
+        int num_connected = 0;
+        for (RedisReplicaNodeTable::const_iterator iter=_redis_replica_nodes.begin(); iter!=_redis_replica_nodes.end(); ++iter)
+        {
+            if (iter->second->is_connected())
+                ++num_connected;
+        }
+        return num_connected;
+    }
+
+    void close_replica_connections()
+    {
+        for (RedisReplicaNodeTable::iterator iter=_redis_replica_nodes.begin(); iter!=_redis_replica_nodes.end(); ++iter)
+        {
+            iter->second->close_all();
+            iter->second->close_blocking_contexts();
+        }
+    }
+
+    void set_num_replica_connections(unsigned int num_connections)
+    {
+        for (RedisReplicaNodeTable::iterator iter=_redis_replica_nodes.begin(); iter!=_redis_replica_nodes.end(); ++iter)
+            iter->second->set_num_connections(num_connections);
+    }
+
+    // Choose a connected node other than excluded_node for hedged reads,
+    // replicas are preferred, returns NULL if no any.
+    CRedisNode* choose_hedge_node(const CRedisNode* excluded_node)
+    {
+        const unsigned int num_redis_replica_nodes = static_cast<unsigned int>(_redis_replica_nodes.size());
+        const unsigned int K = (0 == num_redis_replica_nodes)? 0: _index % num_redis_replica_nodes;
+        RedisReplicaNodeTable::iterator iter = _redis_replica_nodes.begin();
+
+        for (unsigned int i=0; i<K; ++i)
+            ++iter;
+        for (unsigned int i=0; i<num_redis_replica_nodes; ++i)
+        {
+            CRedisNode* redis_node = iter->second;
+            if (redis_node!=excluded_node && redis_node->get_redis_context()!=NULL && !redis_node->has_pending_replies())
+                return redis_node;
+            if (++iter == _redis_replica_nodes.end())
+                iter = _redis_replica_nodes.begin();
+        }
+        if (this!=excluded_node && get_redis_context()!=NULL && !has_pending_replies())
+            return this;
+        return NULL;
+    }
+
 private:
 #if __cplusplus < 201103L
     typedef std::tr1::unordered_map<Node, CRedisReplicaNode*, NodeHasher> RedisReplicaNodeTable;
@@ -475,478 +916,1074 @@ private:
     unsigned int _index;
 };
 
+// The commands of a pipeline sent through the same connection
+struct PipelineGroup
+{
+    CRedisNode* redis_node;
+    unsigned int connection_index;
+    std::deque<int> queued;   // Commands not sent yet
+    std::deque<int> inflight; // Commands sent but the replies not read yet, -1 for the reply of ASKING
+    bool failed;
+
+    PipelineGroup(CRedisNode* redis_node_, unsigned int connection_index_)
+        : redis_node(redis_node_), connection_index(connection_index_), failed(false)
+    {
+    }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
-// RedisReplyHelper
+// Pipeline
 
-RedisReplyHelper::RedisReplyHelper()
-    : _redis_reply(NULL)
+Pipeline::Pipeline()
 {
 }
 
-RedisReplyHelper::RedisReplyHelper(const redisReply* redis_reply)
-    : _redis_reply(redis_reply)
+Pipeline::~Pipeline()
 {
+    clear();
 }
 
-RedisReplyHelper::RedisReplyHelper(const RedisReplyHelper& other)
+void Pipeline::add(const CommandArgs& command_args)
 {
-    _redis_reply = other.detach();
+    char* formatted_command = NULL;
+    const int len = redisFormatCommandArgv(&formatted_command, command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+
+    _commands.resize(_commands.size()+1);
+    PipelineCommand& command = _commands.back();
+    command.key = command_args.get_key();
+    command.command = command_args.get_command();
+    command.reply = NULL;
+    command.asking = false;
+    command.attempts = 0;
+    if (len > 0)
+    {
+        command.formatted_command.assign(formatted_command, len);
+        free(formatted_command);
+    }
 }
 
-RedisReplyHelper::~RedisReplyHelper()
+void Pipeline::add(const std::string& key, const std::string& command, const std::string& formatted_command)
 {
-    free();
+    _commands.resize(_commands.size()+1);
+    PipelineCommand& pipeline_command = _commands.back();
+    pipeline_command.key = key;
+    pipeline_command.command = command;
+    pipeline_command.formatted_command = formatted_command;
+    pipeline_command.reply = NULL;
+    pipeline_command.asking = false;
+    pipeline_command.attempts = 0;
 }
 
-RedisReplyHelper::operator bool() const
+int Pipeline::size() const
 {
-    return _redis_reply != NULL;
+    return static_cast<int>(_commands.size());
 }
 
-void RedisReplyHelper::free()
+void Pipeline::clear()
 {
-    if (_redis_reply != NULL)
+    for (std::vector<PipelineCommand>::size_type i=0; i<_commands.size(); ++i)
     {
-        freeReplyObject((void*)_redis_reply);
-        _redis_reply = NULL;
+        if (_commands[i].reply != NULL)
+            freeReplyObject(_commands[i].reply);
     }
+    _commands.clear();
 }
 
-const redisReply* RedisReplyHelper::get() const
+const redisReply* Pipeline::get_reply(int index) const
 {
-    return _redis_reply;
+    return _commands[index].reply;
 }
 
-const redisReply* RedisReplyHelper::detach() const
+const ErrorInfo& Pipeline::get_errinfo(int index) const
 {
-    const redisReply* redis_reply = _redis_reply;
-    _redis_reply = NULL;
-    return redis_reply;
+    return _commands[index].errinfo;
 }
 
-RedisReplyHelper& RedisReplyHelper::operator =(const redisReply* redis_reply)
+const Node& Pipeline::get_node(int index) const
 {
-    free();
-    _redis_reply = redis_reply;
-    return *this;
+    return _commands[index].node;
 }
 
-RedisReplyHelper& RedisReplyHelper::operator =(const RedisReplyHelper& other)
+redisReply* Pipeline::release_reply(int index)
 {
-    free();
-    _redis_reply = other.detach();
-    return *this;
+    redisReply* redis_reply = _commands[index].reply;
+    _commands[index].reply = NULL;
+    return redis_reply;
 }
 
-const redisReply* RedisReplyHelper::operator ->() const
+////////////////////////////////////////////////////////////////////////////////
+// KeyspaceExporter & KeyspaceImporter
+
+static const char KEYSPACE_FILE_MAGIC[] = "R3CDUMP2"; // With the expire time
+static const char KEYSPACE_FILE_MAGIC_V1[] = "R3CDUMP1"; // With the TTL
+
+static void append_uint32(std::string* buffer, uint32_t n)
 {
-    return _redis_reply;
+    for (int i=3; i>=0; --i)
+        buffer->push_back(static_cast<char>((n >> (i*8)) & 0xFF));
 }
 
-std::ostream& RedisReplyHelper::operator <<(std::ostream& os)
+static void append_int64(std::string* buffer, int64_t n)
 {
-    os << *_redis_reply;
-    return os;
+    const uint64_t m = static_cast<uint64_t>(n);
+    for (int i=7; i>=0; --i)
+        buffer->push_back(static_cast<char>((m >> (i*8)) & 0xFF));
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// ErrorInfo
-
-ErrorInfo::ErrorInfo()
-    : errcode(0)
+static uint64_t decode_uint(const unsigned char* bytes, int size)
 {
+    uint64_t n = 0;
+    for (int i=0; i<size; ++i)
+        n = (n << 8) | bytes[i];
+    return n;
 }
 
-ErrorInfo::ErrorInfo(const std::string& raw_errmsg_, const std::string& errmsg_, const std::string& errtype_, int errcode_)
-    : raw_errmsg(raw_errmsg_), errmsg(errmsg_), errtype(errtype_), errcode(errcode_)
+// Returns 1 if a record is read, 0 at the end of file, or -1 if the file is truncated
+static int read_keyspace_record(FILE* fp, std::string* key, std::string* payload, int64_t* expire)
 {
+    unsigned char bytes[8];
+    size_t n = fread(bytes, 1, 4, fp);
+
+    if (0 == n)
+        return 0;
+    if (n != 4)
+        return -1;
+    key->resize(static_cast<std::string::size_type>(decode_uint(bytes, 4)));
+    if (!key->empty() && fread(&(*key)[0], 1, key->size(), fp)!=key->size())
+        return -1;
+    if (fread(bytes, 1, 4, fp) != 4)
+        return -1;
+    payload->resize(static_cast<std::string::size_type>(decode_uint(bytes, 4)));
+    if (!payload->empty() && fread(&(*payload)[0], 1, payload->size(), fp)!=payload->size())
+        return -1;
+    if (fread(bytes, 1, 8, fp) != 8)
+        return -1;
+    *expire = static_cast<int64_t>(decode_uint(bytes, 8));
+    return 1;
 }
 
-void ErrorInfo::clear()
+static void set_file_errinfo(struct ErrorInfo* errinfo, const char* file, int line, const std::string& op, const std::string& filepath)
 {
-    errcode = 0;
-    errtype.clear();
-    errmsg.clear();
-    raw_errmsg.clear();
+    errinfo->errcode = ERROR_FILE;
+    errinfo->errtype.clear();
+    errinfo->raw_errmsg = format_string("%s %s error: %s", op.c_str(), filepath.c_str(), strerror(errno));
+    errinfo->errmsg = format_string("[R3C_FILE][%s:%d] %s", file, line, errinfo->raw_errmsg.c_str());
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// CRedisException
-
-CRedisException::CRedisException(
-        const struct ErrorInfo& errinfo,
-        const char* file, int line,
-        const std::string& node_ip, uint16_t node_port,
-        const std::string& command, const std::string& key) throw ()
-    :  _errinfo(errinfo),
-       _line(line),
-       _node_ip(node_ip), _node_port(node_port),
-       _command(command), _key(key)
+KeyspaceExporter::KeyspaceExporter(CRedisClient* redis_client, const std::string& pattern, int count)
+    : _redis_client(redis_client),
+      _pattern(pattern),
+      _count(count),
+      _window_size(100),
+      _scans_per_second(0),
+      _num_retries(NUM_RETRIES),
+      _fp(NULL),
+      _num_keys(0),
+      _num_skipped(0),
+      _num_bytes(0)
 {
-    const char* slash_position = strrchr(file, '/');
-    const std::string* file_cp = &_file;
-    std::string* file_p = const_cast<std::string*>(file_cp);
-
-    if (NULL == slash_position)
-    {
-        *file_p = file;
-    }
-    else
-    {
-        *file_p = std::string(slash_position + 1);
-    }
 }
 
-const char* CRedisException::what() const throw()
+KeyspaceExporter::~KeyspaceExporter()
 {
-    return _errinfo.errmsg.c_str();
+    if (_fp != NULL)
+        fclose(_fp);
 }
 
-std::string CRedisException::str() const throw ()
+void KeyspaceExporter::set_window_size(int window_size)
 {
-    const std::string& errmsg = format_string("redis_exception://%s:%d/CMD:%s/%s/(%d)%s@%s:%d/(KEY:%.*s)",
-            _node_ip.c_str(), _node_port,
-            _command.c_str(),
-            _errinfo.errtype.c_str(), _errinfo.errcode, _errinfo.errmsg.c_str(),
-            _file.c_str(), _line,
-            static_cast<int>(_key.size()), _key.c_str());
-
-#if __cplusplus < 201103L
-    return errmsg;
-#else
-    return std::move(errmsg);
-#endif // __cplusplus < 201103L
+    _window_size = window_size;
 }
 
-bool is_general_error(const std::string& errtype)
+void KeyspaceExporter::set_rate_limit(int scans_per_second)
 {
-    return (errtype.size() == sizeof("ERR")-1) && (errtype == "ERR");
+    _scans_per_second = scans_per_second;
 }
 
-bool is_ask_error(const std::string& errtype)
+int64_t KeyspaceExporter::run(const std::string& filepath, int num_retries)
 {
-    return (errtype.size() == sizeof("ASK")-1) && (errtype == "ASK");
-}
+    ParallelScanner scanner(_redis_client, _pattern, _count);
 
-bool is_clusterdown_error(const std::string& errtype)
-{
-    // CLUSTERDOWN The cluster is down
-    // 如果在从未成为主之前，将主和从同时干掉，则即使从正常了，从也无法成为主，
-    // 这个时候必须将原来的主恢复，否则该部分slots就不能再服务
-    return (errtype.size() == sizeof("CLUSTERDOWN")-1) && (errtype == "CLUSTERDOWN");
+    _num_retries = num_retries;
+    _num_keys = 0;
+    _num_skipped = 0;
+    _num_bytes = 0;
+    _errinfo.clear();
+    _filepath = filepath;
+    if (_fp != NULL)
+        fclose(_fp); // Left by the last run failed
+    _fp = fopen(filepath.c_str(), "wb");
+    if (NULL == _fp)
+    {
+        set_file_errinfo(&_errinfo, __FILE__, __LINE__, "open", filepath);
+        THROW_REDIS_EXCEPTION(_errinfo);
+    }
+    if (fwrite(KEYSPACE_FILE_MAGIC, 1, sizeof(KEYSPACE_FILE_MAGIC)-1, _fp) != sizeof(KEYSPACE_FILE_MAGIC)-1)
+    {
+        set_file_errinfo(&_errinfo, __FILE__, __LINE__, "write", filepath);
+    }
+    else
+    {
+        _num_bytes = sizeof(KEYSPACE_FILE_MAGIC)-1;
+        scanner.set_rate_limit(_scans_per_second);
+        scanner.run(this, num_retries); // 出错时由析构函数关闭文件
+        if (0==_errinfo.errcode && ferror(_fp))
+            set_file_errinfo(&_errinfo, __FILE__, __LINE__, "write", filepath);
+    }
+    if (fclose(_fp)!=0 && 0==_errinfo.errcode)
+        set_file_errinfo(&_errinfo, __FILE__, __LINE__, "close", filepath);
+    _fp = NULL;
+    if (_errinfo.errcode != 0)
+        THROW_REDIS_EXCEPTION(_errinfo);
+    return _num_keys;
 }
 
-bool is_moved_error(const std::string& errtype)
+int64_t KeyspaceExporter::get_num_skipped() const
 {
-    return (errtype.size() == sizeof("MOVED")-1) && (errtype == "MOVED");
+    return _num_skipped;
 }
 
-bool is_noauth_error(const std::string& errtype)
+int64_t KeyspaceExporter::get_num_bytes() const
 {
-    // NOAUTH Authentication required.
-    return (errtype.size() == sizeof("NOAUTH")-1) && (errtype == "NOAUTH");
+    return _num_bytes;
 }
 
-bool is_noscript_error(const std::string& errtype)
+bool KeyspaceExporter::handle(const Node& node, const std::vector<std::string>& keys)
 {
-    // NOSCRIPT No matching script. Please use EVAL.
-    return (errtype.size() == sizeof("NOSCRIPT")-1) && (errtype == "NOSCRIPT");
-}
+    Pipeline pipeline;
+    std::string records;
+    int64_t now;
 
-bool is_wrongtype_error(const std::string& errtype)
-{
-    return (errtype.size() == sizeof("WRONGTYPE")-1) && (errtype == "WRONGTYPE");
-}
+    for (std::vector<std::string>::size_type i=0; i<keys.size(); ++i)
+    {
+        CommandArgs dump_args;
+        dump_args.set_key(keys[i]);
+        dump_args.set_command("DUMP");
+        dump_args.add_arg(dump_args.get_command());
+        dump_args.add_arg(keys[i]);
+        dump_args.final();
+        pipeline.add(dump_args);
 
-bool is_busygroup_error(const std::string& errtype)
-{
-    return (errtype.size() == sizeof("BUSYGROUP")-1) && (errtype == "BUSYGROUP");
-}
+        CommandArgs pttl_args;
+        pttl_args.set_key(keys[i]);
+        pttl_args.set_command("PTTL");
+        pttl_args.add_arg(pttl_args.get_command());
+        pttl_args.add_arg(keys[i]);
+        pttl_args.final();
+        pipeline.add(pttl_args);
+    }
+    _redis_client->pipeline(&pipeline, _window_size, _num_retries);
+    now = get_current_milliseconds();
 
-bool is_nogroup_error(const std::string& errtype)
-{
-    return (errtype.size() == sizeof("NOGROUP")-1) && (errtype == "NOGROUP");
-}
+    for (int i=0; i<pipeline.size(); i+=2)
+    {
+        const redisReply* dump_reply = pipeline.get_reply(i);
+        const redisReply* pttl_reply = pipeline.get_reply(i+1);
+        const std::string& key = keys[i/2];
 
-bool is_crossslot_error(const std::string& errtype)
-{
-    return (errtype.size() == sizeof("CROSSSLOT")-1) && (errtype == "CROSSSLOT");
-}
+        for (int j=i; j<i+2; ++j)
+        {
+            const redisReply* redis_reply = pipeline.get_reply(j);
 
-////////////////////////////////////////////////////////////////////////////////
-// CRedisClient
+            if (NULL == redis_reply)
+            {
+                _errinfo = pipeline.get_errinfo(j);
+                return false;
+            }
+            if (REDIS_REPLY_ERROR == redis_reply->type)
+            {
+                _errinfo.errcode = ERROR_COMMAND;
+                _errinfo.errtype = pipeline.get_errinfo(j).errtype;
+                _errinfo.raw_errmsg = format_string("[%s:%d][%s] %s", node.first.c_str(), node.second, key.c_str(), redis_reply->str);
+                _errinfo.errmsg = format_string("[R3C_EXPORT][%s:%d] %s", __FILE__, __LINE__, _errinfo.raw_errmsg.c_str());
+                return false;
+            }
+        }
+        if ((dump_reply->type!=REDIS_REPLY_STRING && dump_reply->type!=REDIS_REPLY_NIL) || pttl_reply->type!=REDIS_REPLY_INTEGER)
+        {
+            _errinfo.errcode = ERROR_UNEXCEPTED_REPLY_TYPE;
+            _errinfo.errtype.clear();
+            _errinfo.raw_errmsg = format_string("[%s:%d][%s] unexpected reply type: %d/%d", node.first.c_str(), node.second, key.c_str(), dump_reply->type, pttl_reply->type);
+            _errinfo.errmsg = format_string("[R3C_EXPORT][%s:%d] %s", __FILE__, __LINE__, _errinfo.raw_errmsg.c_str());
+            return false;
+        }
+        if (REDIS_REPLY_NIL==dump_reply->type || pttl_reply->integer==-2 || pttl_reply->integer==0)
+        {
+            // 已被删除或已过期
+            ++_num_skipped;
+            continue;
+        }
 
-CRedisClient::CRedisClient(
-        const std::string& raw_nodes_string,
-        int connect_timeout_milliseconds,
-        int readwrite_timeout_milliseconds,
-        const std::string& password,
-        ReadPolicy read_policy
-        )
-            : _command_monitor(NULL),
-              _raw_nodes_string(raw_nodes_string),
-              _connect_timeout_milliseconds(connect_timeout_milliseconds),
-              _readwrite_timeout_milliseconds(readwrite_timeout_milliseconds),
-              _password(password),
-              _read_policy(read_policy)
-{
-    init();
+        append_uint32(&records, static_cast<uint32_t>(key.size()));
+        records.append(key);
+        append_uint32(&records, static_cast<uint32_t>(dump_reply->len));
+        records.append(dump_reply->str, dump_reply->len);
+        // 存绝对过期时间，导入时再换算成TTL，避免导出到导入之间的TTL漂移
+        append_int64(&records, (pttl_reply->integer > 0)? now+pttl_reply->integer: static_cast<int64_t>(-1));
+        ++_num_keys;
+    }
+    if (!records.empty() && fwrite(records.data(), 1, records.size(), _fp)!=records.size())
+    {
+        set_file_errinfo(&_errinfo, __FILE__, __LINE__, "write", _filepath);
+        return false;
+    }
+    _num_bytes += static_cast<int64_t>(records.size());
+    return true;
 }
 
-CRedisClient::CRedisClient(
-        const std::string& raw_nodes_string,
-        const std::string& password,
-        int connect_timeout_milliseconds,
-        int readwrite_timeout_milliseconds,
-        ReadPolicy read_policy)
-            : _command_monitor(NULL),
-              _raw_nodes_string(raw_nodes_string),
-              _connect_timeout_milliseconds(connect_timeout_milliseconds),
-              _readwrite_timeout_milliseconds(readwrite_timeout_milliseconds),
-              _password(password),
-              _read_policy(read_policy)
+KeyspaceImporter::KeyspaceImporter(CRedisClient* redis_client, bool replace)
+    : _redis_client(redis_client),
+      _replace(replace),
+      _window_size(100),
+      _batch_size(1000),
+      _num_errors(0),
+      _num_expired(0)
 {
-    init();
 }
 
-CRedisClient::CRedisClient(
-        const std::string& raw_nodes_string,
-        ReadPolicy read_policy,
-        const std::string& password,
-        int connect_timeout_milliseconds,
-        int readwrite_timeout_milliseconds)
-            : _command_monitor(NULL),
-              _raw_nodes_string(raw_nodes_string),
-              _connect_timeout_milliseconds(connect_timeout_milliseconds),
-              _readwrite_timeout_milliseconds(readwrite_timeout_milliseconds),
-              _password(password),
-              _read_policy(read_policy)
+void KeyspaceImporter::set_window_size(int window_size)
 {
-    init();
+    _window_size = window_size;
 }
 
-CRedisClient::~CRedisClient()
+void KeyspaceImporter::set_batch_size(int batch_size)
 {
-    fini();
+    _batch_size = (batch_size > 0)? batch_size: 1;
 }
 
-const std::string& CRedisClient::get_raw_nodes_string() const
+int64_t KeyspaceImporter::run(const std::string& filepath, int num_retries)
 {
-    return _raw_nodes_string;
+    struct ErrorInfo errinfo;
+    FILE* fp = fopen(filepath.c_str(), "rb");
+    char magic[sizeof(KEYSPACE_FILE_MAGIC)-1];
+    Pipeline pipeline;
+    std::string key;
+    std::string payload;
+    int64_t expire = 0;
+    int64_t num_keys = 0;
+    bool with_ttl = false; // R3CDUMP1
+    int ret;
+
+    _num_errors = 0;
+    _num_expired = 0;
+    if (NULL == fp)
+    {
+        set_file_errinfo(&errinfo, __FILE__, __LINE__, "open", filepath);
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic))
+        with_ttl = (0 == memcmp(magic, KEYSPACE_FILE_MAGIC_V1, sizeof(magic)));
+    else
+        memset(magic, 0, sizeof(magic));
+    if (!with_ttl && memcmp(magic, KEYSPACE_FILE_MAGIC, sizeof(magic))!=0)
+    {
+        fclose(fp);
+        errinfo.errcode = ERROR_FORMAT;
+        errinfo.raw_errmsg = format_string("%s is not a file exported by KeyspaceExporter", filepath.c_str());
+        errinfo.errmsg = format_string("[R3C_IMPORT][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+
+    try
+    {
+        while ((ret = read_keyspace_record(fp, &key, &payload, &expire)) == 1)
+        {
+            const int64_t pttl = (with_ttl || expire<0)? expire: expire-get_current_milliseconds();
+            CommandArgs cmd_args;
+
+            if (!with_ttl && expire>=0 && pttl<=0)
+            {
+                ++_num_expired; // 导出后已过期
+                continue;
+            }
+            cmd_args.set_key(key);
+            cmd_args.set_command("RESTORE");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            cmd_args.add_arg((pttl > 0)? pttl: static_cast<int64_t>(0)); // 0 means no TTL
+            cmd_args.add_arg(payload);
+            if (_replace)
+                cmd_args.add_arg("REPLACE");
+            cmd_args.final();
+            pipeline.add(cmd_args);
+            if (pipeline.size() >= _batch_size)
+                num_keys += restore(&pipeline, num_retries);
+        }
+        if (pipeline.size() > 0)
+            num_keys += restore(&pipeline, num_retries);
+    }
+    catch (...)
+    {
+        fclose(fp);
+        throw;
+    }
+
+    if (-1==ret || ferror(fp))
+    {
+        errinfo.errcode = ERROR_FORMAT;
+        errinfo.raw_errmsg = format_string("%s is truncated or unreadable after %" PRId64" keys", filepath.c_str(), num_keys+_num_errors);
+        errinfo.errmsg = format_string("[R3C_IMPORT][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        fclose(fp);
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    fclose(fp);
+    return num_keys;
 }
 
-const std::string& CRedisClient::get_nodes_string() const
+int64_t KeyspaceImporter::get_num_errors() const
 {
-    return _nodes_string;
+    return _num_errors;
 }
 
-std::string CRedisClient::str() const
+int64_t KeyspaceImporter::get_num_expired() const
 {
-    if (cluster_mode())
-        return std::string("rediscluster://") + _raw_nodes_string;
-    else
-        return std::string("redisstandalone://") + _raw_nodes_string;
+    return _num_expired;
 }
 
-bool CRedisClient::cluster_mode() const
+int64_t KeyspaceImporter::restore(Pipeline* pipeline, int num_retries)
 {
-    return _nodes.size() > 1;
+    const int num_restored = _redis_client->pipeline(pipeline, _window_size, num_retries);
+
+    _num_errors += pipeline->size() - num_restored;
+    pipeline->clear();
+    return num_restored;
 }
 
-const char* CRedisClient::get_mode_str() const
+////////////////////////////////////////////////////////////////////////////////
+// The timed waits of the background threads are on CLOCK_MONOTONIC,
+// so that a step of the wall clock neither stalls nor spins them.
+
+static void init_monotonic_cond(pthread_cond_t* cond)
 {
-    return cluster_mode()? "CLUSTER": "STANDALONE";
+    pthread_condattr_t condattr;
+
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &condattr);
+    pthread_condattr_destroy(&condattr);
 }
 
-void CRedisClient::enable_debug_log()
+static int64_t get_monotonic_microseconds()
 {
-    _enable_debug_log = true;
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+    return static_cast<int64_t>(current.tv_sec) * 1000000 + static_cast<int64_t>(current.tv_nsec / 1000);
 }
 
-void CRedisClient::disable_debug_log()
+// Wait on a condition initialized by init_monotonic_cond until the deadline in microseconds of CLOCK_MONOTONIC
+static void wait_monotonic_cond(pthread_cond_t* cond, pthread_mutex_t* mutex, int64_t deadline_us)
 {
-    _enable_debug_log = false;
+    struct timespec abstime;
+
+    abstime.tv_sec = static_cast<time_t>(deadline_us / 1000000);
+    abstime.tv_nsec = static_cast<long>((deadline_us % 1000000) * 1000);
+    pthread_cond_timedwait(cond, mutex, &abstime);
 }
 
-void CRedisClient::enable_info_log()
+////////////////////////////////////////////////////////////////////////////////
+// CounterAggregator
+
+CounterAggregator::CounterAggregator(CRedisClient* redis_client, int flush_interval_milliseconds, int max_pending, int num_shards)
+    : _redis_client(redis_client),
+      _flush_interval_milliseconds(flush_interval_milliseconds),
+      _num_commands(0),
+      _num_errors(0),
+      _started(false),
+      _stop(false),
+      _flush_requested(false)
 {
-    _enable_info_log = true;
+    if (num_shards < 1)
+        num_shards = 1;
+    _max_pending_per_shard = max_pending / num_shards;
+    if (_max_pending_per_shard < 1)
+        _max_pending_per_shard = 1;
+    for (int i=0; i<num_shards; ++i)
+    {
+        CounterShard* shard = new CounterShard;
+        pthread_mutex_init(&shard->mutex, NULL);
+        shard->num_increments = 0;
+        _shards.push_back(shard);
+    }
+    pthread_mutex_init(&_flush_mutex, NULL);
+    pthread_mutex_init(&_mutex, NULL);
+    init_monotonic_cond(&_cond);
 }
 
-void CRedisClient::disable_info_log()
+CounterAggregator::~CounterAggregator()
 {
-    _enable_info_log = false;
+    stop();
+    for (std::vector<CounterShard*>::size_type i=0; i<_shards.size(); ++i)
+    {
+        pthread_mutex_destroy(&_shards[i]->mutex);
+        delete _shards[i];
+    }
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+    pthread_mutex_destroy(&_flush_mutex);
 }
 
-void CRedisClient::enable_error_log()
+void CounterAggregator::start()
 {
-    _enable_error_log = true;
+    pthread_mutex_lock(&_mutex);
+    if (!_started)
+    {
+        _stop = false;
+        const int errcode = pthread_create(&_thread, NULL, flush_thread, this); // pthread_create不设置errno
+        if (0 == errcode)
+        {
+            _started = true;
+        }
+        else
+        {
+            struct ErrorInfo errinfo;
+            errinfo.errcode = errcode;
+            errinfo.raw_errmsg = format_string("create flush thread error: %s", strerror(errcode));
+            errinfo.errmsg = format_string("[R3C_AGGREGATOR][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+            pthread_mutex_unlock(&_mutex);
+            THROW_REDIS_EXCEPTION(errinfo);
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
 }
 
-void CRedisClient::disable_error_log()
+void CounterAggregator::stop()
 {
-    _enable_error_log = false;
+    bool started;
+
+    pthread_mutex_lock(&_mutex);
+    started = _started;
+    _stop = true;
+    _started = false;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    if (started)
+        pthread_join(_thread, NULL);
+    flush();
 }
 
-int CRedisClient::list_nodes(std::vector<struct NodeInfo>* nodes_info)
+void CounterAggregator::incrby(const std::string& key, int64_t increment)
 {
-    struct ErrorInfo errinfo;
+    CounterShard* shard = get_shard(key);
+    bool full;
 
-    for (RedisMasterNodeTable::iterator iter=_redis_master_nodes.begin(); iter!=_redis_master_nodes.end(); ++iter)
-    {
-        const Node& node = iter->first;
-        struct CRedisNode* redis_node = iter->second;
-        redisContext* redis_context = redis_node->get_redis_context();
+    pthread_mutex_lock(&shard->mutex);
+    shard->counters[key] += increment;
+    ++shard->num_increments;
+    full = static_cast<int>(shard->counters.size()+shard->hash_counters.size()) > _max_pending_per_shard;
+    pthread_mutex_unlock(&shard->mutex);
 
-        if (redis_context != NULL)
-        {
-            if (list_cluster_nodes(nodes_info, &errinfo, redis_context, node))
-                break;
-        }
-    }
-    if (nodes_info->empty())
+    if (full)
     {
-        THROW_REDIS_EXCEPTION(errinfo);
+        pthread_mutex_lock(&_mutex);
+        _flush_requested = true;
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_mutex);
     }
-
-    return static_cast<int>(nodes_info->size());
 }
 
-void CRedisClient::flushall()
+void CounterAggregator::hincrby(const std::string& key, const std::string& field, int64_t increment)
 {
-    const int num_retries = NUM_RETRIES;
-    const std::string key;
-    CommandArgs cmd_args;
-    cmd_args.set_command("FLUSHALL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.final();
+    CounterShard* shard = get_shard(key);
+    bool full;
 
-    // Simple string reply (REDIS_REPLY_STATUS)
-    redis_command(true, num_retries, key, cmd_args, NULL);
+    pthread_mutex_lock(&shard->mutex);
+    shard->hash_counters[std::make_pair(key, field)] += increment;
+    ++shard->num_increments;
+    full = static_cast<int>(shard->counters.size()+shard->hash_counters.size()) > _max_pending_per_shard;
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (full)
+    {
+        pthread_mutex_lock(&_mutex);
+        _flush_requested = true;
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_mutex);
+    }
 }
 
-void CRedisClient::multi(const std::string& key, Node* which)
+int CounterAggregator::flush(int window_size)
 {
-    if (cluster_mode())
+    std::map<std::string, int64_t> counters;
+    std::map<std::pair<std::string, std::string>, int64_t> hash_counters;
+    std::map<std::string, int64_t> failed_counters;
+    std::map<std::pair<std::string, std::string>, int64_t> failed_hash_counters;
+    std::vector<std::pair<std::string, std::string> > fields; // (Key, Field) of the commands
+    std::vector<char> kinds; // Kind of the commands: 'c' for INCRBY, 'f' for HINCRBY, and 'h' for _hash_command
+    Pipeline pipeline;
+    int num_errors = 0;
+
+    pthread_mutex_lock(&_flush_mutex);
+    for (std::vector<CounterShard*>::size_type i=0; i<_shards.size(); ++i)
     {
-        struct ErrorInfo errinfo;
-        errinfo.errcode = ERROR_NOT_SUPPORT;
-        errinfo.errmsg = "MULTI not supported in cluster mode";
-        THROW_REDIS_EXCEPTION(errinfo);
+        // 只在交换时持有分片的锁，发送期间不阻塞incrby
+        std::map<std::string, int64_t> shard_counters;
+        std::map<std::pair<std::string, std::string>, int64_t> shard_hash_counters;
+        CounterShard* shard = _shards[i];
+
+        pthread_mutex_lock(&shard->mutex);
+        shard_counters.swap(shard->counters);
+        shard_hash_counters.swap(shard->hash_counters);
+        pthread_mutex_unlock(&shard->mutex);
+        counters.insert(shard_counters.begin(), shard_counters.end());
+        hash_counters.insert(shard_hash_counters.begin(), shard_hash_counters.end());
     }
-    else
+
+    for (std::map<std::string, int64_t>::const_iterator iter=counters.begin(); iter!=counters.end(); ++iter)
     {
-        const int num_retries = 0;
+        if (iter->second != 0)
+        {
+            CommandArgs cmd_args;
+            cmd_args.set_key(iter->first);
+            cmd_args.set_command("INCRBY");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(iter->first);
+            cmd_args.add_arg(iter->second);
+            cmd_args.final();
+            pipeline.add(cmd_args);
+            fields.push_back(std::make_pair(iter->first, std::string("")));
+            kinds.push_back('c');
+        }
+    }
+    for (std::map<std::pair<std::string, std::string>, int64_t>::const_iterator iter=hash_counters.begin(); iter!=hash_counters.end();)
+    {
+        const std::string key = iter->first.first; // iter moves on below
         CommandArgs cmd_args;
+
         cmd_args.set_key(key);
-        cmd_args.set_command("MULTI");
-        cmd_args.add_arg(cmd_args.get_command());
+        fields.push_back(iter->first);
+        kinds.push_back(_hash_command.empty()? 'f': 'h');
+        if (_hash_command.empty())
+        {
+            cmd_args.set_command("HINCRBY");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            cmd_args.add_arg(iter->first.second);
+            cmd_args.add_arg(iter->second);
+            ++iter;
+        }
+        else
+        {
+            // 同一key的所有field合并为一个命令，map按key有序
+            cmd_args.set_command(_hash_command);
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            for (; iter!=hash_counters.end() && iter->first.first==key; ++iter)
+            {
+                cmd_args.add_arg(iter->first.second);
+                cmd_args.add_arg(iter->second);
+            }
+        }
         cmd_args.final();
+        pipeline.add(cmd_args);
+    }
 
-        // Simple string reply (REDIS_REPLY_STATUS):
-        // always OK.
-        redis_command(false, num_retries, key, cmd_args, which);
+    try
+    {
+        if (pipeline.size() > 0)
+            _redis_client->pipeline(&pipeline, window_size, 0);
+    }
+    catch (CRedisException&)
+    {
+        // 结果未知，全部放回
+    }
+    for (int i=0; i<pipeline.size(); ++i)
+    {
+        const redisReply* redis_reply = pipeline.get_reply(i);
+
+        if (redis_reply!=NULL && redis_reply->type!=REDIS_REPLY_ERROR)
+            continue;
+        ++num_errors;
+        if (NULL == redis_reply)
+        {
+            // 未得到响应，放回下次再刷
+            const std::string& key = fields[i].first;
+            if ('c' == kinds[i])
+            {
+                failed_counters[key] = counters[key];
+            }
+            else if ('f' == kinds[i])
+            {
+                failed_hash_counters[fields[i]] = hash_counters[fields[i]];
+            }
+            else
+            {
+                std::map<std::pair<std::string, std::string>, int64_t>::const_iterator iter = hash_counters.lower_bound(std::make_pair(key, std::string("")));
+                for (; iter!=hash_counters.end() && iter->first.first==key; ++iter)
+                    failed_hash_counters.insert(*iter);
+            }
+        }
     }
+    if (!failed_counters.empty() || !failed_hash_counters.empty())
+        merge(failed_counters, failed_hash_counters);
+    _num_commands += static_cast<uint64_t>(pipeline.size());
+    _num_errors += static_cast<uint64_t>(num_errors);
+    pthread_mutex_unlock(&_flush_mutex);
+    return num_errors;
 }
 
-const RedisReplyHelper CRedisClient::exec(const std::string& key, Node* which)
+void CounterAggregator::set_hash_command(const std::string& command)
 {
-    if (cluster_mode())
+    pthread_mutex_lock(&_flush_mutex);
+    _hash_command = command;
+    pthread_mutex_unlock(&_flush_mutex);
+}
+
+int CounterAggregator::get_num_pending() const
+{
+    int num_pending = 0;
+
+    for (std::vector<CounterShard*>::size_type i=0; i<_shards.size(); ++i)
+    {
+        CounterShard* shard = _shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        num_pending += static_cast<int>(shard->counters.size() + shard->hash_counters.size());
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    return num_pending;
+}
+
+uint64_t CounterAggregator::get_num_increments() const
+{
+    uint64_t num_increments = 0;
+
+    for (std::vector<CounterShard*>::size_type i=0; i<_shards.size(); ++i)
+    {
+        CounterShard* shard = _shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        num_increments += shard->num_increments;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    return num_increments;
+}
+
+uint64_t CounterAggregator::get_num_commands() const
+{
+    uint64_t num_commands;
+
+    pthread_mutex_lock(const_cast<pthread_mutex_t*>(&_flush_mutex));
+    num_commands = _num_commands;
+    pthread_mutex_unlock(const_cast<pthread_mutex_t*>(&_flush_mutex));
+    return num_commands;
+}
+
+uint64_t CounterAggregator::get_num_errors() const
+{
+    uint64_t num_errors;
+
+    pthread_mutex_lock(const_cast<pthread_mutex_t*>(&_flush_mutex));
+    num_errors = _num_errors;
+    pthread_mutex_unlock(const_cast<pthread_mutex_t*>(&_flush_mutex));
+    return num_errors;
+}
+
+CounterAggregator::CounterShard* CounterAggregator::get_shard(const std::string& key) const
+{
+    return _shards[static_cast<unsigned int>(get_key_slot(&key)) % _shards.size()];
+}
+
+void CounterAggregator::merge(const std::map<std::string, int64_t>& counters, const std::map<std::pair<std::string, std::string>, int64_t>& hash_counters)
+{
+    for (std::map<std::string, int64_t>::const_iterator iter=counters.begin(); iter!=counters.end(); ++iter)
+    {
+        CounterShard* shard = get_shard(iter->first);
+        pthread_mutex_lock(&shard->mutex);
+        shard->counters[iter->first] += iter->second;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    for (std::map<std::pair<std::string, std::string>, int64_t>::const_iterator iter=hash_counters.begin(); iter!=hash_counters.end(); ++iter)
+    {
+        CounterShard* shard = get_shard(iter->first.first);
+        pthread_mutex_lock(&shard->mutex);
+        shard->hash_counters[iter->first] += iter->second;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+void* CounterAggregator::flush_thread(void* param)
+{
+    CounterAggregator* aggregator = static_cast<CounterAggregator*>(param);
+    aggregator->run();
+    return NULL;
+}
+
+void CounterAggregator::run()
+{
+    pthread_mutex_lock(&_mutex);
+    while (!_stop)
+    {
+        if (!_flush_requested)
+        {
+            if (_flush_interval_milliseconds > 0)
+            {
+                const int64_t deadline_us = get_monotonic_microseconds() + static_cast<int64_t>(_flush_interval_milliseconds) * 1000;
+                wait_monotonic_cond(&_cond, &_mutex, deadline_us);
+            }
+            else
+            {
+                pthread_cond_wait(&_cond, &_mutex);
+            }
+        }
+        if (_stop)
+            break;
+
+        _flush_requested = false;
+        pthread_mutex_unlock(&_mutex);
+        flush();
+        pthread_mutex_lock(&_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BatchFuture & CommandBatcher
+
+static int64_t get_current_microseconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+BatchFuture::BatchFuture()
+    : _submitted(false), _done(false), _reply(NULL)
+{
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+}
+
+BatchFuture::~BatchFuture()
+{
+    wait();
+    if (_reply != NULL)
+        freeReplyObject(_reply);
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool BatchFuture::ready() const
+{
+    bool done;
+
+    pthread_mutex_lock(&_mutex);
+    done = _done;
+    pthread_mutex_unlock(&_mutex);
+    return done;
+}
+
+const redisReply* BatchFuture::get()
+{
+    if (!wait())
     {
         struct ErrorInfo errinfo;
         errinfo.errcode = ERROR_NOT_SUPPORT;
-        errinfo.errmsg = "EXEC not supported in cluster mode";
+        errinfo.raw_errmsg = "future not submitted";
+        errinfo.errmsg = format_string("[R3C_BATCHER][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
         THROW_REDIS_EXCEPTION(errinfo);
     }
-    else
-    {
-        const int num_retries = 0;
-        CommandArgs cmd_args;
-        cmd_args.set_key(key);
-        cmd_args.set_command("EXEC");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.final();
+    if (NULL==_reply || REDIS_REPLY_ERROR==_reply->type)
+        THROW_REDIS_EXCEPTION_WITH_NODE_AND_COMMAND(_errinfo, _node.first, _node.second, _command, _key);
+    return _reply;
+}
 
-        // Array reply:
-        // each element being the reply to each of the commands in the atomic transaction.
-        return redis_command(false, num_retries, key, cmd_args, which);
+void BatchFuture::set_submitted()
+{
+    pthread_mutex_lock(&_mutex);
+    _submitted = true;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void BatchFuture::complete(redisReply* redis_reply, const ErrorInfo& errinfo, const Node& node, const std::string& command, const std::string& key)
+{
+    pthread_mutex_lock(&_mutex);
+    _reply = redis_reply;
+    _errinfo = errinfo;
+    _node = node;
+    _command = command;
+    _key = key;
+    _done = true;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool BatchFuture::wait()
+{
+    bool submitted;
+
+    pthread_mutex_lock(&_mutex);
+    // 未提交过的future不会被complete，等待将永远阻塞
+    submitted = _submitted;
+    while (submitted && !_done)
+        pthread_cond_wait(&_cond, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+    return submitted;
+}
+
+CommandBatcher::CommandBatcher(CRedisClient* redis_client, int max_delay_microseconds, int max_batch_size)
+    : _redis_client(redis_client),
+      _max_delay_microseconds(max_delay_microseconds),
+      _max_batch_size((max_batch_size > 0)? max_batch_size: 1),
+      _num_batches(0),
+      _num_commands(0),
+      _first_submit_us(0),
+      _started(false),
+      _stop(false)
+{
+    pthread_mutex_init(&_mutex, NULL);
+    init_monotonic_cond(&_not_empty);
+}
+
+CommandBatcher::~CommandBatcher()
+{
+    stop();
+    pthread_cond_destroy(&_not_empty);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void CommandBatcher::start()
+{
+    pthread_mutex_lock(&_mutex);
+    if (!_started)
+    {
+        _stop = false;
+        const int errcode = pthread_create(&_thread, NULL, dispatch_thread, this); // pthread_create不设置errno
+        if (0 == errcode)
+        {
+            _started = true;
+        }
+        else
+        {
+            struct ErrorInfo errinfo;
+            errinfo.errcode = errcode;
+            errinfo.raw_errmsg = format_string("create dispatch thread error: %s", strerror(errcode));
+            errinfo.errmsg = format_string("[R3C_BATCHER][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+            pthread_mutex_unlock(&_mutex);
+            THROW_REDIS_EXCEPTION(errinfo);
+        }
     }
+    pthread_mutex_unlock(&_mutex);
 }
 
-//
-// KEY/VALUE
-//
+void CommandBatcher::stop()
+{
+    bool started;
 
-// Time complexity: O(1)
-// EXPIRE key seconds
-bool CRedisClient::expire(
-        const std::string& key,
-        uint32_t seconds,
-        Node* which,
-        int num_retries)
+    pthread_mutex_lock(&_mutex);
+    started = _started;
+    _stop = true;
+    _started = false;
+    pthread_cond_signal(&_not_empty);
+    pthread_mutex_unlock(&_mutex);
+
+    if (started)
+        pthread_join(_thread, NULL);
+}
+
+void CommandBatcher::submit(const CommandArgs& command_args, BatchFuture* future)
+{
+    struct ErrorInfo errinfo;
+    BatchCommand command;
+    char* formatted_command = NULL;
+    const int len = redisFormatCommandArgv(&formatted_command, command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+
+    future->set_submitted();
+    if (len <= 0)
+    {
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = format_string("[%s] invalid command", command_args.get_command().c_str());
+    }
+    else if (command_args.get_block_milliseconds() >= 0)
+    {
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.raw_errmsg = format_string("[%s] blocking command not supported by batcher", command_args.get_command().c_str());
+    }
+    if (len > 0)
+    {
+        command.formatted_command.assign(formatted_command, len);
+        free(formatted_command);
+    }
+    if (errinfo.errcode != 0)
+    {
+        errinfo.errmsg = format_string("[R3C_BATCHER][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        future->complete(NULL, errinfo, Node(), command_args.get_command(), command_args.get_key());
+        return;
+    }
+
+    command.key = command_args.get_key();
+    command.command = command_args.get_command();
+    command.future = future;
+    pthread_mutex_lock(&_mutex);
+    if (!_started)
+    {
+        pthread_mutex_unlock(&_mutex);
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.raw_errmsg = format_string("[%s] batcher not started", command.command.c_str());
+        errinfo.errmsg = format_string("[R3C_BATCHER][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        future->complete(NULL, errinfo, Node(), command.command, command.key);
+        return;
+    }
+    if (_queue.empty())
+        _first_submit_us = get_monotonic_microseconds();
+    _queue.push_back(command);
+    // 只在队列由空变非空或凑满一批时唤醒，减少无谓的唤醒
+    if (1==_queue.size() || static_cast<int>(_queue.size())==_max_batch_size)
+        pthread_cond_signal(&_not_empty);
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool CommandBatcher::get(const std::string& key, std::string* value)
 {
     CommandArgs cmd_args;
     cmd_args.set_key(key);
-    cmd_args.set_command("EXPIRE");
+    cmd_args.set_command("GET");
     cmd_args.add_arg(cmd_args.get_command());
     cmd_args.add_arg(key);
-    cmd_args.add_arg(seconds);
     cmd_args.final();
 
-    // Integer reply, specifically:
-    // 1 if the timeout was set.
-    // 0 if key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
+    BatchFuture future;
+    submit(cmd_args, &future);
+    const redisReply* redis_reply = future.get();
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return CRedisClient::get_value(redis_reply, value);
     return true;
 }
 
-bool CRedisClient::expireat(const std::string& key, int64_t timestamp, Node* which, int num_retries)
+void CommandBatcher::set(const std::string& key, const std::string& value)
 {
     CommandArgs cmd_args;
     cmd_args.set_key(key);
-    cmd_args.set_command("EXPIREAT");
+    cmd_args.set_command("SET");
     cmd_args.add_arg(cmd_args.get_command());
     cmd_args.add_arg(key);
-    cmd_args.add_arg(timestamp);
+    cmd_args.add_arg(value);
     cmd_args.final();
 
-    // Integer reply, specifically:
-    // 1 if the timeout was set.
-    // 0 if key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+    BatchFuture future;
+    submit(cmd_args, &future);
+    future.get();
 }
 
-// Time complexity: O(1)
-// EXISTS key [key ...]
-bool CRedisClient::exists(const std::string& key, Node* which, int num_retries)
+int64_t CommandBatcher::incrby(const std::string& key, int64_t increment)
 {
     CommandArgs cmd_args;
     cmd_args.set_key(key);
-    cmd_args.set_command("EXISTS");
+    cmd_args.set_command("INCRBY");
     cmd_args.add_arg(cmd_args.get_command());
     cmd_args.add_arg(key);
+    cmd_args.add_arg(increment);
     cmd_args.final();
 
-    // Integer reply, specifically:
-    // 1 if the key exists.
-    // 0 if the key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    BatchFuture future;
+    submit(cmd_args, &future);
+    const redisReply* redis_reply = future.get();
     if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+        return redis_reply->integer;
+    return 0;
 }
 
-// Time complexity:
-// O(N) where N is the number of keys that will be removed.
-// When a key to remove holds a value other than a string,
-// the individual complexity for this key is O(M) where M is the number of elements in the list, set, sorted set or hash.
-// Removing a single key that holds a string value is O(1).
-bool CRedisClient::del(const std::string& key, Node* which, int num_retries)
+bool CommandBatcher::del(const std::string& key)
 {
     CommandArgs cmd_args;
     cmd_args.set_key(key);
@@ -955,3122 +1992,6274 @@ bool CRedisClient::del(const std::string& key, Node* which, int num_retries)
     cmd_args.add_arg(key);
     cmd_args.final();
 
-    // Integer reply:
-    // The number of keys that were removed.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    BatchFuture future;
+    submit(cmd_args, &future);
+    const redisReply* redis_reply = future.get();
     if (REDIS_REPLY_INTEGER == redis_reply->type)
         return 1 == redis_reply->integer;
     return true;
 }
 
-// GET key
-// Time complexity: O(1)
-bool CRedisClient::get(
-        const std::string& key,
-        std::string* value,
-        Node* which,
-        int num_retries)
+bool CommandBatcher::hget(const std::string& key, const std::string& field, std::string* value)
 {
     CommandArgs cmd_args;
     cmd_args.set_key(key);
-    cmd_args.set_command("GET");
+    cmd_args.set_command("HGET");
     cmd_args.add_arg(cmd_args.get_command());
     cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
     cmd_args.final();
 
-    // Bulk string reply:
-    // the value of key, or nil when key does not exist.
-    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    BatchFuture future;
+    submit(cmd_args, &future);
+    const redisReply* redis_reply = future.get();
     if (REDIS_REPLY_NIL == redis_reply->type)
         return false;
     if (REDIS_REPLY_STRING == redis_reply->type)
-        return get_value(redis_reply.get(), value);
+        return CRedisClient::get_value(redis_reply, value);
     return true;
 }
 
-// SET key value [EX seconds] [PX milliseconds] [NX|XX]
-// Time complexity: O(1)
-void CRedisClient::set(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+bool CommandBatcher::hset(const std::string& key, const std::string& field, const std::string& value)
 {
     CommandArgs cmd_args;
     cmd_args.set_key(key);
-    cmd_args.set_command("SET");
+    cmd_args.set_command("HSET");
     cmd_args.add_arg(cmd_args.get_command());
     cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
     cmd_args.add_arg(value);
     cmd_args.final();
 
-    // Simple string reply (REDIS_REPLY_STATUS):
-    // OK if SET was executed correctly.
+    BatchFuture future;
+    submit(cmd_args, &future);
+    const redisReply* redis_reply = future.get();
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
 
-    // Null reply: a Null Bulk Reply is returned if the SET operation was not performed
-    // because the user specified the NX or XX option but the condition was not met.
-    //
-    // OK: redis_reply->str
-    redis_command(false, num_retries, key, cmd_args, which);
-}
-
-// Time complexity: O(1)
-// SETNX key value
-bool CRedisClient::setnx(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+uint64_t CommandBatcher::get_num_batches() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SETNX");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    uint64_t num_batches;
 
-    // Integer reply, specifically:
-    // 1 if the key exists.
-    // 0 if the key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+    pthread_mutex_lock(&_mutex);
+    num_batches = _num_batches;
+    pthread_mutex_unlock(&_mutex);
+    return num_batches;
 }
 
-// Time complexity: O(1)
-// SETEX key seconds value
-void CRedisClient::setex(
-        const std::string& key,
-        const std::string& value,
-        uint32_t expired_seconds,
-        Node* which,
-        int num_retries)
+uint64_t CommandBatcher::get_num_commands() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SETEX");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(expired_seconds);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    uint64_t num_commands;
 
-    // Simple string reply (REDIS_REPLY_STATUS)
-    //
-    // OK: redis_reply->str
-    redis_command(false, num_retries, key, cmd_args, which);
+    pthread_mutex_lock(&_mutex);
+    num_commands = _num_commands;
+    pthread_mutex_unlock(&_mutex);
+    return num_commands;
 }
 
-bool CRedisClient::setnxex(
-        const std::string& key,
-        const std::string& value,
-        uint32_t expired_seconds,
-        Node* which,
-        int num_retries)
+void* CommandBatcher::dispatch_thread(void* param)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SET");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.add_arg("EX");
-    cmd_args.add_arg(expired_seconds);
-    cmd_args.add_arg("NX");
-    cmd_args.final();
-
-    // Simple string reply (REDIS_REPLY_STATUS):
-    // OK if SET was executed correctly.
-    //
-    // Null reply: a Null Bulk Reply is returned if the SET operation was not performed
-    // because the user specified the NX or XX option but the condition was not met.
-    //
-    // OK: redis_reply->str
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    return redis_reply->type != REDIS_REPLY_NIL;
+    CommandBatcher* batcher = static_cast<CommandBatcher*>(param);
+    batcher->run();
+    return NULL;
 }
 
-// Time complexity: O(N) where N is the number of keys to retrieve.
-// MGET key [key ...]
-int CRedisClient::mget(
-        const std::vector<std::string>& keys,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+void CommandBatcher::run()
 {
-    values->clear();
-
-    if (!cluster_mode())
-    {
-        const std::string key;
-        CommandArgs cmd_args;
-        cmd_args.set_command("MGET");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_args(keys);
-        cmd_args.final();
+    std::vector<BatchCommand> commands;
 
-        // Array reply:
-        // list of values at the specified keys.
-        //
-        // For every key that does not hold a string value or does not exist,
-        // the special value nil is returned. Because of this, the operation never fails.
-        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-        if (REDIS_REPLY_ARRAY == redis_reply->type)
-            return get_values(redis_reply.get(), values);
-        return 0;
-    }
-    else
+    pthread_mutex_lock(&_mutex);
+    for (;;)
     {
-        values->resize(keys.size());
+        while (_queue.empty() && !_stop)
+            pthread_cond_wait(&_not_empty, &_mutex);
+        if (_queue.empty())
+            break; // Stopped
 
-        try
-        {
-            for (std::vector<std::string>::size_type i=0; i<keys.size(); ++i)
-            {
-                const std::string& key = keys[i];
-                std::string& value = (*values)[i];
-                get(key, &value, NULL, num_retries);
-            }
-        }
-        catch (CRedisException&)
+        // 等待凑满一批，或者第一个命令已等待了max_delay_microseconds
+        const int64_t deadline_us = _first_submit_us + _max_delay_microseconds;
+        while (static_cast<int>(_queue.size())<_max_batch_size && !_stop)
         {
-            values->clear();
-            throw;
+            if (get_monotonic_microseconds() >= deadline_us)
+                break;
+            wait_monotonic_cond(&_not_empty, &_mutex, deadline_us);
         }
 
-        return static_cast<int>(values->size());
+        const int n = std::min(static_cast<int>(_queue.size()), _max_batch_size);
+        commands.assign(_queue.begin(), _queue.begin()+n);
+        _queue.erase(_queue.begin(), _queue.begin()+n);
+        if (!_queue.empty())
+            _first_submit_us = get_monotonic_microseconds();
+        ++_num_batches;
+        _num_commands += static_cast<uint64_t>(n);
+        pthread_mutex_unlock(&_mutex);
+
+        execute(&commands);
+        pthread_mutex_lock(&_mutex);
     }
+    pthread_mutex_unlock(&_mutex);
 }
 
-// Time complexity:
-// O(N) where N is the number of keys to set.
-// MSET key value [key value ...]
-int CRedisClient::mset(
-        const std::map<std::string, std::string>& kv_map,
-        Node* which,
-        int num_retries)
+void CommandBatcher::execute(std::vector<BatchCommand>* commands)
 {
-    int success = 0;
+    Pipeline pipeline;
 
-    if (kv_map.empty())
+    for (std::vector<BatchCommand>::size_type i=0; i<commands->size(); ++i)
     {
-        struct ErrorInfo errinfo;
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.errmsg = "kv_map is empty";
-        THROW_REDIS_EXCEPTION(errinfo);
+        const BatchCommand& command = (*commands)[i];
+        pipeline.add(command.key, command.command, command.formatted_command);
     }
-    if (!cluster_mode())
+    try
     {
-        const std::string key;
-        CommandArgs cmd_args;
-        cmd_args.set_command("MSET");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_args(kv_map);
-        cmd_args.final();
-
-        // Simple string reply:
-        // always OK since MSET can't fail.
-        redis_command(false, num_retries, key, cmd_args, which);
-        success = static_cast<int>(kv_map.size());
+        _redis_client->pipeline(&pipeline, _max_batch_size, 0);
     }
-    else
+    catch (CRedisException& ex)
     {
-        for (std::map<std::string, std::string>::const_iterator iter=kv_map.begin(); iter!=kv_map.end(); ++iter)
+        for (std::vector<BatchCommand>::size_type i=0; i<commands->size(); ++i)
         {
-            const std::string& key = iter->first;
-            const std::string& value = iter->second;
-            set(key, value, which ,num_retries);
-            ++success;
+            const BatchCommand& command = (*commands)[i];
+            command.future->complete(NULL, ex.get_errinfo(), Node(), command.command, command.key);
         }
+        commands->clear();
+        return;
+    }
+    for (std::vector<BatchCommand>::size_type i=0; i<commands->size(); ++i)
+    {
+        const BatchCommand& command = (*commands)[i];
+        const int index = static_cast<int>(i);
+        command.future->complete(pipeline.release_reply(index), pipeline.get_errinfo(index), pipeline.get_node(index), command.command, command.key);
     }
+    commands->clear();
+}
 
-    return success;
+////////////////////////////////////////////////////////////////////////////////
+// StreamBatch
+
+StreamBatch::Slice StreamBatch::EntryView::key() const
+{
+    const std::vector<int>& stream_offsets = _batch->_stream_offsets;
+    // 第一个满足offset>_index的流之前的那个
+    const std::vector<int>::difference_type i = std::upper_bound(stream_offsets.begin(), stream_offsets.end(), _index) - stream_offsets.begin();
+    return _batch->key(static_cast<int>(i-1));
 }
 
-// Time complexity: O(1)
-// INCRBY key increment
-int64_t CRedisClient::incrby(
-        const std::string& key,
-        int64_t increment,
-        Node* which,
-        int num_retries)
+StreamBatch::Slice StreamBatch::EntryView::id() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("INCRBY");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(increment);
-    cmd_args.final();
+    return _batch->slice(_batch->_entry_offsets[_index]);
+}
 
-    // Integer reply:
-    // the value of key after the increment
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return redis_reply->integer;
-    return 0;
+int StreamBatch::EntryView::num_fields() const
+{
+    return static_cast<int>(_batch->_entry_offsets[_index+1] - _batch->_entry_offsets[_index] - 1) / 2;
 }
 
-bool CRedisClient::key_type(const std::string& key, std::string* key_type, Node* which, int num_retries)
+StreamBatch::Slice StreamBatch::EntryView::field(int i) const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("TYPE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    return _batch->slice(_batch->_entry_offsets[_index] + 1 + 2*i);
+}
 
-    // Simple string reply (REDIS_REPLY_STATUS):
-    // type of key, or none when key does not exist.
-    //
-    // (gdb) p *redis_reply._redis_reply
-    // $1 = {type = 5, integer = 0, len = 6, str = 0x742b50 "string", elements = 0, element = 0x0}
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get(), key_type);
+StreamBatch::Slice StreamBatch::EntryView::value(int i) const
+{
+    return _batch->slice(_batch->_entry_offsets[_index] + 2 + 2*i);
 }
 
-int64_t CRedisClient::ttl(const std::string& key, Node* which, int num_retries)
+void StreamBatch::EntryView::get(struct StreamEntry* entry) const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("TTL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    const Slice entry_id = id();
+    const int num = num_fields();
 
-    // Integer reply:
-    // TTL in seconds, or a negative value in order to signal an error
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return redis_reply->integer;
-    return 0;
+    entry->id.assign(entry_id.data, entry_id.size);
+    entry->fvpairs.resize(num);
+    for (int i=0; i<num; ++i)
+    {
+        const Slice entry_field = field(i);
+        const Slice entry_value = value(i);
+        entry->fvpairs[i].field.assign(entry_field.data, entry_field.size);
+        entry->fvpairs[i].value.assign(entry_value.data, entry_value.size);
+    }
 }
 
-// O(1) for every call. O(N) for a complete iteration,
-// including enough command calls for the cursor to return back to 0. N is the number of elements inside the collection.
-//
-// SCAN cursor [MATCH pattern] [COUNT count]
-int64_t CRedisClient::scan(int64_t cursor, std::vector<std::string>* values, Node* which, int num_retries)
+void StreamBatch::clear()
 {
-    return scan(cursor, std::string(""), 0, values, which, num_retries);
+    _buffer.clear();
+    _string_offsets.clear();
+    _string_offsets.push_back(0);
+    _entry_offsets.clear();
+    _stream_offsets.clear();
+    _stream_offsets.push_back(0);
+    _stream_keys.clear();
 }
 
-// SCAN cursor [MATCH pattern] [COUNT count]
-int64_t CRedisClient::scan(int64_t cursor, int count, std::vector<std::string>* values, Node* which, int num_retries)
+StreamBatch::Slice StreamBatch::key(int stream_index) const
 {
-    return scan(cursor, std::string(""), count, values, which, num_retries);
+    return slice(_stream_keys[stream_index]);
 }
 
-// SCAN cursor [MATCH pattern] [COUNT count]
-int64_t CRedisClient::scan(
-        int64_t cursor, const std::string& pattern,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+int StreamBatch::first_entry(int stream_index) const
 {
-    return scan(cursor, pattern, 0, values, which, num_retries);
+    return _stream_offsets[stream_index];
 }
 
-// SCAN cursor [MATCH pattern] [COUNT count]
-int64_t CRedisClient::scan(
-        int64_t cursor, const std::string& pattern, int count,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+int StreamBatch::last_entry(int stream_index) const
 {
-    const std::string key;
-    CommandArgs cmd_args;
-    cmd_args.set_command("SCAN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(cursor);
-    if (!pattern.empty())
-    {
-        cmd_args.add_arg("MATCH");
-        cmd_args.add_arg(pattern);
-    }
-    if (count > 0)
+    return _stream_offsets[stream_index+1];
+}
+
+void StreamBatch::get(std::vector<Stream>* streams) const
+{
+    streams->resize(num_streams());
+    for (int i=0; i<num_streams(); ++i)
     {
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
+        Stream& stream = (*streams)[i];
+        const Slice stream_key = key(i);
+
+        stream.key.assign(stream_key.data, stream_key.size);
+        stream.entries.resize(last_entry(i) - first_entry(i));
+        for (int j=first_entry(i); j<last_entry(i); ++j)
+            entry(j).get(&stream.entries[j-first_entry(i)]);
     }
-    cmd_args.final();
+}
 
-    // return value is an array of two values:
-    // the first value is the new cursor to use in the next call, the second value is an array of elements.
-    //
-    // *EMPTY*:
-    // (gdb) p *redis_reply
-    // $1 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x63e450}
-    // (gdb) p *redis_reply->element[0]
-    // $3 = {type = 1, integer = 0, len = 1, str = 0x63e6f0 "0", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]
-    // $4 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 0, element = 0x0}
-    //
-    // *NON EMPTY*:
-    //
-    // redis-cli set k1 1
-    // redis-cli set k2 2
-    // redis-cli set k3 3
-    //
-    // (gdb) p *redis_reply
-    // $5 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x63e450}
-    // (gdb) p *redis_reply->element[0]
-    // $6 = {type = 1, integer = 0, len = 1, str = 0x63e720 "1", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]
-    // $7 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 3, element = 0x63e780}
-    // (gdb) p *redis_reply->element[1]->element[0]
-    // $8 = {type = 1, integer = 0, len = 2, str = 0x63e820 "k2", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]->element[1]
-    // $9 = {type = 1, integer = 0, len = 2, str = 0x63e880 "k3", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]->element[2]
-    // $10 = {type = 1, integer = 0, len = 2, str = 0x63e8e0 "k1", elements = 0, element = 0x0}
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-    {
-        get_values(redis_reply->element[1], values);
-        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
-    }
-    return 0;
+StreamBatch::Slice StreamBatch::slice(size_t string_index) const
+{
+    const size_t offset = _string_offsets[string_index];
+    const size_t size = _string_offsets[string_index+1] - offset;
+    return Slice((size > 0)? &_buffer[offset]: "", size);
 }
 
-//
-// EVAL
-//
+void StreamBatch::append_string(const char* str, size_t len)
+{
+    _buffer.insert(_buffer.end(), str, str+len);
+    _string_offsets.push_back(_buffer.size());
+}
 
-// Time complexity: Depends on the script that is executed.
-// EVAL script numkeys key [key ...] arg [arg ...]
-const RedisReplyHelper CRedisClient::eval(
-        const std::string& key,
-        const std::string& lua_scripts,
-        Node* which,
-        int num_retries)
+// The keys are followed by the entries, and the ID of an entry is followed by its fields and values
+void StreamBatch::append_entry(const redisReply* entry_redis_reply)
 {
-    const int numkeys = 1;
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("EVAL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(lua_scripts);
-    cmd_args.add_arg(numkeys);
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    const redisReply* id_redis_reply = entry_redis_reply->element[0];
+    const redisReply* fvpairs_redis_reply = entry_redis_reply->element[1];
 
-    return redis_command(false, num_retries, key, cmd_args, which);
+    // _entry_offsets.back() is the start of the entry
+    append_string(id_redis_reply->str, id_redis_reply->len);
+    if (fvpairs_redis_reply->type == REDIS_REPLY_ARRAY) // NIL for an entry deleted (XCLAIM)
+    {
+        for (size_t k=0; k<fvpairs_redis_reply->elements; ++k) // Traversing all field-value pairs
+            append_string(fvpairs_redis_reply->element[k]->str, fvpairs_redis_reply->element[k]->len);
+    }
+    _entry_offsets.push_back(_string_offsets.size()-1);
 }
 
-const RedisReplyHelper CRedisClient::eval(
-        const std::string& key,
-        const std::string& lua_scripts,
-        const std::vector<std::string>& parameters,
-        Node* which,
-        int num_retries)
+void StreamBatch::reserve(const redisReply* entries_redis_reply, size_t* buffer_size, size_t* num_strings) const
 {
-    const int numkeys = 1;
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("EVAL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(lua_scripts);
-    cmd_args.add_arg(numkeys);
-    cmd_args.add_arg(key);
-    cmd_args.add_args(parameters);
-    cmd_args.final();
+    for (size_t j=0; j<entries_redis_reply->elements; ++j)
+    {
+        const redisReply* entry_redis_reply = entries_redis_reply->element[j];
+        const redisReply* fvpairs_redis_reply = entry_redis_reply->element[1];
 
-    return redis_command(false, num_retries, key, cmd_args, which);
+        *buffer_size += entry_redis_reply->element[0]->len;
+        ++*num_strings;
+        if (fvpairs_redis_reply->type == REDIS_REPLY_ARRAY)
+        {
+            for (size_t k=0; k<fvpairs_redis_reply->elements; ++k)
+                *buffer_size += fvpairs_redis_reply->element[k]->len;
+            *num_strings += fvpairs_redis_reply->elements;
+        }
+    }
 }
 
-const RedisReplyHelper CRedisClient::evalsha(
-        const std::string& key,
-        const std::string& sha1,
-        const std::vector<std::string>& parameters,
-        Node* which, int num_retries)
+////////////////////////////////////////////////////////////////////////////////
+// AckBuffer
+
+AckBuffer::AckBuffer(CRedisClient* redis_client, int flush_interval_milliseconds, int max_pending)
+    : _redis_client(redis_client),
+      _flush_interval_milliseconds(flush_interval_milliseconds),
+      _max_pending((max_pending > 0)? max_pending: 1),
+      _num_pending(0),
+      _num_flushing(0),
+      _num_acked(0),
+      _num_commands(0),
+      _num_errors(0),
+      _started(false),
+      _stop(false),
+      _flush_requested(false)
 {
-    const int numkeys = 1;
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("EVALSHA");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(sha1);
-    cmd_args.add_arg(numkeys);
-    cmd_args.add_arg(key);
-    cmd_args.add_args(parameters);
-    cmd_args.final();
+    pthread_mutex_init(&_flush_mutex, NULL);
+    pthread_mutex_init(&_mutex, NULL);
+    init_monotonic_cond(&_cond);
+}
 
-    return redis_command(false, num_retries, key, cmd_args, which);
+AckBuffer::~AckBuffer()
+{
+    stop();
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+    pthread_mutex_destroy(&_flush_mutex);
 }
 
-const RedisReplyHelper CRedisClient::eval(
-        const std::string& lua_scripts,
-        const std::vector<std::string>& keys, const std::vector<std::string>& parameters,
-        Node* which,
-        int num_retries)
+void AckBuffer::start()
 {
-    if (cluster_mode() && keys_crossslots(keys))
+    pthread_mutex_lock(&_mutex);
+    if (!_started)
     {
-        struct ErrorInfo errinfo;
-        errinfo.errcode = ERROR_NOT_SUPPORT;
-        errinfo.errmsg = "EVAL not supported in cluster mode";
-        THROW_REDIS_EXCEPTION(errinfo);
+        _stop = false;
+        const int errcode = pthread_create(&_thread, NULL, flush_thread, this); // pthread_create不设置errno
+        if (0 == errcode)
+        {
+            _started = true;
+        }
+        else
+        {
+            struct ErrorInfo errinfo;
+            errinfo.errcode = errcode;
+            errinfo.raw_errmsg = format_string("create flush thread error: %s", strerror(errcode));
+            errinfo.errmsg = format_string("[R3C_ACK][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+            pthread_mutex_unlock(&_mutex);
+            THROW_REDIS_EXCEPTION(errinfo);
+        }
     }
-    else
-    {
-        const int numkeys = static_cast<int>(keys.size());
-        std::string key;
-        if (cluster_mode() && !keys.empty())
-            key = keys[0];
+    pthread_mutex_unlock(&_mutex);
+}
 
-        CommandArgs cmd_args;
-        if (!key.empty())
-            cmd_args.set_key(key);
-        cmd_args.set_command("EVAL");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg(lua_scripts);
-        cmd_args.add_arg(numkeys);
-        cmd_args.add_args(keys);
-        cmd_args.add_args(parameters);
-        cmd_args.final();
-        return redis_command(false, num_retries, key, cmd_args, which);
-    }
+void AckBuffer::stop()
+{
+    bool started;
+
+    pthread_mutex_lock(&_mutex);
+    started = _started;
+    _stop = true;
+    _started = false;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    if (started)
+        pthread_join(_thread, NULL);
+    flush();
 }
 
-const RedisReplyHelper CRedisClient::evalsha(
-        const std::string& sha1,
-        const std::vector<std::string>& keys,
-        const std::vector<std::string>& parameters,
-        Node* which,
-        int num_retries)
+void AckBuffer::ack(const std::string& key, const std::string& groupname, const std::string& id)
 {
-    if (cluster_mode() && keys_crossslots(keys))
+    pthread_mutex_lock(&_mutex);
+    std::vector<std::string>& ids = _pending[std::make_pair(key, groupname)];
+    ids.push_back(id);
+    ++_num_pending;
+    if (static_cast<int>(ids.size()) >= _max_pending)
     {
-        struct ErrorInfo errinfo;
-        errinfo.errcode = ERROR_NOT_SUPPORT;
-        errinfo.errmsg = "EVAL not supported in cluster mode";
-        THROW_REDIS_EXCEPTION(errinfo);
+        _flush_requested = true;
+        pthread_cond_signal(&_cond);
     }
-    else
+    pthread_mutex_unlock(&_mutex);
+}
+
+int AckBuffer::flush(int window_size)
+{
+    Pipeline pipeline;
+    int num_acked = 0;
+    int num_errors = 0;
+    int i = 0;
+
+    pthread_mutex_lock(&_flush_mutex);
+    pthread_mutex_lock(&_mutex);
+    // 发送期间仍计入未确认，以便观察
+    _flushing.swap(_pending);
+    _num_flushing = _num_pending;
+    _num_pending = 0;
+    pthread_mutex_unlock(&_mutex);
+    if (_flushing.empty())
     {
-        const int numkeys = static_cast<int>(keys.size());
-        std::string key;
-        if (cluster_mode() && !keys.empty())
-            key = keys[0];
+        pthread_mutex_unlock(&_flush_mutex);
+        return 0;
+    }
 
+    for (AckTable::const_iterator iter=_flushing.begin(); iter!=_flushing.end(); ++iter)
+    {
         CommandArgs cmd_args;
-        if (!key.empty())
-            cmd_args.set_key(key);
-        cmd_args.set_command("EVALSHA");
+        cmd_args.set_key(iter->first.first);
+        cmd_args.set_command("XACK");
         cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg(sha1);
-        cmd_args.add_arg(numkeys);
-        cmd_args.add_args(keys);
-        cmd_args.add_args(parameters);
+        cmd_args.add_arg(iter->first.first);
+        cmd_args.add_arg(iter->first.second);
+        cmd_args.add_args(iter->second);
         cmd_args.final();
-        return redis_command(false, num_retries, key, cmd_args, which);
+        pipeline.add(cmd_args);
     }
-}
+    _redis_client->pipeline(&pipeline, window_size, NUM_RETRIES); // XACK is idempotent
 
-//
-// HASH
-//
+    pthread_mutex_lock(&_mutex);
+    for (AckTable::iterator iter=_flushing.begin(); iter!=_flushing.end(); ++iter, ++i)
+    {
+        const redisReply* redis_reply = pipeline.get_reply(i);
 
-// Time complexity: O(N) where N is the number of fields to be removed.
-// HDEL key field [field ...]
-bool CRedisClient::hdel(const std::string& key, const std::string& field, Node* which, int num_retries)
+        if (NULL == redis_reply)
+        {
+            // 放回下次再确认
+            std::vector<std::string>& ids = _pending[iter->first];
+            ids.insert(ids.end(), iter->second.begin(), iter->second.end());
+            _num_pending += static_cast<int>(iter->second.size());
+            ++num_errors;
+            (*g_error_log)("[R3C_ACK][%s:%d] %s\n", __FILE__, __LINE__, pipeline.get_errinfo(i).errmsg.c_str());
+        }
+        else if (REDIS_REPLY_INTEGER == redis_reply->type)
+        {
+            num_acked += static_cast<int>(redis_reply->integer);
+        }
+        else
+        {
+            // 比如NOGROUP，未确认的消息仍在PEL中
+            ++num_errors;
+            (*g_error_log)("[R3C_ACK][%s:%d] XACK %s %s: %s\n", __FILE__, __LINE__,
+                    iter->first.first.c_str(), iter->first.second.c_str(), pipeline.get_errinfo(i).errmsg.c_str());
+        }
+    }
+    _flushing.clear();
+    _num_flushing = 0;
+    _num_acked += static_cast<uint64_t>(num_acked);
+    _num_commands += static_cast<uint64_t>(pipeline.size());
+    _num_errors += static_cast<uint64_t>(num_errors);
+    pthread_mutex_unlock(&_mutex);
+    pthread_mutex_unlock(&_flush_mutex);
+    return num_errors;
+}
+
+int AckBuffer::get_num_unacked() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HDEL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    int num_unacked;
 
-    // Integer reply:
-    // the number of fields that were removed from the hash, not including specified but non existing fields.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return false;
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+    pthread_mutex_lock(&_mutex);
+    num_unacked = _num_pending + _num_flushing;
+    pthread_mutex_unlock(&_mutex);
+    return num_unacked;
 }
 
-int CRedisClient::hdel(
-        const std::string& key,
-        const std::vector<std::string>& fields,
-        Node* which,
-        int num_retries)
+int AckBuffer::get_unacked(const std::string& key, const std::string& groupname, std::vector<std::string>* ids) const
 {
-    return hmdel(key, fields, which, num_retries);
+    const std::pair<std::string, std::string> key_group(key, groupname);
+
+    ids->clear();
+    pthread_mutex_lock(&_mutex);
+    AckTable::const_iterator iter = _flushing.find(key_group);
+    if (iter != _flushing.end())
+        ids->insert(ids->end(), iter->second.begin(), iter->second.end());
+    iter = _pending.find(key_group);
+    if (iter != _pending.end())
+        ids->insert(ids->end(), iter->second.begin(), iter->second.end());
+    pthread_mutex_unlock(&_mutex);
+    return static_cast<int>(ids->size());
 }
 
-int CRedisClient::hmdel(
-        const std::string& key,
-        const std::vector<std::string>& fields,
-        Node* which,
-        int num_retries)
+uint64_t AckBuffer::get_num_acked() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HDEL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(fields);
-    cmd_args.final();
+    uint64_t num_acked;
 
-    // Integer reply:
-    // the number of fields that were removed from the hash, not including specified but non existing fields.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return 0;
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    pthread_mutex_lock(&_mutex);
+    num_acked = _num_acked;
+    pthread_mutex_unlock(&_mutex);
+    return num_acked;
 }
 
-// Time complexity: O(1)
-// HEXISTS key field
-bool CRedisClient::hexists(const std::string& key, const std::string& field, Node* which, int num_retries)
+uint64_t AckBuffer::get_num_commands() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HEXISTS");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    uint64_t num_commands;
 
-    // Integer reply, specifically:
-    // 1 if the hash contains field.
-    // 0 if the hash does not contain field, or key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+    pthread_mutex_lock(&_mutex);
+    num_commands = _num_commands;
+    pthread_mutex_unlock(&_mutex);
+    return num_commands;
 }
 
-// Time complexity: O(1)
-// HLEN key
-int CRedisClient::hlen(const std::string& key, Node* which, int num_retries)
+uint64_t AckBuffer::get_num_errors() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HLEN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    uint64_t num_errors;
 
-    // Integer reply: number of fields in the hash, or 0 when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    pthread_mutex_lock(&_mutex);
+    num_errors = _num_errors;
+    pthread_mutex_unlock(&_mutex);
+    return num_errors;
 }
 
-// Time complexity: O(1)
-// HSET key field value
-bool CRedisClient::hset(
-        const std::string& key,
-        const std::string& field,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+void* AckBuffer::flush_thread(void* param)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HSET");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.add_arg(value);
-    cmd_args.final();
-
-    // Integer reply, specifically:
-    // 1 if field is a new field in the hash and value was set.
-    // 0 if field already exists in the hash and the value was updated.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+    AckBuffer* ack_buffer = static_cast<AckBuffer*>(param);
+    ack_buffer->run();
+    return NULL;
 }
 
-// HSETNX key field value
-// Time complexity: O(1)
-bool CRedisClient::hsetnx(
-        const std::string& key,
-        const std::string& field,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+void AckBuffer::run()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HSETNX");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    pthread_mutex_lock(&_mutex);
+    while (!_stop)
+    {
+        if (!_flush_requested)
+        {
+            if (_flush_interval_milliseconds > 0)
+            {
+                const int64_t deadline_us = get_monotonic_microseconds() + static_cast<int64_t>(_flush_interval_milliseconds) * 1000;
+                wait_monotonic_cond(&_cond, &_mutex, deadline_us);
+            }
+            else
+            {
+                pthread_cond_wait(&_cond, &_mutex);
+            }
+        }
+        if (_stop)
+            break;
 
-    // Integer reply, specifically:
-    // 1 if field is a new field in the hash and value was set.
-    // 0 if field already exists in the hash and no operation was performed.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+        _flush_requested = false;
+        pthread_mutex_unlock(&_mutex);
+        flush();
+        pthread_mutex_lock(&_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
 }
 
-// Time complexity: O(1)
-// HGET key field
-bool CRedisClient::hget(
-        const std::string& key,
-        const std::string& field,
-        std::string* value,
-        Node* which,
-        int num_retries)
-{
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HGET");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+////////////////////////////////////////////////////////////////////////////////
+// StreamConsumer
 
-    // Bulk string reply:
-    // the value associated with field, or nil when field is not present in the hash or key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return false;
-    if (REDIS_REPLY_STRING == redis_reply->type)
-        return get_value(redis_reply.get(), value);
-    return true;
+StreamConsumer::StreamConsumer(CRedisClient* redis_client, const std::string& groupname, const std::string& consumername, const std::vector<std::string>& keys)
+    : _redis_client(redis_client),
+      _groupname(groupname),
+      _consumername(consumername),
+      _keys(keys),
+      _num_workers(4),
+      _count(100),
+      _block_milliseconds(1000),
+      _queue_size(1000),
+      _ack_batch_size(100),
+      _ack_interval_milliseconds(100),
+      _min_idle_milliseconds(60000),
+      _claim_interval_milliseconds(10000),
+      _start_id("$"),
+      _handler(NULL),
+      _ack_client(NULL),
+      _ack_buffer(NULL),
+      _started(false),
+      _stop_reading(false),
+      _stop_working(false),
+      _num_delivered(0),
+      _num_claimed(0)
+{
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_not_empty, NULL);
+    pthread_cond_init(&_not_full, NULL);
+    init_monotonic_cond(&_stop_cond);
 }
 
-// Time complexity: O(1)
-// HINCRBY key field increment
-int64_t CRedisClient::hincrby(
-        const std::string& key,
-        const std::string& field,
-        int64_t increment,
-        Node* which,
-        int num_retries)
+StreamConsumer::~StreamConsumer()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HINCRBY");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.add_arg(increment);
-    cmd_args.final();
+    stop();
+    delete _ack_buffer;
+    delete _ack_client;
+    pthread_cond_destroy(&_stop_cond);
+    pthread_cond_destroy(&_not_full);
+    pthread_cond_destroy(&_not_empty);
+    pthread_mutex_destroy(&_mutex);
+}
 
-    // Integer reply: the value at field after the increment operation.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int64_t>(redis_reply->integer);
-    return 0;
+void StreamConsumer::set_num_workers(int num_workers)
+{
+    _num_workers = (num_workers > 0)? num_workers: 1;
 }
 
-void CRedisClient::hset(
-        const std::string& key,
-        const std::map<std::string, std::string>& map,
-        Node* which,
-        int num_retries)
+void StreamConsumer::set_count(int count)
 {
-    hmset(key, map, which, num_retries);
+    _count = count;
 }
 
-// Time complexity: O(N) where N is the number of fields being set.
-// HMSET key field value [field value ...]
-void CRedisClient::hmset(
-        const std::string& key,
-        const std::map<std::string, std::string>& map,
-        Node* which,
-        int num_retries)
+void StreamConsumer::set_block_milliseconds(int block_milliseconds)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HMSET");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(map);
-    cmd_args.final();
+    _block_milliseconds = block_milliseconds;
+}
 
-    // Simple string reply (REDIS_REPLY_STATUS)
-    redis_command(false, num_retries, key, cmd_args, which);
+void StreamConsumer::set_queue_size(int queue_size)
+{
+    _queue_size = (queue_size > 0)? queue_size: 1;
 }
 
-int CRedisClient::hget(
-        const std::string& key,
-        const std::vector<std::string>& fields,
-        std::map<std::string, std::string>* map,
-        bool keep_null,
-        Node* which,
-        int num_retries)
+void StreamConsumer::set_ack_policy(int ack_batch_size, int ack_interval_milliseconds)
 {
-    return hmget(key, fields, map, keep_null, which, num_retries);
+    _ack_batch_size = (ack_batch_size > 0)? ack_batch_size: 1;
+    _ack_interval_milliseconds = (ack_interval_milliseconds > 0)? ack_interval_milliseconds: 1;
 }
 
-// Time complexity: O(N) where N is the number of fields being requested.
-// HMGET key field [field ...]
-int CRedisClient::hmget(
-        const std::string& key,
-        const std::vector<std::string>& fields,
-        std::map<std::string, std::string>* map,
-        bool keep_null,
-        Node* which,
-        int num_retries)
+void StreamConsumer::set_claim_policy(int64_t min_idle_milliseconds, int claim_interval_milliseconds)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HMGET");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(fields);
-    cmd_args.final();
+    _min_idle_milliseconds = min_idle_milliseconds;
+    _claim_interval_milliseconds = claim_interval_milliseconds;
+}
 
-    // Array reply:
-    // list of values associated with the given fields, in the same order as they are requested.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return 0;
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), fields, keep_null, map);
-    return 0;
+void StreamConsumer::set_start_id(const std::string& id)
+{
+    _start_id = id;
 }
 
-// Time complexity: O(N) where N is the size of the hash.
-// HGETALL key
-int CRedisClient::hgetall(
-        const std::string& key,
-        std::map<std::string, std::string>* map,
-        Node* which,
-        int num_retries)
+void StreamConsumer::start(StreamHandler* handler)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HGETALL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    std::map<int, std::vector<std::string> > slot_keys;
+    struct ErrorInfo errinfo;
 
-    // Array reply:
-    // list of fields and their values stored in the hash, or an empty list when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return 0;
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), map);
-    return 0;
+    if (_started)
+        return;
+    {
+        CRedisClient* redis_client = new_redis_client();
+        try
+        {
+            create_groups(redis_client, _keys);
+        }
+        catch (...)
+        {
+            delete redis_client;
+            throw;
+        }
+        delete redis_client;
+    }
+
+    if (NULL == _ack_buffer)
+    {
+        _ack_client = new_redis_client();
+        _ack_buffer = new AckBuffer(_ack_client, _ack_interval_milliseconds, _ack_batch_size);
+    }
+    _ack_buffer->start();
+
+    _handler = handler;
+    _stop_reading = false;
+    _stop_working = false;
+    _started = true;
+    for (std::vector<std::string>::size_type i=0; i<_keys.size(); ++i)
+        slot_keys[_redis_client->cluster_mode()? get_key_slot(&_keys[i]): 0].push_back(_keys[i]);
+    for (std::map<int, std::vector<std::string> >::const_iterator iter=slot_keys.begin(); iter!=slot_keys.end(); ++iter)
+    {
+        StreamReader* reader = new StreamReader;
+        reader->consumer = this;
+        reader->keys = iter->second;
+        // pthread_create返回错误码，不设置errno
+        errinfo.errcode = pthread_create(&reader->thread, NULL, read_thread, reader);
+        if (0 == errinfo.errcode)
+        {
+            _readers.push_back(reader);
+        }
+        else
+        {
+            delete reader;
+            break;
+        }
+    }
+    for (int i=0; 0==errinfo.errcode && i<_num_workers; ++i)
+    {
+        pthread_t thread;
+        errinfo.errcode = pthread_create(&thread, NULL, work_thread, this);
+        if (0 == errinfo.errcode)
+            _workers.push_back(thread);
+    }
+    if (0 == errinfo.errcode)
+        errinfo.errcode = pthread_create(&_claimer, NULL, claim_thread, this);
+    else
+        _claimer = pthread_self();
+
+    if (errinfo.errcode != 0)
+    {
+        errinfo.raw_errmsg = format_string("create consumer thread error: %s", strerror(errinfo.errcode));
+        errinfo.errmsg = format_string("[R3C_CONSUMER][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        stop();
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
 }
 
-// Time complexity: O(1)
-// HSTRLEN key field
-int CRedisClient::hstrlen(const std::string& key, const std::string& field, Node* which, int num_retries)
+void StreamConsumer::stop()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HSTRLEN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    if (!_started)
+        return;
 
-    // Integer reply:
-    // the string length of the value associated with field,
-    // or zero when field is not present in the hash or key does not exist at all.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return 0;
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    // 先停读和认领，再等待已读到的处理完，最后确认
+    pthread_mutex_lock(&_mutex);
+    _stop_reading = true;
+    pthread_cond_broadcast(&_not_full);
+    pthread_cond_signal(&_stop_cond);
+    pthread_mutex_unlock(&_mutex);
+    for (std::vector<StreamReader*>::size_type i=0; i<_readers.size(); ++i)
+    {
+        pthread_join(_readers[i]->thread, NULL);
+        delete _readers[i];
+    }
+    _readers.clear();
+    if (!pthread_equal(_claimer, pthread_self()))
+        pthread_join(_claimer, NULL);
+
+    pthread_mutex_lock(&_mutex);
+    _stop_working = true;
+    pthread_cond_broadcast(&_not_empty);
+    pthread_mutex_unlock(&_mutex);
+    for (std::vector<pthread_t>::size_type i=0; i<_workers.size(); ++i)
+        pthread_join(_workers[i], NULL);
+    _workers.clear();
+    _ack_buffer->stop();
+    _started = false;
 }
 
-// Time complexity: O(N) where N is the size of the hash.
-// HKEYS key
-int CRedisClient::hkeys(const std::string& key, std::vector<std::string>* fields, Node* which, int num_retries)
+uint64_t StreamConsumer::get_num_delivered() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HKEYS");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    uint64_t num_delivered;
 
-    // Array reply:
-    // list of fields in the hash, or an empty list when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return 0;
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), fields);
-    return 0;
+    pthread_mutex_lock(&_mutex);
+    num_delivered = _num_delivered;
+    pthread_mutex_unlock(&_mutex);
+    return num_delivered;
 }
 
-// Time complexity: O(N) where N is the size of the hash.
-// HVALS key
-int CRedisClient::hvals(const std::string& key, std::vector<std::string>* vals, Node* which, int num_retries)
+uint64_t StreamConsumer::get_num_acked() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HVALS");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    return (NULL == _ack_buffer)? 0: _ack_buffer->get_num_acked();
+}
 
-    // Array reply:
-    // list of values in the hash, or an empty list when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return 0;
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), vals);
-    return 0;
+int StreamConsumer::get_num_unacked() const
+{
+    return (NULL == _ack_buffer)? 0: _ack_buffer->get_num_unacked();
 }
 
-// Time complexity:
-// O(1) for every call. O(N) for a complete iteration,
-// including enough command calls for the cursor to return back to 0. N is the number of elements inside the collection..
-//
-// HSCAN key cursor [MATCH pattern] [COUNT count]
-int64_t CRedisClient::hscan(
-        const std::string& key,
-        int64_t cursor,
-        std::map<std::string, std::string>* map,
-        Node* which,
-        int num_retries)
+uint64_t StreamConsumer::get_num_claimed() const
 {
-    return hscan(key, cursor, std::string(""), 0, map, which, num_retries);
+    uint64_t num_claimed;
+
+    pthread_mutex_lock(&_mutex);
+    num_claimed = _num_claimed;
+    pthread_mutex_unlock(&_mutex);
+    return num_claimed;
 }
 
-int64_t CRedisClient::hscan(
-        const std::string& key,
-        int64_t cursor, int count,
-        std::map<std::string, std::string>* map,
-        Node* which,
-        int num_retries)
+CRedisClient* StreamConsumer::new_redis_client() const
 {
-    return hscan(key, cursor, std::string(""), count, map, which, num_retries);
+    // 每个线程独立的CRedisClient，CRedisClient不是线程安全的
+    CRedisClient* redis_client = new CRedisClient(
+            _redis_client->get_nodes_string(), _redis_client->_password,
+            _redis_client->_connect_timeout_milliseconds, _redis_client->_readwrite_timeout_milliseconds);
+    redis_client->set_unix_socket_table(_redis_client->_unix_socket_table);
+    return redis_client;
 }
 
-int64_t CRedisClient::hscan(
-        const std::string& key,
-        int64_t cursor, const std::string& pattern,
-        std::map<std::string, std::string>* map,
-        Node* which,
-        int num_retries)
+void* StreamConsumer::read_thread(void* param)
 {
-    return hscan(key, cursor, pattern, 0, map, which, num_retries);
+    StreamReader* reader = static_cast<StreamReader*>(param);
+    reader->consumer->read_streams(reader->keys);
+    return NULL;
 }
 
-int64_t CRedisClient::hscan(
-        const std::string& key,
-        int64_t cursor, const std::string& pattern, int count,
-        std::map<std::string, std::string>* map,
-        Node* which,
-        int num_retries)
+void* StreamConsumer::work_thread(void* param)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("HSCAN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(cursor);
-    if (!pattern.empty())
-    {
-        cmd_args.add_arg("MATCH");
-        cmd_args.add_arg(pattern);
-    }
-    if (count > 0)
-    {
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
-    }
-    cmd_args.final();
+    StreamConsumer* consumer = static_cast<StreamConsumer*>(param);
+    consumer->work();
+    return NULL;
+}
 
-    // (gdb) p *redis_reply
-    // $1 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x641450}
-    // (gdb) p *redis_reply->element[0]
-    // $2 = {type = 1, integer = 0, len = 1, str = 0x641820 "0", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]
-    // $3 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 8, element = 0x6414b0}
-    // (gdb) p *redis_reply->element[1]->element[0]
-    // $4 = {type = 1, integer = 0, len = 2, str = 0x6418f0 "f1", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]->element[1]
-    // $5 = {type = 1, integer = 0, len = 2, str = 0x641950 "v1", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]->element[2]
-    // $6 = {type = 1, integer = 0, len = 2, str = 0x6419b0 "f2", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]->element[3]
-    // $7 = {type = 1, integer = 0, len = 2, str = 0x641a10 "v2", elements = 0, element = 0x0}
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
+void* StreamConsumer::claim_thread(void* param)
+{
+    StreamConsumer* consumer = static_cast<StreamConsumer*>(param);
+    consumer->claim();
+    return NULL;
+}
+
+void StreamConsumer::read_streams(const std::vector<std::string>& keys)
+{
+    const std::vector<std::string> ids(keys.size(), ">");
+    CRedisClient* redis_client = NULL;
+    std::vector<Stream> streams;
+    std::vector<StreamWork> works;
+
+    for (;;)
     {
-        get_values(redis_reply->element[1], map);
-        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+        pthread_mutex_lock(&_mutex);
+        const bool stop = _stop_reading;
+        pthread_mutex_unlock(&_mutex);
+        if (stop)
+            break;
+
+        try
+        {
+            if (NULL == redis_client)
+                redis_client = new_redis_client();
+            redis_client->xreadgroup(_groupname, _consumername, keys, ids, _count, _block_milliseconds, false, &streams);
+        }
+        catch (CRedisException& ex)
+        {
+            (*g_error_log)("[R3C_CONSUMER][%s:%d] %s\n", __FILE__, __LINE__, ex.str().c_str());
+            try
+            {
+                // 比如key被删除了
+                if (redis_client!=NULL && is_nogroup_error(ex.errtype()))
+                    create_groups(redis_client, keys);
+            }
+            catch (CRedisException&)
+            {
+            }
+            millisleep(1000);
+            continue;
+        }
+
+        works.clear();
+        for (std::vector<Stream>::size_type i=0; i<streams.size(); ++i)
+        {
+            for (std::vector<StreamEntry>::size_type j=0; j<streams[i].entries.size(); ++j)
+            {
+                works.resize(works.size()+1);
+                works.back().key = streams[i].key;
+                works.back().entry.id.swap(streams[i].entries[j].id);
+                works.back().entry.fvpairs.swap(streams[i].entries[j].fvpairs);
+            }
+        }
+        if (!works.empty() && !push_works(works))
+            break;
     }
-    return 0;
+    delete redis_client;
 }
 
+void StreamConsumer::work()
+{
+    for (;;)
+    {
+        StreamWork work;
+        bool ok = false;
 
+        pthread_mutex_lock(&_mutex);
+        while (_queue.empty() && !_stop_working)
+            pthread_cond_wait(&_not_empty, &_mutex);
+        if (_queue.empty())
+        {
+            pthread_mutex_unlock(&_mutex);
+            break; // Stopped
+        }
+        work.key.swap(_queue.front().key);
+        work.entry.id.swap(_queue.front().entry.id);
+        work.entry.fvpairs.swap(_queue.front().entry.fvpairs);
+        _queue.pop_front();
+        ++_num_delivered;
+        pthread_cond_signal(&_not_full);
+        pthread_mutex_unlock(&_mutex);
 
-//
-// LIST
-//
+        try
+        {
+            ok = _handler->handle(work.key, work.entry);
+        }
+        catch (...)
+        {
+            // 未确认，等待再次认领
+        }
+        if (ok)
+            _ack_buffer->ack(work.key, _groupname, work.entry.id);
+    }
+}
 
-// Time complexity: O(1)
-// LLEN key
-int CRedisClient::llen(const std::string& key, Node* which, int num_retries)
+void StreamConsumer::claim()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LLEN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    CRedisClient* redis_client = NULL;
 
-    // Integer reply: the length of the list at key.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    pthread_mutex_lock(&_mutex);
+    while (!_stop_reading)
+    {
+        if (_min_idle_milliseconds>0 && _claim_interval_milliseconds>0)
+        {
+            const int64_t deadline_us = get_monotonic_microseconds() + static_cast<int64_t>(_claim_interval_milliseconds) * 1000;
+            wait_monotonic_cond(&_stop_cond, &_mutex, deadline_us);
+        }
+        else
+        {
+            pthread_cond_wait(&_stop_cond, &_mutex);
+        }
+        if (_stop_reading)
+            break;
+
+        pthread_mutex_unlock(&_mutex);
+        if (NULL == redis_client)
+            redis_client = new_redis_client();
+        claim(redis_client);
+        pthread_mutex_lock(&_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
+    delete redis_client;
 }
 
-// Time complexity: O(1)
-// LPOP key
-bool CRedisClient::lpop(const std::string& key, std::string* value, Node* which, int num_retries)
+bool StreamConsumer::push_works(const std::vector<StreamWork>& works)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LPOP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
-
-    // Bulk string reply: the value of the first element, or nil when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return false;
-    if (REDIS_REPLY_STRING == redis_reply->type)
-        return get_value(redis_reply.get(), value);
-    return true; // MULTI & EXEC the type always is REDIS_REPLY_STATUS
+    pthread_mutex_lock(&_mutex);
+    for (std::vector<StreamWork>::size_type i=0; i<works.size(); ++i)
+    {
+        // 队列满时等待，停止时未入队的不再处理，留待再次认领
+        while (static_cast<int>(_queue.size())>=_queue_size && !_stop_reading)
+            pthread_cond_wait(&_not_full, &_mutex);
+        if (_stop_reading)
+        {
+            pthread_mutex_unlock(&_mutex);
+            return false;
+        }
+        _queue.push_back(works[i]);
+        pthread_cond_signal(&_not_empty);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return true;
 }
 
-bool CRedisClient::blpop(const std::string& key, std::string* value, uint32_t seconds, Node* which, int num_retries)
+void StreamConsumer::claim(CRedisClient* redis_client)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("BLPOP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(seconds);
-    cmd_args.final();
+    for (std::vector<std::string>::size_type i=0; i<_keys.size(); ++i)
+    {
+        const std::string& key = _keys[i];
+        std::vector<struct DetailedPending> pendings;
+        std::vector<std::string> ids;
+        std::vector<StreamEntry> entries;
+        std::vector<StreamWork> works;
 
-    // Array reply:
-    // 1) A nil multi-bulk when no element could be popped and the timeout expired.
-    // 2) A two-element multi-bulk with the first element being the name of the key
-    //    where an element was popped and the second element being the value of the popped element.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (redis_reply->type == REDIS_REPLY_NIL)
-        return false;
-    if (redis_reply->type != REDIS_REPLY_ARRAY)
-        return false;
-    return get_value(redis_reply->element[1], value);
+        try
+        {
+            redis_client->xpending(key, _groupname, "-", "+", _count, &pendings);
+            for (std::vector<struct DetailedPending>::size_type j=0; j<pendings.size(); ++j)
+            {
+                if (pendings[j].elapsed >= _min_idle_milliseconds)
+                    ids.push_back(pendings[j].id);
+            }
+            if (ids.empty())
+                continue;
+
+            // 只有仍然空闲足够久的才会被认领，避免与其它消费者冲突
+            redis_client->xclaim(key, _groupname, _consumername, _min_idle_milliseconds, ids, &entries);
+        }
+        catch (CRedisException& ex)
+        {
+            (*g_error_log)("[R3C_CONSUMER][%s:%d] %s\n", __FILE__, __LINE__, ex.str().c_str());
+            continue;
+        }
+
+        for (std::vector<StreamEntry>::size_type j=0; j<entries.size(); ++j)
+        {
+            if (entries[j].fvpairs.empty())
+            {
+                // 已被删除的消息，直接确认
+                _ack_buffer->ack(key, _groupname, entries[j].id);
+                continue;
+            }
+            works.resize(works.size()+1);
+            works.back().key = key;
+            works.back().entry = entries[j];
+        }
+        pthread_mutex_lock(&_mutex);
+        _num_claimed += static_cast<uint64_t>(entries.size());
+        pthread_mutex_unlock(&_mutex);
+        if (!works.empty() && !push_works(works))
+            break;
+    }
 }
 
-// Time complexity: O(1)
-// LPUSH key value [value ...]
-int CRedisClient::lpush(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+void StreamConsumer::create_groups(CRedisClient* redis_client, const std::vector<std::string>& keys)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LPUSH");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    for (std::vector<std::string>::size_type i=0; i<keys.size(); ++i)
+        redis_client->xgroup_create(keys[i], _groupname, _start_id, true); // false if exists already
+}
 
-    // Integer reply: the length of the list after the push operations.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+////////////////////////////////////////////////////////////////////////////////
+// MetricsServer
+
+MetricsServer::MetricsServer(const std::string& ip, uint16_t port, const std::string& name_space)
+    : _ip(ip), _port(port), _name_space(name_space),
+      _listen_fd(-1), _started(false), _stop(0), _num_requests(0)
+{
+    pthread_mutex_init(&_mutex, NULL);
 }
 
-// Time complexity: O(1)
-// LPUSH key value [value ...]
-int CRedisClient::lpush(
-        const std::string& key,
-        const std::vector<std::string>& values,
-        Node* which,
-        int num_retries)
+MetricsServer::~MetricsServer()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LPUSH");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(values);
-    cmd_args.final();
+    stop();
+    pthread_mutex_destroy(&_mutex);
+}
 
-    // Integer reply: the length of the list after the push operations.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+void MetricsServer::add_client(const CRedisClient* redis_client)
+{
+    pthread_mutex_lock(&_mutex);
+    if (std::find(_clients.begin(), _clients.end(), redis_client) == _clients.end())
+        _clients.push_back(redis_client);
+    pthread_mutex_unlock(&_mutex);
 }
 
-// Inserts value at the head of the list stored at key, only if key already exists and holds a list.
-// In contrary to LPUSH, no operation will be performed when key does not yet exist.
-// Time complexity: O(1)
-int CRedisClient::lpushx(const std::string& key, const std::string& value, Node* which, int num_retries)
+void MetricsServer::remove_client(const CRedisClient* redis_client)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LPUSHX");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
-
-    // Integer reply: the length of the list after the push operation.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    pthread_mutex_lock(&_mutex);
+    _clients.erase(std::remove(_clients.begin(), _clients.end(), redis_client), _clients.end());
+    pthread_mutex_unlock(&_mutex);
 }
 
-// Time complexity:
-// O(S+N) where S is the distance of start offset from HEAD for small lists,
-// from nearest end (HEAD or TAIL) for large lists;
-// and N is the number of elements in the specified range.
-//
-// LRANGE key start stop
-//
-// start和end值为-1时表示最右边一个，-2表示最右边倒数第二个，依次类推。。。
-//
-// 使用示例（lpush k 1 2 3 4 5）：
-// 1）查看最右边一个：lrange k -1 -1
-// 2）查看最右边两个：lrange k -2 -1
-// 3）查看最左边一个：lrange k 0 0
-// 4）查看最左边两个：lrange k 0 1
-// 5）查看全部：lrange k 0 -1
-int CRedisClient::lrange(
-        const std::string& key,
-        int64_t start, int64_t end,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+void MetricsServer::start()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LRANGE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    cmd_args.final();
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    const int on = 1;
+    struct ErrorInfo errinfo;
 
-    // Array reply: list of elements in the specified range.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), values);
-    return 0;
+    if (_started)
+        return;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_port);
+    if (1 != inet_pton(AF_INET, _ip.c_str(), &addr.sin_addr))
+    {
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = format_string("invalid ip: %s", _ip.c_str());
+        errinfo.errmsg = format_string("[R3C_METRICS][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == _listen_fd ||
+        -1 == setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+        -1 == bind(_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+        -1 == listen(_listen_fd, 16) ||
+        -1 == getsockname(_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen))
+    {
+        errinfo.errcode = errno;
+        errinfo.raw_errmsg = format_string("listen on %s:%d error: %s", _ip.c_str(), _port, strerror(errno));
+        errinfo.errmsg = format_string("[R3C_METRICS][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        if (_listen_fd != -1)
+            ::close(_listen_fd);
+        _listen_fd = -1;
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    _port = ntohs(addr.sin_port);
+
+    _stop = 0; // Before the serving thread created
+    errinfo.errcode = pthread_create(&_thread, NULL, serve_thread, this); // pthread_create不设置errno
+    if (errinfo.errcode != 0)
+    {
+        errinfo.raw_errmsg = format_string("create metrics thread error: %s", strerror(errinfo.errcode));
+        errinfo.errmsg = format_string("[R3C_METRICS][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        ::close(_listen_fd);
+        _listen_fd = -1;
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    _started = true;
 }
 
-// Time complexity:
-// O(N) where N is the number of elements to be removed by the operation.
-//
-// LTRIM key start stop
-//
-// 注意：
-// 1）start和end值为-1时表示最右边一个，-2表示最右边倒数第二个，依次类推。。。
-// 2）start~stop 是“保留”区间而不是删除范围，两值相减的绝对值为保留的数量
-//
-// 使用示例（lpush k 1 2 3 4 5）：
-// 1）删除最右一个：ltrim k 0 -2
-// 2）删除最右两个：ltrim k 0 -3
-// 3）删除最左一个：ltrim k 1 -1
-// 4）删除最左两个：ltrim k 2 -1
-void CRedisClient::ltrim(
-        const std::string& key,
-        int64_t start, int64_t end,
-        Node* which,
-        int num_retries)
+void MetricsServer::stop()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LTRIM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    cmd_args.final();
-
-    // Simple string reply (REDIS_REPLY_STATUS)
-    redis_command(false, num_retries, key, cmd_args, which);
+    if (_started)
+    {
+        __sync_fetch_and_or(&_stop, 1);
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+    if (_listen_fd != -1)
+    {
+        ::close(_listen_fd);
+        _listen_fd = -1;
+    }
 }
 
-void CRedisClient::lset(const std::string& key, int index, const std::string& value, Node* which, int num_retries)
+std::string MetricsServer::render() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LSET");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(index);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    struct ClientMetrics metrics;
 
-    // Simple string reply (REDIS_REPLY_STATUS)
-    // An error is returned for out of range indexes.
-    redis_command(false, num_retries, key, cmd_args, which);
+    pthread_mutex_lock(&_mutex);
+    for (std::vector<const CRedisClient*>::size_type i=0; i<_clients.size(); ++i)
+    {
+        struct ClientMetrics client_metrics;
+        _clients[i]->get_metrics(&client_metrics);
+        metrics.merge(client_metrics);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return render_openmetrics(metrics, _name_space);
 }
 
-// Inserts value in the list stored at key either before or after the reference value pivot.
-//
-// Time complexity:
-// O(N) where N is the number of elements to traverse before seeing the value pivot.
-// This means that inserting somewhere on the left end on the list (head) can be considered O(1)
-// and inserting somewhere on the right end (tail) is O(N).
-int CRedisClient::linsert(const std::string& key, const std::string& pivot, const std::string& value, bool before, Node* which, int num_retries)
+void* MetricsServer::serve_thread(void* param)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LINSERT");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    if (before)
-        cmd_args.add_arg("BEFORE");
-    else
-        cmd_args.add_arg("AFTER");
-    cmd_args.add_arg(pivot);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    MetricsServer* metrics_server = static_cast<MetricsServer*>(param);
+    metrics_server->run();
+    return NULL;
+}
 
-    // Integer reply:
-    // the length of the list after the insert operation,
-    // or -1 when the value pivot was not found.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+void MetricsServer::run()
+{
+    while (0 == __sync_fetch_and_add(&_stop, 0))
+    {
+        struct pollfd pfd;
+        pfd.fd = _listen_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        // 定时醒来检查是否需要退出
+        if (poll(&pfd, 1, 100) > 0)
+        {
+            const int fd = accept(_listen_fd, NULL, NULL);
+            if (fd != -1)
+            {
+                struct timeval send_timeout;
+                send_timeout.tv_sec = 1;
+                send_timeout.tv_usec = 0;
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+                serve(fd);
+                ::close(fd);
+            }
+        }
+    }
 }
 
-// Removes the first count occurrences of elements equal to value from the list stored at key.
-// Time complexity:
-// O(N) where N is the length of the list.
-int CRedisClient::lrem(const std::string& key, int count, const std::string& value, Node* which, int num_retries)
+void MetricsServer::serve(int fd)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LREM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(count);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    const int64_t deadline_milliseconds = get_monotonic_milliseconds() + 1000;
+    std::string request;
+    std::string response;
+    char buf[1024];
 
-    // Integer reply: the number of removed elements.
-    // Returns the number of removed elements.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    // 只需读完请求头，请求的路径和方法都不区分
+    while (request.find("\r\n\r\n")==std::string::npos && request.size()<8192)
+    {
+        const int64_t remaining_milliseconds = deadline_milliseconds - get_monotonic_milliseconds();
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (remaining_milliseconds<=0 || poll(&pfd, 1, static_cast<int>(remaining_milliseconds))<=0)
+            return;
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            return;
+        request.append(buf, n);
+    }
+
+    const std::string body = render();
+    response = format_string(
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+            "Content-Length: %d\r\n"
+            "Connection: close\r\n"
+            "\r\n", static_cast<int>(body.size()));
+    response += body;
+    for (std::string::size_type sent=0; sent<response.size();)
+    {
+        // 对端已关闭时不产生SIGPIPE
+        const ssize_t n = send(fd, response.data()+sent, response.size()-sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    __sync_fetch_and_add(&_num_requests, 1);
 }
 
-// Time complexity:
-// O(N) where N is the number of elements to traverse to get to the element at index.
-// This makes asking for the first or the last element of the list O(1).
-bool CRedisClient::lindex(const std::string& key, int index, std::string* value, Node* which, int num_retries)
+////////////////////////////////////////////////////////////////////////////////
+// DeadlineHelper
+
+DeadlineHelper::DeadlineHelper(CRedisClient* redis_client, int64_t deadline_milliseconds)
+    : _redis_client(redis_client),
+      _old_deadline_milliseconds(redis_client->get_deadline())
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("LINDEX");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(index);
-    cmd_args.final();
+    if (_old_deadline_milliseconds<=0 || deadline_milliseconds<_old_deadline_milliseconds)
+        _redis_client->set_deadline(deadline_milliseconds);
+}
 
-    // Bulk string reply: the requested element, or nil when index is out of range.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return false;
-    if (REDIS_REPLY_STRING == redis_reply->type)
-        return get_value(redis_reply.get(), value);
-    return true;
+DeadlineHelper::~DeadlineHelper()
+{
+    _redis_client->set_deadline(_old_deadline_milliseconds);
 }
 
-// Time complexity: O(1)
-// RPOP key
-bool CRedisClient::rpop(
-        const std::string& key,
-        std::string* value,
-        Node* which,
-        int num_retries)
+////////////////////////////////////////////////////////////////////////////////
+// ClusterScanner
+
+ClusterScanner::ClusterScanner(CRedisClient* redis_client, const std::string& pattern, int count, const std::string& type)
+    : _redis_client(redis_client),
+      _pattern(pattern),
+      _count(count),
+      _type(type),
+      _initialized(false),
+      _index(0)
+{
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]
+// Called by: ClusterScanner & ParallelScanner
+static int64_t scan_slot(
+        CRedisClient* redis_client, int slot, int64_t cursor,
+        const std::string& pattern, int count, const std::string& type,
+        std::vector<std::string>* keys, Node* which, int num_retries)
 {
     CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("RPOP");
+    cmd_args.set_command("SCAN");
     cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
+    cmd_args.add_arg(cursor);
+    if (!pattern.empty())
+    {
+        cmd_args.add_arg("MATCH");
+        cmd_args.add_arg(pattern);
+    }
+    if (count > 0)
+    {
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+    }
+    if (!type.empty())
+    {
+        cmd_args.add_arg("TYPE");
+        cmd_args.add_arg(type);
+    }
     cmd_args.final();
 
-    // Bulk string reply: the value of the last element, or nil when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return false;
-    if (REDIS_REPLY_STRING == redis_reply->type)
-        return get_value(redis_reply.get(), value);
-    return true;
-}
-
-int CRedisClient::rpop(const std::string& key, std::vector<std::string>* values, int n, Node* which, int num_retries)
-{
-    values->clear();
+    // 游标只对发出它的实例有意义，因此总是发给master，不走replica和对冲读
+    Node node;
+    const RedisReplyHelper redis_reply = redis_client->redis_command(false, num_retries, slot, cmd_args, &node);
+    if (which != NULL)
+        *which = node;
 
-    if (n < 1)
+    // An array of two values: the next cursor, and the array of the keys
+    if (REDIS_REPLY_ARRAY!=redis_reply->type || redis_reply->elements!=2 ||
+        REDIS_REPLY_STRING!=redis_reply->element[0]->type || REDIS_REPLY_ARRAY!=redis_reply->element[1]->type)
     {
         struct ErrorInfo errinfo;
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.errmsg = "`n` is less than 1";
-        THROW_REDIS_EXCEPTION(errinfo);
+        errinfo.errcode = ERROR_REPLY_FORMAT;
+        errinfo.raw_errmsg = format_string("unexpected reply of SCAN (type:%d, elements:%d)",
+                redis_reply->type, static_cast<int>(redis_reply->elements));
+        errinfo.errmsg = format_string("[R3C_SCAN][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION_WITH_NODE_AND_COMMAND(errinfo, node.first, node.second, cmd_args.get_command(), cmd_args.get_key());
     }
-    else if (n == 1)
+    CRedisClient::get_values(redis_reply->element[1], keys);
+    return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+}
+
+int ClusterScanner::next(std::vector<std::string>* keys, Node* which, int num_retries)
+{
+    Node node;
+    int64_t cursor;
+
+    keys->clear();
+    if (done())
+        return 0;
+
+    struct Shard& shard = _shards[_index];
+    follow_shard();
+    cursor = scan_slot(_redis_client, shard.slot, shard.cursor, _pattern, _count, _type, keys, &node, num_retries);
+    if (which != NULL)
+        *which = node;
+    if (_redis_client->cluster_mode())
     {
-        std::string value;
-        if (!rpop(key, &value, which, num_retries))
-        {
-            return 0;
-        }
-        else
+        const NodeId nodeid = _redis_client->get_master_nodeid(node);
+
+        if (!nodeid.empty() && nodeid!=shard.nodeid)
         {
-            values->push_back(value);
-            return 1;
+            const bool restart = !shard.nodeid.empty();
+
+            shard.nodeid = nodeid;
+            if (restart)
+            {
+                // 调用中被重定向到了另一个master，游标不是它发出的，从头扫描
+                shard.cursor = 0;
+                return static_cast<int>(keys->size());
+            }
         }
     }
-    else
+    shard.cursor = cursor;
+    if (0 == shard.cursor)
     {
-        const std::string lua_scripts =
-                "local v=redis.call('LRANGE',KEYS[1],-ARGV[1], -1);"
-                "redis.call('LTRIM',KEYS[1],0,-(ARGV[1]+1));"
-                "return v;";
-        std::vector<std::string> parameters(1);
-        parameters[0] = int2string(n);
-        const RedisReplyHelper redis_reply = eval(key, lua_scripts, parameters, which, num_retries);
-        if (REDIS_REPLY_ARRAY == redis_reply->type)
-        {
-            std::vector<std::string> v;
-            const int m = get_values(redis_reply.get(), &v);
-            // LRANGE 返回的结果是从左到右，对 r 操作需要倒过来
-            for (int i=m-1; i>-1; --i)
-                values->push_back(v[i]);
-            return m;
-        }
-        return 0;
+        shard.cursor = -1; // This master is done
+        ++_index;
     }
+    return static_cast<int>(keys->size());
 }
 
-bool CRedisClient::brpop(const std::string& key, std::string* value, uint32_t seconds, Node* which, int num_retries)
+void ClusterScanner::follow_shard()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("BRPOP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(seconds);
-    cmd_args.final();
+    struct Shard& shard = _shards[_index];
 
-    // Array reply:
-    // 1) A nil multi-bulk when no element could be popped and the timeout expired.
-    // 2) A two-element multi-bulk with the first element being the name of the key
-    //    where an element was popped and the second element being the value of the popped element.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (redis_reply->type == REDIS_REPLY_NIL)
-        return false;
-    if (redis_reply->type != REDIS_REPLY_ARRAY)
-        return false;
-    return get_value(redis_reply->element[1], value);
+    if (_redis_client->cluster_mode() && !shard.nodeid.empty())
+    {
+        const NodeId owner = _redis_client->get_slot_nodeid(shard.slot);
+
+        if (!owner.empty() && owner!=shard.nodeid)
+        {
+            const int slot = _redis_client->get_nodeid_slot(shard.nodeid);
+
+            if (slot >= 0)
+            {
+                // 用于路由的slot迁走了，改用该master的另一个slot
+                shard.slot = slot;
+            }
+            else
+            {
+                // 主备切换或master已下线，在新的master上从头扫描
+                shard.nodeid = owner;
+                shard.cursor = 0;
+            }
+        }
+    }
 }
 
-// Time complexity: O(1)
-bool CRedisClient::rpoppush(
-        const std::string& source,
-        const std::string& destination,
-        std::string* value,
-        Node* which, int num_retries)
+bool ClusterScanner::done()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(source);
-    cmd_args.set_command("RPOPLPUSH");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(source);
-    cmd_args.add_arg(destination);
-    cmd_args.final();
-
-    // Bulk string reply: the value of the last element, or nil when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, source, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return false;
-    if (REDIS_REPLY_STRING == redis_reply->type)
-        return get_value(redis_reply.get(), value);
-    return true;
+    if (!_initialized)
+        init_shards();
+    while (_index<_shards.size() && -1==_shards[_index].cursor)
+        ++_index;
+    return _index >= _shards.size();
 }
 
-// Time complexity: O(1)
-bool CRedisClient::brpoppush(const std::string& source, const std::string& destination, std::string* value, uint32_t seconds, Node* which, int num_retries)
+std::string ClusterScanner::get_cursor()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(source);
-    cmd_args.set_command("BRPOPLPUSH");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(source);
-    cmd_args.add_arg(destination);
-    cmd_args.add_arg(seconds);
-    cmd_args.final();
+    std::string cursor;
 
-    // Bulk string reply: the value of the last element, or nil when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, source, cmd_args, which);
-    if (redis_reply->type == REDIS_REPLY_NIL)
-        return false;
-    if (redis_reply->type == REDIS_REPLY_STRING)
-        return get_value(redis_reply.get(), value);
-    return true;
+    if (!_initialized)
+        init_shards();
+    for (std::vector<struct Shard>::size_type i=0; i<_shards.size(); ++i)
+    {
+        if (_shards[i].cursor != -1)
+        {
+            if (!cursor.empty())
+                cursor.push_back(',');
+            cursor += format_string("%d:%" PRId64 ":%s", _shards[i].slot, _shards[i].cursor, _shards[i].nodeid.c_str());
+        }
+    }
+    return cursor;
 }
 
-// Time complexity: O(1)
-int CRedisClient::rpush(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+bool ClusterScanner::set_cursor(const std::string& cursor)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("RPUSH");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    std::vector<std::string> tokens;
+    std::vector<struct Shard> shards;
 
-    // Integer reply: the length of the list after the push operation.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    split(&tokens, cursor, std::string(","));
+    for (std::vector<std::string>::size_type i=0; i<tokens.size(); ++i)
+    {
+        std::vector<std::string> fields;
+        struct Shard shard;
+
+        // slot:cursor[:nodeid]
+        split(&fields, tokens[i], std::string(":"));
+        if (fields.size()<2 || fields.size()>3)
+            return false;
+        shard.slot = atoi(fields[0].c_str());
+        shard.cursor = static_cast<int64_t>(atoll(fields[1].c_str()));
+        if (fields.size() > 2)
+            shard.nodeid = fields[2];
+        if (shard.slot<0 || shard.slot>=CLUSTER_SLOTS || shard.cursor<0)
+            return false;
+        shards.push_back(shard);
+    }
+
+    _shards.swap(shards);
+    _index = 0;
+    _initialized = true;
+    return true;
 }
 
-// Time complexity: O(1)
-int CRedisClient::rpush(
-        const std::string& key,
-        const std::vector<std::string>& values,
-        Node* which,
-        int num_retries)
+void ClusterScanner::reset()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("RPUSH");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(values);
-    cmd_args.final();
-
-    // Integer reply: the length of the list after the push operation.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    _shards.clear();
+    _index = 0;
+    _initialized = false;
 }
 
-// Time complexity: O(1)
-int CRedisClient::rpushx(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+void ClusterScanner::init_shards()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("RPUSHX");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    std::vector<std::pair<int, NodeId> > masters; // First slot -> ID
 
-    // Integer reply:
-    // the length of the list after the push operation.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    _shards.clear();
+    _index = 0;
+    if (!_redis_client->cluster_mode())
+    {
+        masters.push_back(std::make_pair(0, NodeId()));
+    }
+    else
+    {
+        std::vector<struct NodeInfo> nodes_info;
+
+        _redis_client->list_nodes(&nodes_info);
+        for (std::vector<struct NodeInfo>::size_type i=0; i<nodes_info.size(); ++i)
+        {
+            const struct NodeInfo& nodeinfo = nodes_info[i];
+            if (nodeinfo.is_master() && !nodeinfo.is_fail() && !nodeinfo.slots.empty())
+                masters.push_back(std::make_pair(nodeinfo.slots[0].first, nodeinfo.id));
+        }
+        std::sort(masters.begin(), masters.end());
+    }
+    _shards.resize(masters.size());
+    for (std::vector<std::pair<int, NodeId> >::size_type i=0; i<masters.size(); ++i)
+    {
+        _shards[i].slot = masters[i].first;
+        _shards[i].cursor = 0;
+        _shards[i].nodeid = masters[i].second;
+    }
+    _initialized = true;
 }
 
-//
-// SET
-//
+////////////////////////////////////////////////////////////////////////////////
+// ParallelScanner
 
-// Time complexity:
-//  O(1) for each element added, so O(N) to add N elements when the command is called with multiple arguments.
-int CRedisClient::sadd(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+ParallelScanner::ParallelScanner(CRedisClient* redis_client, const std::string& pattern, int count, const std::string& type)
+    : _redis_client(redis_client),
+      _pattern(pattern),
+      _count(count),
+      _type(type),
+      _queue_size(16),
+      _scans_per_second(0),
+      _num_retries(NUM_RETRIES),
+      _num_active_workers(0),
+      _stop(false),
+      _exception(NULL)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SADD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
-
-    // Integer reply: the number of elements that were added to the set,
-    // not including all the elements already present into the set.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_not_empty, NULL);
+    pthread_cond_init(&_not_full, NULL);
 }
 
-//  O(1) for each element added, so O(N) to add N elements when the command is called with multiple arguments.
-int CRedisClient::sadd(
-        const std::string& key,
-        const std::vector<std::string>& values,
-        Node* which,
-        int num_retries)
+ParallelScanner::~ParallelScanner()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SADD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(values);
-    cmd_args.final();
-
-    // Integer reply: the number of elements that were added to the set,
-    // not including all the elements already present into the set.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    pthread_cond_destroy(&_not_full);
+    pthread_cond_destroy(&_not_empty);
+    pthread_mutex_destroy(&_mutex);
 }
 
-// O(1)
-int CRedisClient::scard(const std::string& key, Node* which, int num_retries)
+void ParallelScanner::set_queue_size(int queue_size)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SCARD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
-
-    // Integer reply: the cardinality (number of elements) of the set, or 0 if key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    _queue_size = (queue_size > 1)? queue_size: 1;
 }
 
-// O(1)
-bool CRedisClient::sismember(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+void ParallelScanner::set_rate_limit(int scans_per_second)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SISMEMBER");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
-
-    // Integer reply, specifically:
-    // 1 if the element is a member of the set.
-    // 0 if the element is not a member of the set, or if key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return 1 == redis_reply->integer;
-    return true;
+    _scans_per_second = (scans_per_second > 0)? scans_per_second: 0;
 }
 
-// O(N) where N is the set cardinality.
-int CRedisClient::smembers(
-        const std::string& key,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+int64_t ParallelScanner::run(ScanHandler* handler, int num_retries)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SMEMBERS");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    std::vector<ScanWorker> workers;
+    int64_t num_keys = 0;
 
-    // Array reply:
-    // all elements of the set.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), values);
-    return 0;
+    if (!_redis_client->cluster_mode())
+    {
+        ScanWorker worker;
+        worker.scanner = this;
+        worker.node = _redis_client->_nodes[0];
+        workers.push_back(worker);
+    }
+    else
+    {
+        for (CRedisClient::RedisMasterNodeTable::const_iterator iter=_redis_client->_redis_master_nodes.begin(); iter!=_redis_client->_redis_master_nodes.end(); ++iter)
+        {
+            ScanWorker worker;
+            worker.scanner = this;
+            worker.node = iter->first;
+            workers.push_back(worker);
+        }
+    }
+
+    _num_retries = num_retries;
+    _num_active_workers = 0;
+    _stop = false;
+    for (std::vector<ScanWorker>::size_type i=0; i<workers.size(); ++i)
+    {
+        const int errcode = pthread_create(&workers[i].thread, NULL, scan_thread, &workers[i]); // pthread_create不设置errno
+        if (0 == errcode)
+        {
+            pthread_mutex_lock(&_mutex);
+            ++_num_active_workers;
+            pthread_mutex_unlock(&_mutex);
+        }
+        else
+        {
+            workers.resize(i);
+            pthread_mutex_lock(&_mutex);
+            _stop = true;
+            if (NULL == _exception)
+            {
+                struct ErrorInfo errinfo;
+                errinfo.errcode = errcode;
+                errinfo.raw_errmsg = format_string("create scan thread error: %s", strerror(errcode));
+                errinfo.errmsg = format_string("[R3C_SCAN][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+                _exception = new CRedisException(errinfo, __FILE__, __LINE__);
+            }
+            pthread_cond_broadcast(&_not_full);
+            pthread_mutex_unlock(&_mutex);
+            break;
+        }
+    }
+
+    while (true)
+    {
+        ScanBatch* batch = NULL;
+        bool stop;
+
+        pthread_mutex_lock(&_mutex);
+        while (_queue.empty() && _num_active_workers>0)
+            pthread_cond_wait(&_not_empty, &_mutex);
+        if (!_queue.empty())
+        {
+            batch = _queue.front();
+            _queue.pop_front();
+            pthread_cond_signal(&_not_full);
+        }
+        stop = _stop;
+        pthread_mutex_unlock(&_mutex);
+        if (NULL == batch)
+            break; // All workers done
+
+        if (!stop)
+        {
+            bool go_on;
+
+            num_keys += static_cast<int64_t>(batch->keys.size());
+            try
+            {
+                go_on = handler->handle(batch->node, batch->keys);
+            }
+            catch (...)
+            {
+                // 工作线程仍在运行，须先停止并回收后才能将异常抛给调用者
+                delete batch;
+                stop_workers(workers);
+                throw;
+            }
+            if (!go_on)
+            {
+                pthread_mutex_lock(&_mutex);
+                _stop = true;
+                pthread_cond_broadcast(&_not_full);
+                pthread_mutex_unlock(&_mutex);
+            }
+        }
+        delete batch;
+    }
+    for (std::vector<ScanWorker>::size_type i=0; i<workers.size(); ++i)
+        pthread_join(workers[i].thread, NULL);
+
+    if (_exception != NULL)
+    {
+        const CRedisException exception(*_exception);
+        delete _exception;
+        _exception = NULL;
+        throw exception;
+    }
+    return num_keys;
 }
 
-int CRedisClient::smembers(
-        const std::string& key,
-        std::set<std::string>* values,
-        Node* which,
-        int num_retries)
+void* ParallelScanner::scan_thread(void* param)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SMEMBERS");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    ScanWorker* worker = static_cast<ScanWorker*>(param);
+    ParallelScanner* scanner = worker->scanner;
 
-    // Array reply:
-    // all elements of the set.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), values);
-    return 0;
+    scanner->scan_node(worker->node);
+    pthread_mutex_lock(&scanner->_mutex);
+    --scanner->_num_active_workers;
+    pthread_cond_signal(&scanner->_not_empty);
+    pthread_mutex_unlock(&scanner->_mutex);
+    return NULL;
 }
 
-// Time complexity: O(1)
-bool CRedisClient::spop(
-        const std::string& key,
-        std::string* value,
-        Node* which,
-        int num_retries)
+void ParallelScanner::scan_node(const Node& node)
 {
-    std::vector<std::string> values;
-    const int n = spop(key, 1, &values, which, num_retries);
-    if (n > 0)
+    try
     {
-        *value = value[0];
+        // 每个master独立的连接，CRedisClient不是线程安全的
+        CRedisClient redis_client(
+                node2string(node), _redis_client->_password,
+                _redis_client->_connect_timeout_milliseconds, _redis_client->_readwrite_timeout_milliseconds);
+        const int64_t interval_us = (_scans_per_second > 0)? (1000000 / _scans_per_second): 0;
+        int64_t cursor = 0;
+
+        redis_client.set_unix_socket_table(_redis_client->_unix_socket_table);
+        do
+        {
+            ScanBatch* batch = new ScanBatch;
+            struct timeval start_tv, stop_tv;
+
+            gettimeofday(&start_tv, NULL);
+            batch->node = node;
+            try
+            {
+                cursor = scan_slot(&redis_client, -1, cursor, _pattern, _count, _type, &batch->keys, NULL, _num_retries);
+            }
+            catch (...)
+            {
+                delete batch;
+                throw;
+            }
+            if (batch->keys.empty())
+                delete batch;
+            else if (!push_batch(batch))
+                break; // Stopped
+
+            if (interval_us > 0)
+            {
+                // 限速，避免影响线上请求
+                int64_t elapsed_us;
+
+                gettimeofday(&stop_tv, NULL);
+                elapsed_us = calc_elapsed_time(start_tv, stop_tv);
+                if (elapsed_us < interval_us)
+                    usleep(static_cast<useconds_t>(interval_us - elapsed_us));
+            }
+        } while (cursor != 0);
+    }
+    catch (CRedisException& ex)
+    {
+        pthread_mutex_lock(&_mutex);
+        if (NULL == _exception)
+            _exception = new CRedisException(ex);
+        _stop = true;
+        pthread_cond_broadcast(&_not_full);
+        pthread_mutex_unlock(&_mutex);
     }
-    return n > 0;
 }
 
-// Time complexity: O(1)
-int CRedisClient::spop(
-        const std::string& key,
-        int count,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+void ParallelScanner::stop_workers(const std::vector<ScanWorker>& workers)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SPOP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(count);
-    cmd_args.final();
+    pthread_mutex_lock(&_mutex);
+    _stop = true;
+    pthread_cond_broadcast(&_not_full);
+    pthread_mutex_unlock(&_mutex);
 
-    // Bulk string reply:
-    // the removed element, or nil when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), values);
-    return 0;
+    for (std::vector<ScanWorker>::size_type i=0; i<workers.size(); ++i)
+        pthread_join(workers[i].thread, NULL);
+    while (!_queue.empty())
+    {
+        delete _queue.front();
+        _queue.pop_front();
+    }
+    delete _exception;
+    _exception = NULL;
 }
 
-// Time complexity: O(1)
-bool CRedisClient::srandmember(
-        const std::string& key,
-        std::string* value,
-        Node* which,
-        int num_retries)
+bool ParallelScanner::push_batch(ScanBatch* batch)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SRANDMEMBER");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    bool pushed = false;
 
-    // Bulk string reply:
-    // without the additional count argument the command returns a Bulk Reply with the randomly selected element,
-    // or nil when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
-        return false;
-    if (REDIS_REPLY_STRING == redis_reply->type)
-        return get_value(redis_reply.get(), value);
-    return true;
+    pthread_mutex_lock(&_mutex);
+    while (!_stop && static_cast<int>(_queue.size())>=_queue_size)
+        pthread_cond_wait(&_not_full, &_mutex);
+    if (!_stop)
+    {
+        _queue.push_back(batch);
+        pushed = true;
+        pthread_cond_signal(&_not_empty);
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    if (!pushed)
+        delete batch;
+    return pushed;
 }
 
-// Time complexity: O(N) where N is the absolute value of the passed count.
-int CRedisClient::srandmember(
-        const std::string& key,
-        int count,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
-{
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SRANDMEMBER");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(count);
-    cmd_args.final();
+////////////////////////////////////////////////////////////////////////////////
+// RedisReplyHelper
 
-    // Array reply:
-    // when the additional count argument is passed the command returns an array of elements,
-    // or an empty array when key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), values);
-    return 0;
+RedisReplyHelper::RedisReplyHelper()
+    : _redis_reply(NULL)
+{
 }
 
-// Time complexity: O(N) where N is the number of members to be removed.
-int CRedisClient::srem(
-        const std::string& key,
-        const std::string& value,
-        Node* which,
-        int num_retries)
+RedisReplyHelper::RedisReplyHelper(const redisReply* redis_reply)
+    : _redis_reply(redis_reply)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SREM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+}
 
-    // Integer reply: the number of members that were removed from the set,
-    // not including non existing members.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+RedisReplyHelper::RedisReplyHelper(const RedisReplyHelper& other)
+{
+    _redis_reply = other.detach();
 }
 
-int CRedisClient::srem(
-        const std::string& key,
-        const std::vector<std::string>& values,
-        Node* which,
-        int num_retries)
+RedisReplyHelper::~RedisReplyHelper()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SREM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(values);
-    cmd_args.final();
+    free();
+}
 
-    // Integer reply: the number of members that were removed from the set,
-    // not including non existing members.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+RedisReplyHelper::operator bool() const
+{
+    return _redis_reply != NULL;
 }
 
-// Time complexity:
-// O(1) for every call.
-// O(N) for a complete iteration, including enough command calls for the cursor to return back to 0.
-// N is the number of elements inside the collection..
-int64_t CRedisClient::sscan(
-        const std::string& key,
-        int64_t cursor,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+void RedisReplyHelper::free()
 {
-    return sscan(key, cursor, std::string(""), 0, values, which, num_retries);
+    if (_redis_reply != NULL)
+    {
+        freeReplyObject((void*)_redis_reply);
+        _redis_reply = NULL;
+    }
 }
 
-int64_t CRedisClient::sscan(
-        const std::string& key,
-        int64_t cursor, int count,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+const redisReply* RedisReplyHelper::get() const
 {
-    return sscan(key, cursor, std::string(""), count, values, which, num_retries);
+    return _redis_reply;
 }
 
-int64_t CRedisClient::sscan(
-        const std::string& key,
-        int64_t cursor, const std::string& pattern,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+const redisReply* RedisReplyHelper::detach() const
 {
-    return sscan(key, cursor, pattern, 0, values, which, num_retries);
+    const redisReply* redis_reply = _redis_reply;
+    _redis_reply = NULL;
+    return redis_reply;
 }
 
-int64_t CRedisClient::sscan(
-        const std::string& key,
-        int64_t cursor, const std::string& pattern, int count,
-        std::vector<std::string>* values,
-        Node* which,
-        int num_retries)
+RedisReplyHelper& RedisReplyHelper::operator =(const redisReply* redis_reply)
 {
-    // SSCAN key cursor [MATCH pattern] [COUNT count]
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SSCAN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(cursor);
-    if (!pattern.empty())
-    {
-        cmd_args.add_arg("MATCH");
-        cmd_args.add_arg(pattern);
-    }
-    if (count > 0)
-    {
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
-    }
-    cmd_args.final();
+    free();
+    _redis_reply = redis_reply;
+    return *this;
+}
 
-    // (gdb) p *redis_reply
-    // $3 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x641450}
-    // (gdb) p *redis_reply->element[0]
-    // $4 = {type = 1, integer = 0, len = 4, str = 0x641810 "6656", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]
-    // $5 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 10, element = 0x641930}
-    // (gdb) p *redis_reply->element[1]->element[0]
-    // $6 = {type = 1, integer = 0, len = 5, str = 0x6419d0 "f1055", elements = 0, element = 0x0}
-    // (gdb) p *redis_reply->element[1]->element[1]
-    // $7 = {type = 1, integer = 0, len = 5, str = 0x641a30 "f6368", elements = 0, element = 0x0}
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-    {
-        get_values(redis_reply->element[1], values);
-        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
-    }
-    return 0;
+RedisReplyHelper& RedisReplyHelper::operator =(const RedisReplyHelper& other)
+{
+    free();
+    _redis_reply = other.detach();
+    return *this;
 }
 
-int64_t CRedisClient::sscan(
-        const std::string& key,
-        int64_t cursor,
-        const std::string& pattern,
-        int count,
-        std::set<std::string>* values,
-        Node* which,
-        int num_retries)
+const redisReply* RedisReplyHelper::operator ->() const
 {
-    // SSCAN key cursor [MATCH pattern] [COUNT count]
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SSCAN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(cursor);
-    if (!pattern.empty())
-    {
-        cmd_args.add_arg("MATCH");
-        cmd_args.add_arg(pattern);
-    }
-    if (count > 0)
-    {
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
-    }
-    cmd_args.final();
+    return _redis_reply;
+}
 
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-    {
-        get_values(redis_reply->element[1], values);
-        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
-    }
-    return 0;
+std::ostream& RedisReplyHelper::operator <<(std::ostream& os)
+{
+    os << *_redis_reply;
+    return os;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// ErrorInfo
 
-// Copies all members of source keys to destinationkey.
-// Time complexity: O(N) where N is the total number of elements in all given sets.
-// Returns the number of members that were in resulting set.
-int  CRedisClient::sunionstore(
-    const std::string& destinationkey, 
-    const std::vector<std::string>& keys, 
-    Node* which, 
-    int num_retries)
+ErrorInfo::ErrorInfo()
+    : errcode(0)
 {
-    
-    std::vector<std::string> allKeys;
-    allKeys=keys;
-    allKeys.push_back(destinationkey);
-    if(keys.size()<1){
-        struct ErrorInfo errinfo;
-        errinfo.errcode = ERROR_NOT_SUPPORT;
-        errinfo.errmsg = "There must be minimum one key";
-        THROW_REDIS_EXCEPTION(errinfo);        
-    }
-    else if (cluster_mode() && keys_crossslots(allKeys))
+}
+
+ErrorInfo::ErrorInfo(const std::string& raw_errmsg_, const std::string& errmsg_, const std::string& errtype_, int errcode_)
+    : raw_errmsg(raw_errmsg_), errmsg(errmsg_), errtype(errtype_), errcode(errcode_)
+{
+}
+
+void ErrorInfo::clear()
+{
+    errcode = 0;
+    errtype.clear();
+    errmsg.clear();
+    raw_errmsg.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CRedisException
+
+CRedisException::CRedisException(
+        const struct ErrorInfo& errinfo,
+        const char* file, int line,
+        const std::string& node_ip, uint16_t node_port,
+        const std::string& command, const std::string& key) throw ()
+    :  _errinfo(errinfo),
+       _line(line),
+       _node_ip(node_ip), _node_port(node_port),
+       _command(command), _key(key)
+{
+    const char* slash_position = strrchr(file, '/');
+    const std::string* file_cp = &_file;
+    std::string* file_p = const_cast<std::string*>(file_cp);
+
+    if (NULL == slash_position)
     {
-        struct ErrorInfo errinfo;
-        errinfo.errcode = ERROR_NOT_SUPPORT;
-        errinfo.errmsg = "CROSSSLOT not supported in cluster mode";
-        THROW_REDIS_EXCEPTION(errinfo);
+        *file_p = file;
     }
     else
-    {    
-        CommandArgs cmd_args;
-        cmd_args.set_command("SUNIONSTORE");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg(destinationkey);
-        cmd_args.add_args(keys);
-        cmd_args.final();
-
-        // Integer reply, specifically:
-        // Integer reply: the number of elements in the resulting set..
-        const RedisReplyHelper redis_reply = redis_command(false, num_retries, destinationkey, cmd_args, which);
-        if (REDIS_REPLY_INTEGER == redis_reply->type)
-            return static_cast<int>(redis_reply->integer);
-        return 0;
+    {
+        *file_p = std::string(slash_position + 1);
     }
 }
 
+const char* CRedisException::what() const throw()
+{
+    return _errinfo.errmsg.c_str();
+}
 
-//
-// ZSET
-//
-
-// Time complexity:
-// O(M*log(N)) with N being the number of elements in the sorted set and M the number of elements to be removed.
-//
-// ZREM key member [member ...]
-int CRedisClient::zrem(
-        const std::string& key,
-        const std::string& field,
-        Node* which,
-        int num_retries)
+std::string CRedisException::str() const throw ()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZREM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    const std::string& errmsg = format_string("redis_exception://%s:%d/CMD:%s/%s/(%d)%s@%s:%d/(KEY:%.*s)",
+            _node_ip.c_str(), _node_port,
+            _command.c_str(),
+            _errinfo.errtype.c_str(), _errinfo.errcode, _errinfo.errmsg.c_str(),
+            _file.c_str(), _line,
+            static_cast<int>(_key.size()), _key.c_str());
 
-    // Integer reply, specifically:
-    // The number of members removed from the sorted set, not including non existing members.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+#if __cplusplus < 201103L
+    return errmsg;
+#else
+    return std::move(errmsg);
+#endif // __cplusplus < 201103L
 }
 
-// Time complexity:
-// O(M*log(N)) with N being the number of elements in the sorted set and M the number of elements to be removed.
-int CRedisClient::zrem(
-        const std::string& key,
-        const std::vector<std::string>& fields,
-        Node* which,
-        int num_retries)
+bool is_general_error(const std::string& errtype)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZREM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(fields);
-    cmd_args.final();
+    return (errtype.size() == sizeof("ERR")-1) && (errtype == "ERR");
+}
 
-    // Integer reply, specifically:
-    // The number of members removed from the sorted set, not including non existing members.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+bool is_ask_error(const std::string& errtype)
+{
+    return (errtype.size() == sizeof("ASK")-1) && (errtype == "ASK");
 }
 
-// Time complexity:
-// O(log(N)) for each item added, where N is the number of elements in the sorted set.
-//
-// ZADD key [NX|XX] [CH] [INCR] score member [score member ...]
-int CRedisClient::zadd(
-        const std::string& key,
-        const std::string& field,
-        int64_t score,
-        ZADDFLAG flag,
-        Node* which,
-        int num_retries)
+bool is_clusterdown_error(const std::string& errtype)
 {
-    std::map<std::string, int64_t> map;
-    map[field] = score;
-    return zadd(key, map, flag, which, num_retries);
+    // CLUSTERDOWN The cluster is down
+    // 如果在从未成为主之前，将主和从同时干掉，则即使从正常了，从也无法成为主，
+    // 这个时候必须将原来的主恢复，否则该部分slots就不能再服务
+    return (errtype.size() == sizeof("CLUSTERDOWN")-1) && (errtype == "CLUSTERDOWN");
 }
 
-int CRedisClient::zadd(
-        const std::string& key,
-        const std::map<std::string, int64_t>& map,
-        ZADDFLAG flag,
-        Node* which,
-        int num_retries)
+bool is_moved_error(const std::string& errtype)
 {
-    const std::string& flag_str = zaddflag2str(flag);
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZADD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    if (!flag_str.empty())
-    {
-        cmd_args.add_arg(flag_str);
-    }
-    cmd_args.add_args(map, true);
-    cmd_args.final();
+    return (errtype.size() == sizeof("MOVED")-1) && (errtype == "MOVED");
+}
 
-    // Integer reply, specifically:
-    // The number of elements added to the sorted sets, not including
-    // elements already existing for which the score was updated.
-    //
-    // If the INCR option is specified, the return value will be Bulk string reply:
-    // the new score of member (a double precision floating point number), represented as string.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+bool is_tryagain_error(const std::string& errtype)
+{
+    // TRYAGAIN Multiple keys request during rehashing of slot
+    return (errtype.size() == sizeof("TRYAGAIN")-1) && (errtype == "TRYAGAIN");
 }
 
-// Time complexity: O(1)
-int64_t CRedisClient::zcard(const std::string& key, Node* which, int num_retries)
+bool is_noauth_error(const std::string& errtype)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZCARD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    // NOAUTH Authentication required.
+    return (errtype.size() == sizeof("NOAUTH")-1) && (errtype == "NOAUTH");
+}
 
-    // Integer reply:
-    // the cardinality (number of elements) of the sorted set, or 0 if key does not exist.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int64_t>(redis_reply->integer);
-    return 0;
+bool is_noscript_error(const std::string& errtype)
+{
+    // NOSCRIPT No matching script. Please use EVAL.
+    return (errtype.size() == sizeof("NOSCRIPT")-1) && (errtype == "NOSCRIPT");
 }
 
-// Time complexity:
-// O(log(N)) with N being the number of elements in the sorted set.
-//
-// ZCOUNT key min max
-int64_t CRedisClient::zcount(
-        const std::string& key,
-        int64_t min, int64_t max ,
-        Node* which,
-        int num_retries)
+bool is_wrongtype_error(const std::string& errtype)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZCOUNT");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(min);
-    cmd_args.add_arg(max);
-    cmd_args.final();
+    return (errtype.size() == sizeof("WRONGTYPE")-1) && (errtype == "WRONGTYPE");
+}
 
-    // Integer reply:
-    // the number of elements in the specified score range.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int64_t>(redis_reply->integer);
-    return 0;
+bool is_busygroup_error(const std::string& errtype)
+{
+    return (errtype.size() == sizeof("BUSYGROUP")-1) && (errtype == "BUSYGROUP");
 }
 
-// Time complexity:
-// O(log(N)) where N is the number of elements in the sorted set.
-//
-// ZINCRBY key increment member
-int64_t CRedisClient::zincrby(
-        const std::string& key,
-        const std::string& field, int64_t increment,
-        Node* which,
-        int num_retries)
+bool is_nogroup_error(const std::string& errtype)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZINCRBY");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(increment);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    return (errtype.size() == sizeof("NOGROUP")-1) && (errtype == "NOGROUP");
+}
 
-    // Bulk string reply:
-    // the new score of member (a double precision floating point number), represented as string.
-    //
-    // (gdb) p *redis_reply._redis_reply
-    // $4 = {type = 1, integer = 0, len = 2, str = 0x647860 "10", elements = 0, element = 0x0}
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_STRING == redis_reply->type)
-        return static_cast<int64_t>(atoll(redis_reply->str));
-    return 0;
+bool is_crossslot_error(const std::string& errtype)
+{
+    return (errtype.size() == sizeof("CROSSSLOT")-1) && (errtype == "CROSSSLOT");
 }
 
-// Time complexity:
-// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements returned.
-// ZRANGE key start stop [WITHSCORES]
-//
-// ZRANGE key start stop [WITHSCORES]
-int CRedisClient::zrange(
-        const std::string& key,
-        int64_t start, int64_t end, bool withscores,
-        std::vector<std::pair<std::string, int64_t> >* vec,
-        Node* which,
-        int num_retries)
+////////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram & ClientMetrics
+
+LatencyHistogram::LatencyHistogram()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZRANGE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    if (withscores)
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = 0;
+    _sum = 0;
+    _max = 0;
+}
+
+void LatencyHistogram::record(int64_t value)
+{
+    const uint64_t v = (value > 0)? static_cast<uint64_t>(value): 0;
+    uint64_t max_value = _max;
+
+    __sync_fetch_and_add(&_buckets[bucket_index(value)], 1);
+    __sync_fetch_and_add(&_count, 1);
+    __sync_fetch_and_add(&_sum, v);
+    while (v > max_value)
     {
-        cmd_args.add_arg("WITHSCORES");
+        if (__sync_bool_compare_and_swap(&_max, max_value, v))
+            break;
+        max_value = _max;
     }
-    cmd_args.final();
-
-    // Array reply:
-    // list of elements in the specified range (optionally with their scores, in case the WITHSCORES option is given).
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), vec, withscores);
-    return 0;
 }
 
-// Time complexity:
-// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements returned.
-//
-// ZREVRANGE key start stop [WITHSCORES]
-int CRedisClient::zrevrange(
-        const std::string& key,
-        int64_t start, int64_t end, bool withscores,
-        std::vector<std::pair<std::string, int64_t> >* vec,
-        Node* which,
-        int num_retries)
+void LatencyHistogram::reset()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZREVRANGE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    if (withscores)
+    for (int i=0; i<NUM_BUCKETS; ++i)
     {
-        cmd_args.add_arg("WITHSCORES");
+        if (_buckets[i] != 0)
+            __sync_fetch_and_and(&_buckets[i], 0);
     }
-    cmd_args.final();
+    __sync_fetch_and_and(&_count, 0);
+    __sync_fetch_and_and(&_sum, 0);
+    __sync_fetch_and_and(&_max, 0);
+}
 
-    // Array reply:
-    // list of elements in the specified range (optionally with their scores, in case the WITHSCORES option is given).
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), vec, withscores);
-    return 0;
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (int i=0; i<NUM_BUCKETS; ++i)
+        __sync_fetch_and_add(&_buckets[i], other._buckets[i]);
+    __sync_fetch_and_add(&_count, other._count);
+    __sync_fetch_and_add(&_sum, other._sum);
+    if (other._max > _max)
+        _max = other._max;
 }
 
-// Time complexity:
-// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements being returned.
-// If M is constant (e.g. always asking for the first 10 elements with LIMIT), you can consider it O(log(N)).
-//
-// ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
-int CRedisClient::zrangebyscore(
-        const std::string& key,
-        int64_t min, int64_t max, bool withscores,
-        std::vector<std::pair<std::string, int64_t> >* vec,
-        Node* which,
-        int num_retries)
+double LatencyHistogram::mean() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZRANGEBYSCORE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(min);
-    cmd_args.add_arg(max);
-    if (withscores)
+    const uint64_t count = _count;
+    return (0 == count)? 0: static_cast<double>(_sum) / count;
+}
+
+int64_t LatencyHistogram::percentile(double percentile) const
+{
+    const uint64_t count = _count;
+    uint64_t target;
+    uint64_t accumulated = 0;
+
+    if (0 == count)
+        return 0;
+    if (percentile > 100)
+        percentile = 100;
+    target = static_cast<uint64_t>(percentile * count / 100 + 0.5);
+    if (target < 1)
+        target = 1;
+    for (int i=0; i<NUM_BUCKETS; ++i)
+    {
+        accumulated += _buckets[i];
+        if (accumulated >= target)
+        {
+            // 桶的上界不超过记录到的最大值
+            const int64_t upper = bucket_upper(i);
+            return (upper < max())? upper: max();
+        }
+    }
+    return max();
+}
+
+int LatencyHistogram::bucket_index(int64_t value)
+{
+    if (value < SUB_BUCKETS)
     {
-        cmd_args.add_arg("WITHSCORES");
+        return (value > 0)? static_cast<int>(value): 0;
     }
-    cmd_args.final();
+    else
+    {
+        const int msb = 63 - __builtin_clzll(static_cast<unsigned long long>(value));
+        const int shift = msb - SUB_BUCKET_BITS;
 
-    // Array reply:
-    // list of elements in the specified score range (optionally with their scores).
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), vec, withscores);
-    return 0;
+        if (msb >= MAX_VALUE_BITS)
+            return NUM_BUCKETS - 1;
+        return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+    }
 }
 
-// Time complexity:
-// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements being returned.
-// If M is constant (e.g. always asking for the first 10 elements with LIMIT), you can consider it O(log(N)).
-//
-// ZREVRANGEBYSCORE key max min [WITHSCORES] [LIMIT offset count]
-int CRedisClient::zrevrangebyscore(
-        const std::string& key,
-        int64_t max, int64_t min, bool withscores,
-        std::vector<std::pair<std::string, int64_t> >* vec,
-        Node* which,
-        int num_retries)
+int64_t LatencyHistogram::bucket_lower(int bucket)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZREVRANGEBYSCORE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(max);
-    cmd_args.add_arg(min);
-    if (withscores)
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    else
+        return static_cast<int64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << (bucket / SUB_BUCKETS - 1);
+}
+
+int64_t LatencyHistogram::bucket_upper(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    else
+        return bucket_lower(bucket) + (static_cast<int64_t>(1) << (bucket / SUB_BUCKETS - 1)) - 1;
+}
+
+uint64_t LatencyHistogram::cumulative_count(int64_t value) const
+{
+    uint64_t count = 0;
+
+    for (int i=0; i<NUM_BUCKETS && bucket_upper(i)<=value; ++i)
+        count += _buckets[i];
+    if (value >= bucket_upper(NUM_BUCKETS-1))
     {
-        cmd_args.add_arg("WITHSCORES");
+        // 最后一个桶包含了所有更大的值
+        count = 0;
+        for (int i=0; i<NUM_BUCKETS; ++i)
+            count += _buckets[i];
     }
-    cmd_args.final();
+    return count;
+}
 
-    // Array reply:
-    // list of elements in the specified score range (optionally with their scores).
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), vec, withscores);
-    return 0;
+NodeStats::NodeStats()
+    : master(false), bytes_sent(0), bytes_received(0), num_replies(0), inflight(0),
+      num_connects(0), num_reconnects(0), num_connections(0), connected_milliseconds(0),
+      last_error_milliseconds(0)
+{
 }
 
-// ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
-int CRedisClient::zrangebyscore(
-        const std::string& key,
-        int64_t min, int64_t max, int64_t offset, int64_t count, bool withscores,
-        std::vector<std::pair<std::string, int64_t> >* vec,
-        Node* which,
-        int num_retries)
+int64_t NodeStats::connection_age_milliseconds(int64_t now_milliseconds) const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZRANGEBYSCORE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(min);
-    cmd_args.add_arg(max);
-    if (withscores)
-    {
-        cmd_args.add_arg("WITHSCORES");
-    }
-    cmd_args.add_arg("LIMIT");
-    cmd_args.add_arg(offset);
-    cmd_args.add_arg(count);
-    cmd_args.final();
-
-    // Array reply:
-    // list of elements in the specified score range (optionally with their scores).
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), vec, withscores);
-    return 0;
+    if (num_connections<=0 || connected_milliseconds<=0 || now_milliseconds<connected_milliseconds)
+        return 0;
+    return now_milliseconds - connected_milliseconds;
 }
 
-// ZREVRANGEBYSCORE key max min [WITHSCORES] [LIMIT offset count]
-int CRedisClient::zrevrangebyscore(
-        const std::string& key,
-        int64_t max, int64_t min, int64_t offset, int64_t count, bool withscores,
-        std::vector<std::pair<std::string, int64_t> >* vec,
-        Node* which,
-        int num_retries)
+double NodeStats::average_reply_size() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZREVRANGEBYSCORE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(max);
-    cmd_args.add_arg(min);
-    if (withscores)
-    {
-        cmd_args.add_arg("WITHSCORES");
-    }
-    cmd_args.add_arg("LIMIT");
-    cmd_args.add_arg(offset);
-    cmd_args.add_arg(count);
-    cmd_args.final();
+    return (0 == num_replies)? 0: static_cast<double>(bytes_received) / static_cast<double>(num_replies);
+}
 
-    // Array reply:
-    // list of elements in the specified score range (optionally with their scores).
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
-        return get_values(redis_reply.get(), vec, withscores);
-    return 0;
+std::string NodeStats::str() const
+{
+    return format_string("nodestats://%s:%d/%s(sent:%" PRIu64",received:%" PRIu64",replies:%" PRIu64",inflight:%" PRId64",connections:%d,connects:%" PRIu64",reconnects:%" PRIu64")%s",
+            node.first.c_str(), node.second, master? "master": "replica",
+            bytes_sent, bytes_received, num_replies, inflight, num_connections, num_connects, num_reconnects, last_error.c_str());
 }
 
-// Time complexity:
-// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements removed by the operation.
-//
-// ZREMRANGEBYRANK key start stop
-int CRedisClient::zremrangebyrank(
-        const std::string& key,
-        int64_t start, int64_t end,
-        Node* which,
-        int num_retries)
+ClientMetrics::ClientMetrics()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZREMRANGEBYRANK");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    cmd_args.final();
+    clear();
+}
 
-    // Integer reply:
-    // the number of elements removed.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+void ClientMetrics::clear()
+{
+    start_milliseconds = 0;
+    snapshot_milliseconds = 0;
+    num_retries = 0;
+    num_moved = 0;
+    num_asks = 0;
+    num_reconnects = 0;
+    num_timeouts = 0;
+    num_refreshes = 0;
+    commands.clear();
+    nodes.clear();
+    num_masters = 0;
+    num_replicas = 0;
+    num_connected_nodes = 0;
+    num_unmapped_slots = 0;
 }
 
-// Time complexity: O(log(N))
-//
-// ZRANK key member
-int CRedisClient::zrank(const std::string& key, const std::string& field, Node* which, int num_retries)
+void ClientMetrics::merge(const struct ClientMetrics& other)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZRANK");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    std::map<std::pair<Node, std::string>, std::vector<struct CommandMetrics>::size_type> command_table;
 
-    // If member exists in the sorted set, Integer reply: the rank of member.
-    // If member does not exist in the sorted set or key does not exist, Bulk string reply: nil.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
+    if (0==start_milliseconds || (other.start_milliseconds>0 && other.start_milliseconds<start_milliseconds))
+        start_milliseconds = other.start_milliseconds;
+    if (other.snapshot_milliseconds > snapshot_milliseconds)
+        snapshot_milliseconds = other.snapshot_milliseconds;
+    num_retries += other.num_retries;
+    num_moved += other.num_moved;
+    num_asks += other.num_asks;
+    num_reconnects += other.num_reconnects;
+    num_timeouts += other.num_timeouts;
+    num_refreshes += other.num_refreshes;
+    num_masters = std::max(num_masters, other.num_masters);
+    num_replicas = std::max(num_replicas, other.num_replicas);
+    num_connected_nodes = std::max(num_connected_nodes, other.num_connected_nodes);
+    num_unmapped_slots = std::max(num_unmapped_slots, other.num_unmapped_slots);
+
+    for (std::vector<struct CommandMetrics>::size_type i=0; i<commands.size(); ++i)
+        command_table[std::make_pair(commands[i].node, commands[i].command)] = i;
+    for (std::vector<struct CommandMetrics>::size_type i=0; i<other.commands.size(); ++i)
     {
-        return -1;
+        const struct CommandMetrics& command_metrics = other.commands[i];
+        const std::pair<Node, std::string> key(command_metrics.node, command_metrics.command);
+        const std::map<std::pair<Node, std::string>, std::vector<struct CommandMetrics>::size_type>::const_iterator iter = command_table.find(key);
+
+        if (iter == command_table.end())
+        {
+            command_table[key] = commands.size();
+            commands.push_back(command_metrics);
+        }
+        else
+        {
+            commands[iter->second].latency.merge(command_metrics.latency);
+            commands[iter->second].num_errors += command_metrics.num_errors;
+            commands[iter->second].cost.add(command_metrics.cost);
+        }
     }
-    else
+
+    std::map<Node, std::vector<struct NodeStats>::size_type> node_table;
+    for (std::vector<struct NodeStats>::size_type i=0; i<nodes.size(); ++i)
+        node_table[nodes[i].node] = i;
+    for (std::vector<struct NodeStats>::size_type i=0; i<other.nodes.size(); ++i)
     {
-        if (REDIS_REPLY_INTEGER == redis_reply->type)
-            return static_cast<int>(redis_reply->integer);
-        return 0;
+        const struct NodeStats& node_stats = other.nodes[i];
+        const std::map<Node, std::vector<struct NodeStats>::size_type>::const_iterator iter = node_table.find(node_stats.node);
+
+        if (iter == node_table.end())
+        {
+            node_table[node_stats.node] = nodes.size();
+            nodes.push_back(node_stats);
+        }
+        else
+        {
+            struct NodeStats& merged = nodes[iter->second];
+
+            merged.bytes_sent += node_stats.bytes_sent;
+            merged.bytes_received += node_stats.bytes_received;
+            merged.num_replies += node_stats.num_replies;
+            merged.inflight += node_stats.inflight;
+            merged.num_connects += node_stats.num_connects;
+            merged.num_reconnects += node_stats.num_reconnects;
+            merged.reconnect_milliseconds.insert(merged.reconnect_milliseconds.end(),
+                    node_stats.reconnect_milliseconds.begin(), node_stats.reconnect_milliseconds.end());
+            std::sort(merged.reconnect_milliseconds.begin(), merged.reconnect_milliseconds.end());
+            merged.num_connections += node_stats.num_connections;
+            if (node_stats.connected_milliseconds > merged.connected_milliseconds)
+                merged.connected_milliseconds = node_stats.connected_milliseconds;
+            if (node_stats.last_error_milliseconds > merged.last_error_milliseconds)
+            {
+                merged.master = node_stats.master;
+                merged.last_error = node_stats.last_error;
+                merged.last_error_milliseconds = node_stats.last_error_milliseconds;
+            }
+        }
     }
 }
 
-int CRedisClient::zrevrank(const std::string& key, const std::string& field, Node* which, int num_retries)
+// Upper bounds of the buckets of the histograms rendered, in microseconds
+static const int64_t openmetrics_buckets[] =
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZREVRANK");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
 
-    // If member exists in the sorted set, Integer reply: the rank of member.
-    // If member does not exist in the sorted set or key does not exist, Bulk string reply: nil.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
+static std::string escape_label_value(const std::string& value)
+{
+    std::string escaped;
+
+    escaped.reserve(value.size());
+    for (std::string::size_type i=0; i<value.size(); ++i)
     {
-        return -1;
+        if ('\\' == value[i])
+            escaped += "\\\\";
+        else if ('"' == value[i])
+            escaped += "\\\"";
+        else if ('\n' == value[i])
+            escaped += "\\n";
+        else
+            escaped += value[i];
     }
-    else
+    return escaped;
+}
+
+static void render_family(std::string* text, const std::string& name, const char* type, const char* help)
+{
+    *text += format_string("# TYPE %s %s\n", name.c_str(), type);
+    *text += format_string("# HELP %s %s\n", name.c_str(), help);
+}
+
+// Only if the accounting enabled
+static void render_command_costs(std::string* text, const struct ClientMetrics& metrics, const std::string& name_space)
+{
+    static const char* names[] =
     {
-        if (REDIS_REPLY_INTEGER == redis_reply->type)
-            return static_cast<int>(redis_reply->integer);
-        return 0;
+        "accounted", "allocations", "allocated_bytes", "modelled_copied_bytes", "syscalls"
+    };
+    static const char* helps[] =
+    {
+        "Commands accounted, the denominator of the costs.",
+        "Heap allocations of r3c and hiredis for the commands, measured by the allocation hook (0 if not linked).",
+        "Bytes allocated by r3c and hiredis for the commands, measured by the allocation hook (0 if not linked).",
+        "Bytes copied by r3c and hiredis for the commands, modelled from the sizes of the command and the reply.",
+        "read and write syscalls of the commands."
+    };
+    bool accounted = false;
+
+    for (std::vector<struct CommandMetrics>::size_type i=0; i<metrics.commands.size() && !accounted; ++i)
+        accounted = metrics.commands[i].cost.num_commands > 0;
+    if (!accounted)
+        return;
+
+    for (size_t k=0; k<sizeof(names)/sizeof(names[0]); ++k)
+    {
+        const std::string family = format_string("%s_command_%s", name_space.c_str(), names[k]);
+
+        render_family(text, family, "counter", helps[k]);
+        for (std::vector<struct CommandMetrics>::size_type i=0; i<metrics.commands.size(); ++i)
+        {
+            const struct CommandMetrics& command_metrics = metrics.commands[i];
+            const struct CommandCost& cost = command_metrics.cost;
+            const std::string labels = format_string("node=\"%s\",command=\"%s\"",
+                    escape_label_value(node2string(command_metrics.node)).c_str(), escape_label_value(command_metrics.command).c_str());
+
+            if (0 == cost.num_commands)
+                continue;
+            switch (k)
+            {
+            case 0:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), cost.num_commands);
+                break;
+            case 1:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), cost.num_allocations);
+                break;
+            case 2:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), cost.allocated_bytes);
+                break;
+            case 3:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), cost.modelled_copied_bytes);
+                break;
+            default:
+                *text += format_string("%s_total{%s,op=\"read\"} %" PRIu64"\n", family.c_str(), labels.c_str(), cost.num_reads);
+                *text += format_string("%s_total{%s,op=\"write\"} %" PRIu64"\n", family.c_str(), labels.c_str(), cost.num_writes);
+                break;
+            }
+        }
     }
 }
 
-// Time complexity: O(1)
-// ZSCORE key member
-int64_t CRedisClient::zscore(const std::string& key, const std::string& field, Node* which, int num_retries)
+static void render_node_stats(std::string* text, const struct ClientMetrics& metrics, const std::string& name_space)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZSCORE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(field);
-    cmd_args.final();
+    static const char* names[] = { "sent_bytes", "received_bytes", "replies", "reconnects", "inflight_commands", "connections", "connection_age_seconds" };
+    static const char* types[] = { "counter", "counter", "counter", "counter", "gauge", "gauge", "gauge" };
+    static const char* helps[] =
+    {
+        "Bytes of the commands sent to the node.",
+        "Bytes of the replies read from the node.",
+        "Replies read from the node, including the error replies.",
+        "Connections to the node closed by errors to be reconnected.",
+        "Commands sent to the node but the replies not read yet.",
+        "Connections to the node established.",
+        "Age of the newest connection to the node, 0 if not connected."
+    };
 
-    // Bulk string reply:
-    // the score of member (a double precision floating point number), represented as string.
-    // If member does not exist in the sorted set, or key does not exist, nil is returned.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_NIL == redis_reply->type)
+    for (size_t k=0; k<sizeof(names)/sizeof(names[0]); ++k)
     {
-        return -1;
+        const std::string family = format_string("%s_node_%s", name_space.c_str(), names[k]);
+
+        render_family(text, family, types[k], helps[k]);
+        for (std::vector<struct NodeStats>::size_type i=0; i<metrics.nodes.size(); ++i)
+        {
+            const struct NodeStats& node_stats = metrics.nodes[i];
+            const std::string labels = format_string("node=\"%s\"", escape_label_value(node2string(node_stats.node)).c_str());
+
+            switch (k)
+            {
+            case 0:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), node_stats.bytes_sent);
+                break;
+            case 1:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), node_stats.bytes_received);
+                break;
+            case 2:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), node_stats.num_replies);
+                break;
+            case 3:
+                *text += format_string("%s_total{%s} %" PRIu64"\n", family.c_str(), labels.c_str(), node_stats.num_reconnects);
+                break;
+            case 4:
+                *text += format_string("%s{%s} %" PRId64"\n", family.c_str(), labels.c_str(), node_stats.inflight);
+                break;
+            case 5:
+                *text += format_string("%s{%s} %d\n", family.c_str(), labels.c_str(), node_stats.num_connections);
+                break;
+            default:
+                *text += format_string("%s{%s} %.3f\n", family.c_str(), labels.c_str(),
+                        node_stats.connection_age_milliseconds(metrics.snapshot_milliseconds)/1000.0);
+                break;
+            }
+        }
     }
-    else
+}
+
+std::string render_openmetrics(const struct ClientMetrics& metrics, const std::string& name_space)
+{
+    const std::string duration_name = name_space + "_command_duration_seconds";
+    const std::string errors_name = name_space + "_command_errors";
+    std::string text;
+
+    render_family(&text, duration_name, "histogram", "Latency of the attempts of the commands.");
+    text += format_string("# UNIT %s seconds\n", duration_name.c_str());
+    for (std::vector<struct CommandMetrics>::size_type i=0; i<metrics.commands.size(); ++i)
     {
-        if (REDIS_REPLY_STRING == redis_reply->type)
-            return static_cast<int64_t>(atoll(redis_reply->str));
-        return 0;
-    }
+        const struct CommandMetrics& command_metrics = metrics.commands[i];
+        const std::string labels = format_string("node=\"%s\",command=\"%s\"",
+                escape_label_value(node2string(command_metrics.node)).c_str(), escape_label_value(command_metrics.command).c_str());
+        // 用桶的总数作为count，保证与+Inf桶一致
+        const uint64_t count = command_metrics.latency.cumulative_count(LatencyHistogram::bucket_upper(LatencyHistogram::NUM_BUCKETS-1));
+
+        for (size_t j=0; j<sizeof(openmetrics_buckets)/sizeof(openmetrics_buckets[0]); ++j)
+        {
+            text += format_string("%s_bucket{%s,le=\"%g\"} %" PRIu64"\n",
+                    duration_name.c_str(), labels.c_str(), openmetrics_buckets[j]/1000000.0,
+                    command_metrics.latency.cumulative_count(openmetrics_buckets[j]));
+        }
+        text += format_string("%s_bucket{%s,le=\"+Inf\"} %" PRIu64"\n", duration_name.c_str(), labels.c_str(), count);
+        text += format_string("%s_count{%s} %" PRIu64"\n", duration_name.c_str(), labels.c_str(), count);
+        text += format_string("%s_sum{%s} %.6f\n", duration_name.c_str(), labels.c_str(), command_metrics.latency.sum()/1000000.0);
+    }
+    render_family(&text, errors_name, "counter", "Attempts of the commands failed, including the error replies.");
+    for (std::vector<struct CommandMetrics>::size_type i=0; i<metrics.commands.size(); ++i)
+    {
+        const struct CommandMetrics& command_metrics = metrics.commands[i];
+        text += format_string("%s_total{node=\"%s\",command=\"%s\"} %" PRIu64"\n", errors_name.c_str(),
+                escape_label_value(node2string(command_metrics.node)).c_str(), escape_label_value(command_metrics.command).c_str(),
+                command_metrics.num_errors);
+    }
+    render_command_costs(&text, metrics, name_space);
+    render_node_stats(&text, metrics, name_space);
+
+    render_family(&text, name_space+"_retries", "counter", "Attempts after the first of the commands.");
+    text += format_string("%s_retries_total %" PRIu64"\n", name_space.c_str(), metrics.num_retries);
+    render_family(&text, name_space+"_redirects", "counter", "MOVED and ASK replies.");
+    text += format_string("%s_redirects_total{type=\"moved\"} %" PRIu64"\n", name_space.c_str(), metrics.num_moved);
+    text += format_string("%s_redirects_total{type=\"ask\"} %" PRIu64"\n", name_space.c_str(), metrics.num_asks);
+    render_family(&text, name_space+"_reconnects", "counter", "Connections closed by errors to be reconnected.");
+    text += format_string("%s_reconnects_total %" PRIu64"\n", name_space.c_str(), metrics.num_reconnects);
+    render_family(&text, name_space+"_timeouts", "counter", "Attempts timed out.");
+    text += format_string("%s_timeouts_total %" PRIu64"\n", name_space.c_str(), metrics.num_timeouts);
+    render_family(&text, name_space+"_refreshes", "counter", "Refreshes of the master nodes table.");
+    text += format_string("%s_refreshes_total %" PRIu64"\n", name_space.c_str(), metrics.num_refreshes);
+
+    render_family(&text, name_space+"_masters", "gauge", "Masters known.");
+    text += format_string("%s_masters %d\n", name_space.c_str(), metrics.num_masters);
+    render_family(&text, name_space+"_replicas", "gauge", "Replicas known.");
+    text += format_string("%s_replicas %d\n", name_space.c_str(), metrics.num_replicas);
+    render_family(&text, name_space+"_connected_nodes", "gauge", "Nodes having at least a connection.");
+    text += format_string("%s_connected_nodes %d\n", name_space.c_str(), metrics.num_connected_nodes);
+    render_family(&text, name_space+"_unmapped_slots", "gauge", "Slots not owned by any known master.");
+    text += format_string("%s_unmapped_slots %d\n", name_space.c_str(), metrics.num_unmapped_slots);
+    text += "# EOF\n";
+    return text;
 }
 
-// Time complexity:
-// O(1) for every call. O(N) for a complete iteration,
-// including enough command calls for the cursor to return back to 0. N is the number of elements inside the collection..
-//
-// ZSCAN key cursor [MATCH pattern] [COUNT count]
-int64_t CRedisClient::zscan(
-        const std::string& key,
-        int64_t cursor,
-        std::vector<std::pair<std::string, int64_t> >* values,
-        Node* which,
-        int num_retries)
+////////////////////////////////////////////////////////////////////////////////
+// CommandSpan
+
+CommandSpan::CommandSpan()
+    : command_args(NULL), slot(-1), readonly(false), replica(false),
+      attempt(0), num_redirects(0), start_us(0), stop_us(0),
+      result(CRedisClient::HR_SUCCESS), request_bytes(0), reply_bytes(0)
 {
-    return zscan(key, cursor, std::string(""), 0, values, which, num_retries);
 }
 
-int64_t CRedisClient::zscan(
-        const std::string& key,
-        int64_t cursor, int count,
-        std::vector<std::pair<std::string, int64_t> >* values,
-        Node* which,
-        int num_retries)
+static size_t num_digits(long long n)
 {
-    return zscan(key, cursor, std::string(""), count, values, which, num_retries);
+    size_t digits = (n < 0)? 2: 1;
+
+    for (n/=10; n!=0; n/=10)
+        ++digits;
+    return digits;
 }
 
-int64_t CRedisClient::zscan(
-        const std::string& key,
-        int64_t cursor, const std::string& pattern,
-        std::vector<std::pair<std::string, int64_t> >* values,
-        Node* which,
-        int num_retries)
+// Size of the command in the protocol, like "*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n"
+static size_t get_command_size(const CommandArgs& command_args)
 {
-    return zscan(key, cursor, pattern, 0, values, which, num_retries);
+    const size_t* argvlen = command_args.get_argvlen();
+    size_t size = 1 + num_digits(command_args.get_argc()) + 2;
+
+    for (int i=0; i<command_args.get_argc(); ++i)
+        size += 1 + num_digits(static_cast<long long>(argvlen[i])) + 2 + argvlen[i] + 2;
+    return size;
 }
 
-int64_t CRedisClient::zscan(
-        const std::string& key,
-        int64_t cursor, const std::string& pattern, int count,
-        std::vector<std::pair<std::string, int64_t> >* values,
-        Node* which,
-        int num_retries)
+// Size of the reply in the protocol, the status and the bulk string are not distinguished by hiredis
+static size_t get_reply_size(const redisReply* redis_reply)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("ZSCAN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(cursor);
-    if (!pattern.empty())
+    switch (redis_reply->type)
     {
-        cmd_args.add_arg("MATCH");
-        cmd_args.add_arg(pattern);
+    case REDIS_REPLY_STRING:
+        return 1 + num_digits(redis_reply->len) + 2 + redis_reply->len + 2;
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_ERROR:
+        return 1 + redis_reply->len + 2;
+    case REDIS_REPLY_INTEGER:
+        return 1 + num_digits(redis_reply->integer) + 2;
+    case REDIS_REPLY_ARRAY:
+        {
+            size_t size = 1 + num_digits(static_cast<long long>(redis_reply->elements)) + 2;
+            for (size_t i=0; i<redis_reply->elements; ++i)
+                size += get_reply_size(redis_reply->element[i]);
+            return size;
+        }
+    default:
+        return sizeof("$-1\r\n") - 1; // REDIS_REPLY_NIL
     }
-    if (count > 0)
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RandomFaultInjector
+
+static const char* g_fault_names[FaultInjector::FAULT_MAX] =
+{
+    "none", "connect", "timeout", "eof", "partial_read", "moved", "clusterdown"
+};
+
+RandomFaultInjector::RandomFaultInjector(uint64_t seed)
+    : _seed(seed), _burst_fault(FAULT_NONE), _burst_remaining(0)
+{
+    if (0 == _seed)
     {
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        _seed = static_cast<uint64_t>(tv.tv_sec) * 1000000 + static_cast<uint64_t>(tv.tv_usec);
+        _seed ^= static_cast<uint64_t>(pthread_self());
+        if (0 == _seed)
+            _seed = 2019;
     }
-    cmd_args.final();
-
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_ARRAY == redis_reply->type)
+    for (int i=0; i<FAULT_MAX; ++i)
     {
-        get_values(redis_reply->element[1], values, true);
-        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+        _probabilities[i] = 0;
+        _burst_lengths[i] = 1;
+        _num_faults[i] = 0;
     }
-    return 0;
 }
 
-//
-// STREAM
-//
-
-// 从待处理条目列表（PEL）中移除待处理条目（ids），
-// 因为一旦消息被成功处理，消费者组就不再需要跟踪它并记住消息的当前所有者
-// Time complexity: O(1) for each message ID processed.
-// XACK key group ID [ID ...]
-int CRedisClient::xack(
-        const std::string& key, const std::string& groupname,
-        const std::vector<std::string>& ids,
-        Node* which, int num_retries)
+void RandomFaultInjector::set_probability(int fault_type, double probability, int burst_length)
 {
-    std::string value;
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XACK");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(groupname);
-    cmd_args.add_args(ids);
-    cmd_args.final();
-
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+    if (fault_type>FAULT_NONE && fault_type<FAULT_MAX)
+    {
+        _probabilities[fault_type] = (probability < 0)? 0: ((probability > 1)? 1: probability);
+        _burst_lengths[fault_type] = (burst_length < 1)? 1: burst_length;
+    }
 }
 
-int CRedisClient::xack(
-        const std::string& key, const std::string& groupname,
-        const std::string& id,
-        Node* which, int num_retries)
+double RandomFaultInjector::get_probability(int fault_type) const
 {
-    std::vector<std::string> ids(1);
-    ids[0] = id;
-    return xack(key, groupname, ids, which, num_retries);
+    return (fault_type>FAULT_NONE && fault_type<FAULT_MAX)? _probabilities[fault_type]: 0;
 }
 
-// Time complexity: O(1)
-// XADD key [MAXLEN [~|=] <count>] <ID or *> [field value] [field value] ...
-std::string CRedisClient::xadd(
-        const std::string& key, const std::string& id,
-        const std::vector<FVPair>& values,
-        int64_t maxlen, char c,
-        Node* which, int num_retries)
+bool RandomFaultInjector::set_probabilities(const std::string& spec)
 {
-    std::string value;
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XADD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg("MAXLEN");
-    cmd_args.add_arg(c);
-    cmd_args.add_arg(maxlen);
-    cmd_args.add_arg(id);
-    cmd_args.add_args(values);
-    cmd_args.final();
+    std::vector<std::string> tokens;
+    const int num_tokens = split(&tokens, spec, std::string(","), true);
 
-    // The command returns the number of messages successfully acknowledged.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    //if (REDIS_REPLY_STRING == redis_reply->type)
-    (void)get_value(redis_reply.get(), &value);
-    return value;
+    for (int i=0; i<num_tokens; ++i)
+    {
+        const std::string::size_type eq_pos = tokens[i].find('=');
+        if (eq_pos == std::string::npos)
+            return false;
+
+        const std::string name = tokens[i].substr(0, eq_pos);
+        const std::string value = tokens[i].substr(eq_pos+1);
+        const std::string::size_type colon_pos = value.find(':');
+        const double probability = atof(value.substr(0, colon_pos).c_str());
+        const int burst_length = (colon_pos == std::string::npos)? 1: atoi(value.substr(colon_pos+1).c_str());
+        int fault_type = FAULT_NONE;
+
+        for (int j=FAULT_NONE+1; j<FAULT_MAX; ++j)
+        {
+            if (name == g_fault_names[j])
+            {
+                fault_type = j;
+                break;
+            }
+        }
+        if (FAULT_NONE==fault_type || probability<0 || probability>1 || burst_length<1)
+            return false;
+        set_probability(fault_type, probability, burst_length);
+    }
+    return true;
 }
 
-std::string CRedisClient::xadd(
-        const std::string& key, const std::string& id,
-        const std::vector<FVPair>& values,
-        Node* which, int num_retries)
+uint64_t RandomFaultInjector::get_num_faults(int fault_type) const
 {
-    std::string value;
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XADD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(id);
-    cmd_args.add_args(values);
-    cmd_args.final();
+    return (fault_type>FAULT_NONE && fault_type<FAULT_MAX)? _num_faults[fault_type]: 0;
+}
 
-    // The command returns the number of messages successfully acknowledged.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    //if (REDIS_REPLY_STRING == redis_reply->type)
-    (void)get_value(redis_reply.get(), &value);
-    return value;
+uint64_t RandomFaultInjector::get_num_faults() const
+{
+    uint64_t num_faults = 0;
+    for (int i=FAULT_NONE+1; i<FAULT_MAX; ++i)
+        num_faults += _num_faults[i];
+    return num_faults;
 }
 
-// Time complexity: O(1) for all the subcommands, with the exception of the
-// DESTROY subcommand which takes an additional O(M) time in order to delete
-// the M entries inside the consumer group pending entries list (PEL).
-//
-// XGROUP CREATE key(topic) groupname id-or-$
-bool CRedisClient::xgroup_create(
-        const std::string& key, const std::string& groupname, const std::string& id,
-        bool mkstream,
-        Node* which, int num_retries)
+const char* RandomFaultInjector::get_fault_name(int fault_type)
 {
-    // xgroup CREATE key groupname id-or-$
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XGROUP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg("CREATE");
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(groupname);
-    cmd_args.add_arg(id);
-    if (mkstream)
+    return (fault_type>=FAULT_NONE && fault_type<FAULT_MAX)? g_fault_names[fault_type]: "unknown";
+}
+
+bool RandomFaultInjector::on_connect(const Node& UNUSED(node))
+{
+    if ((_probabilities[FAULT_CONNECT] > 0) && (random() < _probabilities[FAULT_CONNECT]))
     {
-        // ERR The XGROUP subcommand requires the key to exist.
-        // Note that for CREATE you may want to use the MKSTREAM option to create an empty stream automatically.
-        cmd_args.add_arg("MKSTREAM");
+        ++_num_faults[FAULT_CONNECT];
+        return true;
     }
-    cmd_args.final();
+    return false;
+}
 
-    try
+int RandomFaultInjector::on_command(const Node& UNUSED(node), const CommandArgs& UNUSED(command_args))
+{
+    int fault_type = FAULT_NONE;
+
+    if (_burst_remaining > 0)
     {
-        // If the specified consumer group already exists, the command returns a -BUSYGROUP error.
-        // Otherwise the operation is performed and OK is returned.
-        // There are no hard limits to the number of consumer groups you can associate to a given stream.
-        //
-        // Consumers in a consumer group are auto-created every time a new consumer name is mentioned by some command.
-        //
-        // 如果key不存在，则会报如下错误：
-        // The XGROUP subcommand requires the key to exist.
-        // Note that for CREATE you may want to use the MKSTREAM option to create an empty stream automatically.
-        const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-        std::string val;
-        get_value(redis_reply.get(), &val);
-        // When a consumer group with the same name already exists, the command returns a -BUSYGROUP error.
-        return val == "OK";
+        // 风暴期间的命令得到同样的错误
+        --_burst_remaining;
+        fault_type = _burst_fault;
     }
-    catch (r3c::CRedisException& ex)
+    else
     {
-        // BUSYGROUP Consumer Group name already exists
-        if (r3c::is_busygroup_error(ex.errtype()))
-            return false;
-        else
-            throw;
+        // 每种故障独立判定，取第一个命中的
+        for (int i=FAULT_TIMEOUT; i<FAULT_MAX; ++i)
+        {
+            if ((_probabilities[i] > 0) && (random() < _probabilities[i]))
+            {
+                fault_type = i;
+                if (FAULT_MOVED==i || FAULT_CLUSTERDOWN==i)
+                {
+                    _burst_fault = i;
+                    _burst_remaining = _burst_lengths[i] - 1;
+                }
+                break;
+            }
+        }
     }
+    if (fault_type != FAULT_NONE)
+        ++_num_faults[fault_type];
+    return fault_type;
 }
 
-// To just remove a given consumer from a consumer group.
-// Consumers in a consumer group are auto-created every time a new consumer name is mentioned by some command.
-//
-// XGROUP DESTROY key groupname
-bool CRedisClient::xgroup_destroy(const std::string& key, const std::string& groupname, Node* which, int num_retries)
+// xorshift64*, in [0, 1)
+double RandomFaultInjector::random()
 {
-    // xgroup DESTROY key groupname
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XGROUP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg("DESTROY");
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(groupname);
-    cmd_args.final();
+    _seed ^= _seed >> 12;
+    _seed ^= _seed << 25;
+    _seed ^= _seed >> 27;
+    return static_cast<double>((_seed * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
 
-    // The consumer group will be destroyed even if there are active consumers
-    // and pending messages, so make sure to call this command only when really needed.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    // Integer reply: the number of destroyed consumer groups (0 or 1)
-    return get_value(redis_reply.get()) == 1;
+////////////////////////////////////////////////////////////////////////////////
+// CRedisClient
+
+CRedisClient::CRedisClient(
+        const std::string& raw_nodes_string,
+        int connect_timeout_milliseconds,
+        int readwrite_timeout_milliseconds,
+        const std::string& password,
+        ReadPolicy read_policy
+        )
+            : _command_monitor(NULL),
+              _fault_injector(NULL),
+              _raw_nodes_string(raw_nodes_string),
+              _connect_timeout_milliseconds(connect_timeout_milliseconds),
+              _readwrite_timeout_milliseconds(readwrite_timeout_milliseconds),
+              _password(password),
+              _read_policy(read_policy),
+              _deadline_milliseconds(0)
+{
+    init();
 }
 
-// XGROUP SETID key groupname id-or-$
-void CRedisClient::xgroup_setid(const std::string& key, const std::string& id, Node* which, int num_retries)
+CRedisClient::CRedisClient(
+        const std::string& raw_nodes_string,
+        const std::string& password,
+        int connect_timeout_milliseconds,
+        int readwrite_timeout_milliseconds,
+        ReadPolicy read_policy)
+            : _command_monitor(NULL),
+              _fault_injector(NULL),
+              _raw_nodes_string(raw_nodes_string),
+              _connect_timeout_milliseconds(connect_timeout_milliseconds),
+              _readwrite_timeout_milliseconds(readwrite_timeout_milliseconds),
+              _password(password),
+              _read_policy(read_policy),
+              _deadline_milliseconds(0)
 {
-    // xgroup SETID key id-or-$
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XGROUP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg("SETID");
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(id);
-    cmd_args.final();
+    init();
+}
 
-    (void)redis_command(false, num_retries, key, cmd_args, which);
+CRedisClient::CRedisClient(
+        const std::string& raw_nodes_string,
+        ReadPolicy read_policy,
+        const std::string& password,
+        int connect_timeout_milliseconds,
+        int readwrite_timeout_milliseconds)
+            : _command_monitor(NULL),
+              _fault_injector(NULL),
+              _raw_nodes_string(raw_nodes_string),
+              _connect_timeout_milliseconds(connect_timeout_milliseconds),
+              _readwrite_timeout_milliseconds(readwrite_timeout_milliseconds),
+              _password(password),
+              _read_policy(read_policy),
+              _deadline_milliseconds(0)
+{
+    init();
 }
 
-// XGROUP DELCONSUMER key groupname consumername
-int64_t CRedisClient::xgroup_delconsumer(const std::string& key, const std::string& groupname, const std::string& consumername, Node* which, int num_retries)
+CRedisClient::~CRedisClient()
 {
-    // xgroup DELCONSUMER key groupname consumername
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XGROUP");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg("DELCONSUMER");
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(groupname);
-    cmd_args.add_arg(consumername);
-    cmd_args.final();
+    fini();
+}
 
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+const std::string& CRedisClient::get_raw_nodes_string() const
+{
+    return _raw_nodes_string;
 }
 
-// XREADGROUP命令是XREAD命令的特殊版本，支持消费者组
-// 当使用XREADGROUP读取时，服务器将会记住某个给定的消息已经传递：
-// 消息会被存储在消费者组内的待处理条目列表（PEL）中，即已送达但尚未确认的消息ID列表。
-// 客户端必须使用XACK确认消息处理，以便从待处理条目列表中删除待处理条目，
-// 还可以使用XPENDING命令检查待处理条目列表。
-//
-// 特殊ID“>”，意味着消费者希望只接收从未发送给任何其他消费者的消息，即只读取新的消息
-//
-// Reads more than one keys
-//
-// Available since 5.0.0.
-// Time complexity: For each stream mentioned: O(M) with M being the number
-// of elements returned. If M is constant (e.g. always asking for the first 10
-// elements with COUNT), you can consider it O(1). On the other side when
-// XREADGROUP blocks, XADD will pay the O(N) time in order to serve the N
-// clients blocked on the stream getting new data.
-//
-// XREADGROUP GROUP group consumer [COUNT count] [BLOCK milliseconds] [NOACK] STREAMS key [key ...] ID [ID ...]
-void CRedisClient::xreadgroup(
-        const std::string& groupname, const std::string& consumername,
-        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
-        int64_t count, int64_t block_milliseconds, bool noack,
-        std::vector<Stream>* values,
-        Node* which, int num_retries)
+const std::string& CRedisClient::get_nodes_string() const
 {
-    if (keys.empty())
-    {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "ERR";
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.raw_errmsg = "wrong number of arguments for 'xreadgroup' command";
-        errinfo.errmsg = format_string("[R3C_XREADGROUP][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
-    }
-    else if (keys.size() != ids.size())
-    {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "ERR";
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.raw_errmsg = "unbalanced XREADGROUP list of streams: for each stream key an ID or '$' must be specified";
-        errinfo.errmsg = format_string("[R3C_XREADGROUP][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
-    }
-    else if (cluster_mode() && keys_crossslots(keys))
-    {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "CROSSSLOT";
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.raw_errmsg = "keys in request don't hash to the same slot";
-        errinfo.errmsg = format_string("[R3C_XREADGROUP][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
-    }
+    return _nodes_string;
+}
+
+std::string CRedisClient::str() const
+{
+    if (cluster_mode())
+        return std::string("rediscluster://") + _raw_nodes_string;
     else
-    {
-        const std::string key = cluster_mode()? keys[0]: std::string("");
-        std::string value;
-        CommandArgs cmd_args;
-        if (!key.empty())
-            cmd_args.set_key(key);
-        cmd_args.set_command("XREADGROUP");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg("GROUP");
-        cmd_args.add_arg(groupname);
-        cmd_args.add_arg(consumername);
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
-        if (block_milliseconds >= 0) // timeout is negative
-        {
-            cmd_args.add_arg("BLOCK");
-            cmd_args.add_arg(block_milliseconds);
-        }
-        if (noack)
-        {
-            cmd_args.add_arg("NOACK");
-        }
-        cmd_args.add_arg("STREAMS");
-        cmd_args.add_args(keys);
-        cmd_args.add_args(ids);
-        cmd_args.final();
+        return std::string("redisstandalone://") + _raw_nodes_string;
+}
 
-        // REDIS_REPLY_ARRAY
-        const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-        get_values(redis_reply.get(), values);
-    }
+bool CRedisClient::cluster_mode() const
+{
+    return _nodes.size() > 1;
 }
 
-// Reads more than one keys
-void CRedisClient::xreadgroup(
-        const std::string& groupname, const std::string& consumername,
-        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
-        int64_t count, bool noack,
-        std::vector<Stream>* values,
-        Node* which, int num_retries)
+const char* CRedisClient::get_mode_str() const
 {
-    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
-    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, values, which, num_retries);
+    return cluster_mode()? "CLUSTER": "STANDALONE";
 }
 
-// Reads more than one keys
-void CRedisClient::xreadgroup(
-        const std::string& groupname, const std::string& consumername,
-        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
-        bool noack,
-        std::vector<Stream>* values,
-        Node* which, int num_retries)
+void CRedisClient::enable_debug_log()
 {
-    const int64_t count = 0;
-    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
-    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, values, which, num_retries);
+    _enable_debug_log = true;
 }
 
-// Only read one key
-void CRedisClient::xreadgroup(
-        const std::string& groupname, const std::string& consumername,
-        const std::string& key, const std::string& id,
-        int64_t count, int64_t block_milliseconds,
-        bool noack,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+void CRedisClient::disable_debug_log()
 {
-    std::vector<Stream> streams;
-    std::vector<std::string> keys(1);
-    std::vector<std::string> ids(1);
+    _enable_debug_log = false;
+}
 
-    keys[0] = key;
-    ids[0] = id;
-    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, &streams, which, num_retries);
-    if (!streams.empty())
-        values->swap(streams[0].entries);
+void CRedisClient::enable_info_log()
+{
+    _enable_info_log = true;
 }
 
-// Only read one key
-void CRedisClient::xreadgroup(
-        const std::string& groupname, const std::string& consumername,
-        const std::string& key,
-        int64_t count, int64_t block_milliseconds,
-        bool noack,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+void CRedisClient::disable_info_log()
 {
-    std::vector<Stream> streams;
-    std::vector<std::string> keys(1);
-    std::vector<std::string> ids(1);
+    _enable_info_log = false;
+}
 
-    keys[0] = key;
-    ids[0] = ">";
-    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, &streams, which, num_retries);
-    if (!streams.empty())
-        values->swap(streams[0].entries);
+void CRedisClient::enable_error_log()
+{
+    _enable_error_log = true;
 }
 
-// Reads more than one keys
-// XREAD [COUNT count] [BLOCK milliseconds] STREAMS key [key ...] ID [ID ...]
-void CRedisClient::xread(
-        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
-        int64_t count, int64_t block_milliseconds,
-        std::vector<Stream>* values, Node* which, int num_retries)
+void CRedisClient::disable_error_log()
 {
-    if (keys.empty())
-    {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "ERR";
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.raw_errmsg = "wrong number of arguments for 'xread' command";
-        errinfo.errmsg = format_string("[R3C_XREAD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
-    }
-    else if (keys.size() != ids.size())
-    {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "ERR";
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.raw_errmsg = "unbalanced XREAD list of streams: for each stream key an ID or '$' must be specified";
-        errinfo.errmsg = format_string("[R3C_XREAD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
-    }
-    else if (cluster_mode() && keys_crossslots(keys))
-    {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "CROSSSLOT";
-        errinfo.errcode = ERROR_PARAMETER;
-        errinfo.raw_errmsg = "keys in request don't hash to the same slot";
-        errinfo.errmsg = format_string("[R3C_XREAD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
-    }
-    else
-    {
-        const std::string key = cluster_mode()? keys[0]: std::string("");
-        std::string value;
-        CommandArgs cmd_args;
-        if (!key.empty())
-            cmd_args.set_key(key);
-        cmd_args.set_command("XREAD");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
-        if (block_milliseconds >= 0) // timeout is negative
-        {
-            cmd_args.add_arg("BLOCK");
-            cmd_args.add_arg(block_milliseconds);
-        }
-        cmd_args.add_arg("STREAMS");
-        cmd_args.add_args(keys);
-        cmd_args.add_args(ids);
-        cmd_args.final();
+    _enable_error_log = false;
+}
 
-        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-        get_values(redis_reply.get(), values);
-    }
+void CRedisClient::set_deadline(int64_t deadline_milliseconds)
+{
+    _deadline_milliseconds = deadline_milliseconds;
 }
 
-// Reads more than one keys
-void CRedisClient::xread(
-        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
-        int64_t count,
-        std::vector<Stream>* values, Node* which, int num_retries)
+void CRedisClient::set_deadline_after(int64_t budget_milliseconds)
 {
-    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
-    xread(keys, ids, count, block_milliseconds, values, which, num_retries);
+    _deadline_milliseconds = get_monotonic_milliseconds() + budget_milliseconds;
 }
 
-// Reads more than one keys
-void CRedisClient::xread(
-        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
-        std::vector<Stream>* values, Node* which, int num_retries)
+int64_t CRedisClient::get_deadline() const
 {
-    const int64_t count = 0;
-    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
-    xread(keys, ids, count, block_milliseconds, values, which, num_retries);
+    return _deadline_milliseconds;
 }
 
-// Only read one key
-void CRedisClient::xread(
-        const std::string& key, const std::string& id,
-        int64_t count, int64_t block_milliseconds,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+void CRedisClient::clear_deadline()
 {
-    std::vector<Stream> streams;
-    std::vector<std::string> keys(1);
-    std::vector<std::string> ids(1);
+    _deadline_milliseconds = 0;
+}
 
-    keys[0] = key;
-    ids[0] = id;
-    xread(keys, ids, count, block_milliseconds, &streams, which, num_retries);
-    if (!streams.empty())
-        values->swap(streams[0].entries);
+void CRedisClient::set_unix_socket_table(const std::map<Node, std::string>& unix_socket_table)
+{
+    _unix_socket_table = unix_socket_table;
+
+    for (RedisMasterNodeTable::iterator iter=_redis_master_nodes.begin(); iter!=_redis_master_nodes.end(); ++iter)
+    {
+        CRedisMasterNode* redis_master_node = iter->second;
+        redis_master_node->close_all();
+        redis_master_node->close_blocking_contexts();
+        redis_master_node->close_replica_connections();
+    }
 }
 
-// Only read one key
-void CRedisClient::xread(
-        const std::string& key,
-        int64_t count, int64_t block_milliseconds,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+void CRedisClient::set_connections_per_node(int num_master_connections, int num_replica_connections, StripePolicy stripe_policy)
 {
-    std::vector<Stream> streams;
-    std::vector<std::string> keys(1);
-    std::vector<std::string> ids(1);
+    _num_master_connections = (num_master_connections > 1)? num_master_connections: 1;
+    _num_replica_connections = (num_replica_connections > 1)? num_replica_connections: 1;
+    _stripe_policy = stripe_policy;
 
-    keys[0] = key;
-    ids[0] = ">";
-    xread(keys, ids, count, block_milliseconds, &streams, which, num_retries);
-    if (!streams.empty())
-        values->swap(streams[0].entries);
+    for (RedisMasterNodeTable::iterator iter=_redis_master_nodes.begin(); iter!=_redis_master_nodes.end(); ++iter)
+    {
+        CRedisMasterNode* redis_master_node = iter->second;
+        redis_master_node->set_num_connections(_num_master_connections);
+        redis_master_node->set_num_replica_connections(_num_replica_connections);
+    }
 }
 
-// XDEL <key> [<ID1> <ID2> ... <IDN>]
-int CRedisClient::xdel(const std::string& key, const std::vector<std::string>& ids, Node* which, int num_retries)
+void CRedisClient::enable_hedged_reads(int percentile, int min_delay_milliseconds)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XDEL");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(ids);
-    cmd_args.final();
+    _hedge_percentile = (percentile > 99)? 99: ((percentile < 1)? 1: percentile);
+    _hedge_min_delay_milliseconds = (min_delay_milliseconds > 0)? min_delay_milliseconds: 0;
+    _hedge_delay_us = -1;
+    _num_read_latencies = 0;
+    _read_latencies.resize(HEDGE_LATENCY_SAMPLES);
+}
 
-    // Integer reply: the number of entries actually deleted.
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
+void CRedisClient::disable_hedged_reads()
+{
+    _hedge_percentile = 0;
+    _hedge_delay_us = -1;
+    _num_read_latencies = 0;
+    _read_latencies.clear();
 }
 
-int CRedisClient::xdel(const std::string& key, const std::string& id, Node* which, int num_retries)
+uint64_t CRedisClient::get_num_hedges() const
 {
-    std::vector<std::string> ids(1);
-    ids[0] = id;
-    return xdel(key, ids, which, num_retries);
+    return _num_hedges;
 }
 
-// XTRIM key MAXLEN [~] count
-int64_t CRedisClient::xtrim(const std::string& key, int64_t maxlen, char c, Node* which, int num_retries)
+uint64_t CRedisClient::get_num_hedge_wins() const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XTRIM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg("MAXLEN");
-    cmd_args.add_arg(c);
-    cmd_args.add_arg(maxlen);
-    cmd_args.final();
+    return _num_hedge_wins;
+}
 
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+void CRedisClient::enable_metrics()
+{
+    _enable_metrics = true;
 }
 
-int64_t CRedisClient::xtrim(const std::string& key, int64_t maxlen, Node* which, int num_retries)
+void CRedisClient::disable_metrics()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XTRIM");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg("MAXLEN");
-    cmd_args.add_arg(maxlen);
-    cmd_args.final();
+    _enable_metrics = false;
+}
 
-    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+void CRedisClient::enable_accounting()
+{
+    _enable_accounting = true;
+    _build_cost.clear();
+    _decode_cost.clear();
+    _last_cost_entry = NULL;
+    sg_build_cost = &_build_cost;
+    sg_decode_cost = &_decode_cost;
 }
 
-// XLEN key
-int64_t CRedisClient::xlen(const std::string& key, Node* which, int num_retries)
+void CRedisClient::disable_accounting()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XLEN");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    if (_enable_accounting && _last_cost_entry!=NULL)
+        _last_cost_entry->cost.add(_decode_cost);
+    _enable_accounting = false;
+    _last_cost_entry = NULL;
+    if (sg_build_cost == &_build_cost)
+    {
+        sg_build_cost = NULL;
+        sg_decode_cost = NULL;
+    }
+}
 
-    // Integer reply: the number of entries of the stream at key.
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+void CRedisClient::get_metrics(struct ClientMetrics* metrics) const
+{
+    metrics->clear();
+    metrics->snapshot_milliseconds = get_current_milliseconds();
+    metrics->num_retries = _num_retries;
+    metrics->num_moved = _num_moved;
+    metrics->num_asks = _num_asks;
+    metrics->num_reconnects = _num_reconnects;
+    metrics->num_timeouts = _num_timeouts;
+    metrics->num_refreshes = _num_refreshes;
+    metrics->num_masters = _num_masters;
+    metrics->num_replicas = _num_replicas;
+    metrics->num_connected_nodes = _num_connected_nodes;
+    metrics->num_unmapped_slots = _num_unmapped_slots;
+
+    pthread_mutex_lock(&_metrics_mutex);
+    metrics->start_milliseconds = _metrics_start_milliseconds;
+    metrics->commands.resize(_command_metrics.size());
+    CommandMetricsTable::size_type i = 0;
+    for (CommandMetricsTable::const_iterator iter=_command_metrics.begin(); iter!=_command_metrics.end(); ++iter, ++i)
+    {
+        struct CommandMetrics& command_metrics = metrics->commands[i];
+        command_metrics.node = iter->first.first;
+        command_metrics.command = iter->first.second;
+        command_metrics.latency = iter->second->latency;
+        command_metrics.num_errors = iter->second->num_errors;
+        command_metrics.cost = iter->second->cost;
+    }
+    pthread_mutex_unlock(&_metrics_mutex);
+    get_node_stats(&metrics->nodes);
 }
 
-// XRANGE key start end [COUNT count]
-void CRedisClient::xrange(
-        const std::string& key,
-        const std::string& start, const std::string& end, int64_t count,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+int CRedisClient::get_node_stats(std::vector<struct NodeStats>* nodes_stats) const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XRANGE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    if (count >= 0)
+    std::vector<struct NodeStats>::size_type i = 0;
+
+    pthread_mutex_lock(&_metrics_mutex);
+    nodes_stats->resize(_node_stats.size());
+    for (std::map<Node, NodeStatsEntry*>::const_iterator iter=_node_stats.begin(); iter!=_node_stats.end(); ++iter, ++i)
     {
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
+        const NodeStatsEntry* entry = iter->second;
+        struct NodeStats& node_stats = (*nodes_stats)[i];
+
+        node_stats.node = iter->first;
+        node_stats.master = entry->master;
+        node_stats.bytes_sent = entry->bytes_sent;
+        node_stats.bytes_received = entry->bytes_received;
+        node_stats.num_replies = entry->num_replies;
+        node_stats.inflight = entry->inflight;
+        node_stats.num_connects = entry->num_connects;
+        node_stats.num_reconnects = entry->num_reconnects;
+        node_stats.reconnect_milliseconds.assign(entry->reconnect_milliseconds.begin(), entry->reconnect_milliseconds.end());
+        node_stats.num_connections = entry->num_connections;
+        node_stats.connected_milliseconds = entry->connected_milliseconds;
+        node_stats.last_error = entry->last_error;
+        node_stats.last_error_milliseconds = entry->last_error_milliseconds;
     }
-    cmd_args.final();
+    pthread_mutex_unlock(&_metrics_mutex);
+    return static_cast<int>(nodes_stats->size());
+}
 
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    get_values(redis_reply.get(), values);
+void CRedisClient::enable_slowlog(int64_t threshold_us, int max_entries, int sample_interval, int max_key_length)
+{
+    pthread_mutex_lock(&_metrics_mutex);
+    _slowlog_threshold_us = threshold_us;
+    _slowlog_sample_interval = (sample_interval > 0)? sample_interval: 0;
+    _slowlog_max_key_length = (max_key_length > 0)? max_key_length: 0;
+    _slowlog_max_entries = (max_entries > 0)? max_entries: 1;
+    _slowlog.clear();
+    _enable_slowlog = true;
+    pthread_mutex_unlock(&_metrics_mutex);
 }
 
-void CRedisClient::xrange(
-        const std::string& key,
-        const std::string& start, const std::string& end,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+void CRedisClient::disable_slowlog()
 {
-    const int64_t count = -1;
-    xrange(key, start, end, count, values, which, num_retries);
+    pthread_mutex_lock(&_metrics_mutex);
+    _enable_slowlog = false;
+    _slowlog.clear();
+    pthread_mutex_unlock(&_metrics_mutex);
 }
 
-// XREVRANGE key end start [COUNT count]
-void CRedisClient::xrevrange(
-        const std::string& key,
-        const std::string& end, const std::string& start, int64_t count,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+int CRedisClient::get_slowlog(std::vector<struct SlowLogEntry>* entries, int count) const
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XRANGE");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(end);
-    cmd_args.add_arg(start);
-    if (count >= 0)
+    entries->clear();
+    pthread_mutex_lock(&_metrics_mutex);
+    for (std::deque<struct SlowLogEntry>::size_type i=0; i<_slowlog.size() && (count<0 || static_cast<int>(i)<count); ++i)
+        entries->push_back(_slowlog[i]);
+    pthread_mutex_unlock(&_metrics_mutex);
+    return static_cast<int>(entries->size());
+}
+
+void CRedisClient::reset_slowlog()
+{
+    pthread_mutex_lock(&_metrics_mutex);
+    _slowlog.clear();
+    pthread_mutex_unlock(&_metrics_mutex);
+}
+
+std::string CRedisClient::get_openmetrics(const std::string& name_space) const
+{
+    struct ClientMetrics metrics;
+    get_metrics(&metrics);
+    return render_openmetrics(metrics, name_space);
+}
+
+void CRedisClient::reset_metrics()
+{
+    __sync_fetch_and_and(&_num_retries, 0);
+    __sync_fetch_and_and(&_num_moved, 0);
+    __sync_fetch_and_and(&_num_asks, 0);
+    __sync_fetch_and_and(&_num_reconnects, 0);
+    __sync_fetch_and_and(&_num_timeouts, 0);
+    __sync_fetch_and_and(&_num_refreshes, 0);
+
+    // 不删除已有的直方图，因为记录时不加锁
+    pthread_mutex_lock(&_metrics_mutex);
+    _metrics_start_milliseconds = get_current_milliseconds();
+    for (CommandMetricsTable::iterator iter=_command_metrics.begin(); iter!=_command_metrics.end(); ++iter)
     {
-        cmd_args.add_arg("COUNT");
-        cmd_args.add_arg(count);
+        struct CommandCost& cost = iter->second->cost;
+        iter->second->latency.reset();
+        __sync_fetch_and_and(&iter->second->num_errors, 0);
+        __sync_fetch_and_and(&cost.num_commands, 0);
+        __sync_fetch_and_and(&cost.num_allocations, 0);
+        __sync_fetch_and_and(&cost.allocated_bytes, 0);
+        __sync_fetch_and_and(&cost.modelled_copied_bytes, 0);
+        __sync_fetch_and_and(&cost.num_reads, 0);
+        __sync_fetch_and_and(&cost.num_writes, 0);
     }
-    cmd_args.final();
+    // 连接数和在途命令数是当前状态，不清零
+    for (std::map<Node, NodeStatsEntry*>::iterator iter=_node_stats.begin(); iter!=_node_stats.end(); ++iter)
+    {
+        NodeStatsEntry* entry = iter->second;
+        __sync_fetch_and_and(&entry->bytes_sent, 0);
+        __sync_fetch_and_and(&entry->bytes_received, 0);
+        __sync_fetch_and_and(&entry->num_replies, 0);
+        __sync_fetch_and_and(&entry->num_connects, 0);
+        __sync_fetch_and_and(&entry->num_reconnects, 0);
+        entry->reconnect_milliseconds.clear();
+        entry->last_error.clear();
+        entry->last_error_milliseconds = 0;
+    }
+    pthread_mutex_unlock(&_metrics_mutex);
+}
 
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    get_values(redis_reply.get(), values);
+int CRedisClient::list_nodes(std::vector<struct NodeInfo>* nodes_info)
+{
+    struct ErrorInfo errinfo;
+
+    for (RedisMasterNodeTable::iterator iter=_redis_master_nodes.begin(); iter!=_redis_master_nodes.end(); ++iter)
+    {
+        const Node& node = iter->first;
+        struct CRedisNode* redis_node = iter->second;
+        redisContext* redis_context = redis_node->get_redis_context();
+
+        if (redis_context!=NULL && discard_pending_replies(redis_node))
+        {
+            if (list_cluster_nodes(nodes_info, &errinfo, redis_node->get_redis_context(), node))
+                break;
+        }
+    }
+    if (nodes_info->empty())
+    {
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+
+    return static_cast<int>(nodes_info->size());
 }
 
-void CRedisClient::xrevrange(
-        const std::string& key,
-        const std::string& end, const std::string& start,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
+void CRedisClient::flushall()
 {
-    const int64_t count = -1;
-    xrevrange(key, start, end, count, values, which, num_retries);
+    const int num_retries = NUM_RETRIES;
+    const std::string key;
+    CommandArgs cmd_args;
+    cmd_args.set_command("FLUSHALL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS)
+    redis_command(true, num_retries, key, cmd_args, NULL);
 }
 
-// PEL: Pending Entries List (待处理条目列表)
-// XPENDING <key> <group> [<start> <stop> <count> [<consumer>]]
-int CRedisClient::xpending(
-        const std::string& key, const std::string& groupname,
-        const std::string& start, const std::string& end, int count, const std::string& consumer,
-        std::vector<struct DetailedPending>* pendings,
-        Node* which, int num_retries)
+void CRedisClient::multi(const std::string& key, Node* which)
 {
-    if (start.empty() || end.empty() || consumer.empty())
+    if (cluster_mode())
     {
         struct ErrorInfo errinfo;
-        errinfo.errtype = "ERR";
-        errinfo.raw_errmsg = "wrong number of arguments for 'xpending' command";
-        errinfo.errmsg = format_string("[R3C_XPENDING][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.errmsg = "MULTI not supported in cluster mode";
         THROW_REDIS_EXCEPTION(errinfo);
     }
     else
     {
+        const int num_retries = 0;
         CommandArgs cmd_args;
         cmd_args.set_key(key);
-        cmd_args.set_command("XPENDING");
+        cmd_args.set_command("MULTI");
         cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg(key);
-        cmd_args.add_arg(groupname);
-        // 如果指定了start，则end和count也必须指定，否则会报错“syntax error”
-        cmd_args.add_arg(start); // -
-        cmd_args.add_arg(end); // +
-        cmd_args.add_arg(count);
-        if (!consumer.empty())
-            cmd_args.add_arg(consumer);
         cmd_args.final();
 
-        // The command returns data in different format depending on the way it is called,
-        // as previously explained in this page. However the reply is always an array of items.
-        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-        return get_values(redis_reply.get(), pendings);
+        // Simple string reply (REDIS_REPLY_STATUS):
+        // always OK.
+        redis_command(false, num_retries, key, cmd_args, which);
     }
 }
 
-int CRedisClient::xpending(
-        const std::string& key, const std::string& groupname,
-        const std::string& start, const std::string& end, int count,
-        std::vector<struct DetailedPending>* pendings,
-        Node* which, int num_retries)
+const RedisReplyHelper CRedisClient::exec(const std::string& key, Node* which)
 {
-    const std::string consumer;
-    return xpending(key, groupname, start, end, count, consumer, pendings, which, num_retries);
+    if (cluster_mode())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.errmsg = "EXEC not supported in cluster mode";
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        const int num_retries = 0;
+        CommandArgs cmd_args;
+        cmd_args.set_key(key);
+        cmd_args.set_command("EXEC");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.final();
+
+        // Array reply:
+        // each element being the reply to each of the commands in the atomic transaction.
+        return redis_command(false, num_retries, key, cmd_args, which);
+    }
 }
 
-int CRedisClient::xpending(
-        const std::string& key, const std::string& groupname,
-        struct GroupPending* groups,
-        Node* which, int num_retries)
+//
+// KEY/VALUE
+//
+
+// Time complexity: O(1)
+// EXPIRE key seconds
+bool CRedisClient::expire(
+        const std::string& key,
+        uint32_t seconds,
+        Node* which,
+        int num_retries)
 {
     CommandArgs cmd_args;
     cmd_args.set_key(key);
-    cmd_args.set_command("XPENDING");
+    cmd_args.set_command("EXPIRE");
     cmd_args.add_arg(cmd_args.get_command());
     cmd_args.add_arg(key);
-    cmd_args.add_arg(groupname);
+    cmd_args.add_arg(seconds);
     cmd_args.final();
 
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_values(redis_reply.get(), groups);
-}
-
-// Gets ownership of one or multiple messages in the Pending Entries List
-// of a given stream consumer group.
+    // Integer reply, specifically:
+    // 1 if the timeout was set.
+    // 0 if key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+bool CRedisClient::expireat(const std::string& key, int64_t timestamp, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("EXPIREAT");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(timestamp);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // 1 if the timeout was set.
+    // 0 if key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// Time complexity: O(1)
+// EXISTS key [key ...]
+bool CRedisClient::exists(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("EXISTS");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // 1 if the key exists.
+    // 0 if the key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// Time complexity:
+// O(N) where N is the number of keys that will be removed.
+// When a key to remove holds a value other than a string,
+// the individual complexity for this key is O(M) where M is the number of elements in the list, set, sorted set or hash.
+// Removing a single key that holds a string value is O(1).
+bool CRedisClient::del(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("DEL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply:
+    // The number of keys that were removed.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// GET key
+// Time complexity: O(1)
+bool CRedisClient::get(
+        const std::string& key,
+        std::string* value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("GET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Bulk string reply:
+    // the value of key, or nil when key does not exist.
+    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return get_value(redis_reply.get(), value);
+    return true;
+}
+
+// SET key value [EX seconds] [PX milliseconds] [NX|XX]
+// Time complexity: O(1)
+void CRedisClient::set(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS):
+    // OK if SET was executed correctly.
+
+    // Null reply: a Null Bulk Reply is returned if the SET operation was not performed
+    // because the user specified the NX or XX option but the condition was not met.
+    //
+    // OK: redis_reply->str
+    redis_command(false, num_retries, key, cmd_args, which);
+}
+
+// Time complexity: O(1)
+// SETNX key value
+bool CRedisClient::setnx(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SETNX");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // 1 if the key exists.
+    // 0 if the key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// Time complexity: O(1)
+// SETEX key seconds value
+void CRedisClient::setex(
+        const std::string& key,
+        const std::string& value,
+        uint32_t expired_seconds,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SETEX");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(expired_seconds);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS)
+    //
+    // OK: redis_reply->str
+    redis_command(false, num_retries, key, cmd_args, which);
+}
+
+bool CRedisClient::setnxex(
+        const std::string& key,
+        const std::string& value,
+        uint32_t expired_seconds,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.add_arg("EX");
+    cmd_args.add_arg(expired_seconds);
+    cmd_args.add_arg("NX");
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS):
+    // OK if SET was executed correctly.
+    //
+    // Null reply: a Null Bulk Reply is returned if the SET operation was not performed
+    // because the user specified the NX or XX option but the condition was not met.
+    //
+    // OK: redis_reply->str
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    return redis_reply->type != REDIS_REPLY_NIL;
+}
+
+// Time complexity: O(N) where N is the number of keys to retrieve.
+// MGET key [key ...]
+int CRedisClient::mget(
+        const std::vector<std::string>& keys,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    values->clear();
+
+    if (!cluster_mode())
+    {
+        const std::string key;
+        CommandArgs cmd_args;
+        cmd_args.set_command("MGET");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_args(keys);
+        cmd_args.final();
+
+        // Array reply:
+        // list of values at the specified keys.
+        //
+        // For every key that does not hold a string value or does not exist,
+        // the special value nil is returned. Because of this, the operation never fails.
+        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+        if (REDIS_REPLY_ARRAY == redis_reply->type)
+            return get_values(redis_reply.get(), values);
+        return 0;
+    }
+    else
+    {
+        values->resize(keys.size());
+
+        try
+        {
+            for (std::vector<std::string>::size_type i=0; i<keys.size(); ++i)
+            {
+                const std::string& key = keys[i];
+                std::string& value = (*values)[i];
+                get(key, &value, NULL, num_retries);
+            }
+        }
+        catch (CRedisException&)
+        {
+            values->clear();
+            throw;
+        }
+
+        return static_cast<int>(values->size());
+    }
+}
+
+// Time complexity:
+// O(N) where N is the number of keys to set.
+// MSET key value [key value ...]
+int CRedisClient::mset(
+        const std::map<std::string, std::string>& kv_map,
+        Node* which,
+        int num_retries)
+{
+    int success = 0;
+
+    if (kv_map.empty())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.errmsg = "kv_map is empty";
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    if (!cluster_mode())
+    {
+        const std::string key;
+        CommandArgs cmd_args;
+        cmd_args.set_command("MSET");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_args(kv_map);
+        cmd_args.final();
+
+        // Simple string reply:
+        // always OK since MSET can't fail.
+        redis_command(false, num_retries, key, cmd_args, which);
+        success = static_cast<int>(kv_map.size());
+    }
+    else
+    {
+        for (std::map<std::string, std::string>::const_iterator iter=kv_map.begin(); iter!=kv_map.end(); ++iter)
+        {
+            const std::string& key = iter->first;
+            const std::string& value = iter->second;
+            set(key, value, which ,num_retries);
+            ++success;
+        }
+    }
+
+    return success;
+}
+
+// Time complexity: O(1)
+// INCRBY key increment
+int64_t CRedisClient::incrby(
+        const std::string& key,
+        int64_t increment,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("INCRBY");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(increment);
+    cmd_args.final();
+
+    // Integer reply:
+    // the value of key after the increment
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return redis_reply->integer;
+    return 0;
+}
+
+bool CRedisClient::key_type(const std::string& key, std::string* key_type, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("TYPE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS):
+    // type of key, or none when key does not exist.
+    //
+    // (gdb) p *redis_reply._redis_reply
+    // $1 = {type = 5, integer = 0, len = 6, str = 0x742b50 "string", elements = 0, element = 0x0}
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get(), key_type);
+}
+
+int64_t CRedisClient::ttl(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("TTL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply:
+    // TTL in seconds, or a negative value in order to signal an error
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return redis_reply->integer;
+    return 0;
+}
+
+// O(1) for every call. O(N) for a complete iteration,
+// including enough command calls for the cursor to return back to 0. N is the number of elements inside the collection.
+//
+// SCAN cursor [MATCH pattern] [COUNT count]
+int64_t CRedisClient::scan(int64_t cursor, std::vector<std::string>* values, Node* which, int num_retries)
+{
+    return scan(cursor, std::string(""), 0, values, which, num_retries);
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count]
+int64_t CRedisClient::scan(int64_t cursor, int count, std::vector<std::string>* values, Node* which, int num_retries)
+{
+    return scan(cursor, std::string(""), count, values, which, num_retries);
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count]
+int64_t CRedisClient::scan(
+        int64_t cursor, const std::string& pattern,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    return scan(cursor, pattern, 0, values, which, num_retries);
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count]
+int64_t CRedisClient::scan(
+        int64_t cursor, const std::string& pattern, int count,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    const std::string key;
+    CommandArgs cmd_args;
+    cmd_args.set_command("SCAN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(cursor);
+    if (!pattern.empty())
+    {
+        cmd_args.add_arg("MATCH");
+        cmd_args.add_arg(pattern);
+    }
+    if (count > 0)
+    {
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+    }
+    cmd_args.final();
+
+    // return value is an array of two values:
+    // the first value is the new cursor to use in the next call, the second value is an array of elements.
+    //
+    // *EMPTY*:
+    // (gdb) p *redis_reply
+    // $1 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x63e450}
+    // (gdb) p *redis_reply->element[0]
+    // $3 = {type = 1, integer = 0, len = 1, str = 0x63e6f0 "0", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]
+    // $4 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 0, element = 0x0}
+    //
+    // *NON EMPTY*:
+    //
+    // redis-cli set k1 1
+    // redis-cli set k2 2
+    // redis-cli set k3 3
+    //
+    // (gdb) p *redis_reply
+    // $5 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x63e450}
+    // (gdb) p *redis_reply->element[0]
+    // $6 = {type = 1, integer = 0, len = 1, str = 0x63e720 "1", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]
+    // $7 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 3, element = 0x63e780}
+    // (gdb) p *redis_reply->element[1]->element[0]
+    // $8 = {type = 1, integer = 0, len = 2, str = 0x63e820 "k2", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]->element[1]
+    // $9 = {type = 1, integer = 0, len = 2, str = 0x63e880 "k3", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]->element[2]
+    // $10 = {type = 1, integer = 0, len = 2, str = 0x63e8e0 "k1", elements = 0, element = 0x0}
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+    {
+        get_values(redis_reply->element[1], values);
+        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+    }
+    return 0;
+}
+
+//
+// EVAL
+//
+
+// Time complexity: Depends on the script that is executed.
+// EVAL script numkeys key [key ...] arg [arg ...]
+const RedisReplyHelper CRedisClient::eval(
+        const std::string& key,
+        const std::string& lua_scripts,
+        Node* which,
+        int num_retries)
+{
+    const int numkeys = 1;
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("EVAL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(lua_scripts);
+    cmd_args.add_arg(numkeys);
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    return redis_command(false, num_retries, key, cmd_args, which);
+}
+
+const RedisReplyHelper CRedisClient::eval(
+        const std::string& key,
+        const std::string& lua_scripts,
+        const std::vector<std::string>& parameters,
+        Node* which,
+        int num_retries)
+{
+    const int numkeys = 1;
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("EVAL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(lua_scripts);
+    cmd_args.add_arg(numkeys);
+    cmd_args.add_arg(key);
+    cmd_args.add_args(parameters);
+    cmd_args.final();
+
+    return redis_command(false, num_retries, key, cmd_args, which);
+}
+
+const RedisReplyHelper CRedisClient::evalsha(
+        const std::string& key,
+        const std::string& sha1,
+        const std::vector<std::string>& parameters,
+        Node* which, int num_retries)
+{
+    const int numkeys = 1;
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("EVALSHA");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(sha1);
+    cmd_args.add_arg(numkeys);
+    cmd_args.add_arg(key);
+    cmd_args.add_args(parameters);
+    cmd_args.final();
+
+    return redis_command(false, num_retries, key, cmd_args, which);
+}
+
+const RedisReplyHelper CRedisClient::eval(
+        const std::string& lua_scripts,
+        const std::vector<std::string>& keys, const std::vector<std::string>& parameters,
+        Node* which,
+        int num_retries)
+{
+    if (cluster_mode() && keys_crossslots(keys))
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.errmsg = "EVAL not supported in cluster mode";
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        const int numkeys = static_cast<int>(keys.size());
+        std::string key;
+        if (cluster_mode() && !keys.empty())
+            key = keys[0];
+
+        CommandArgs cmd_args;
+        if (!key.empty())
+            cmd_args.set_key(key);
+        cmd_args.set_command("EVAL");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(lua_scripts);
+        cmd_args.add_arg(numkeys);
+        cmd_args.add_args(keys);
+        cmd_args.add_args(parameters);
+        cmd_args.final();
+        return redis_command(false, num_retries, key, cmd_args, which);
+    }
+}
+
+const RedisReplyHelper CRedisClient::evalsha(
+        const std::string& sha1,
+        const std::vector<std::string>& keys,
+        const std::vector<std::string>& parameters,
+        Node* which,
+        int num_retries)
+{
+    if (cluster_mode() && keys_crossslots(keys))
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.errmsg = "EVAL not supported in cluster mode";
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        const int numkeys = static_cast<int>(keys.size());
+        std::string key;
+        if (cluster_mode() && !keys.empty())
+            key = keys[0];
+
+        CommandArgs cmd_args;
+        if (!key.empty())
+            cmd_args.set_key(key);
+        cmd_args.set_command("EVALSHA");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(sha1);
+        cmd_args.add_arg(numkeys);
+        cmd_args.add_args(keys);
+        cmd_args.add_args(parameters);
+        cmd_args.final();
+        return redis_command(false, num_retries, key, cmd_args, which);
+    }
+}
+
+//
+// HASH
+//
+
+// Time complexity: O(N) where N is the number of fields to be removed.
+// HDEL key field [field ...]
+bool CRedisClient::hdel(const std::string& key, const std::string& field, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HDEL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // Integer reply:
+    // the number of fields that were removed from the hash, not including specified but non existing fields.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+int CRedisClient::hdel(
+        const std::string& key,
+        const std::vector<std::string>& fields,
+        Node* which,
+        int num_retries)
+{
+    return hmdel(key, fields, which, num_retries);
+}
+
+int CRedisClient::hmdel(
+        const std::string& key,
+        const std::vector<std::string>& fields,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HDEL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(fields);
+    cmd_args.final();
+
+    // Integer reply:
+    // the number of fields that were removed from the hash, not including specified but non existing fields.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return 0;
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(1)
+// HEXISTS key field
+bool CRedisClient::hexists(const std::string& key, const std::string& field, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HEXISTS");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // 1 if the hash contains field.
+    // 0 if the hash does not contain field, or key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// Time complexity: O(1)
+// HLEN key
+int CRedisClient::hlen(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HLEN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply: number of fields in the hash, or 0 when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(1)
+// HSET key field value
+bool CRedisClient::hset(
+        const std::string& key,
+        const std::string& field,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HSET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // 1 if field is a new field in the hash and value was set.
+    // 0 if field already exists in the hash and the value was updated.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// HSETNX key field value
+// Time complexity: O(1)
+bool CRedisClient::hsetnx(
+        const std::string& key,
+        const std::string& field,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HSETNX");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // 1 if field is a new field in the hash and value was set.
+    // 0 if field already exists in the hash and no operation was performed.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// Time complexity: O(1)
+// HGET key field
+bool CRedisClient::hget(
+        const std::string& key,
+        const std::string& field,
+        std::string* value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HGET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // Bulk string reply:
+    // the value associated with field, or nil when field is not present in the hash or key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return get_value(redis_reply.get(), value);
+    return true;
+}
+
+// Time complexity: O(1)
+// HINCRBY key field increment
+int64_t CRedisClient::hincrby(
+        const std::string& key,
+        const std::string& field,
+        int64_t increment,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HINCRBY");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.add_arg(increment);
+    cmd_args.final();
+
+    // Integer reply: the value at field after the increment operation.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int64_t>(redis_reply->integer);
+    return 0;
+}
+
+void CRedisClient::hset(
+        const std::string& key,
+        const std::map<std::string, std::string>& map,
+        Node* which,
+        int num_retries)
+{
+    hmset(key, map, which, num_retries);
+}
+
+// Time complexity: O(N) where N is the number of fields being set.
+// HMSET key field value [field value ...]
+void CRedisClient::hmset(
+        const std::string& key,
+        const std::map<std::string, std::string>& map,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HMSET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(map);
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS)
+    redis_command(false, num_retries, key, cmd_args, which);
+}
+
+int CRedisClient::hget(
+        const std::string& key,
+        const std::vector<std::string>& fields,
+        std::map<std::string, std::string>* map,
+        bool keep_null,
+        Node* which,
+        int num_retries)
+{
+    return hmget(key, fields, map, keep_null, which, num_retries);
+}
+
+// Time complexity: O(N) where N is the number of fields being requested.
+// HMGET key field [field ...]
+int CRedisClient::hmget(
+        const std::string& key,
+        const std::vector<std::string>& fields,
+        std::map<std::string, std::string>* map,
+        bool keep_null,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HMGET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(fields);
+    cmd_args.final();
+
+    // Array reply:
+    // list of values associated with the given fields, in the same order as they are requested.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return 0;
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), fields, keep_null, map);
+    return 0;
+}
+
+// Time complexity: O(N) where N is the size of the hash.
+// HGETALL key
+int CRedisClient::hgetall(
+        const std::string& key,
+        std::map<std::string, std::string>* map,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HGETALL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Array reply:
+    // list of fields and their values stored in the hash, or an empty list when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return 0;
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), map);
+    return 0;
+}
+
+// Time complexity: O(1)
+// HSTRLEN key field
+int CRedisClient::hstrlen(const std::string& key, const std::string& field, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HSTRLEN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // Integer reply:
+    // the string length of the value associated with field,
+    // or zero when field is not present in the hash or key does not exist at all.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return 0;
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(N) where N is the size of the hash.
+// HKEYS key
+int CRedisClient::hkeys(const std::string& key, std::vector<std::string>* fields, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HKEYS");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Array reply:
+    // list of fields in the hash, or an empty list when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return 0;
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), fields);
+    return 0;
+}
+
+// Time complexity: O(N) where N is the size of the hash.
+// HVALS key
+int CRedisClient::hvals(const std::string& key, std::vector<std::string>* vals, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HVALS");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Array reply:
+    // list of values in the hash, or an empty list when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return 0;
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), vals);
+    return 0;
+}
+
+// Time complexity:
+// O(1) for every call. O(N) for a complete iteration,
+// including enough command calls for the cursor to return back to 0. N is the number of elements inside the collection..
+//
+// HSCAN key cursor [MATCH pattern] [COUNT count]
+int64_t CRedisClient::hscan(
+        const std::string& key,
+        int64_t cursor,
+        std::map<std::string, std::string>* map,
+        Node* which,
+        int num_retries)
+{
+    return hscan(key, cursor, std::string(""), 0, map, which, num_retries);
+}
+
+int64_t CRedisClient::hscan(
+        const std::string& key,
+        int64_t cursor, int count,
+        std::map<std::string, std::string>* map,
+        Node* which,
+        int num_retries)
+{
+    return hscan(key, cursor, std::string(""), count, map, which, num_retries);
+}
+
+int64_t CRedisClient::hscan(
+        const std::string& key,
+        int64_t cursor, const std::string& pattern,
+        std::map<std::string, std::string>* map,
+        Node* which,
+        int num_retries)
+{
+    return hscan(key, cursor, pattern, 0, map, which, num_retries);
+}
+
+int64_t CRedisClient::hscan(
+        const std::string& key,
+        int64_t cursor, const std::string& pattern, int count,
+        std::map<std::string, std::string>* map,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("HSCAN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(cursor);
+    if (!pattern.empty())
+    {
+        cmd_args.add_arg("MATCH");
+        cmd_args.add_arg(pattern);
+    }
+    if (count > 0)
+    {
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+    }
+    cmd_args.final();
+
+    // (gdb) p *redis_reply
+    // $1 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x641450}
+    // (gdb) p *redis_reply->element[0]
+    // $2 = {type = 1, integer = 0, len = 1, str = 0x641820 "0", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]
+    // $3 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 8, element = 0x6414b0}
+    // (gdb) p *redis_reply->element[1]->element[0]
+    // $4 = {type = 1, integer = 0, len = 2, str = 0x6418f0 "f1", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]->element[1]
+    // $5 = {type = 1, integer = 0, len = 2, str = 0x641950 "v1", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]->element[2]
+    // $6 = {type = 1, integer = 0, len = 2, str = 0x6419b0 "f2", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]->element[3]
+    // $7 = {type = 1, integer = 0, len = 2, str = 0x641a10 "v2", elements = 0, element = 0x0}
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+    {
+        get_values(redis_reply->element[1], map);
+        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+    }
+    return 0;
+}
+
+
+
+//
+// LIST
+//
+
+// Time complexity: O(1)
+// LLEN key
+int CRedisClient::llen(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LLEN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply: the length of the list at key.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(1)
+// LPOP key
+bool CRedisClient::lpop(const std::string& key, std::string* value, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LPOP");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Bulk string reply: the value of the first element, or nil when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return get_value(redis_reply.get(), value);
+    return true; // MULTI & EXEC the type always is REDIS_REPLY_STATUS
+}
+
+bool CRedisClient::blpop(const std::string& key, std::string* value, uint32_t seconds, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("BLPOP");
+    cmd_args.set_block_milliseconds(static_cast<int64_t>(seconds) * 1000);
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(seconds);
+    cmd_args.final();
+
+    // Array reply:
+    // 1) A nil multi-bulk when no element could be popped and the timeout expired.
+    // 2) A two-element multi-bulk with the first element being the name of the key
+    //    where an element was popped and the second element being the value of the popped element.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (redis_reply->type == REDIS_REPLY_NIL)
+        return false;
+    if (redis_reply->type != REDIS_REPLY_ARRAY)
+        return false;
+    return get_value(redis_reply->element[1], value);
+}
+
+// Time complexity: O(1)
+// LPUSH key value [value ...]
+int CRedisClient::lpush(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LPUSH");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply: the length of the list after the push operations.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(1)
+// LPUSH key value [value ...]
+int CRedisClient::lpush(
+        const std::string& key,
+        const std::vector<std::string>& values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LPUSH");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(values);
+    cmd_args.final();
+
+    // Integer reply: the length of the list after the push operations.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Inserts value at the head of the list stored at key, only if key already exists and holds a list.
+// In contrary to LPUSH, no operation will be performed when key does not yet exist.
+// Time complexity: O(1)
+int CRedisClient::lpushx(const std::string& key, const std::string& value, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LPUSHX");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply: the length of the list after the push operation.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity:
+// O(S+N) where S is the distance of start offset from HEAD for small lists,
+// from nearest end (HEAD or TAIL) for large lists;
+// and N is the number of elements in the specified range.
+//
+// LRANGE key start stop
+//
+// start和end值为-1时表示最右边一个，-2表示最右边倒数第二个，依次类推。。。
+//
+// 使用示例（lpush k 1 2 3 4 5）：
+// 1）查看最右边一个：lrange k -1 -1
+// 2）查看最右边两个：lrange k -2 -1
+// 3）查看最左边一个：lrange k 0 0
+// 4）查看最左边两个：lrange k 0 1
+// 5）查看全部：lrange k 0 -1
+int CRedisClient::lrange(
+        const std::string& key,
+        int64_t start, int64_t end,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LRANGE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(start);
+    cmd_args.add_arg(end);
+    cmd_args.final();
+
+    // Array reply: list of elements in the specified range.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), values);
+    return 0;
+}
+
+// Time complexity:
+// O(N) where N is the number of elements to be removed by the operation.
+//
+// LTRIM key start stop
+//
+// 注意：
+// 1）start和end值为-1时表示最右边一个，-2表示最右边倒数第二个，依次类推。。。
+// 2）start~stop 是“保留”区间而不是删除范围，两值相减的绝对值为保留的数量
+//
+// 使用示例（lpush k 1 2 3 4 5）：
+// 1）删除最右一个：ltrim k 0 -2
+// 2）删除最右两个：ltrim k 0 -3
+// 3）删除最左一个：ltrim k 1 -1
+// 4）删除最左两个：ltrim k 2 -1
+void CRedisClient::ltrim(
+        const std::string& key,
+        int64_t start, int64_t end,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LTRIM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(start);
+    cmd_args.add_arg(end);
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS)
+    redis_command(false, num_retries, key, cmd_args, which);
+}
+
+void CRedisClient::lset(const std::string& key, int index, const std::string& value, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LSET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(index);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Simple string reply (REDIS_REPLY_STATUS)
+    // An error is returned for out of range indexes.
+    redis_command(false, num_retries, key, cmd_args, which);
+}
+
+// Inserts value in the list stored at key either before or after the reference value pivot.
+//
+// Time complexity:
+// O(N) where N is the number of elements to traverse before seeing the value pivot.
+// This means that inserting somewhere on the left end on the list (head) can be considered O(1)
+// and inserting somewhere on the right end (tail) is O(N).
+int CRedisClient::linsert(const std::string& key, const std::string& pivot, const std::string& value, bool before, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LINSERT");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    if (before)
+        cmd_args.add_arg("BEFORE");
+    else
+        cmd_args.add_arg("AFTER");
+    cmd_args.add_arg(pivot);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply:
+    // the length of the list after the insert operation,
+    // or -1 when the value pivot was not found.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Removes the first count occurrences of elements equal to value from the list stored at key.
+// Time complexity:
+// O(N) where N is the length of the list.
+int CRedisClient::lrem(const std::string& key, int count, const std::string& value, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LREM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(count);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply: the number of removed elements.
+    // Returns the number of removed elements.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity:
+// O(N) where N is the number of elements to traverse to get to the element at index.
+// This makes asking for the first or the last element of the list O(1).
+bool CRedisClient::lindex(const std::string& key, int index, std::string* value, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("LINDEX");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(index);
+    cmd_args.final();
+
+    // Bulk string reply: the requested element, or nil when index is out of range.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return get_value(redis_reply.get(), value);
+    return true;
+}
+
+// Time complexity: O(1)
+// RPOP key
+bool CRedisClient::rpop(
+        const std::string& key,
+        std::string* value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("RPOP");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Bulk string reply: the value of the last element, or nil when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return get_value(redis_reply.get(), value);
+    return true;
+}
+
+int CRedisClient::rpop(const std::string& key, std::vector<std::string>* values, int n, Node* which, int num_retries)
+{
+    values->clear();
+
+    if (n < 1)
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.errmsg = "`n` is less than 1";
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else if (n == 1)
+    {
+        std::string value;
+        if (!rpop(key, &value, which, num_retries))
+        {
+            return 0;
+        }
+        else
+        {
+            values->push_back(value);
+            return 1;
+        }
+    }
+    else
+    {
+        const std::string lua_scripts =
+                "local v=redis.call('LRANGE',KEYS[1],-ARGV[1], -1);"
+                "redis.call('LTRIM',KEYS[1],0,-(ARGV[1]+1));"
+                "return v;";
+        std::vector<std::string> parameters(1);
+        parameters[0] = int2string(n);
+        const RedisReplyHelper redis_reply = eval(key, lua_scripts, parameters, which, num_retries);
+        if (REDIS_REPLY_ARRAY == redis_reply->type)
+        {
+            std::vector<std::string> v;
+            const int m = get_values(redis_reply.get(), &v);
+            // LRANGE 返回的结果是从左到右，对 r 操作需要倒过来
+            for (int i=m-1; i>-1; --i)
+                values->push_back(v[i]);
+            return m;
+        }
+        return 0;
+    }
+}
+
+bool CRedisClient::brpop(const std::string& key, std::string* value, uint32_t seconds, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("BRPOP");
+    cmd_args.set_block_milliseconds(static_cast<int64_t>(seconds) * 1000);
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(seconds);
+    cmd_args.final();
+
+    // Array reply:
+    // 1) A nil multi-bulk when no element could be popped and the timeout expired.
+    // 2) A two-element multi-bulk with the first element being the name of the key
+    //    where an element was popped and the second element being the value of the popped element.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (redis_reply->type == REDIS_REPLY_NIL)
+        return false;
+    if (redis_reply->type != REDIS_REPLY_ARRAY)
+        return false;
+    return get_value(redis_reply->element[1], value);
+}
+
+// Time complexity: O(1)
+bool CRedisClient::rpoppush(
+        const std::string& source,
+        const std::string& destination,
+        std::string* value,
+        Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(source);
+    cmd_args.set_command("RPOPLPUSH");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(source);
+    cmd_args.add_arg(destination);
+    cmd_args.final();
+
+    // Bulk string reply: the value of the last element, or nil when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, source, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return get_value(redis_reply.get(), value);
+    return true;
+}
+
+// Time complexity: O(1)
+bool CRedisClient::brpoppush(const std::string& source, const std::string& destination, std::string* value, uint32_t seconds, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(source);
+    cmd_args.set_command("BRPOPLPUSH");
+    cmd_args.set_block_milliseconds(static_cast<int64_t>(seconds) * 1000);
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(source);
+    cmd_args.add_arg(destination);
+    cmd_args.add_arg(seconds);
+    cmd_args.final();
+
+    // Bulk string reply: the value of the last element, or nil when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, source, cmd_args, which);
+    if (redis_reply->type == REDIS_REPLY_NIL)
+        return false;
+    if (redis_reply->type == REDIS_REPLY_STRING)
+        return get_value(redis_reply.get(), value);
+    return true;
+}
+
+// Time complexity: O(1)
+int CRedisClient::rpush(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("RPUSH");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply: the length of the list after the push operation.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(1)
+int CRedisClient::rpush(
+        const std::string& key,
+        const std::vector<std::string>& values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("RPUSH");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(values);
+    cmd_args.final();
+
+    // Integer reply: the length of the list after the push operation.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(1)
+int CRedisClient::rpushx(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("RPUSHX");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply:
+    // the length of the list after the push operation.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+//
+// SET
+//
+
+// Time complexity:
+//  O(1) for each element added, so O(N) to add N elements when the command is called with multiple arguments.
+int CRedisClient::sadd(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SADD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply: the number of elements that were added to the set,
+    // not including all the elements already present into the set.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+//  O(1) for each element added, so O(N) to add N elements when the command is called with multiple arguments.
+int CRedisClient::sadd(
+        const std::string& key,
+        const std::vector<std::string>& values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SADD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(values);
+    cmd_args.final();
+
+    // Integer reply: the number of elements that were added to the set,
+    // not including all the elements already present into the set.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// O(1)
+int CRedisClient::scard(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SCARD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply: the cardinality (number of elements) of the set, or 0 if key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// O(1)
+bool CRedisClient::sismember(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SISMEMBER");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // 1 if the element is a member of the set.
+    // 0 if the element is not a member of the set, or if key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return 1 == redis_reply->integer;
+    return true;
+}
+
+// O(N) where N is the set cardinality.
+int CRedisClient::smembers(
+        const std::string& key,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SMEMBERS");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Array reply:
+    // all elements of the set.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), values);
+    return 0;
+}
+
+int CRedisClient::smembers(
+        const std::string& key,
+        std::set<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SMEMBERS");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Array reply:
+    // all elements of the set.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), values);
+    return 0;
+}
+
+// Time complexity: O(1)
+bool CRedisClient::spop(
+        const std::string& key,
+        std::string* value,
+        Node* which,
+        int num_retries)
+{
+    std::vector<std::string> values;
+    const int n = spop(key, 1, &values, which, num_retries);
+    if (n > 0)
+    {
+        *value = value[0];
+    }
+    return n > 0;
+}
+
+// Time complexity: O(1)
+int CRedisClient::spop(
+        const std::string& key,
+        int count,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SPOP");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(count);
+    cmd_args.final();
+
+    // Bulk string reply:
+    // the removed element, or nil when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), values);
+    return 0;
+}
+
+// Time complexity: O(1)
+bool CRedisClient::srandmember(
+        const std::string& key,
+        std::string* value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SRANDMEMBER");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Bulk string reply:
+    // without the additional count argument the command returns a Bulk Reply with the randomly selected element,
+    // or nil when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+        return false;
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return get_value(redis_reply.get(), value);
+    return true;
+}
+
+// Time complexity: O(N) where N is the absolute value of the passed count.
+int CRedisClient::srandmember(
+        const std::string& key,
+        int count,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SRANDMEMBER");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(count);
+    cmd_args.final();
+
+    // Array reply:
+    // when the additional count argument is passed the command returns an array of elements,
+    // or an empty array when key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), values);
+    return 0;
+}
+
+// Time complexity: O(N) where N is the number of members to be removed.
+int CRedisClient::srem(
+        const std::string& key,
+        const std::string& value,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SREM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply: the number of members that were removed from the set,
+    // not including non existing members.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+int CRedisClient::srem(
+        const std::string& key,
+        const std::vector<std::string>& values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SREM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(values);
+    cmd_args.final();
+
+    // Integer reply: the number of members that were removed from the set,
+    // not including non existing members.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity:
+// O(1) for every call.
+// O(N) for a complete iteration, including enough command calls for the cursor to return back to 0.
+// N is the number of elements inside the collection..
+int64_t CRedisClient::sscan(
+        const std::string& key,
+        int64_t cursor,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    return sscan(key, cursor, std::string(""), 0, values, which, num_retries);
+}
+
+int64_t CRedisClient::sscan(
+        const std::string& key,
+        int64_t cursor, int count,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    return sscan(key, cursor, std::string(""), count, values, which, num_retries);
+}
+
+int64_t CRedisClient::sscan(
+        const std::string& key,
+        int64_t cursor, const std::string& pattern,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    return sscan(key, cursor, pattern, 0, values, which, num_retries);
+}
+
+int64_t CRedisClient::sscan(
+        const std::string& key,
+        int64_t cursor, const std::string& pattern, int count,
+        std::vector<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    // SSCAN key cursor [MATCH pattern] [COUNT count]
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SSCAN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(cursor);
+    if (!pattern.empty())
+    {
+        cmd_args.add_arg("MATCH");
+        cmd_args.add_arg(pattern);
+    }
+    if (count > 0)
+    {
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+    }
+    cmd_args.final();
+
+    // (gdb) p *redis_reply
+    // $3 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 2, element = 0x641450}
+    // (gdb) p *redis_reply->element[0]
+    // $4 = {type = 1, integer = 0, len = 4, str = 0x641810 "6656", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]
+    // $5 = {type = 2, integer = 0, len = 0, str = 0x0, elements = 10, element = 0x641930}
+    // (gdb) p *redis_reply->element[1]->element[0]
+    // $6 = {type = 1, integer = 0, len = 5, str = 0x6419d0 "f1055", elements = 0, element = 0x0}
+    // (gdb) p *redis_reply->element[1]->element[1]
+    // $7 = {type = 1, integer = 0, len = 5, str = 0x641a30 "f6368", elements = 0, element = 0x0}
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+    {
+        get_values(redis_reply->element[1], values);
+        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+    }
+    return 0;
+}
+
+int64_t CRedisClient::sscan(
+        const std::string& key,
+        int64_t cursor,
+        const std::string& pattern,
+        int count,
+        std::set<std::string>* values,
+        Node* which,
+        int num_retries)
+{
+    // SSCAN key cursor [MATCH pattern] [COUNT count]
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SSCAN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(cursor);
+    if (!pattern.empty())
+    {
+        cmd_args.add_arg("MATCH");
+        cmd_args.add_arg(pattern);
+    }
+    if (count > 0)
+    {
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+    }
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+    {
+        get_values(redis_reply->element[1], values);
+        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+    }
+    return 0;
+}
+
+
+// Copies all members of source keys to destinationkey.
+// Time complexity: O(N) where N is the total number of elements in all given sets.
+// Returns the number of members that were in resulting set.
+int  CRedisClient::sunionstore(
+    const std::string& destinationkey, 
+    const std::vector<std::string>& keys, 
+    Node* which, 
+    int num_retries)
+{
+    
+    std::vector<std::string> allKeys;
+    allKeys=keys;
+    allKeys.push_back(destinationkey);
+    if(keys.size()<1){
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.errmsg = "There must be minimum one key";
+        THROW_REDIS_EXCEPTION(errinfo);        
+    }
+    else if (cluster_mode() && keys_crossslots(allKeys))
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_NOT_SUPPORT;
+        errinfo.errmsg = "CROSSSLOT not supported in cluster mode";
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {    
+        CommandArgs cmd_args;
+        cmd_args.set_command("SUNIONSTORE");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(destinationkey);
+        cmd_args.add_args(keys);
+        cmd_args.final();
+
+        // Integer reply, specifically:
+        // Integer reply: the number of elements in the resulting set..
+        const RedisReplyHelper redis_reply = redis_command(false, num_retries, destinationkey, cmd_args, which);
+        if (REDIS_REPLY_INTEGER == redis_reply->type)
+            return static_cast<int>(redis_reply->integer);
+        return 0;
+    }
+}
+
+
+//
+// ZSET
+//
+
+// Time complexity:
+// O(M*log(N)) with N being the number of elements in the sorted set and M the number of elements to be removed.
+//
+// ZREM key member [member ...]
+int CRedisClient::zrem(
+        const std::string& key,
+        const std::string& field,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZREM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // The number of members removed from the sorted set, not including non existing members.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity:
+// O(M*log(N)) with N being the number of elements in the sorted set and M the number of elements to be removed.
+int CRedisClient::zrem(
+        const std::string& key,
+        const std::vector<std::string>& fields,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZREM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(fields);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // The number of members removed from the sorted set, not including non existing members.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)) for each item added, where N is the number of elements in the sorted set.
+//
+// ZADD key [NX|XX] [CH] [INCR] score member [score member ...]
+int CRedisClient::zadd(
+        const std::string& key,
+        const std::string& field,
+        int64_t score,
+        ZADDFLAG flag,
+        Node* which,
+        int num_retries)
+{
+    std::map<std::string, int64_t> map;
+    map[field] = score;
+    return zadd(key, map, flag, which, num_retries);
+}
+
+int CRedisClient::zadd(
+        const std::string& key,
+        const std::map<std::string, int64_t>& map,
+        ZADDFLAG flag,
+        Node* which,
+        int num_retries)
+{
+    const std::string& flag_str = zaddflag2str(flag);
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZADD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    if (!flag_str.empty())
+    {
+        cmd_args.add_arg(flag_str);
+    }
+    cmd_args.add_args(map, true);
+    cmd_args.final();
+
+    // Integer reply, specifically:
+    // The number of elements added to the sorted sets, not including
+    // elements already existing for which the score was updated.
+    //
+    // If the INCR option is specified, the return value will be Bulk string reply:
+    // the new score of member (a double precision floating point number), represented as string.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(1)
+int64_t CRedisClient::zcard(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZCARD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply:
+    // the cardinality (number of elements) of the sorted set, or 0 if key does not exist.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int64_t>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)) with N being the number of elements in the sorted set.
+//
+// ZCOUNT key min max
+int64_t CRedisClient::zcount(
+        const std::string& key,
+        int64_t min, int64_t max ,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZCOUNT");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(min);
+    cmd_args.add_arg(max);
+    cmd_args.final();
+
+    // Integer reply:
+    // the number of elements in the specified score range.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int64_t>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)) where N is the number of elements in the sorted set.
+//
+// ZINCRBY key increment member
+int64_t CRedisClient::zincrby(
+        const std::string& key,
+        const std::string& field, int64_t increment,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZINCRBY");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(increment);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // Bulk string reply:
+    // the new score of member (a double precision floating point number), represented as string.
+    //
+    // (gdb) p *redis_reply._redis_reply
+    // $4 = {type = 1, integer = 0, len = 2, str = 0x647860 "10", elements = 0, element = 0x0}
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_STRING == redis_reply->type)
+        return static_cast<int64_t>(atoll(redis_reply->str));
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements returned.
+// ZRANGE key start stop [WITHSCORES]
+//
+// ZRANGE key start stop [WITHSCORES]
+int CRedisClient::zrange(
+        const std::string& key,
+        int64_t start, int64_t end, bool withscores,
+        std::vector<std::pair<std::string, int64_t> >* vec,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZRANGE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(start);
+    cmd_args.add_arg(end);
+    if (withscores)
+    {
+        cmd_args.add_arg("WITHSCORES");
+    }
+    cmd_args.final();
+
+    // Array reply:
+    // list of elements in the specified range (optionally with their scores, in case the WITHSCORES option is given).
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), vec, withscores);
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements returned.
+//
+// ZREVRANGE key start stop [WITHSCORES]
+int CRedisClient::zrevrange(
+        const std::string& key,
+        int64_t start, int64_t end, bool withscores,
+        std::vector<std::pair<std::string, int64_t> >* vec,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZREVRANGE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(start);
+    cmd_args.add_arg(end);
+    if (withscores)
+    {
+        cmd_args.add_arg("WITHSCORES");
+    }
+    cmd_args.final();
+
+    // Array reply:
+    // list of elements in the specified range (optionally with their scores, in case the WITHSCORES option is given).
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), vec, withscores);
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements being returned.
+// If M is constant (e.g. always asking for the first 10 elements with LIMIT), you can consider it O(log(N)).
+//
+// ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
+int CRedisClient::zrangebyscore(
+        const std::string& key,
+        int64_t min, int64_t max, bool withscores,
+        std::vector<std::pair<std::string, int64_t> >* vec,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZRANGEBYSCORE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(min);
+    cmd_args.add_arg(max);
+    if (withscores)
+    {
+        cmd_args.add_arg("WITHSCORES");
+    }
+    cmd_args.final();
+
+    // Array reply:
+    // list of elements in the specified score range (optionally with their scores).
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), vec, withscores);
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements being returned.
+// If M is constant (e.g. always asking for the first 10 elements with LIMIT), you can consider it O(log(N)).
+//
+// ZREVRANGEBYSCORE key max min [WITHSCORES] [LIMIT offset count]
+int CRedisClient::zrevrangebyscore(
+        const std::string& key,
+        int64_t max, int64_t min, bool withscores,
+        std::vector<std::pair<std::string, int64_t> >* vec,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZREVRANGEBYSCORE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(max);
+    cmd_args.add_arg(min);
+    if (withscores)
+    {
+        cmd_args.add_arg("WITHSCORES");
+    }
+    cmd_args.final();
+
+    // Array reply:
+    // list of elements in the specified score range (optionally with their scores).
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), vec, withscores);
+    return 0;
+}
+
+// ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
+int CRedisClient::zrangebyscore(
+        const std::string& key,
+        int64_t min, int64_t max, int64_t offset, int64_t count, bool withscores,
+        std::vector<std::pair<std::string, int64_t> >* vec,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZRANGEBYSCORE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(min);
+    cmd_args.add_arg(max);
+    if (withscores)
+    {
+        cmd_args.add_arg("WITHSCORES");
+    }
+    cmd_args.add_arg("LIMIT");
+    cmd_args.add_arg(offset);
+    cmd_args.add_arg(count);
+    cmd_args.final();
+
+    // Array reply:
+    // list of elements in the specified score range (optionally with their scores).
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), vec, withscores);
+    return 0;
+}
+
+// ZREVRANGEBYSCORE key max min [WITHSCORES] [LIMIT offset count]
+int CRedisClient::zrevrangebyscore(
+        const std::string& key,
+        int64_t max, int64_t min, int64_t offset, int64_t count, bool withscores,
+        std::vector<std::pair<std::string, int64_t> >* vec,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZREVRANGEBYSCORE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(max);
+    cmd_args.add_arg(min);
+    if (withscores)
+    {
+        cmd_args.add_arg("WITHSCORES");
+    }
+    cmd_args.add_arg("LIMIT");
+    cmd_args.add_arg(offset);
+    cmd_args.add_arg(count);
+    cmd_args.final();
+
+    // Array reply:
+    // list of elements in the specified score range (optionally with their scores).
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+        return get_values(redis_reply.get(), vec, withscores);
+    return 0;
+}
+
+// Time complexity:
+// O(log(N)+M) with N being the number of elements in the sorted set and M the number of elements removed by the operation.
+//
+// ZREMRANGEBYRANK key start stop
+int CRedisClient::zremrangebyrank(
+        const std::string& key,
+        int64_t start, int64_t end,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZREMRANGEBYRANK");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(start);
+    cmd_args.add_arg(end);
+    cmd_args.final();
+
+    // Integer reply:
+    // the number of elements removed.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// Time complexity: O(log(N))
+//
+// ZRANK key member
+int CRedisClient::zrank(const std::string& key, const std::string& field, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZRANK");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // If member exists in the sorted set, Integer reply: the rank of member.
+    // If member does not exist in the sorted set or key does not exist, Bulk string reply: nil.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+    {
+        return -1;
+    }
+    else
+    {
+        if (REDIS_REPLY_INTEGER == redis_reply->type)
+            return static_cast<int>(redis_reply->integer);
+        return 0;
+    }
+}
+
+int CRedisClient::zrevrank(const std::string& key, const std::string& field, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZREVRANK");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // If member exists in the sorted set, Integer reply: the rank of member.
+    // If member does not exist in the sorted set or key does not exist, Bulk string reply: nil.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+    {
+        return -1;
+    }
+    else
+    {
+        if (REDIS_REPLY_INTEGER == redis_reply->type)
+            return static_cast<int>(redis_reply->integer);
+        return 0;
+    }
+}
+
+// Time complexity: O(1)
+// ZSCORE key member
+int64_t CRedisClient::zscore(const std::string& key, const std::string& field, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZSCORE");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(field);
+    cmd_args.final();
+
+    // Bulk string reply:
+    // the score of member (a double precision floating point number), represented as string.
+    // If member does not exist in the sorted set, or key does not exist, nil is returned.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_NIL == redis_reply->type)
+    {
+        return -1;
+    }
+    else
+    {
+        if (REDIS_REPLY_STRING == redis_reply->type)
+            return static_cast<int64_t>(atoll(redis_reply->str));
+        return 0;
+    }
+}
+
+// Time complexity:
+// O(1) for every call. O(N) for a complete iteration,
+// including enough command calls for the cursor to return back to 0. N is the number of elements inside the collection..
+//
+// ZSCAN key cursor [MATCH pattern] [COUNT count]
+int64_t CRedisClient::zscan(
+        const std::string& key,
+        int64_t cursor,
+        std::vector<std::pair<std::string, int64_t> >* values,
+        Node* which,
+        int num_retries)
+{
+    return zscan(key, cursor, std::string(""), 0, values, which, num_retries);
+}
+
+int64_t CRedisClient::zscan(
+        const std::string& key,
+        int64_t cursor, int count,
+        std::vector<std::pair<std::string, int64_t> >* values,
+        Node* which,
+        int num_retries)
+{
+    return zscan(key, cursor, std::string(""), count, values, which, num_retries);
+}
+
+int64_t CRedisClient::zscan(
+        const std::string& key,
+        int64_t cursor, const std::string& pattern,
+        std::vector<std::pair<std::string, int64_t> >* values,
+        Node* which,
+        int num_retries)
+{
+    return zscan(key, cursor, pattern, 0, values, which, num_retries);
+}
+
+int64_t CRedisClient::zscan(
+        const std::string& key,
+        int64_t cursor, const std::string& pattern, int count,
+        std::vector<std::pair<std::string, int64_t> >* values,
+        Node* which,
+        int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("ZSCAN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(cursor);
+    if (!pattern.empty())
+    {
+        cmd_args.add_arg("MATCH");
+        cmd_args.add_arg(pattern);
+    }
+    if (count > 0)
+    {
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+    }
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_ARRAY == redis_reply->type)
+    {
+        get_values(redis_reply->element[1], values, true);
+        return static_cast<int64_t>(atoll(redis_reply->element[0]->str));
+    }
+    return 0;
+}
+
+//
+// STREAM
+//
+
+// 从待处理条目列表（PEL）中移除待处理条目（ids），
+// 因为一旦消息被成功处理，消费者组就不再需要跟踪它并记住消息的当前所有者
+// Time complexity: O(1) for each message ID processed.
+// XACK key group ID [ID ...]
+int CRedisClient::xack(
+        const std::string& key, const std::string& groupname,
+        const std::vector<std::string>& ids,
+        Node* which, int num_retries)
+{
+    std::string value;
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XACK");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(groupname);
+    cmd_args.add_args(ids);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+int CRedisClient::xack(
+        const std::string& key, const std::string& groupname,
+        const std::string& id,
+        Node* which, int num_retries)
+{
+    std::vector<std::string> ids(1);
+    ids[0] = id;
+    return xack(key, groupname, ids, which, num_retries);
+}
+
+// Time complexity: O(1)
+// XADD key [MAXLEN [~|=] <count>] <ID or *> [field value] [field value] ...
+std::string CRedisClient::xadd(
+        const std::string& key, const std::string& id,
+        const std::vector<FVPair>& values,
+        int64_t maxlen, char c,
+        Node* which, int num_retries)
+{
+    std::string value;
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XADD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg("MAXLEN");
+    cmd_args.add_arg(c);
+    cmd_args.add_arg(maxlen);
+    cmd_args.add_arg(id);
+    cmd_args.add_args(values);
+    cmd_args.final();
+
+    // The command returns the number of messages successfully acknowledged.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    //if (REDIS_REPLY_STRING == redis_reply->type)
+    (void)get_value(redis_reply.get(), &value);
+    return value;
+}
+
+std::string CRedisClient::xadd(
+        const std::string& key, const std::string& id,
+        const std::vector<FVPair>& values,
+        Node* which, int num_retries)
+{
+    std::string value;
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XADD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(id);
+    cmd_args.add_args(values);
+    cmd_args.final();
+
+    // The command returns the number of messages successfully acknowledged.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    //if (REDIS_REPLY_STRING == redis_reply->type)
+    (void)get_value(redis_reply.get(), &value);
+    return value;
+}
+
+int CRedisClient::xadd(
+        const std::vector<Stream>& streams, std::vector<std::string>* ids,
+        int64_t maxlen, char c, int window_size, int num_retries)
+{
+    Pipeline pipeline;
+    int num_added = 0;
+
+    for (std::vector<Stream>::size_type i=0; i<streams.size(); ++i)
+    {
+        const Stream& stream = streams[i];
+
+        for (std::vector<StreamEntry>::size_type j=0; j<stream.entries.size(); ++j)
+        {
+            const StreamEntry& entry = stream.entries[j];
+            CommandArgs cmd_args;
+            cmd_args.set_key(stream.key);
+            cmd_args.set_command("XADD");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(stream.key);
+            if (maxlen > 0)
+            {
+                cmd_args.add_arg("MAXLEN");
+                cmd_args.add_arg(c);
+                cmd_args.add_arg(maxlen);
+            }
+            cmd_args.add_arg(entry.id.empty()? std::string("*"): entry.id);
+            cmd_args.add_args(entry.fvpairs);
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+    }
+    if (pipeline.size() > 0)
+        num_added = this->pipeline(&pipeline, window_size, num_retries);
+
+    ids->resize(pipeline.size());
+    for (int i=0; i<pipeline.size(); ++i)
+    {
+        const redisReply* redis_reply = pipeline.get_reply(i);
+
+        (*ids)[i].clear();
+        if (redis_reply!=NULL && REDIS_REPLY_STRING==redis_reply->type)
+            (void)get_value(redis_reply, &(*ids)[i]);
+    }
+    return num_added;
+}
+
+// Time complexity: O(1) for all the subcommands, with the exception of the
+// DESTROY subcommand which takes an additional O(M) time in order to delete
+// the M entries inside the consumer group pending entries list (PEL).
+//
+// XGROUP CREATE key(topic) groupname id-or-$
+bool CRedisClient::xgroup_create(
+        const std::string& key, const std::string& groupname, const std::string& id,
+        bool mkstream,
+        Node* which, int num_retries)
+{
+    // xgroup CREATE key groupname id-or-$
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XGROUP");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg("CREATE");
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(groupname);
+    cmd_args.add_arg(id);
+    if (mkstream)
+    {
+        // ERR The XGROUP subcommand requires the key to exist.
+        // Note that for CREATE you may want to use the MKSTREAM option to create an empty stream automatically.
+        cmd_args.add_arg("MKSTREAM");
+    }
+    cmd_args.final();
+
+    try
+    {
+        // If the specified consumer group already exists, the command returns a -BUSYGROUP error.
+        // Otherwise the operation is performed and OK is returned.
+        // There are no hard limits to the number of consumer groups you can associate to a given stream.
+        //
+        // Consumers in a consumer group are auto-created every time a new consumer name is mentioned by some command.
+        //
+        // 如果key不存在，则会报如下错误：
+        // The XGROUP subcommand requires the key to exist.
+        // Note that for CREATE you may want to use the MKSTREAM option to create an empty stream automatically.
+        const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+        std::string val;
+        get_value(redis_reply.get(), &val);
+        // When a consumer group with the same name already exists, the command returns a -BUSYGROUP error.
+        return val == "OK";
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        // BUSYGROUP Consumer Group name already exists
+        if (r3c::is_busygroup_error(ex.errtype()))
+            return false;
+        else
+            throw;
+    }
+}
+
+// To just remove a given consumer from a consumer group.
+// Consumers in a consumer group are auto-created every time a new consumer name is mentioned by some command.
+//
+// XGROUP DESTROY key groupname
+bool CRedisClient::xgroup_destroy(const std::string& key, const std::string& groupname, Node* which, int num_retries)
+{
+    // xgroup DESTROY key groupname
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XGROUP");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg("DESTROY");
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(groupname);
+    cmd_args.final();
+
+    // The consumer group will be destroyed even if there are active consumers
+    // and pending messages, so make sure to call this command only when really needed.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    // Integer reply: the number of destroyed consumer groups (0 or 1)
+    return get_value(redis_reply.get()) == 1;
+}
+
+// XGROUP SETID key groupname id-or-$
+void CRedisClient::xgroup_setid(const std::string& key, const std::string& id, Node* which, int num_retries)
+{
+    // xgroup SETID key id-or-$
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XGROUP");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg("SETID");
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(id);
+    cmd_args.final();
+
+    (void)redis_command(false, num_retries, key, cmd_args, which);
+}
+
+// XGROUP DELCONSUMER key groupname consumername
+int64_t CRedisClient::xgroup_delconsumer(const std::string& key, const std::string& groupname, const std::string& consumername, Node* which, int num_retries)
+{
+    // xgroup DELCONSUMER key groupname consumername
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XGROUP");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg("DELCONSUMER");
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(groupname);
+    cmd_args.add_arg(consumername);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+// XREADGROUP命令是XREAD命令的特殊版本，支持消费者组
+// 当使用XREADGROUP读取时，服务器将会记住某个给定的消息已经传递：
+// 消息会被存储在消费者组内的待处理条目列表（PEL）中，即已送达但尚未确认的消息ID列表。
+// 客户端必须使用XACK确认消息处理，以便从待处理条目列表中删除待处理条目，
+// 还可以使用XPENDING命令检查待处理条目列表。
+//
+// 特殊ID“>”，意味着消费者希望只接收从未发送给任何其他消费者的消息，即只读取新的消息
+//
+// Reads more than one keys
+//
+// Available since 5.0.0.
+// Time complexity: For each stream mentioned: O(M) with M being the number
+// of elements returned. If M is constant (e.g. always asking for the first 10
+// elements with COUNT), you can consider it O(1). On the other side when
+// XREADGROUP blocks, XADD will pay the O(N) time in order to serve the N
+// clients blocked on the stream getting new data.
+//
+// XREADGROUP GROUP group consumer [COUNT count] [BLOCK milliseconds] [NOACK] STREAMS key [key ...] ID [ID ...]
+const RedisReplyHelper CRedisClient::xreadgroup_command(
+        const std::string& groupname, const std::string& consumername,
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count, int64_t block_milliseconds, bool noack,
+        Node* which, int num_retries)
+{
+    if (keys.empty())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "ERR";
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = "wrong number of arguments for 'xreadgroup' command";
+        errinfo.errmsg = format_string("[R3C_XREADGROUP][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else if (keys.size() != ids.size())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "ERR";
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = "unbalanced XREADGROUP list of streams: for each stream key an ID or '$' must be specified";
+        errinfo.errmsg = format_string("[R3C_XREADGROUP][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else if (cluster_mode() && keys_crossslots(keys))
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "CROSSSLOT";
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = "keys in request don't hash to the same slot";
+        errinfo.errmsg = format_string("[R3C_XREADGROUP][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        const std::string key = cluster_mode()? keys[0]: std::string("");
+        CommandArgs cmd_args;
+        if (!key.empty())
+            cmd_args.set_key(key);
+        cmd_args.set_command("XREADGROUP");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg("GROUP");
+        cmd_args.add_arg(groupname);
+        cmd_args.add_arg(consumername);
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+        if (block_milliseconds >= 0) // timeout is negative
+        {
+            cmd_args.add_arg("BLOCK");
+            cmd_args.add_arg(block_milliseconds);
+            cmd_args.set_block_milliseconds(block_milliseconds);
+        }
+        if (noack)
+        {
+            cmd_args.add_arg("NOACK");
+        }
+        cmd_args.add_arg("STREAMS");
+        cmd_args.add_args(keys);
+        cmd_args.add_args(ids);
+        cmd_args.final();
+
+        // REDIS_REPLY_ARRAY
+        return redis_command(false, num_retries, key, cmd_args, which);
+    }
+}
+
+void CRedisClient::xreadgroup(
+        const std::string& groupname, const std::string& consumername,
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count, int64_t block_milliseconds, bool noack,
+        std::vector<Stream>* values,
+        Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xreadgroup_command(
+            groupname, consumername, keys, ids, count, block_milliseconds, noack, which, num_retries);
+    get_values(redis_reply.get(), values);
+}
+
+void CRedisClient::xreadgroup(
+        const std::string& groupname, const std::string& consumername,
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count, int64_t block_milliseconds, bool noack,
+        StreamBatch* batch,
+        Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xreadgroup_command(
+            groupname, consumername, keys, ids, count, block_milliseconds, noack, which, num_retries);
+    get_values(redis_reply.get(), batch);
+}
+
+// Reads more than one keys
+void CRedisClient::xreadgroup(
+        const std::string& groupname, const std::string& consumername,
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count, bool noack,
+        std::vector<Stream>* values,
+        Node* which, int num_retries)
+{
+    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
+    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, values, which, num_retries);
+}
+
+// Reads more than one keys
+void CRedisClient::xreadgroup(
+        const std::string& groupname, const std::string& consumername,
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        bool noack,
+        std::vector<Stream>* values,
+        Node* which, int num_retries)
+{
+    const int64_t count = 0;
+    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
+    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, values, which, num_retries);
+}
+
+// Only read one key
+void CRedisClient::xreadgroup(
+        const std::string& groupname, const std::string& consumername,
+        const std::string& key, const std::string& id,
+        int64_t count, int64_t block_milliseconds,
+        bool noack,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    std::vector<Stream> streams;
+    std::vector<std::string> keys(1);
+    std::vector<std::string> ids(1);
+
+    keys[0] = key;
+    ids[0] = id;
+    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, &streams, which, num_retries);
+    if (!streams.empty())
+        values->swap(streams[0].entries);
+}
+
+// Only read one key
+void CRedisClient::xreadgroup(
+        const std::string& groupname, const std::string& consumername,
+        const std::string& key,
+        int64_t count, int64_t block_milliseconds,
+        bool noack,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    std::vector<Stream> streams;
+    std::vector<std::string> keys(1);
+    std::vector<std::string> ids(1);
+
+    keys[0] = key;
+    ids[0] = ">";
+    xreadgroup(groupname, consumername, keys, ids, count, block_milliseconds, noack, &streams, which, num_retries);
+    if (!streams.empty())
+        values->swap(streams[0].entries);
+}
+
+// Reads more than one keys
+// XREAD [COUNT count] [BLOCK milliseconds] STREAMS key [key ...] ID [ID ...]
+const RedisReplyHelper CRedisClient::xread_command(
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count, int64_t block_milliseconds,
+        Node* which, int num_retries)
+{
+    if (keys.empty())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "ERR";
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = "wrong number of arguments for 'xread' command";
+        errinfo.errmsg = format_string("[R3C_XREAD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else if (keys.size() != ids.size())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "ERR";
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = "unbalanced XREAD list of streams: for each stream key an ID or '$' must be specified";
+        errinfo.errmsg = format_string("[R3C_XREAD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else if (cluster_mode() && keys_crossslots(keys))
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "CROSSSLOT";
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = "keys in request don't hash to the same slot";
+        errinfo.errmsg = format_string("[R3C_XREAD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        const std::string key = cluster_mode()? keys[0]: std::string("");
+        CommandArgs cmd_args;
+        if (!key.empty())
+            cmd_args.set_key(key);
+        cmd_args.set_command("XREAD");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+        if (block_milliseconds >= 0) // timeout is negative
+        {
+            cmd_args.add_arg("BLOCK");
+            cmd_args.add_arg(block_milliseconds);
+            cmd_args.set_block_milliseconds(block_milliseconds);
+        }
+        cmd_args.add_arg("STREAMS");
+        cmd_args.add_args(keys);
+        cmd_args.add_args(ids);
+        cmd_args.final();
+
+        return redis_command(true, num_retries, key, cmd_args, which);
+    }
+}
+
+void CRedisClient::xread(
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count, int64_t block_milliseconds,
+        std::vector<Stream>* values, Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xread_command(keys, ids, count, block_milliseconds, which, num_retries);
+    get_values(redis_reply.get(), values);
+}
+
+void CRedisClient::xread(
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count, int64_t block_milliseconds,
+        StreamBatch* batch, Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xread_command(keys, ids, count, block_milliseconds, which, num_retries);
+    get_values(redis_reply.get(), batch);
+}
+
+// Reads more than one keys
+void CRedisClient::xread(
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        int64_t count,
+        std::vector<Stream>* values, Node* which, int num_retries)
+{
+    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
+    xread(keys, ids, count, block_milliseconds, values, which, num_retries);
+}
+
+// Reads more than one keys
+void CRedisClient::xread(
+        const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+        std::vector<Stream>* values, Node* which, int num_retries)
+{
+    const int64_t count = 0;
+    const int64_t block_milliseconds = -1; // -1 means, no BLOCK argument given
+    xread(keys, ids, count, block_milliseconds, values, which, num_retries);
+}
+
+// Only read one key
+void CRedisClient::xread(
+        const std::string& key, const std::string& id,
+        int64_t count, int64_t block_milliseconds,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    std::vector<Stream> streams;
+    std::vector<std::string> keys(1);
+    std::vector<std::string> ids(1);
+
+    keys[0] = key;
+    ids[0] = id;
+    xread(keys, ids, count, block_milliseconds, &streams, which, num_retries);
+    if (!streams.empty())
+        values->swap(streams[0].entries);
+}
+
+// Only read one key
+void CRedisClient::xread(
+        const std::string& key,
+        int64_t count, int64_t block_milliseconds,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    std::vector<Stream> streams;
+    std::vector<std::string> keys(1);
+    std::vector<std::string> ids(1);
+
+    keys[0] = key;
+    ids[0] = ">";
+    xread(keys, ids, count, block_milliseconds, &streams, which, num_retries);
+    if (!streams.empty())
+        values->swap(streams[0].entries);
+}
+
+// XDEL <key> [<ID1> <ID2> ... <IDN>]
+int CRedisClient::xdel(const std::string& key, const std::vector<std::string>& ids, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XDEL");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(ids);
+    cmd_args.final();
+
+    // Integer reply: the number of entries actually deleted.
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+int CRedisClient::xdel(const std::string& key, const std::string& id, Node* which, int num_retries)
+{
+    std::vector<std::string> ids(1);
+    ids[0] = id;
+    return xdel(key, ids, which, num_retries);
+}
+
+// XTRIM key MAXLEN [~] count
+int64_t CRedisClient::xtrim(const std::string& key, int64_t maxlen, char c, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XTRIM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg("MAXLEN");
+    cmd_args.add_arg(c);
+    cmd_args.add_arg(maxlen);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+int64_t CRedisClient::xtrim(const std::string& key, int64_t maxlen, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XTRIM");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg("MAXLEN");
+    cmd_args.add_arg(maxlen);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(false, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+// XLEN key
+int64_t CRedisClient::xlen(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XLEN");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply: the number of entries of the stream at key.
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+// XRANGE key start end [COUNT count]
+const RedisReplyHelper CRedisClient::xrange_command(
+        const std::string& command, const std::string& key,
+        const std::string& first, const std::string& second, int64_t count,
+        Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command(command);
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(first);
+    cmd_args.add_arg(second);
+    if (count >= 0)
+    {
+        cmd_args.add_arg("COUNT");
+        cmd_args.add_arg(count);
+    }
+    cmd_args.final();
+
+    return redis_command(true, num_retries, key, cmd_args, which);
+}
+
+void CRedisClient::xrange(
+        const std::string& key,
+        const std::string& start, const std::string& end, int64_t count,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xrange_command("XRANGE", key, start, end, count, which, num_retries);
+    get_values(redis_reply.get(), values);
+}
+
+void CRedisClient::xrange(
+        const std::string& key,
+        const std::string& start, const std::string& end,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    const int64_t count = -1;
+    xrange(key, start, end, count, values, which, num_retries);
+}
+
+// XREVRANGE key end start [COUNT count]
+void CRedisClient::xrevrange(
+        const std::string& key,
+        const std::string& end, const std::string& start, int64_t count,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xrange_command("XREVRANGE", key, end, start, count, which, num_retries);
+    get_values(redis_reply.get(), values);
+}
+
+void CRedisClient::xrevrange(
+        const std::string& key,
+        const std::string& end, const std::string& start,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    const int64_t count = -1;
+    xrevrange(key, end, start, count, values, which, num_retries);
+}
+
+void CRedisClient::xrange(
+        const std::string& key,
+        const std::string& start, const std::string& end, int64_t count,
+        StreamBatch* batch,
+        Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xrange_command("XRANGE", key, start, end, count, which, num_retries);
+    get_values(redis_reply.get(), key, batch);
+}
+
+void CRedisClient::xrevrange(
+        const std::string& key,
+        const std::string& end, const std::string& start, int64_t count,
+        StreamBatch* batch,
+        Node* which, int num_retries)
+{
+    const RedisReplyHelper redis_reply = xrange_command("XREVRANGE", key, end, start, count, which, num_retries);
+    get_values(redis_reply.get(), key, batch);
+}
+
+// PEL: Pending Entries List (待处理条目列表)
+// XPENDING <key> <group> [<start> <stop> <count> [<consumer>]]
+int CRedisClient::xpending(
+        const std::string& key, const std::string& groupname,
+        const std::string& start, const std::string& end, int count, const std::string& consumer,
+        std::vector<struct DetailedPending>* pendings,
+        Node* which, int num_retries)
+{
+    if (start.empty() || end.empty() || consumer.empty())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "ERR";
+        errinfo.raw_errmsg = "wrong number of arguments for 'xpending' command";
+        errinfo.errmsg = format_string("[R3C_XPENDING][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        CommandArgs cmd_args;
+        cmd_args.set_key(key);
+        cmd_args.set_command("XPENDING");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(key);
+        cmd_args.add_arg(groupname);
+        // 如果指定了start，则end和count也必须指定，否则会报错“syntax error”
+        cmd_args.add_arg(start); // -
+        cmd_args.add_arg(end); // +
+        cmd_args.add_arg(count);
+        if (!consumer.empty())
+            cmd_args.add_arg(consumer);
+        cmd_args.final();
+
+        // The command returns data in different format depending on the way it is called,
+        // as previously explained in this page. However the reply is always an array of items.
+        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+        return get_values(redis_reply.get(), pendings);
+    }
+}
+
+int CRedisClient::xpending(
+        const std::string& key, const std::string& groupname,
+        const std::string& start, const std::string& end, int count,
+        std::vector<struct DetailedPending>* pendings,
+        Node* which, int num_retries)
+{
+    const std::string consumer;
+    return xpending(key, groupname, start, end, count, consumer, pendings, which, num_retries);
+}
+
+int CRedisClient::xpending(
+        const std::string& key, const std::string& groupname,
+        struct GroupPending* groups,
+        Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XPENDING");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(groupname);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_values(redis_reply.get(), groups);
+}
+
+// Gets ownership of one or multiple messages in the Pending Entries List
+// of a given stream consumer group.
 //
 // If the message ID (among the specified ones) exists, and its idle
 // time greater or equal to <min-idle-time>, then the message new owner
@@ -4131,1293 +8320,2726 @@ int CRedisClient::xpending(
 void CRedisClient::xclaim(
         const std::string& key, const std::string& groupname, const std::string& consumer,
         int64_t minidle, const std::vector<std::string>& ids,
-        int64_t idletime, int64_t unixtime, int64_t retrycount, bool force,
-        std::vector<StreamEntry>* values,
+        int64_t idletime, int64_t unixtime, int64_t retrycount, bool force,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    if (ids.empty())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "ERR";
+        errinfo.raw_errmsg = "wrong number of arguments for 'xclaim' command";
+        errinfo.errmsg = format_string("[R3C_XPENDING][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        CommandArgs cmd_args;
+        cmd_args.set_key(key);
+        cmd_args.set_command("XCLAIM");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(key);
+        cmd_args.add_arg(groupname);
+        cmd_args.add_arg(consumer);
+        if (minidle >= 0)
+        {
+            cmd_args.add_arg(minidle);
+        }
+        if (!ids.empty())
+        {
+            cmd_args.add_args(ids);
+        }
+        if (idletime >= 0)
+        {
+            cmd_args.add_arg("IDLE");
+            cmd_args.add_arg(idletime);
+        }
+        if (unixtime >= 0)
+        {
+            cmd_args.add_arg("TIME");
+            cmd_args.add_arg(unixtime);
+        }
+        if (retrycount >= 0)
+        {
+            cmd_args.add_arg(retrycount);
+        }
+        if (force)
+        {
+            cmd_args.add_arg("FORCE");
+        }
+        //cmd_args.add_arg("JUSTID");
+        cmd_args.final();
+
+        // Returns all the messages successfully claimed, in the same format as XRANGE.
+        // However if the JUSTID option was specified,
+        // only the message IDs are reported, without including the actual message.
+        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+        get_values(redis_reply.get(), values);
+    }
+}
+
+void CRedisClient::xclaim(
+        const std::string& key, const std::string& groupname, const std::string& consumer,
+        int64_t minidle, const std::vector<std::string>& ids,
+        std::vector<StreamEntry>* values,
+        Node* which, int num_retries)
+{
+    const int64_t idletime = -1;
+    const int64_t unixtime = -1;
+    const int64_t retrycount = -1;
+    bool force = false;
+    xclaim(key, groupname, consumer, minidle, ids, idletime, unixtime, retrycount, force, values, which, num_retries);
+}
+
+void CRedisClient::xclaim(
+        const std::string& key, const std::string& groupname, const std::string& consumer,
+        int64_t minidle, const std::vector<std::string>& ids,
+        int64_t idletime, int64_t unixtime, int64_t retrycount,
+        bool force,
+        std::vector<std::string>* values,
+        Node* which, int num_retries)
+{
+    if (ids.empty())
+    {
+        struct ErrorInfo errinfo;
+        errinfo.errtype = "ERR";
+        errinfo.raw_errmsg = "wrong number of arguments for 'xclaim' command";
+        errinfo.errmsg = format_string("[R3C_XCLAIM][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    else
+    {
+        CommandArgs cmd_args;
+        cmd_args.set_key(key);
+        cmd_args.set_command("XCLAIM");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(key);
+        cmd_args.add_arg(groupname);
+        cmd_args.add_arg(consumer);
+        if (minidle >= 0)
+        {
+            cmd_args.add_arg(minidle);
+        }
+        if (!ids.empty())
+        {
+            cmd_args.add_args(ids);
+        }
+        if (idletime >= 0)
+        {
+            cmd_args.add_arg("IDLE");
+            cmd_args.add_arg(idletime);
+        }
+        if (unixtime >= 0)
+        {
+            cmd_args.add_arg("TIME");
+            cmd_args.add_arg(unixtime);
+        }
+        if (retrycount >= 0)
+        {
+            cmd_args.add_arg(retrycount);
+        }
+        if (force)
+        {
+            cmd_args.add_arg("FORCE");
+        }
+        cmd_args.add_arg("JUSTID");
+        cmd_args.final();
+
+        // Returns all the messages successfully claimed, in the same format as XRANGE.
+        // However if the JUSTID option was specified,
+        // only the message IDs are reported, without including the actual message.
+        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+        get_values(redis_reply.get(), values);
+    }
+}
+
+void CRedisClient::xclaim(
+        const std::string& key, const std::string& groupname, const std::string& consumer,
+        int64_t minidle, const std::vector<std::string>& ids,
+        std::vector<std::string>* values,
+        Node* which, int num_retries)
+{
+    const int64_t idletime = -1;
+    const int64_t unixtime = -1;
+    const int64_t retrycount = -1;
+    bool force = false;
+    xclaim(key, groupname, consumer, minidle, ids, idletime, unixtime, retrycount, force, values, which, num_retries);
+}
+
+// Show consumer groups of group <groupname>.
+// XINFO CONSUMERS <key> <group>
+int CRedisClient::xinfo_consumers(
+        const std::string& key, const std::string& groupname,
+        std::vector<struct ConsumerInfo>* infos,
+        Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XINFO");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg("CONSUMERS");
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(groupname);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_values(redis_reply.get(), infos);
+}
+
+// Show the stream consumer groups.
+// XINFO GROUPS <key>
+int CRedisClient::xinfo_groups(
+        const std::string& key,
+        std::vector<struct GroupInfo>* infos,
+        Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XINFO");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg("GROUPS");
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_values(redis_reply.get(), infos);
+}
+
+// Show information about the stream.
+// XINFO STREAM <key>
+void CRedisClient::xinfo_stream(
+        const std::string& key,
+        struct StreamInfo* info,
         Node* which, int num_retries)
 {
-    if (ids.empty())
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("XINFO");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg("STREAM");
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    get_value(redis_reply.get(), info);
+}
+
+// SETBIT key offset value
+// Time complexity: O(1)
+#if !defined(setbit)
+void CRedisClient::setbit(const std::string& key, uint32_t offset, uint32_t value, Node* which, int num_retries)
+#else
+#undef setbit
+void CRedisClient::setbit(const std::string& key, uint32_t offset, uint32_t value, Node* which, int num_retries)
+#endif // setbit
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("SETBIT");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(offset);
+    cmd_args.add_arg(value);
+    cmd_args.final();
+
+    // Integer reply:
+    // the original value of the bit on the specified offset.
+    redis_command(false, num_retries, key, cmd_args, which);
+}
+
+// GETBIT key offset 
+// Time complexity: O(1)
+int CRedisClient::getbit(const std::string& key, uint32_t offset, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("GETBIT");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(offset);
+    cmd_args.final();
+
+    // Integer reply:
+    // the value of the bit on the offset, return 0 if key does not exist.
+    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    if (REDIS_REPLY_INTEGER == redis_reply->type)
+        return static_cast<int>(redis_reply->integer);
+    return 0;
+}
+
+// BITCOUNT key [start end]
+// Time complexity: O(N)
+int64_t CRedisClient::bitcount(const std::string& key, int32_t start, int32_t end, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("BITCOUNT");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);       
+    cmd_args.add_arg(start);
+    cmd_args.add_arg(end);
+    cmd_args.final();
+    
+    // Integer reply:
+    // the number of bits set to 1.
+    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+// BITPOS key bit [start] [end]
+// Time complexity: O(N)
+int64_t CRedisClient::bitpos(const std::string& key, uint8_t bit, int32_t start, int32_t end, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("BITPOS");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_arg(bit);        
+    cmd_args.add_arg(start);
+    cmd_args.add_arg(end);
+    cmd_args.final();
+    
+    // Integer reply:
+    // the position of the first bit in the bitmap whose value is bit.
+    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+int64_t CRedisClient::pfadd(const std::string& key, const std::string& element, Node* which, int num_retries)
+{
+    std::vector<std::string> elements(1);
+    elements[0] = element;
+    return pfadd(key, elements, which, num_retries);
+}
+
+int64_t CRedisClient::pfadd(const std::string& key, const std::vector<std::string>& elements, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("PFADD");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.add_args(elements);
+    cmd_args.final();
+
+    // Integer reply:
+    // 1 if at least 1 HyperLogLog internal register was altered. 0 otherwise.
+    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+int64_t CRedisClient::pfcount(const std::string& key, Node* which, int num_retries)
+{
+    CommandArgs cmd_args;
+    cmd_args.set_key(key);
+    cmd_args.set_command("PFCOUNT");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(key);
+    cmd_args.final();
+
+    // Integer reply:
+    // The approximated number of unique elements observed via PFADD.
+    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
+    return get_value(redis_reply.get());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const RedisReplyHelper
+CRedisClient::redis_command(
+        bool readonly, int num_retries,
+        const std::string& key,
+        const CommandArgs& command_args,
+        Node* which)
+{
+    if (cluster_mode() && key.empty())
+    {
+        // 集群模式必须指定key
+        struct ErrorInfo errinfo;
+        errinfo.errcode = ERROR_ZERO_KEY;
+        errinfo.raw_errmsg = format_string("[%s] key is empty in cluster node", command_args.get_command().c_str());
+        errinfo.errmsg = format_string("[R3C_CMD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        if (_enable_error_log)
+            (*g_error_log)("%s\n", errinfo.errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+
+    const int slot = cluster_mode()? get_key_slot(&key): -1;
+    return redis_command(readonly, num_retries, slot, command_args, which);
+}
+
+const RedisReplyHelper
+CRedisClient::redis_command(
+        bool readonly, int num_retries,
+        int slot,
+        const CommandArgs& command_args,
+        Node* which)
+{
+    Node node;
+    Node* ask_node = NULL;
+    RedisReplyHelper redis_reply;
+    struct ErrorInfo errinfo;
+    struct CommandSpan command_span; // Only if monitored
+    size_t command_bytes = 0;
+    const bool monitored = (_command_monitor != NULL) || _enable_slowlog;
+    struct CommandCost io_cost; // Only if accounting enabled
+    AllocationScope allocation_scope(_enable_accounting? &io_cost: NULL);
+
+    if (!cluster_mode())
+    {
+        slot = -1;
+    }
+    else if (slot<0 || slot>=CLUSTER_SLOTS)
+    {
+        errinfo.errcode = ERROR_PARAMETER;
+        errinfo.raw_errmsg = format_string("[%s] invalid slot: %d", command_args.get_command().c_str(), slot);
+        errinfo.errmsg = format_string("[R3C_CMD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        if (_enable_error_log)
+            (*g_error_log)("%s\n", errinfo.errmsg.c_str());
+        THROW_REDIS_EXCEPTION(errinfo);
+    }
+    if (monitored)
+    {
+        _attempts_cost_us.clear();
+        command_span.command_args = &command_args;
+        command_span.slot = slot;
+        command_span.readonly = readonly;
+        command_span.start_us = get_current_microseconds();
+        command_span.result = HR_ERROR;
+    }
+    if (monitored || _enable_metrics)
+    {
+        command_bytes = get_command_size(command_args);
+    }
+    for (int loop_counter=0;;++loop_counter)
+    {
+        const int64_t attempt_start_us = monitored? get_current_microseconds(): 0;
+        const unsigned int key_hash = (slot >= 0)? static_cast<unsigned int>(slot): static_cast<unsigned int>(get_key_slot(&command_args.get_key()));
+        CRedisNode* redis_node = get_redis_node(slot, key_hash, readonly, ask_node, &errinfo);
+        HandleResult errcode;
+        bool sent = false; // 是否发出了命令
+
+        if (loop_counter > 0)
+        {
+            // 上一次尝试的响应已处理完
+            redis_reply.free();
+            count_metric(&_num_retries);
+        }
+        if (NULL == redis_node)
+        {
+            node.first.clear(); node.second = 0;
+        }
+        else
+        {
+            node = redis_node->get_node();
+        }
+        if (which != NULL)
+        {
+            *which = node;
+        }
+        if (0==loop_counter && _command_monitor!= NULL)
+        {
+            _command_monitor->before_execute(node, command_args.get_command(), command_args, readonly);
+        }
+        if (NULL == redis_node)
+        {
+            errinfo.errcode = ERROR_NO_ANY_NODE;
+            errinfo.raw_errmsg = format_string("[%s][%s][%s:%d] no any node", command_args.get_command().c_str(), get_mode_str(), node.first.c_str(), node.second);
+            errinfo.errmsg = format_string("[R3C_CMD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+            if (_enable_error_log)
+                (*g_error_log)("[NO_ANY_NODE] %s\n", errinfo.errmsg.c_str());
+            break; // 没有任何master
+        }
+        if (0 == get_remaining_milliseconds())
+        {
+            // 已超过调用者设定的截止时间，不再重试
+            const std::string last_errmsg = errinfo.raw_errmsg;
+            errinfo.errcode = ERROR_DEADLINE_EXCEEDED;
+            errinfo.errtype.clear();
+            errinfo.raw_errmsg = format_string("[%s][%s][%s:%d] deadline exceeded after %d attempts%s%s",
+                    command_args.get_command().c_str(), get_mode_str(), node.first.c_str(), node.second,
+                    loop_counter, last_errmsg.empty()? "": ", last error: ", last_errmsg.c_str());
+            errinfo.errmsg = format_string("[R3C_CMD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+            if (_enable_error_log)
+                (*g_error_log)("[DEADLINE_EXCEEDED] %s\n", errinfo.errmsg.c_str());
+            break;
+        }
+        if (command_args.get_block_milliseconds() >= 0)
+        {
+            // 阻塞命令使用独立的连接，以免阻塞该节点的其它命令，
+            // 共享连接不必准备
+            redis_node->get_stats()->add_inflight(1);
+            errcode = blocking_command(redis_node, readonly, ask_node, command_args, &redis_reply, &errinfo);
+            redis_node->get_stats()->add_inflight(-1);
+            sent = true;
+        }
+        else if (NULL == redis_node->get_redis_context())
+        {
+            // 连接master不成功
+            errcode = HR_RECONN_UNCOND;
+        }
+        else if (!discard_pending_replies(redis_node))
+        {
+            // 重建连接失败时连接已关闭
+            if (NULL == redis_node->get_redis_context())
+                errcode = HR_RECONN_UNCOND;
+            else
+                errcode = handle_redis_command_error(0, redis_node, redis_node->get_redis_context(), command_args, &errinfo);
+        }
+        else if (!update_readwrite_timeout(redis_node))
+        {
+            errcode = handle_redis_command_error(0, redis_node, redis_node->get_redis_context(), command_args, &errinfo);
+        }
+        else
+        {
+            struct timeval start_tv, stop_tv;
+            int64_t cost_us = 0;
+
+            // When a slot is set as MIGRATING, the node will accept all queries that are about this hash slot,
+            // but only if the key in question exists,
+            // otherwise the query is forwarded using a -ASK redirection to the node that is target of the migration.
+            // 当一个槽状态为 MIGRATING时，原来负责该哈希槽的节点仍会接受所有跟这个哈希槽有关的请求，但只处理仍然在该节点上的键，
+            // 否则类似于MOVED，返回ASK重定向到目标节点。
+            //
+            // When a slot is set as IMPORTING, the node will accept all queries that are about this hash slot,
+            // but only if the request is preceded by an ASKING command.
+            // If the ASKING command was not given by the client, the query is redirected to the real hash slot owner via a -MOVED redirection error,
+            // as would happen normally.
+            // 当一个槽状态为 IMPORTING时，只有在接受到 ASKING命令之后节点才会接受所有查询这个哈希槽的请求，
+            // 如果客户端一直没有发送 ASKING命令，那么查询都会通过MOVED重定向错误转发到真正处理这个哈希槽的节点那里。
+            // 注入的故障不作用于ASK重定向和对冲读
+            const int fault = ((_fault_injector != NULL) && (NULL == ask_node) && !hedged_reads_enabled(readonly, slot))?
+                    _fault_injector->on_command(node, command_args): static_cast<int>(FaultInjector::FAULT_NONE);
+            NodeStatsEntry* sent_stats = redis_node->get_stats(); // 对冲读可能换了节点
+
+            sent_stats->add_inflight(1);
+            gettimeofday(&start_tv, NULL);
+            if (fault != FaultInjector::FAULT_NONE)
+            {
+                redis_reply = inject_fault(fault, slot, redis_node, command_args);
+            }
+            else if (ask_node != NULL)
+            {
+                redis_reply = (redisReply*)redisCommand(redis_node->get_redis_context(), "ASKING");
+                if (redis_reply)
+                {
+                    redis_reply = (redisReply*)redisCommandArgv(
+                            redis_node->get_redis_context(),
+                            command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+                }
+            }
+            else if (hedged_reads_enabled(readonly, slot))
+            {
+                // 对冲读，由响应胜出的节点处理结果
+                redis_reply = hedged_command(slot, &redis_node, command_args);
+                node = redis_node->get_node();
+                if (which != NULL)
+                    *which = node;
+            }
+            else if (_enable_accounting)
+            {
+                redis_reply = accounted_command(redis_node->get_redis_context(), command_args, &io_cost);
+            }
+            else
+            {
+                redis_reply = (redisReply*)redisCommandArgv(
+                        redis_node->get_redis_context(),
+                        command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+            }
+
+#if R3C_TEST // for test
+            debug_redis_reply(command_args.get_command(), redis_reply.get());
+#endif // R3C_TEST==1
+
+            gettimeofday(&stop_tv, NULL);
+            sent_stats->add_inflight(-1);
+            cost_us = calc_elapsed_time(start_tv, stop_tv);
+            if (!redis_reply)
+                errcode = handle_redis_command_error(cost_us, redis_node, redis_node->get_redis_context(), command_args, &errinfo);
+            else
+                errcode = handle_redis_reply(cost_us, redis_node, command_args, redis_reply.get(), &errinfo);
+            record_latency(redis_node, command_args, cost_us, errcode);
+            if (HR_SUCCESS==errcode && hedged_reads_enabled(readonly, slot))
+                add_read_latency(cost_us);
+            sent = true;
+        }
+        if (sent && _enable_metrics)
+        {
+            NodeStatsEntry* stats = redis_node->get_stats();
+
+            stats->add_sent((ask_node != NULL)? command_bytes+16: command_bytes);
+            if (redis_reply)
+                stats->add_received(get_reply_size(redis_reply.get()));
+        }
+        if (monitored)
+        {
+            // ASKING: "*1\r\n$6\r\nASKING\r\n"
+            const size_t request_bytes = !sent? 0: ((ask_node != NULL)? command_bytes+16: command_bytes);
+            monitor_attempt(&command_span, attempt_start_us, redis_node, request_bytes, redis_reply.get(), errcode);
+        }
+
+        ask_node = NULL;
+        if (HR_SUCCESS == errcode)
+        {
+            // 成功立即返回
+            if (_command_monitor!=NULL)
+                _command_monitor->after_execute(0, node, command_args.get_command(), redis_reply.get());
+            if (monitored)
+                monitor_command(&command_span);
+            if (_enable_accounting)
+                account_command(node, command_args, io_cost);
+            return redis_reply;
+        }
+        else if (HR_ERROR == errcode)
+        {
+            // 不需要重试的错误立即返回，比如：EVAL命令语法错误
+            if (_enable_debug_log)
+            {
+                (*g_debug_log)("[NOTRETRY][%s:%d][%s][%s:%d] loop: %d\n",
+                        __FILE__, __LINE__, get_mode_str(),
+                        redis_node->get_node().first.c_str(), redis_node->get_node().second, loop_counter);
+            }
+            break;
+        }
+        else if (HR_RECONN_COND == errcode || HR_RECONN_UNCOND == errcode)
+        {
+            // 连接问题，先调用close关闭连接（调用get_redis_node时就会执行重连接）
+            redis_node->close();
+            count_reconnect(redis_node);
+            update_topology_metrics(false);
+        }
+        else if (HR_REDIRECT == errcode)
+        {
+            if (!parse_moved_string(redis_reply->str, &node))
+            {
+                if (_enable_error_log)
+                {
+                    (*g_error_log)("[PARSE_MOVED][%s:%d][%s][%s:%d] node string error: %s\n",
+                            __FILE__, __LINE__, get_mode_str(),
+                            redis_node->get_node().first.c_str(), redis_node->get_node().second,
+                            redis_reply->str);
+                }
+                break;
+            }
+            else
+            {
+                ask_node = &node;
+                if (loop_counter <= 2)
+                    continue;
+                if (_enable_debug_log)
+                {
+                    (*g_debug_log)("[REDIRECT][%s:%d][%s][%s:%d] retries more than %d\n",
+                            __FILE__, __LINE__, get_mode_str(),
+                            redis_node->get_node().first.c_str(), redis_node->get_node().second, loop_counter);
+                }
+                break;
+            }
+        }
+
+        if (HR_RECONN_UNCOND == errcode)
+        {
+            // 保持至少重试一次（前提是先重新建立好连接）
+            if (loop_counter>num_retries && loop_counter>0)
+            {
+                if (_enable_debug_log)
+                {
+                    (*g_debug_log)("[NOTRECONN][%s:%d][%s][%s:%d] retries more than %d\n",
+                            __FILE__, __LINE__, get_mode_str(),
+                            redis_node->get_node().first.c_str(), redis_node->get_node().second, num_retries);
+                }
+                break;
+            }
+        }
+        else if (HR_RETRY_UNCOND == errcode)
+        {
+            // 一般replica切换成master需要几秒钟，
+            // 所以需要保证有足够的重试次数
+            if (loop_counter > num_retries)
+            {
+                if (_enable_debug_log)
+                {
+                    (*g_debug_log)("[RETRY_UNCOND][%s:%d][%s][%s:%d] retries more than %d\n",
+                            __FILE__, __LINE__, get_mode_str(),
+                            redis_node->get_node().first.c_str(), redis_node->get_node().second, num_retries);
+                }
+                break;
+            }
+        }
+        else if (loop_counter>=num_retries)
+        {
+            if (_enable_debug_log)
+            {
+                (*g_debug_log)("[OVERRETRY][%s:%d][%s][%s:%d] retries more than %d\n",
+                        __FILE__, __LINE__, get_mode_str(),
+                        redis_node->get_node().first.c_str(), redis_node->get_node().second, num_retries);
+            }
+            break;
+        }
+
+        // 控制重试频率，以增强重试成功率
+        if (HR_RETRY_UNCOND == errcode || HR_RECONN_UNCOND == errcode)
+        {
+            const int64_t remaining_milliseconds = get_remaining_milliseconds();
+            int retry_sleep_milliseconds = get_retry_sleep_milliseconds(loop_counter);
+            if (remaining_milliseconds>=0 && retry_sleep_milliseconds>remaining_milliseconds)
+                retry_sleep_milliseconds = static_cast<int>(remaining_milliseconds);
+            if (retry_sleep_milliseconds > 0)
+                millisleep(retry_sleep_milliseconds);
+        }
+        if (cluster_mode() && redis_node->need_refresh_master())
+        {
+            // 单机模式下走到这会导致没法重连接，
+            // 因为_redis_master_nodes被清空了。
+            if (HR_RECONN_COND==errcode || HR_RECONN_UNCOND==errcode)
+                refresh_master_node_table(&errinfo, &node);
+            else
+                refresh_master_node_table(&errinfo, NULL);
+        }
+    }
+
+    // 错误以异常方式抛出
+    if (_command_monitor!=NULL)
+        _command_monitor->after_execute(1, node, command_args.get_command(), redis_reply.get());
+    if (monitored)
+        monitor_command(&command_span);
+    if (_enable_accounting && !node.first.empty())
+        account_command(node, command_args, io_cost);
+    THROW_REDIS_EXCEPTION_WITH_NODE_AND_COMMAND(errinfo, node.first, node.second, command_args.get_command(), command_args.get_key());
+}
+
+int CRedisClient::pipeline(Pipeline* pipeline, int window_size, int num_retries)
+{
+    std::vector<int> indexes; // Commands not done
+    std::vector<int> retries;
+    int num_succeeded = 0;
+
+    if (window_size < 1)
+        window_size = 1;
+    for (int i=0; i<pipeline->size(); ++i)
+    {
+        Pipeline::PipelineCommand& command = pipeline->_commands[i];
+
+        if (command.reply != NULL)
+        {
+            freeReplyObject(command.reply);
+            command.reply = NULL;
+        }
+        command.errinfo.clear();
+        command.node.first.clear();
+        command.node.second = 0;
+        command.asking = false;
+        command.attempts = 0;
+        if (cluster_mode() && command.key.empty())
+        {
+            // 集群模式必须指定key
+            command.errinfo.errcode = ERROR_ZERO_KEY;
+            command.errinfo.raw_errmsg = format_string("[%s] key is empty in cluster node", command.command.c_str());
+            command.errinfo.errmsg = format_string("[R3C_PIPELINE][%s:%d] %s", __FILE__, __LINE__, command.errinfo.raw_errmsg.c_str());
+            if (_enable_error_log)
+                (*g_error_log)("%s\n", command.errinfo.errmsg.c_str());
+            continue;
+        }
+        if (command.formatted_command.empty())
+        {
+            command.errinfo.errcode = ERROR_PARAMETER;
+            command.errinfo.raw_errmsg = format_string("[%s] invalid command", command.command.c_str());
+            command.errinfo.errmsg = format_string("[R3C_PIPELINE][%s:%d] %s", __FILE__, __LINE__, command.errinfo.raw_errmsg.c_str());
+            if (_enable_error_log)
+                (*g_error_log)("%s\n", command.errinfo.errmsg.c_str());
+            continue;
+        }
+        indexes.push_back(i);
+    }
+
+    for (int loop_counter=0; !indexes.empty(); ++loop_counter)
+    {
+        bool need_refresh = false;
+        bool need_sleep = false;
+
+        if (0 == get_remaining_milliseconds())
+        {
+            // 已超过调用者设定的截止时间，余下的命令均失败
+            for (std::vector<int>::size_type i=0; i<indexes.size(); ++i)
+            {
+                Pipeline::PipelineCommand& command = pipeline->_commands[indexes[i]];
+                command.errinfo.errcode = ERROR_DEADLINE_EXCEEDED;
+                command.errinfo.errtype.clear();
+                command.errinfo.raw_errmsg = format_string("[%s][%s] deadline exceeded after %d rounds", command.command.c_str(), get_mode_str(), loop_counter);
+                command.errinfo.errmsg = format_string("[R3C_PIPELINE][%s:%d] %s", __FILE__, __LINE__, command.errinfo.raw_errmsg.c_str());
+            }
+            if (_enable_error_log)
+                (*g_error_log)("[DEADLINE_EXCEEDED][%s:%d] %d commands of pipeline not done\n", __FILE__, __LINE__, static_cast<int>(indexes.size()));
+            break;
+        }
+
+        retries.clear();
+        pipeline_round(pipeline, indexes, window_size, num_retries, &retries, &need_refresh, &need_sleep);
+        indexes.swap(retries);
+        if (indexes.empty())
+            break;
+
+        // 重定向至少跟随两次（MOVED后可能紧跟着ASK），
+        // 失败的命令保留最后一次的错误信息
+        if (loop_counter>=num_retries && loop_counter>=2)
+        {
+            if (_enable_debug_log)
+            {
+                (*g_debug_log)("[OVERRETRY][%s:%d][%s] %d commands of pipeline not done after %d rounds\n",
+                        __FILE__, __LINE__, get_mode_str(), static_cast<int>(indexes.size()), loop_counter+1);
+            }
+            break;
+        }
+        count_metric(&_num_retries, indexes.size());
+        if (need_sleep)
+        {
+            const int64_t remaining_milliseconds = get_remaining_milliseconds();
+            int retry_sleep_milliseconds = get_retry_sleep_milliseconds(loop_counter);
+            if (remaining_milliseconds>=0 && retry_sleep_milliseconds>remaining_milliseconds)
+                retry_sleep_milliseconds = static_cast<int>(remaining_milliseconds);
+            if (retry_sleep_milliseconds > 0)
+                millisleep(retry_sleep_milliseconds);
+        }
+        if (need_refresh && cluster_mode())
+        {
+            struct ErrorInfo errinfo;
+            refresh_master_node_table(&errinfo, NULL);
+        }
+    }
+
+    for (int i=0; i<pipeline->size(); ++i)
+    {
+        const redisReply* redis_reply = pipeline->_commands[i].reply;
+        if (redis_reply!=NULL && redis_reply->type!=REDIS_REPLY_ERROR)
+            ++num_succeeded;
+    }
+    return num_succeeded;
+}
+
+void CRedisClient::pipeline_round(
+        Pipeline* pipeline, const std::vector<int>& indexes, int window_size, int num_retries,
+        std::vector<int>* retries, bool* need_refresh, bool* need_sleep)
+{
+    std::vector<PipelineGroup> groups;
+    std::map<std::pair<CRedisNode*, unsigned int>, std::vector<PipelineGroup>::size_type> group_table;
+    std::vector<struct pollfd> fds;
+    std::vector<std::vector<PipelineGroup>::size_type> polled; // Index of the group of fds[i]
+
+    // 按连接分组，同一连接上的命令保持原来的顺序
+    for (std::vector<int>::size_type i=0; i<indexes.size(); ++i)
+    {
+        const int index = indexes[i];
+        Pipeline::PipelineCommand& command = pipeline->_commands[index];
+        const int slot = cluster_mode()? get_key_slot(&command.key): -1;
+        const unsigned int key_hash = static_cast<unsigned int>(get_key_slot(&command.key));
+        CRedisNode* redis_node = get_redis_node(slot, key_hash, false, command.asking? &command.ask_node: NULL, &command.errinfo);
+
+        if (NULL == redis_node)
+        {
+            command.errinfo.errcode = ERROR_NO_ANY_NODE;
+            command.errinfo.raw_errmsg = format_string("[%s][%s] no any node", command.command.c_str(), get_mode_str());
+            command.errinfo.errmsg = format_string("[R3C_PIPELINE][%s:%d] %s", __FILE__, __LINE__, command.errinfo.raw_errmsg.c_str());
+            if (_enable_error_log)
+                (*g_error_log)("[NO_ANY_NODE] %s\n", command.errinfo.errmsg.c_str());
+            continue; // 没有任何master
+        }
+
+        command.node = redis_node->get_node();
+        if (NULL == redis_node->get_redis_context())
+        {
+            // 连接不成功，命令还未发出，可放心重试
+            retries->push_back(index);
+            *need_sleep = true;
+            if (redis_node->need_refresh_master())
+                *need_refresh = true;
+            continue;
+        }
+        else
+        {
+            const std::pair<CRedisNode*, unsigned int> key(redis_node, redis_node->get_connection_index());
+            std::map<std::pair<CRedisNode*, unsigned int>, std::vector<PipelineGroup>::size_type>::iterator iter = group_table.find(key);
+
+            if (iter == group_table.end())
+            {
+                iter = group_table.insert(std::make_pair(key, groups.size())).first;
+                groups.push_back(PipelineGroup(key.first, key.second));
+            }
+            groups[iter->second].queued.push_back(index);
+        }
+    }
+    for (std::vector<PipelineGroup>::size_type i=0; i<groups.size(); ++i)
+    {
+        PipelineGroup& group = groups[i];
+
+        group.redis_node->select_connection_index(group.connection_index);
+        if (!discard_pending_replies(group.redis_node) || !update_readwrite_timeout(group.redis_node))
+            fail_pipeline_group(pipeline, &group, num_retries, retries);
+    }
+
+    // 每个连接保持最多window_size个命令在途，有响应返回就补发
+    for (;;)
+    {
+        const int64_t remaining_milliseconds = get_remaining_milliseconds();
+        int timeout_milliseconds = (_readwrite_timeout_milliseconds > 0)? _readwrite_timeout_milliseconds: -1;
+        int n;
+
+        fds.clear();
+        polled.clear();
+        for (std::vector<PipelineGroup>::size_type i=0; i<groups.size(); ++i)
+        {
+            PipelineGroup& group = groups[i];
+
+            if (group.failed)
+                continue;
+            if (!write_pipeline_group(pipeline, &group, window_size))
+            {
+                fail_pipeline_group(pipeline, &group, num_retries, retries);
+            }
+            else if (!group.inflight.empty())
+            {
+                struct pollfd pfd;
+                pfd.fd = group.redis_node->get_redis_context()->fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                fds.push_back(pfd);
+                polled.push_back(i);
+            }
+        }
+        if (fds.empty())
+            break;
+
+        if (remaining_milliseconds>0 && (timeout_milliseconds<0 || timeout_milliseconds>remaining_milliseconds))
+            timeout_milliseconds = static_cast<int>(remaining_milliseconds);
+        n = poll(&fds[0], fds.size(), timeout_milliseconds);
+        if (-1==n && EINTR==errno)
+            continue;
+
+        for (std::vector<struct pollfd>::size_type i=0; i<fds.size(); ++i)
+        {
+            PipelineGroup& group = groups[polled[i]];
+
+            // 超时或出错时，所有在途的连接均按失败处理
+            if (n<=0 || (fds[i].revents!=0 && !read_pipeline_group(pipeline, &group, retries, need_refresh, need_sleep)))
+                fail_pipeline_group(pipeline, &group, num_retries, retries);
+        }
+    }
+}
+
+bool CRedisClient::write_pipeline_group(Pipeline* pipeline, PipelineGroup* group, int window_size)
+{
+    static const char asking_command[] = "*1\r\n$6\r\nASKING\r\n";
+    NodeStatsEntry* stats = group->redis_node->get_stats();
+    redisContext* redis_context;
+    int done = 0;
+
+    group->redis_node->select_connection_index(group->connection_index);
+    redis_context = group->redis_node->get_redis_context();
+    if (group->queued.empty())
+        return true;
+    while (static_cast<int>(group->inflight.size())<window_size && !group->queued.empty())
+    {
+        const int index = group->queued.front();
+        const Pipeline::PipelineCommand& command = pipeline->_commands[index];
+
+        if (command.asking)
+        {
+            if (REDIS_OK != redisAppendFormattedCommand(redis_context, asking_command, sizeof(asking_command)-1))
+                return false;
+            group->inflight.push_back(-1);
+            stats->add_inflight(1);
+            if (_enable_metrics)
+                stats->add_sent(sizeof(asking_command)-1);
+        }
+        if (REDIS_OK != redisAppendFormattedCommand(redis_context, command.formatted_command.data(), command.formatted_command.size()))
+            return false;
+        group->queued.pop_front();
+        group->inflight.push_back(index);
+        stats->add_inflight(1);
+        if (_enable_metrics)
+            stats->add_sent(command.formatted_command.size());
+    }
+    do
+    {
+        if (REDIS_ERR == redisBufferWrite(redis_context, &done))
+            return false;
+    } while (!done);
+    return true;
+}
+
+bool CRedisClient::read_pipeline_group(Pipeline* pipeline, PipelineGroup* group, std::vector<int>* retries, bool* need_refresh, bool* need_sleep)
+{
+    CRedisNode* redis_node = group->redis_node;
+    redisContext* redis_context;
+
+    redis_node->select_connection_index(group->connection_index);
+    redis_context = redis_node->get_redis_context();
+    if (REDIS_ERR == redisBufferRead(redis_context))
+        return false;
+    for (;;)
+    {
+        void* reply = NULL;
+        redisReply* redis_reply;
+        int index;
+
+        if (REDIS_ERR == redisGetReplyFromReader(redis_context, &reply))
+            return false;
+        if (NULL == reply)
+            break;
+        redis_node->reset_conn_errors();
+        index = group->inflight.front();
+        group->inflight.pop_front();
+        redis_reply = static_cast<redisReply*>(reply);
+        redis_node->get_stats()->add_inflight(-1);
+        if (_enable_metrics)
+            redis_node->get_stats()->add_received(get_reply_size(redis_reply));
+        if (-1 == index)
+        {
+            // ASKING的响应，出错时命令本身会得到MOVED
+            freeReplyObject(redis_reply);
+            continue;
+        }
+
+        Pipeline::PipelineCommand& command = pipeline->_commands[index];
+        command.asking = false;
+        if (REDIS_REPLY_ERROR == redis_reply->type)
+        {
+            struct ErrorInfo& errinfo = command.errinfo;
+            Node node;
+
+            extract_errtype(redis_reply, &errinfo.errtype);
+            errinfo.errcode = ERROR_COMMAND;
+            errinfo.raw_errmsg = format_string("[%s] %s", redis_node->str().c_str(), redis_reply->str);
+            errinfo.errmsg = format_string("[R3C_PIPELINE_REPLAY_ERROR][%s:%d][%s] %s", __FILE__, __LINE__, command.command.c_str(), errinfo.raw_errmsg.c_str());
+            if ((is_ask_error(errinfo.errtype) || is_moved_error(errinfo.errtype)) && parse_moved_string(redis_reply->str, &node))
+            {
+                // ASK 6474 127.0.0.1:6380
+                // MOVED 6474 127.0.0.1:6380
+                if (is_ask_error(errinfo.errtype))
+                {
+                    command.asking = true;
+                    command.ask_node = node;
+                    count_metric(&_num_asks);
+                }
+                else
+                {
+                    *need_refresh = true;
+                    count_metric(&_num_moved);
+                }
+                retries->push_back(index);
+                freeReplyObject(redis_reply);
+                continue;
+            }
+            if (is_clusterdown_error(errinfo.errtype) || is_tryagain_error(errinfo.errtype))
+            {
+                *need_sleep = true;
+                retries->push_back(index);
+                freeReplyObject(redis_reply);
+                continue;
+            }
+            if (_enable_error_log)
+                (*g_error_log)("%s\n", errinfo.errmsg.c_str());
+        }
+        else
+        {
+            command.errinfo.clear(); // Maybe set by the redirect before
+        }
+        command.reply = redis_reply;
+    }
+    return true;
+}
+
+void CRedisClient::fail_pipeline_group(Pipeline* pipeline, PipelineGroup* group, int num_retries, std::vector<int>* retries)
+{
+    CRedisNode* redis_node = group->redis_node;
+    redisContext* redis_context;
+    struct ErrorInfo errinfo;
+
+    redis_node->select_connection_index(group->connection_index);
+    redis_context = redis_node->get_redis_context();
+    if (NULL == redis_context)
+    {
+        // discard_pending_replies重建连接失败
+        errinfo.errcode = ENOTCONN;
+        errinfo.raw_errmsg = format_string("[%s] (errno:%d)%s",
+                redis_node->str().c_str(), errinfo.errcode, strerror(errinfo.errcode));
+    }
+    else if (redis_context->err != 0)
+    {
+        errinfo.errcode = errno;
+        errinfo.raw_errmsg = format_string("[%s] (hiredis:%d,errno:%d)%s (%s)",
+                redis_node->str().c_str(), redis_context->err, errinfo.errcode, redis_context->errstr, strerror(errinfo.errcode));
+    }
+    else
+    {
+        // poll超时
+        count_metric(&_num_timeouts);
+        errinfo.errcode = ETIMEDOUT;
+        errinfo.raw_errmsg = format_string("[%s] (errno:%d)%s",
+                redis_node->str().c_str(), errinfo.errcode, strerror(errinfo.errcode));
+    }
+    errinfo.errmsg = format_string("[R3C_PIPELINE_ERROR][%s:%d] %s (%d in flight, %d queued)",
+            __FILE__, __LINE__, errinfo.raw_errmsg.c_str(),
+            static_cast<int>(group->inflight.size()), static_cast<int>(group->queued.size()));
+    if (_enable_error_log)
+        (*g_error_log)("%s\n", errinfo.errmsg.c_str());
+
+    // 连接上剩余的响应已无法区分，只能关闭连接
+    record_node_error(redis_node, errinfo);
+    redis_node->get_stats()->add_inflight(-static_cast<int64_t>(group->inflight.size()));
+    redis_node->inc_conn_errors();
+    redis_node->close();
+    count_reconnect(redis_node);
+    update_topology_metrics(false);
+    group->failed = true;
+    for (std::deque<int>::size_type i=0; i<group->inflight.size(); ++i)
+    {
+        const int index = group->inflight[i];
+
+        if (index != -1)
+        {
+            // 已发出的命令结果未知，仅当允许重试时才重发
+            Pipeline::PipelineCommand& command = pipeline->_commands[index];
+            command.errinfo = errinfo;
+            if (command.attempts++ < num_retries)
+                retries->push_back(index);
+        }
+    }
+    for (std::deque<int>::size_type i=0; i<group->queued.size(); ++i)
+    {
+        const int index = group->queued[i];
+        pipeline->_commands[index].errinfo = errinfo;
+        retries->push_back(index);
+    }
+    group->inflight.clear();
+    group->queued.clear();
+}
+
+CRedisClient::HandleResult
+CRedisClient::handle_redis_command_error(
+        int64_t cost_us,
+        CRedisNode* redis_node,
+        redisContext* redis_context,
+        const CommandArgs& command_args,
+        struct ErrorInfo* errinfo)
+{
+    // REDIS_ERR_EOF (call read() return 0):
+    // redis_context->err(3)
+    // redis_context->errstr("Server closed the connection")
+    //
+    // REDIS_ERR_IO (call read() return -1):
+    // redis_context->err(1)
+    // redis_context->errstr("Bad file descriptor")
+    //
+    // REDIS_ERR_IO means there was an I/O error
+    // and you should use the "errno" variable to find out what is wrong.
+    // For other values, the "errstr" field will hold a description.
+    const int redis_errcode = redis_context->err;
+    errinfo->errcode = errno;
+    errinfo->raw_errmsg = format_string("[%s][cost:%ldus] (hiredis:%d,errno:%d)%s (%s)",
+            redis_node->str().c_str(), cost_us, redis_errcode, errinfo->errcode, redis_context->errstr, strerror(errinfo->errcode));
+    errinfo->errmsg = format_string("[R3C_CMD_ERROR][%s:%d][%s] %s",
+            __FILE__, __LINE__, command_args.get_command().c_str(), errinfo->raw_errmsg.c_str());
+    record_node_error(redis_node, *errinfo);
+    if (_enable_error_log)
+    {
+        const unsigned int conn_errors = redis_node->get_conn_errors();
+        if (conn_errors==0 || conn_errors%10==0) // Reduce duplicate error logs
+            (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+    }
+
+    // REDIS_ERR_IO (1):
+    // There was an I/O error while creating the connection, trying to write
+    // to the socket or read from the socket. If you included `errno.h` in your
+    // application, you can use the global `errno` variable to find out what is wrong.
+    //
+    // REDIS_ERR_EOF (3):
+    // The server closed the connection which resulted in an empty read.
+    //
+    // REDIS_ERR_PROTOCOL (4):
+    // There was an error while parsing the protocol.
+    //
+    // REDIS_ERR_OTHER:
+    // Any other error. Currently, it is only used when a specified hostname to connect to cannot be resolved.
+    //
+    // #define   EAGAIN          11      /* Try again */
+    // #define   EINPROGRESS     115     /* Operation now in progress */
+    // #define   ECONNRESET      104     /* Connection reset by peer */
+    if ((redis_errcode != REDIS_ERR_IO) &&
+        (redis_errcode != REDIS_ERR_EOF))
+    {
+        return HR_ERROR; // Not retry
+    }
+    else if (redis_errcode == REDIS_ERR_EOF)
+    {
+        // (3/115)Server closed the connection (Operation now in progress)
+        redis_node->inc_conn_errors();
+        return HR_RECONN_UNCOND; // Retry unconditionally and reconnect
+    }
+    else if (redis_errcode == REDIS_ERR_IO && errinfo->errcode != EAGAIN)
+    {
+        // (1/104)Connection reset by peer (Connection reset by peer)
+        redis_node->inc_conn_errors();
+        return HR_RECONN_UNCOND; // Retry unconditionally and reconnect
+    }
+    else
+    {
+        // $ redis-cli -p 1386 cluster nodes | grep master
+        // 49cadd758538f821b922738fd000b5a16ef64fc7 127.0.0.1:1384@11384 master - 0 1546317629187 14 connected 10923-16383
+        // 95ce22507d469ae84cb760505bba4be0283c5468 127.0.0.1:1381@11381 master - 0 1546317630190 1 connected 0-5460
+        // a27a1ce7f8c5c5f79a1d09227eb80b73919ec795 127.0.0.1:1383@11383 master,fail - 1546317518930 1546317515000 12 connected
+        // 03c4ada274ac137c710f3d514700c2e94649c131 127.0.0.1:1382@11382 master - 0 1546317631191 2 connected 5461-10922
+        // 错误期间，可能发生了主备切换，因此光重连接是不够的，
+        // 更严重的是，该master可能一直连接超时，比如进程被SIGSTOP了，
+        // 因此重试几次后，应当重刷新master
+        redis_node->inc_conn_errors();
+        count_metric(&_num_timeouts);
+        return HR_RECONN_COND; // Retry conditionally
+    }
+}
+
+CRedisClient::HandleResult
+CRedisClient::handle_redis_reply(
+        int64_t cost_us,
+        CRedisNode* redis_node,
+        const CommandArgs& command_args,
+        const redisReply* redis_reply,
+        struct ErrorInfo* errinfo)
+{
+    redis_node->reset_conn_errors();
+
+    if (redis_reply->type != REDIS_REPLY_ERROR)
+        return HR_SUCCESS;
+    else
+        return handle_redis_replay_error(cost_us, redis_node, command_args, redis_reply, errinfo);
+}
+
+CRedisClient::HandleResult
+CRedisClient::handle_redis_replay_error(
+        int64_t cost_us,
+        CRedisNode* redis_node,
+        const CommandArgs& command_args,
+        const redisReply* redis_reply,
+        struct ErrorInfo* errinfo)
+{
+    // ASK
+    // NOAUTH Authentication required
+    // MOVED 6474 127.0.0.1:6380
+    // WRONGTYPE Operation against a key holding the wrong kind of value
+    // CLUSTERDOWN The cluster is down
+    // NOSCRIPT No matching script. Please use EVAL.
+    //
+    // ERR Error running script (call to f_64b2246244d60088e7351656c216c00cb1d7d2fd) : @user_script:1: @user_script: 1: Lua script attempted to access a non local key in a cluster node
+    extract_errtype(redis_reply, &errinfo->errtype);
+    errinfo->errcode = ERROR_COMMAND;
+    errinfo->raw_errmsg = format_string("[%s][cost:%ldus] %s", redis_node->str().c_str(), cost_us, redis_reply->str);
+    errinfo->errmsg = format_string("[R3C_REPLAY_ERROR][%s:%d][%s] %s", __FILE__, __LINE__, command_args.get_command().c_str(), errinfo->raw_errmsg.c_str());
+    if (_enable_error_log)
+        (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+
+    // EVAL不会返回“MOVED”的错误，需特别处理
+    if (is_clusterdown_error(errinfo->errtype))
     {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "ERR";
-        errinfo.raw_errmsg = "wrong number of arguments for 'xclaim' command";
-        errinfo.errmsg = format_string("[R3C_XPENDING][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
+        return HR_RETRY_UNCOND;
+    }
+    else if (is_ask_error(errinfo->errtype))
+    {
+        // ASK 6474 127.0.0.1:6380
+        //
+        // 如下所示，如果此时向10.212.2.72:6379请求slot为14148的keys时，将得到：
+        // ASK 6474 10.212.2.71:6381
+        // 其中ec19be9a50b5416999ac0305c744d9b6c957c18d为10.212.2.71:6381的NodeId
+        // e008649f6f8340a495fc860f7a9a8155f91fcb93 10.212.2.72:6379@16379 myself,master - 0 1547374698000 35 connected 5461-10922 14148 [14148->-ec19be9a50b5416999ac0305c744d9b6c957c18d]
+        count_metric(&_num_asks);
+        return HR_REDIRECT;
+    }
+    else if (is_moved_error(errinfo->errtype))
+    {
+        // MOVED 6474 127.0.0.1:6380
+        //
+        //Node ask_node;
+        //parse_moved_string(redis_reply->str, &ask_node);
+        count_metric(&_num_moved);
+        redis_node->set_conn_errors(2019); // Trigger to refresh master nodes
+        return HR_RETRY_UNCOND;
     }
     else
     {
-        CommandArgs cmd_args;
-        cmd_args.set_key(key);
-        cmd_args.set_command("XCLAIM");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg(key);
-        cmd_args.add_arg(groupname);
-        cmd_args.add_arg(consumer);
-        if (minidle >= 0)
+        return HR_ERROR;
+    }
+}
+
+void CRedisClient::fini()
+{
+    disable_accounting();
+    clear_all_master_nodes();
+    for (CommandMetricsTable::iterator iter=_command_metrics.begin(); iter!=_command_metrics.end(); ++iter)
+        delete iter->second;
+    _command_metrics.clear();
+    for (std::map<Node, NodeStatsEntry*>::iterator iter=_node_stats.begin(); iter!=_node_stats.end(); ++iter)
+        delete iter->second;
+    _node_stats.clear();
+    pthread_mutex_destroy(&_metrics_mutex);
+}
+
+void CRedisClient::init()
+{
+    _enable_debug_log = true;
+    _enable_info_log = true;
+    _enable_error_log = true;
+    _num_master_connections = 1;
+    _num_replica_connections = 1;
+    _stripe_policy = SP_KEY_HASH;
+    _hedge_percentile = 0;
+    _hedge_min_delay_milliseconds = 0;
+    _hedge_delay_us = -1;
+    _num_hedges = 0;
+    _num_hedge_wins = 0;
+    _num_read_latencies = 0;
+    _enable_metrics = true;
+    pthread_mutex_init(&_metrics_mutex, NULL);
+    _metrics_start_milliseconds = get_current_milliseconds();
+    _num_retries = 0;
+    _num_moved = 0;
+    _num_asks = 0;
+    _num_reconnects = 0;
+    _num_timeouts = 0;
+    _num_refreshes = 0;
+    _num_masters = 0;
+    _num_replicas = 0;
+    _num_connected_nodes = 0;
+    _num_unmapped_slots = 0;
+    _enable_accounting = false;
+    _last_cost_entry = NULL;
+    _enable_slowlog = false;
+    _slowlog_threshold_us = 0;
+    _slowlog_sample_interval = 0;
+    _slowlog_max_key_length = 0;
+    _slowlog_max_entries = 0;
+    _num_slowlog_commands = 0;
+    _num_slowlog_entries = 0;
+
+    try
+    {
+        const int num_nodes = parse_nodes(&_nodes, _raw_nodes_string);
+        struct ErrorInfo errinfo;
+
+        if (0 == num_nodes)
         {
-            cmd_args.add_arg(minidle);
+            errinfo.errcode = ERROR_PARAMETER;
+            errinfo.errmsg = format_string("[R3C_INIT][%s:%d] parameter[nodes] error: %s", __FILE__, __LINE__, _raw_nodes_string.c_str());
+            errinfo.raw_errmsg = format_string("parameter[nodes] error: %s", _raw_nodes_string.c_str());
+            if (_enable_error_log)
+                (*g_error_log)("%s\n", errinfo.errmsg.c_str());
+            THROW_REDIS_EXCEPTION(errinfo);
         }
-        if (!ids.empty())
+        else if (1 == num_nodes)
         {
-            cmd_args.add_args(ids);
+            if (!init_standlone(&errinfo))
+                THROW_REDIS_EXCEPTION(errinfo);
         }
-        if (idletime >= 0)
+        else
         {
-            cmd_args.add_arg("IDLE");
-            cmd_args.add_arg(idletime);
+            if (!init_cluster(&errinfo))
+                THROW_REDIS_EXCEPTION(errinfo);
         }
-        if (unixtime >= 0)
+        update_topology_metrics(true);
+    }
+    catch (...)
+    {
+        clear_all_master_nodes();
+        for (std::map<Node, NodeStatsEntry*>::iterator iter=_node_stats.begin(); iter!=_node_stats.end(); ++iter)
+            delete iter->second;
+        _node_stats.clear();
+        pthread_mutex_destroy(&_metrics_mutex);
+        throw;
+    }
+}
+
+bool CRedisClient::init_standlone(struct ErrorInfo* errinfo)
+{
+    const Node& node = _nodes[0];
+    _nodes_string = _raw_nodes_string;
+
+    redisContext* redis_context = connect_redis_node(node, errinfo, false);
+    if (NULL == redis_context)
+    {
+        return false;
+    }
+    else
+    {
+        CRedisMasterNode* redis_node = new CRedisMasterNode(std::string(""), node, redis_context, get_node_stats_entry(node, true));
+        redis_node->set_num_connections(_num_master_connections);
+        const std::pair<RedisMasterNodeTable::iterator, bool> ret =
+                _redis_master_nodes.insert(std::make_pair(node, redis_node));
+        R3C_ASSERT(ret.second);
+        return true;
+    }
+}
+
+bool CRedisClient::init_cluster(struct ErrorInfo* errinfo)
+{
+    const int num_nodes = static_cast<int>(_nodes.size());
+    const uint64_t base = reinterpret_cast<uint64_t>(this);
+    uint64_t seed = get_random_number(base);
+
+    _slot2node.resize(CLUSTER_SLOTS);
+    for (int i=0; i<num_nodes; ++i)
+    {
+        const int j = static_cast<int>(++seed % num_nodes);
+        const Node& node = _nodes[j];
+        std::vector<struct NodeInfo> nodes_info;
+
+        redisContext* redis_context = connect_redis_node(node, errinfo, false);
+        if (NULL == redis_context)
         {
-            cmd_args.add_arg("TIME");
-            cmd_args.add_arg(unixtime);
+            continue;
         }
-        if (retrycount >= 0)
+        if (!list_cluster_nodes(&nodes_info, errinfo, redis_context, node))
         {
-            cmd_args.add_arg(retrycount);
+            redisFree(redis_context);
+            continue;
         }
-        if (force)
+        else
         {
-            cmd_args.add_arg("FORCE");
-        }
-        //cmd_args.add_arg("JUSTID");
-        cmd_args.final();
+            std::vector<struct NodeInfo> replication_nodes_info;
 
-        // Returns all the messages successfully claimed, in the same format as XRANGE.
-        // However if the JUSTID option was specified,
-        // only the message IDs are reported, without including the actual message.
-        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-        get_values(redis_reply.get(), values);
+            redisFree(redis_context);
+            redis_context = NULL;
+            if (init_master_nodes(nodes_info, &replication_nodes_info, errinfo))
+            {
+                if (_read_policy != RP_ONLY_MASTER)
+                    init_replica_nodes(replication_nodes_info);
+                break;
+            }
+        }
     }
-}
 
-void CRedisClient::xclaim(
-        const std::string& key, const std::string& groupname, const std::string& consumer,
-        int64_t minidle, const std::vector<std::string>& ids,
-        std::vector<StreamEntry>* values,
-        Node* which, int num_retries)
-{
-    const int64_t idletime = -1;
-    const int64_t unixtime = -1;
-    const int64_t retrycount = -1;
-    bool force = false;
-    xclaim(key, groupname, consumer, minidle, ids, idletime, unixtime, retrycount, force, values, which, num_retries);
+    return !_redis_master_nodes.empty();
 }
 
-void CRedisClient::xclaim(
-        const std::string& key, const std::string& groupname, const std::string& consumer,
-        int64_t minidle, const std::vector<std::string>& ids,
-        int64_t idletime, int64_t unixtime, int64_t retrycount,
-        bool force,
-        std::vector<std::string>* values,
-        Node* which, int num_retries)
+bool CRedisClient::init_master_nodes(
+        const std::vector<struct NodeInfo>& nodes_info,
+        std::vector<struct NodeInfo>* replication_nodes_info,
+        struct ErrorInfo* errinfo)
 {
-    if (ids.empty())
+    int connected = 0; // 成功连接的master个数
+
+    if (nodes_info.size() > 1)
     {
-        struct ErrorInfo errinfo;
-        errinfo.errtype = "ERR";
-        errinfo.raw_errmsg = "wrong number of arguments for 'xclaim' command";
-        errinfo.errmsg = format_string("[R3C_XCLAIM][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
+        _nodes_string.clear();
     }
     else
     {
-        CommandArgs cmd_args;
-        cmd_args.set_key(key);
-        cmd_args.set_command("XCLAIM");
-        cmd_args.add_arg(cmd_args.get_command());
-        cmd_args.add_arg(key);
-        cmd_args.add_arg(groupname);
-        cmd_args.add_arg(consumer);
-        if (minidle >= 0)
-        {
-            cmd_args.add_arg(minidle);
-        }
-        if (!ids.empty())
-        {
-            cmd_args.add_args(ids);
-        }
-        if (idletime >= 0)
+        _nodes_string = _raw_nodes_string;
+    }
+    for (std::vector<struct NodeInfo>::size_type i=0; i<nodes_info.size(); ++i) // Traversing all master nodes
+    {
+        const struct NodeInfo& nodeinfo = nodes_info[i];
+
+        if (nodes_info.size() > 1)
         {
-            cmd_args.add_arg("IDLE");
-            cmd_args.add_arg(idletime);
+            update_nodes_string(nodeinfo);
         }
-        if (unixtime >= 0)
+        if (nodeinfo.is_master() && !nodeinfo.is_fail())
         {
-            cmd_args.add_arg("TIME");
-            cmd_args.add_arg(unixtime);
+            update_slots(nodeinfo);
+            if (add_master_node(nodeinfo, errinfo))
+                ++connected;
         }
-        if (retrycount >= 0)
+        else if (nodeinfo.is_replica() && !nodeinfo.is_fail())
         {
-            cmd_args.add_arg(retrycount);
+            replication_nodes_info->push_back(nodeinfo);
         }
-        if (force)
+    }
+
+    // 至少要有一个能够连接上
+    return connected > 0;
+}
+
+void CRedisClient::init_replica_nodes(const std::vector<struct NodeInfo>& replication_nodes_info)
+{
+    for (std::vector<struct NodeInfo>::size_type i=0; i<replication_nodes_info.size(); ++i)
+    {
+        const struct NodeInfo& nodeinfo = replication_nodes_info[i];
+        const NodeId& master_nodeid = nodeinfo.master_id;
+        const NodeId& replica_nodeid = nodeinfo.id;
+        const Node& replica_node = nodeinfo.node;
+
+        CRedisMasterNode* redis_master_node = get_redis_master_node(master_nodeid);
+        if (redis_master_node != NULL)
         {
-            cmd_args.add_arg("FORCE");
+            struct ErrorInfo errinfo;
+            redisContext* redis_context = connect_redis_node(replica_node, &errinfo, true);
+            if (redis_context != NULL)
+            {
+                CRedisReplicaNode* redis_replica_node = new CRedisReplicaNode(replica_nodeid, replica_node, redis_context, get_node_stats_entry(replica_node, false));
+                redis_replica_node->set_num_connections(_num_replica_connections);
+                redis_master_node->add_replica_node(redis_replica_node);
+            }
         }
-        cmd_args.add_arg("JUSTID");
-        cmd_args.final();
-
-        // Returns all the messages successfully claimed, in the same format as XRANGE.
-        // However if the JUSTID option was specified,
-        // only the message IDs are reported, without including the actual message.
-        const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-        get_values(redis_reply.get(), values);
     }
 }
 
-void CRedisClient::xclaim(
-        const std::string& key, const std::string& groupname, const std::string& consumer,
-        int64_t minidle, const std::vector<std::string>& ids,
-        std::vector<std::string>* values,
-        Node* which, int num_retries)
+void CRedisClient::update_slots(const struct NodeInfo& nodeinfo)
 {
-    const int64_t idletime = -1;
-    const int64_t unixtime = -1;
-    const int64_t retrycount = -1;
-    bool force = false;
-    xclaim(key, groupname, consumer, minidle, ids, idletime, unixtime, retrycount, force, values, which, num_retries);
+    for (SlotSegment::size_type i=0; i<nodeinfo.slots.size(); ++i)
+    {
+        const std::pair<int, int>& slot_segment = nodeinfo.slots[i];
+        for (int slot=slot_segment.first; slot<=slot_segment.second; ++slot)
+            _slot2node[slot] = nodeinfo.node;
+    }
 }
 
-// Show consumer groups of group <groupname>.
-// XINFO CONSUMERS <key> <group>
-int CRedisClient::xinfo_consumers(
-        const std::string& key, const std::string& groupname,
-        std::vector<struct ConsumerInfo>* infos,
-        Node* which, int num_retries)
+// 几种需要刷新master情况：
+// 1) 遇到MOVED错误（可立即重刷）
+// 2) master挂起（能够连接，但不能服务，立即重刷一般无效，得等主从切换后）
+void CRedisClient::refresh_master_node_table(struct ErrorInfo* errinfo, const Node* error_node)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XINFO");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg("CONSUMERS");
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(groupname);
-    cmd_args.final();
-
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_values(redis_reply.get(), infos);
-}
+    const int num_nodes = static_cast<int>(_redis_master_nodes.size());
+    count_metric(&_num_refreshes);
+    uint64_t seed = reinterpret_cast<uint64_t>(this) - num_nodes;
+    const int k = static_cast<int>(seed % num_nodes);
+    RedisMasterNodeTable::iterator iter = _redis_master_nodes.begin();
 
-// Show the stream consumer groups.
-// XINFO GROUPS <key>
-int CRedisClient::xinfo_groups(
-        const std::string& key,
-        std::vector<struct GroupInfo>* infos,
-        Node* which, int num_retries)
-{
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XINFO");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg("GROUPS");
-    cmd_args.add_arg(key);
-    cmd_args.final();
+    for (int i=0; i<k; ++i)
+    {
+        ++iter;
+        if (iter == _redis_master_nodes.end())
+            iter = _redis_master_nodes.begin();
+    }
+    for (int i=0; i<num_nodes; ++i)
+    {
+        const Node& node = iter->first;
+        CRedisMasterNode* redis_node = iter->second;
+        ++iter;
 
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_values(redis_reply.get(), infos);
-}
+        // error_node可能已是一个有问题的节点，所以最好避开它
+        if ((NULL==error_node) || (node!=*error_node))
+        {
+            redisContext* redis_context = redis_node->get_redis_context();
 
-// Show information about the stream.
-// XINFO STREAM <key>
-void CRedisClient::xinfo_stream(
-        const std::string& key,
-        struct StreamInfo* info,
-        Node* which, int num_retries)
-{
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("XINFO");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg("STREAM");
-    cmd_args.add_arg(key);
-    cmd_args.final();
+            if (NULL == redis_context)
+            {
+                redis_context = connect_redis_node(node, errinfo, false);
+            }
+            if (redis_context != NULL)
+            {
+                std::vector<struct NodeInfo> nodes_info;
 
-    const RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    get_value(redis_reply.get(), info);
+                redis_node->set_redis_context(redis_context);
+                if (discard_pending_replies(redis_node) && list_cluster_nodes(&nodes_info, errinfo, redis_node->get_redis_context(), node))
+                {
+                    std::vector<struct NodeInfo> replication_nodes_info;
+                    clear_and_update_master_nodes(nodes_info, &replication_nodes_info, errinfo);
+                    if (_read_policy != RP_ONLY_MASTER)
+                        init_replica_nodes(replication_nodes_info);
+                    break; // Continue is not safe, because `clear_and_update_master_nodes` will modify _redis_master_nodes
+                }
+            }
+        }
+        if (iter == _redis_master_nodes.end())
+        {
+            iter = _redis_master_nodes.begin();
+        }
+    }
+    update_topology_metrics(true);
 }
 
-// SETBIT key offset value
-// Time complexity: O(1)
-#if !defined(setbit)
-void CRedisClient::setbit(const std::string& key, uint32_t offset, uint32_t value, Node* which, int num_retries)
-#else
-#undef setbit
-void CRedisClient::setbit(const std::string& key, uint32_t offset, uint32_t value, Node* which, int num_retries)
-#endif // setbit
+void CRedisClient::clear_and_update_master_nodes(
+        const std::vector<struct NodeInfo>& nodes_info,
+        std::vector<struct NodeInfo>* replication_nodes_info,
+        struct ErrorInfo* errinfo)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("SETBIT");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(offset);
-    cmd_args.add_arg(value);
-    cmd_args.final();
+    NodeInfoTable master_nodeinfo_table;
+    std::string nodes_string;
 
-    // Integer reply:
-    // the original value of the bit on the specified offset.
-    redis_command(false, num_retries, key, cmd_args, which);
-}
+    if (nodes_info.size() > 1)
+    {
+        _nodes_string.clear();
+    }
+    for (std::vector<struct NodeInfo>::size_type i=0; i<nodes_info.size(); ++i) // Traversing all master nodes
+    {
+        const struct NodeInfo& nodeinfo = nodes_info[i];
 
-// GETBIT key offset 
-// Time complexity: O(1)
-int CRedisClient::getbit(const std::string& key, uint32_t offset, Node* which, int num_retries)
-{
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("GETBIT");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(offset);
-    cmd_args.final();
+        if (nodes_info.size() > 1)
+        {
+            update_nodes_string(nodeinfo);
+        }
+        if (nodeinfo.is_master() && !nodeinfo.is_fail())
+        {
+            // 可能只是一个或多个slot从一个master迁到另一个master，
+            // 简单的全量更新slot和node间的关系，
+            // 如果一对master和replica同时异常，则_slot2node会出现空洞
+            update_slots(nodeinfo);
+            master_nodeinfo_table.insert(std::make_pair(nodeinfo.node, nodeinfo));
 
-    // Integer reply:
-    // the value of the bit on the offset, return 0 if key does not exist.
-    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    if (REDIS_REPLY_INTEGER == redis_reply->type)
-        return static_cast<int>(redis_reply->integer);
-    return 0;
-}
+            if (_redis_master_nodes.count(nodeinfo.node) <= 0)
+            {
+                // New master
+                add_master_node(nodeinfo, errinfo);
+            }
+        }
+        else if (nodeinfo.is_replica() && !nodeinfo.is_fail())
+        {
+            replication_nodes_info->push_back(nodeinfo);
+        }
+    }
 
-// BITCOUNT key [start end]
-// Time complexity: O(N)
-int64_t CRedisClient::bitcount(const std::string& key, int32_t start, int32_t end, Node* which, int num_retries)
-{
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("BITCOUNT");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);       
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    cmd_args.final();
-    
-    // Integer reply:
-    // the number of bits set to 1.
-    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+    clear_invalid_master_nodes(master_nodeinfo_table);
 }
 
-// BITPOS key bit [start] [end]
-// Time complexity: O(N)
-int64_t CRedisClient::bitpos(const std::string& key, uint8_t bit, int32_t start, int32_t end, Node* which, int num_retries)
+void CRedisClient::clear_invalid_master_nodes(const NodeInfoTable& master_nodeinfo_table)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("BITPOS");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_arg(bit);        
-    cmd_args.add_arg(start);
-    cmd_args.add_arg(end);
-    cmd_args.final();
-    
-    // Integer reply:
-    // the position of the first bit in the bitmap whose value is bit.
-    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+    for (RedisMasterNodeTable::iterator node_iter=_redis_master_nodes.begin(); node_iter!=_redis_master_nodes.end();)
+    {
+        const Node& node = node_iter->first;
+        const NodeInfoTable::const_iterator info_iter = master_nodeinfo_table.find(node);
+
+        if (info_iter != master_nodeinfo_table.end())
+        {
+            // 保持不变，仍然是master
+            ++node_iter;
+        }
+        else
+        {
+            CRedisMasterNode* master_node = node_iter->second;
+            const NodeId nodeid = master_node->get_nodeid();
+            if (_enable_info_log)
+                (*g_info_log)("[R3C_CLEAR_INVALID][%s:%d] %s is removed because it is not a master now\n", __FILE__, __LINE__, master_node->str().c_str());
+
+#if __cplusplus < 201103L
+            _redis_master_nodes.erase(node_iter++);
+#else
+            node_iter = _redis_master_nodes.erase(node_iter);
+#endif
+            delete master_node;
+            _redis_master_nodes_id.erase(nodeid);
+        }
+    }
 }
 
-int64_t CRedisClient::pfadd(const std::string& key, const std::string& element, Node* which, int num_retries)
+bool CRedisClient::add_master_node(const NodeInfo& nodeinfo, struct ErrorInfo* errinfo)
 {
-    std::vector<std::string> elements(1);
-    elements[0] = element;
-    return pfadd(key, elements, which, num_retries);
+    const NodeId& nodeid = nodeinfo.id;
+    const Node& node = nodeinfo.node;
+    redisContext* redis_context = connect_redis_node(node, errinfo, false);
+    CRedisMasterNode* master_node = new CRedisMasterNode(nodeid, node, redis_context, get_node_stats_entry(node, true));
+    master_node->set_num_connections(_num_master_connections);
+    if (NULL == redis_context)
+        record_node_error(master_node, *errinfo);
+
+    const std::pair<RedisMasterNodeTable::iterator, bool> ret =
+            _redis_master_nodes.insert(std::make_pair(node, master_node));
+    R3C_ASSERT(ret.second);
+    if (!ret.second)
+        delete master_node;
+    _redis_master_nodes_id[nodeid] = node;
+    return redis_context != NULL;
 }
 
-int64_t CRedisClient::pfadd(const std::string& key, const std::vector<std::string>& elements, Node* which, int num_retries)
+void CRedisClient::clear_all_master_nodes()
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("PFADD");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.add_args(elements);
-    cmd_args.final();
-
-    // Integer reply:
-    // 1 if at least 1 HyperLogLog internal register was altered. 0 otherwise.
-    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+    for (RedisMasterNodeTable::iterator iter=_redis_master_nodes.begin(); iter!=_redis_master_nodes.end(); ++iter)
+    {
+        CRedisMasterNode* master_node = iter->second;
+        delete master_node;
+    }
+    _redis_master_nodes.clear();
+    _redis_master_nodes_id.clear();
 }
 
-int64_t CRedisClient::pfcount(const std::string& key, Node* which, int num_retries)
+void CRedisClient::update_nodes_string(const NodeInfo& nodeinfo)
 {
-    CommandArgs cmd_args;
-    cmd_args.set_key(key);
-    cmd_args.set_command("PFCOUNT");
-    cmd_args.add_arg(cmd_args.get_command());
-    cmd_args.add_arg(key);
-    cmd_args.final();
-
-    // Integer reply:
-    // The approximated number of unique elements observed via PFADD.
-    RedisReplyHelper redis_reply = redis_command(true, num_retries, key, cmd_args, which);
-    return get_value(redis_reply.get());
+    std::string node_str;
+    if (_nodes_string.empty())
+        _nodes_string = node2string(nodeinfo.node, &node_str);
+    else
+        _nodes_string = _nodes_string + std::string(",") + node2string(nodeinfo.node, &node_str);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-const RedisReplyHelper
-CRedisClient::redis_command(
-        bool readonly, int num_retries,
-        const std::string& key,
-        const CommandArgs& command_args,
-        Node* which)
+redisContext* CRedisClient::connect_redis_node(const Node& node, struct ErrorInfo* errinfo, bool readonly) const
 {
-    Node node;
-    Node* ask_node = NULL;
-    RedisReplyHelper redis_reply;
-    struct ErrorInfo errinfo;
+    redisContext* redis_context = NULL;
 
-    if (cluster_mode() && key.empty())
+    int connect_timeout_milliseconds = _connect_timeout_milliseconds;
+    const int64_t remaining_milliseconds = get_remaining_milliseconds();
+    std::string unix_socket_path;
+
+    errinfo->clear();
+    if (0 == remaining_milliseconds)
     {
-        // 集群模式必须指定key
-        errinfo.errcode = ERROR_ZERO_KEY;
-        errinfo.raw_errmsg = format_string("[%s] key is empty in cluster node", command_args.get_command().c_str());
-        errinfo.errmsg = format_string("[R3C_CMD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        errinfo->errcode = ERROR_DEADLINE_EXCEEDED;
+        errinfo->raw_errmsg = "deadline exceeded before connecting";
+        errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] %s",
+                __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
+        return NULL;
+    }
+    if (remaining_milliseconds>0 && (connect_timeout_milliseconds<=0 || connect_timeout_milliseconds>remaining_milliseconds))
+    {
+        // 连接超时不超过截止时间剩余的时长
+        connect_timeout_milliseconds = static_cast<int>(remaining_milliseconds);
+    }
+    if ((_fault_injector != NULL) && _fault_injector->on_connect(node))
+    {
+        errinfo->errcode = ERROR_INIT_REDIS_CONN;
+        errinfo->raw_errmsg = "Connection refused (injected)";
+        errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] %s",
+                __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
         if (_enable_error_log)
-            (*g_error_log)("%s\n", errinfo.errmsg.c_str());
-        THROW_REDIS_EXCEPTION(errinfo);
+            (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+        return NULL;
     }
-    for (int loop_counter=0;;++loop_counter)
+    if (is_unix_socket_node(node))
     {
-        const int slot = cluster_mode()? get_key_slot(&key): -1;
-        CRedisNode* redis_node = get_redis_node(slot, readonly, ask_node, &errinfo);
-        HandleResult errcode;
+        unix_socket_path = node.first.substr(sizeof("unix:")-1);
+    }
+    else
+    {
+        const std::map<Node, std::string>::const_iterator iter = _unix_socket_table.find(node);
+        if (iter != _unix_socket_table.end())
+            unix_socket_path = iter->second;
+    }
+    if (_enable_debug_log)
+    {
+        (*g_debug_log)("[R3C_CONN][%s:%d] To connect %s%s%s with timeout: %dms\n",
+                __FILE__, __LINE__, node2string(node).c_str(),
+                unix_socket_path.empty()? "": " via ", unix_socket_path.c_str(), connect_timeout_milliseconds);
+    }
+    if (connect_timeout_milliseconds <= 0)
+    {
+        if (!unix_socket_path.empty())
+            redis_context = redisConnectUnix(unix_socket_path.c_str());
+        else
+            redis_context = redisConnect(node.first.c_str(), node.second);
+    }
+    else
+    {
+        struct timeval timeout;
+        timeout.tv_sec = connect_timeout_milliseconds / 1000;
+        timeout.tv_usec = (connect_timeout_milliseconds % 1000) * 1000;
+        if (!unix_socket_path.empty())
+            redis_context = redisConnectUnixWithTimeout(unix_socket_path.c_str(), timeout);
+        else
+            redis_context = redisConnectWithTimeout(node.first.c_str(), node.second, timeout);
+    }
 
-        if (NULL == redis_node)
+    if (NULL == redis_context)
+    {
+        // can't allocate redis context
+        errinfo->errcode = ERROR_REDIS_CONTEXT;
+        errinfo->raw_errmsg = "can not allocate redis context";
+        errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] %s",
+                __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
+        if (_enable_error_log)
+            (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+    }
+    else if (redis_context->err != 0)
+    {
+        // #define REDIS_ERR_IO 1 /* Error in read or write */
+        // redis_context->errstr
+        //
+        // Connection refused
+        //
+        // errno: EADDRNOTAVAIL(99)
+        // err: REDIS_ERR_IO(1)
+        // Cannot assign requested address
+
+        errinfo->errcode = ERROR_INIT_REDIS_CONN;
+        errinfo->raw_errmsg = redis_context->errstr;
+        if (REDIS_ERR_IO == redis_context->err)
         {
-            node.first.clear(); node.second = 0;
+            errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] (errno:%d,err:%d)%s",
+                    __FILE__, __LINE__, node.first.c_str(), node.second,
+                    errno, redis_context->err, errinfo->raw_errmsg.c_str());
         }
         else
         {
-            node = redis_node->get_node();
-        }
-        if (which != NULL)
-        {
-            *which = node;
+            errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] (err:%d)%s",
+                    __FILE__, __LINE__, node.first.c_str(), node.second,
+                    redis_context->err, errinfo->raw_errmsg.c_str());
         }
-        if (0==loop_counter && _command_monitor!= NULL)
+        if (_enable_error_log)
         {
-            _command_monitor->before_execute(node, command_args.get_command(), command_args, readonly);
+            (*g_error_log)("%s\n", errinfo->errmsg.c_str());
         }
-        if (NULL == redis_node)
+        redisFree(redis_context);
+        redis_context = NULL;
+    }
+    else
+    {
+        if (_enable_debug_log)
         {
-            errinfo.errcode = ERROR_NO_ANY_NODE;
-            errinfo.raw_errmsg = format_string("[%s][%s][%s:%d] no any node", command_args.get_command().c_str(), get_mode_str(), node.first.c_str(), node.second);
-            errinfo.errmsg = format_string("[R3C_CMD][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
-            if (_enable_error_log)
-                (*g_error_log)("[NO_ANY_NODE] %s\n", errinfo.errmsg.c_str());
-            break; // 没有任何master
+            (*g_debug_log)("[R3C_CONN][%s:%d] Connect %s successfully with readwrite timeout: %dms\n",
+                    __FILE__, __LINE__, node2string(node).c_str(), _readwrite_timeout_milliseconds);
         }
-        if (NULL == redis_node->get_redis_context())
+        if (_readwrite_timeout_milliseconds > 0)
         {
-            // 连接master不成功
-            errcode = HR_RECONN_UNCOND;
+            struct timeval data_timeout;
+            data_timeout.tv_sec = _readwrite_timeout_milliseconds / 1000;
+            data_timeout.tv_usec = (_readwrite_timeout_milliseconds % 1000) * 1000;
+
+            if (REDIS_ERR == redisSetTimeout(redis_context, data_timeout))
+            {
+                // REDIS_ERR_IO == redis_context->err
+                errinfo->errcode = ERROR_INIT_REDIS_CONN;
+                errinfo->raw_errmsg = redis_context->errstr;
+                errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] (errno:%d,err:%d)%s",
+                        __FILE__, __LINE__, node.first.c_str(), node.second,
+                        errno, redis_context->err, errinfo->raw_errmsg.c_str());
+                if (_enable_error_log)
+                    (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+                redisFree(redis_context);
+                redis_context = NULL;
+            }
         }
-        else
+        if ((0 == errinfo->errcode) && !_password.empty())
         {
-            struct timeval start_tv, stop_tv;
-            int64_t cost_us = 0;
+            const RedisReplyHelper redis_reply = (redisReply*)redisCommand(redis_context, "AUTH %s", _password.c_str());
 
-            // When a slot is set as MIGRATING, the node will accept all queries that are about this hash slot,
-            // but only if the key in question exists,
-            // otherwise the query is forwarded using a -ASK redirection to the node that is target of the migration.
-            // 当一个槽状态为 MIGRATING时，原来负责该哈希槽的节点仍会接受所有跟这个哈希槽有关的请求，但只处理仍然在该节点上的键，
-            // 否则类似于MOVED，返回ASK重定向到目标节点。
-            //
-            // When a slot is set as IMPORTING, the node will accept all queries that are about this hash slot,
-            // but only if the request is preceded by an ASKING command.
-            // If the ASKING command was not given by the client, the query is redirected to the real hash slot owner via a -MOVED redirection error,
-            // as would happen normally.
-            // 当一个槽状态为 IMPORTING时，只有在接受到 ASKING命令之后节点才会接受所有查询这个哈希槽的请求，
-            // 如果客户端一直没有发送 ASKING命令，那么查询都会通过MOVED重定向错误转发到真正处理这个哈希槽的节点那里。
-            gettimeofday(&start_tv, NULL);
-            if (ask_node != NULL)
+            if (redis_reply && 0==strcmp(redis_reply->str, "OK"))
             {
-                redis_reply = (redisReply*)redisCommand(redis_node->get_redis_context(), "ASKING");
-                if (redis_reply)
+                // AUTH success
+                if (_enable_info_log)
+                    (*g_info_log)("[R3C_AUTH][%s:%d] Connect redis://%s:%d success\n",
+                            __FILE__, __LINE__, node.first.c_str(), node.second);
+            }
+            else
+            {
+                // AUTH failed
+                if (!redis_reply)
                 {
-                    redis_reply = (redisReply*)redisCommandArgv(
-                            redis_node->get_redis_context(),
-                            command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+                    errinfo->errcode = ERROR_REDIS_AUTH;
+                    errinfo->raw_errmsg = "authorization failed";
+                }
+                else
+                {
+                    extract_errtype(redis_reply.get(), &errinfo->errtype);
+                    errinfo->errcode = ERROR_REDIS_AUTH;
+                    errinfo->raw_errmsg = redis_reply->str;
                 }
+
+                errinfo->errmsg = format_string("[R3C_AUTH][%s:%d][%s:%d] %s",
+                        __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
+                if (_enable_error_log)
+                    (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+                redisFree(redis_context);
+                redis_context = NULL;
+            }
+        }
+    }
+    if (readonly && redis_context!=NULL)
+    {
+        const RedisReplyHelper redis_reply = (redisReply*)redisCommand(redis_context, "READONLY");
+
+        if (redis_reply && 0==strcmp(redis_reply->str, "OK"))
+        {
+            // READONLY success
+            if (_enable_info_log)
+                (*g_debug_log)("[R3C_READONLY][%s:%d] READONLY redis://%s:%d success\n",
+                        __FILE__, __LINE__, node.first.c_str(), node.second);
+        }
+        else
+        {
+            // READONLY failed
+            if (!redis_reply)
+            {
+                errinfo->errcode = ERROR_REDIS_READONLY;
+                errinfo->raw_errmsg = "readonly failed";
             }
             else
             {
-                redis_reply = (redisReply*)redisCommandArgv(
-                        redis_node->get_redis_context(),
-                        command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+                extract_errtype(redis_reply.get(), &errinfo->errtype);
+                errinfo->errcode = ERROR_REDIS_READONLY;
+                errinfo->raw_errmsg = redis_reply->str;
             }
 
-#if R3C_TEST // for test
-            debug_redis_reply(command_args.get_command(), redis_reply.get());
-#endif // R3C_TEST==1
-
-            gettimeofday(&stop_tv, NULL);
-            cost_us = calc_elapsed_time(start_tv, stop_tv);
-            if (!redis_reply)
-                errcode = handle_redis_command_error(cost_us, redis_node, command_args, &errinfo);
-            else
-                errcode = handle_redis_reply(cost_us, redis_node, command_args, redis_reply.get(), &errinfo);
+            errinfo->errmsg = format_string("[R3C_READONLY][%s:%d][%s:%d] %s",
+                    __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
+            if (_enable_error_log)
+                (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+            redisFree(redis_context);
+            redis_context = NULL;
         }
+    }
 
-        ask_node = NULL;
-        if (HR_SUCCESS == errcode)
-        {
-            // 成功立即返回
-            if (_command_monitor!=NULL)
-                _command_monitor->after_execute(0, node, command_args.get_command(), redis_reply.get());
-            return redis_reply;
-        }
-        else if (HR_ERROR == errcode)
+    return redis_context;
+}
+
+CRedisNode* CRedisClient::get_redis_node(
+        int slot, unsigned int key_hash, bool readonly,
+        const Node* ask_node, struct ErrorInfo* errinfo)
+{
+    CRedisNode* redis_node = NULL;
+    redisContext* redis_context = NULL;
+    bool connected = false; // 建立了新连接，或重新初始化了集群
+
+    do
+    {
+        if (-1 == slot)
         {
-            // 不需要重试的错误立即返回，比如：EVAL命令语法错误
-            if (_enable_debug_log)
+            // Standalone（单机redis）
+            R3C_ASSERT(!_redis_master_nodes.empty());
+            redis_node = _redis_master_nodes.begin()->second;
+            select_connection(redis_node, key_hash);
+            redis_context = redis_node->get_redis_context();
+            if (NULL == redis_context)
             {
-                (*g_debug_log)("[NOTRETRY][%s:%d][%s][%s:%d] loop: %d\n",
-                        __FILE__, __LINE__, get_mode_str(),
-                        redis_node->get_node().first.c_str(), redis_node->get_node().second, loop_counter);
+                redis_context = connect_redis_node(redis_node->get_node(), errinfo, false);
+                redis_node->set_redis_context(redis_context);
+                if (NULL == redis_context)
+                    record_node_error(redis_node, *errinfo);
+                connected = true;
             }
             break;
         }
-        else if (HR_RECONN_COND == errcode || HR_RECONN_UNCOND == errcode)
-        {
-            // 连接问题，先调用close关闭连接（调用get_redis_node时就会执行重连接）
-            redis_node->close();
-        }
-        else if (HR_REDIRECT == errcode)
+        else
         {
-            if (!parse_moved_string(redis_reply->str, &node))
+            // Cluster（集群redis）
+            R3C_ASSERT(slot>=0 && slot<CLUSTER_SLOTS);
+
+            // clear_invalid_master_nodes可能将整个_master_nodes清空了，比如当整个集群短暂不可用时
+            if (_redis_master_nodes.empty())
             {
-                if (_enable_error_log)
+                const int num_nodes = parse_nodes(&_nodes, _nodes_string);
+
+                R3C_ASSERT(num_nodes > 1);
+                connected = true;
+                if (!init_cluster(errinfo))
                 {
-                    (*g_error_log)("[PARSE_MOVED][%s:%d][%s][%s:%d] node string error: %s\n",
-                            __FILE__, __LINE__, get_mode_str(),
-                            redis_node->get_node().first.c_str(), redis_node->get_node().second,
-                            redis_reply->str);
+                    break;
                 }
-                break;
             }
-            else
             {
-                ask_node = &node;
-                if (loop_counter <= 2)
-                    continue;
-                if (_enable_debug_log)
+                const Node& node = (NULL==ask_node)? _slot2node[slot]: *ask_node;
+                const RedisMasterNodeTable::const_iterator iter = _redis_master_nodes.find(node);
+                if (iter != _redis_master_nodes.end())
                 {
-                    (*g_debug_log)("[REDIRECT][%s:%d][%s][%s:%d] retries more than %d\n",
-                            __FILE__, __LINE__, get_mode_str(),
-                            redis_node->get_node().first.c_str(), redis_node->get_node().second, loop_counter);
+                    redis_node = iter->second;
                 }
-                break;
             }
         }
 
-        if (HR_RECONN_UNCOND == errcode)
+        if (NULL == redis_node)
         {
-            // 保持至少重试一次（前提是先重新建立好连接）
-            if (loop_counter>num_retries && loop_counter>0)
-            {
-                if (_enable_debug_log)
-                {
-                    (*g_debug_log)("[NOTRECONN][%s:%d][%s][%s:%d] retries more than %d\n",
-                            __FILE__, __LINE__, get_mode_str(),
-                            redis_node->get_node().first.c_str(), redis_node->get_node().second, num_retries);
-                }
-                break;
-            }
+            // 遇到空的slot，随机选一个
+            redis_node = random_redis_master_node();
         }
-        else if (HR_RETRY_UNCOND == errcode)
+        if (redis_node != NULL)
         {
-            // 一般replica切换成master需要几秒钟，
-            // 所以需要保证有足够的重试次数
-            if (loop_counter > num_retries)
+            select_connection(redis_node, key_hash);
+            redis_context = redis_node->get_redis_context();
+
+            if (NULL == redis_context)
             {
-                if (_enable_debug_log)
-                {
-                    (*g_debug_log)("[RETRY_UNCOND][%s:%d][%s][%s:%d] retries more than %d\n",
-                            __FILE__, __LINE__, get_mode_str(),
-                            redis_node->get_node().first.c_str(), redis_node->get_node().second, num_retries);
-                }
-                break;
+                redis_context = connect_redis_node(redis_node->get_node(), errinfo, false);
+                redis_node->set_redis_context(redis_context);
+                if (NULL == redis_context)
+                    record_node_error(redis_node, *errinfo);
+                connected = true;
             }
-        }
-        else if (loop_counter>=num_retries)
-        {
-            if (_enable_debug_log)
+            if (!readonly || RP_ONLY_MASTER==_read_policy)
             {
-                (*g_debug_log)("[OVERRETRY][%s:%d][%s][%s:%d] retries more than %d\n",
-                        __FILE__, __LINE__, get_mode_str(),
-                        redis_node->get_node().first.c_str(), redis_node->get_node().second, num_retries);
+                break;
+            }
+            if (redis_context!=NULL && RP_PRIORITY_MASTER==_read_policy)
+            {
+                break;
             }
-            break;
-        }
-
-        // 控制重试频率，以增强重试成功率
-        if (HR_RETRY_UNCOND == errcode || HR_RECONN_UNCOND == errcode)
-        {
-            const int retry_sleep_milliseconds = get_retry_sleep_milliseconds(loop_counter);
-            if (retry_sleep_milliseconds > 0)
-                millisleep(retry_sleep_milliseconds);
-        }
-        if (cluster_mode() && redis_node->need_refresh_master())
-        {
-            // 单机模式下走到这会导致没法重连接，
-            // 因为_redis_master_nodes被清空了。
-            if (HR_RECONN_COND==errcode || HR_RECONN_UNCOND==errcode)
-                refresh_master_node_table(&errinfo, &node);
-            else
-                refresh_master_node_table(&errinfo, NULL);
-        }
-    }
-
-    // 错误以异常方式抛出
-    if (_command_monitor!=NULL)
-        _command_monitor->after_execute(1, node, command_args.get_command(), redis_reply.get());
-    THROW_REDIS_EXCEPTION_WITH_NODE_AND_COMMAND(errinfo, node.first, node.second, command_args.get_command(), command_args.get_key());
-}
-
-CRedisClient::HandleResult
-CRedisClient::handle_redis_command_error(
-        int64_t cost_us,
-        CRedisNode* redis_node,
-        const CommandArgs& command_args,
-        struct ErrorInfo* errinfo)
-{
-    redisContext* redis_context = redis_node->get_redis_context();
-
-    // REDIS_ERR_EOF (call read() return 0):
-    // redis_context->err(3)
-    // redis_context->errstr("Server closed the connection")
-    //
-    // REDIS_ERR_IO (call read() return -1):
-    // redis_context->err(1)
-    // redis_context->errstr("Bad file descriptor")
-    //
-    // REDIS_ERR_IO means there was an I/O error
-    // and you should use the "errno" variable to find out what is wrong.
-    // For other values, the "errstr" field will hold a description.
-    const int redis_errcode = redis_context->err;
-    errinfo->errcode = errno;
-    errinfo->raw_errmsg = format_string("[%s][cost:%ldus] (hiredis:%d,errno:%d)%s (%s)",
-            redis_node->str().c_str(), cost_us, redis_errcode, errinfo->errcode, redis_context->errstr, strerror(errinfo->errcode));
-    errinfo->errmsg = format_string("[R3C_CMD_ERROR][%s:%d][%s] %s",
-            __FILE__, __LINE__, command_args.get_command().c_str(), errinfo->raw_errmsg.c_str());
-    if (_enable_error_log)
-    {
-        const unsigned int conn_errors = redis_node->get_conn_errors();
-        if (conn_errors==0 || conn_errors%10==0) // Reduce duplicate error logs
-            (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-    }
-
-    // REDIS_ERR_IO (1):
-    // There was an I/O error while creating the connection, trying to write
-    // to the socket or read from the socket. If you included `errno.h` in your
-    // application, you can use the global `errno` variable to find out what is wrong.
-    //
-    // REDIS_ERR_EOF (3):
-    // The server closed the connection which resulted in an empty read.
-    //
-    // REDIS_ERR_PROTOCOL (4):
-    // There was an error while parsing the protocol.
-    //
-    // REDIS_ERR_OTHER:
-    // Any other error. Currently, it is only used when a specified hostname to connect to cannot be resolved.
-    //
-    // #define   EAGAIN          11      /* Try again */
-    // #define   EINPROGRESS     115     /* Operation now in progress */
-    // #define   ECONNRESET      104     /* Connection reset by peer */
-    if ((redis_errcode != REDIS_ERR_IO) &&
-        (redis_errcode != REDIS_ERR_EOF))
-    {
-        return HR_ERROR; // Not retry
-    }
-    else if (redis_errcode == REDIS_ERR_EOF)
-    {
-        // (3/115)Server closed the connection (Operation now in progress)
-        redis_node->inc_conn_errors();
-        return HR_RECONN_UNCOND; // Retry unconditionally and reconnect
-    }
-    else if (redis_errcode == REDIS_ERR_IO && errinfo->errcode != EAGAIN)
-    {
-        // (1/104)Connection reset by peer (Connection reset by peer)
-        redis_node->inc_conn_errors();
-        return HR_RECONN_UNCOND; // Retry unconditionally and reconnect
-    }
-    else
-    {
-        // $ redis-cli -p 1386 cluster nodes | grep master
-        // 49cadd758538f821b922738fd000b5a16ef64fc7 127.0.0.1:1384@11384 master - 0 1546317629187 14 connected 10923-16383
-        // 95ce22507d469ae84cb760505bba4be0283c5468 127.0.0.1:1381@11381 master - 0 1546317630190 1 connected 0-5460
-        // a27a1ce7f8c5c5f79a1d09227eb80b73919ec795 127.0.0.1:1383@11383 master,fail - 1546317518930 1546317515000 12 connected
-        // 03c4ada274ac137c710f3d514700c2e94649c131 127.0.0.1:1382@11382 master - 0 1546317631191 2 connected 5461-10922
-        // 错误期间，可能发生了主备切换，因此光重连接是不够的，
-        // 更严重的是，该master可能一直连接超时，比如进程被SIGSTOP了，
-        // 因此重试几次后，应当重刷新master
-        redis_node->inc_conn_errors();
-        return HR_RECONN_COND; // Retry conditionally
-    }
-}
-
-CRedisClient::HandleResult
-CRedisClient::handle_redis_reply(
-        int64_t cost_us,
-        CRedisNode* redis_node,
-        const CommandArgs& command_args,
-        const redisReply* redis_reply,
-        struct ErrorInfo* errinfo)
-{
-    redis_node->reset_conn_errors();
 
-    if (redis_reply->type != REDIS_REPLY_ERROR)
-        return HR_SUCCESS;
-    else
-        return handle_redis_replay_error(cost_us, redis_node, command_args, redis_reply, errinfo);
+            CRedisMasterNode* redis_master_node = (CRedisMasterNode*)redis_node;
+            redis_node = redis_master_node->choose_node(_read_policy);
+            select_connection(redis_node, key_hash);
+            redis_context = redis_node->get_redis_context();
+            if (NULL == redis_context)
+            {
+                // 从replica读需要先发送READONLY
+                redis_context = connect_redis_node(redis_node->get_node(), errinfo, redis_node!=redis_master_node);
+                redis_node->set_redis_context(redis_context);
+                if (NULL == redis_context)
+                    record_node_error(redis_node, *errinfo);
+                connected = true;
+            }
+            if (NULL == redis_context)
+            {
+                redis_node = redis_master_node;
+            }
+        }
+    } while(false);
+
+    if (connected)
+        update_topology_metrics(true);
+    return redis_node;
 }
 
-CRedisClient::HandleResult
-CRedisClient::handle_redis_replay_error(
-        int64_t cost_us,
-        CRedisNode* redis_node,
-        const CommandArgs& command_args,
-        const redisReply* redis_reply,
-        struct ErrorInfo* errinfo)
+int64_t CRedisClient::get_remaining_milliseconds() const
 {
-    // ASK
-    // NOAUTH Authentication required
-    // MOVED 6474 127.0.0.1:6380
-    // WRONGTYPE Operation against a key holding the wrong kind of value
-    // CLUSTERDOWN The cluster is down
-    // NOSCRIPT No matching script. Please use EVAL.
-    //
-    // ERR Error running script (call to f_64b2246244d60088e7351656c216c00cb1d7d2fd) : @user_script:1: @user_script: 1: Lua script attempted to access a non local key in a cluster node
-    extract_errtype(redis_reply, &errinfo->errtype);
-    errinfo->errcode = ERROR_COMMAND;
-    errinfo->raw_errmsg = format_string("[%s][cost:%ldus] %s", redis_node->str().c_str(), cost_us, redis_reply->str);
-    errinfo->errmsg = format_string("[R3C_REPLAY_ERROR][%s:%d][%s] %s", __FILE__, __LINE__, command_args.get_command().c_str(), errinfo->raw_errmsg.c_str());
-    if (_enable_error_log)
-        (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-
-    // EVAL不会返回“MOVED”的错误，需特别处理
-    if (is_clusterdown_error(errinfo->errtype))
+    if (_deadline_milliseconds <= 0)
     {
-        return HR_RETRY_UNCOND;
+        return -1;
     }
-    else if (is_ask_error(errinfo->errtype))
+    else
     {
-        // ASK 6474 127.0.0.1:6380
-        //
-        // 如下所示，如果此时向10.212.2.72:6379请求slot为14148的keys时，将得到：
-        // ASK 6474 10.212.2.71:6381
-        // 其中ec19be9a50b5416999ac0305c744d9b6c957c18d为10.212.2.71:6381的NodeId
-        // e008649f6f8340a495fc860f7a9a8155f91fcb93 10.212.2.72:6379@16379 myself,master - 0 1547374698000 35 connected 5461-10922 14148 [14148->-ec19be9a50b5416999ac0305c744d9b6c957c18d]
-        return HR_REDIRECT;
+        const int64_t remaining_milliseconds = _deadline_milliseconds - get_monotonic_milliseconds();
+        return (remaining_milliseconds > 0)? remaining_milliseconds: 0;
     }
-    else if (is_moved_error(errinfo->errtype))
+}
+
+bool CRedisClient::update_readwrite_timeout(CRedisNode* redis_node)
+{
+    const int64_t remaining_milliseconds = get_remaining_milliseconds();
+    const int default_timeout_milliseconds = (_readwrite_timeout_milliseconds > 0)? _readwrite_timeout_milliseconds: 0;
+    const int current_timeout_milliseconds = (-1 == redis_node->get_readwrite_timeout())? default_timeout_milliseconds: redis_node->get_readwrite_timeout();
+    int timeout_milliseconds = default_timeout_milliseconds;
+
+    if (remaining_milliseconds>0 && (0==timeout_milliseconds || timeout_milliseconds>remaining_milliseconds))
     {
-        // MOVED 6474 127.0.0.1:6380
-        //
-        //Node ask_node;
-        //parse_moved_string(redis_reply->str, &ask_node);
-        redis_node->set_conn_errors(2019); // Trigger to refresh master nodes
-        return HR_RETRY_UNCOND;
+        timeout_milliseconds = static_cast<int>(remaining_milliseconds);
     }
-    else
+    if (timeout_milliseconds != current_timeout_milliseconds)
     {
-        return HR_ERROR;
+        struct timeval data_timeout;
+        data_timeout.tv_sec = timeout_milliseconds / 1000;
+        data_timeout.tv_usec = (timeout_milliseconds % 1000) * 1000;
+
+        // 0 means no timeout
+        if (REDIS_ERR == redisSetTimeout(redis_node->get_redis_context(), data_timeout))
+            return false;
+        redis_node->set_readwrite_timeout(timeout_milliseconds);
     }
-}
 
-void CRedisClient::fini()
-{
-    clear_all_master_nodes();
+    return true;
 }
 
-void CRedisClient::init()
+CRedisClient::HandleResult
+CRedisClient::blocking_command(
+        CRedisNode* redis_node, bool readonly, const Node* ask_node, const CommandArgs& command_args,
+        RedisReplyHelper* redis_reply, struct ErrorInfo* errinfo)
 {
-    _enable_debug_log = true;
-    _enable_info_log = true;
-    _enable_error_log = true;
+    redisContext* redis_context = redis_node->pop_blocking_context();
+    HandleResult errcode;
 
-    try
+    if (NULL == redis_context)
     {
-        const int num_nodes = parse_nodes(&_nodes, _raw_nodes_string);
-        struct ErrorInfo errinfo;
-
-        if (0 == num_nodes)
+        // 路由到replica的阻塞读（如XREAD BLOCK）需要先发送READONLY，对master无害
+        redis_context = connect_redis_node(redis_node->get_node(), errinfo, readonly);
+        if (NULL == redis_context)
         {
-            errinfo.errcode = ERROR_PARAMETER;
-            errinfo.errmsg = format_string("[R3C_INIT][%s:%d] parameter[nodes] error: %s", __FILE__, __LINE__, _raw_nodes_string.c_str());
-            errinfo.raw_errmsg = format_string("parameter[nodes] error: %s", _raw_nodes_string.c_str());
-            if (_enable_error_log)
-                (*g_error_log)("%s\n", errinfo.errmsg.c_str());
-            THROW_REDIS_EXCEPTION(errinfo);
+            redis_node->inc_conn_errors();
+            return HR_RETRY_UNCOND;
         }
-        else if (1 == num_nodes)
+    }
+    if (!set_blocking_timeout(redis_context, command_args.get_block_milliseconds()))
+    {
+        errcode = handle_redis_command_error(0, redis_node, redis_context, command_args, errinfo);
+    }
+    else
+    {
+        struct timeval start_tv, stop_tv;
+        int64_t cost_us = 0;
+
+        gettimeofday(&start_tv, NULL);
+        if (ask_node != NULL)
         {
-            if (!init_standlone(&errinfo))
-                THROW_REDIS_EXCEPTION(errinfo);
+            *redis_reply = (redisReply*)redisCommand(redis_context, "ASKING");
+            if (*redis_reply)
+            {
+                *redis_reply = (redisReply*)redisCommandArgv(
+                        redis_context,
+                        command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+            }
         }
         else
         {
-            if (!init_cluster(&errinfo))
-                THROW_REDIS_EXCEPTION(errinfo);
+            *redis_reply = (redisReply*)redisCommandArgv(
+                    redis_context,
+                    command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
         }
-    }
-    catch (...)
-    {
-        clear_all_master_nodes();
-        throw;
-    }
-}
 
-bool CRedisClient::init_standlone(struct ErrorInfo* errinfo)
-{
-    const Node& node = _nodes[0];
-    _nodes_string = _raw_nodes_string;
+        gettimeofday(&stop_tv, NULL);
+        cost_us = calc_elapsed_time(start_tv, stop_tv);
+        if (!*redis_reply)
+            errcode = handle_redis_command_error(cost_us, redis_node, redis_context, command_args, errinfo);
+        else
+            errcode = handle_redis_reply(cost_us, redis_node, command_args, redis_reply->get(), errinfo);
+        record_latency(redis_node, command_args, cost_us, errcode);
+    }
 
-    redisContext* redis_context = connect_redis_node(node, errinfo, false);
-    if (NULL == redis_context)
+    if (0 == redis_context->err)
     {
-        return false;
+        redis_node->push_blocking_context(redis_context);
     }
     else
     {
-        CRedisMasterNode* redis_node = new CRedisMasterNode(std::string(""), node, redis_context);
-        const std::pair<RedisMasterNodeTable::iterator, bool> ret =
-                _redis_master_nodes.insert(std::make_pair(node, redis_node));
-        R3C_ASSERT(ret.second);
-        return true;
+        // 只关闭出错的阻塞连接，节点的共享连接不受影响
+        redisFree(redis_context);
+        if (HR_RECONN_COND == errcode)
+            errcode = HR_RETRY_COND;
+        else if (HR_RECONN_UNCOND == errcode)
+            errcode = HR_RETRY_UNCOND;
     }
+    return errcode;
 }
 
-bool CRedisClient::init_cluster(struct ErrorInfo* errinfo)
+bool CRedisClient::set_blocking_timeout(redisContext* redis_context, int64_t block_milliseconds) const
 {
-    const int num_nodes = static_cast<int>(_nodes.size());
-    const uint64_t base = reinterpret_cast<uint64_t>(this);
-    uint64_t seed = get_random_number(base);
+    const int64_t remaining_milliseconds = get_remaining_milliseconds();
+    int64_t timeout_milliseconds = 0; // 0 means no timeout
+    struct timeval data_timeout;
 
-    _slot2node.resize(CLUSTER_SLOTS);
-    for (int i=0; i<num_nodes; ++i)
-    {
-        const int j = static_cast<int>(++seed % num_nodes);
-        const Node& node = _nodes[j];
-        std::vector<struct NodeInfo> nodes_info;
+    if (block_milliseconds>0 && _readwrite_timeout_milliseconds>0)
+        timeout_milliseconds = block_milliseconds + _readwrite_timeout_milliseconds;
+    if (remaining_milliseconds>0 && (0==timeout_milliseconds || timeout_milliseconds>remaining_milliseconds))
+        timeout_milliseconds = remaining_milliseconds;
+    data_timeout.tv_sec = timeout_milliseconds / 1000;
+    data_timeout.tv_usec = (timeout_milliseconds % 1000) * 1000;
+    return REDIS_OK == redisSetTimeout(redis_context, data_timeout);
+}
 
-        redisContext* redis_context = connect_redis_node(node, errinfo, false);
-        if (NULL == redis_context)
-        {
-            continue;
-        }
-        if (!list_cluster_nodes(&nodes_info, errinfo, redis_context, node))
-        {
-            redisFree(redis_context);
-            continue;
-        }
-        else
-        {
-            std::vector<struct NodeInfo> replication_nodes_info;
+CommandMetricsEntry* CRedisClient::get_command_metrics(const Node& node, const std::string& command)
+{
+    const std::pair<Node, std::string> key(node, command);
+    CommandMetricsTable::iterator iter = _command_metrics.find(key);
 
-            redisFree(redis_context);
-            redis_context = NULL;
-            if (init_master_nodes(nodes_info, &replication_nodes_info, errinfo))
-            {
-                if (_read_policy != RP_ONLY_MASTER)
-                    init_replica_nodes(replication_nodes_info);
-                break;
-            }
-        }
+    if (iter == _command_metrics.end())
+    {
+        CommandMetricsEntry* entry = new CommandMetricsEntry;
+        entry->num_errors = 0; // cost is cleared by its constructor
+        pthread_mutex_lock(&_metrics_mutex);
+        iter = _command_metrics.insert(std::make_pair(key, entry)).first;
+        pthread_mutex_unlock(&_metrics_mutex);
     }
+    return iter->second;
+}
 
-    return !_redis_master_nodes.empty();
+CommandMetricsEntry* CRedisClient::get_command_metrics(CRedisNode* redis_node, const std::string& command)
+{
+    std::map<std::string, CommandMetricsEntry*>& command_metrics = redis_node->get_stats()->command_metrics;
+    std::map<std::string, CommandMetricsEntry*>::iterator iter = command_metrics.find(command);
+
+    if (iter == command_metrics.end())
+        iter = command_metrics.insert(std::make_pair(command, get_command_metrics(redis_node->get_node(), command))).first;
+    return iter->second;
 }
 
-bool CRedisClient::init_master_nodes(
-        const std::vector<struct NodeInfo>& nodes_info,
-        std::vector<struct NodeInfo>* replication_nodes_info,
-        struct ErrorInfo* errinfo)
+NodeStatsEntry* CRedisClient::get_node_stats_entry(const Node& node, bool master)
 {
-    int connected = 0; // 成功连接的master个数
+    std::map<Node, NodeStatsEntry*>::iterator iter = _node_stats.find(node);
 
-    if (nodes_info.size() > 1)
+    if (iter == _node_stats.end())
     {
-        _nodes_string.clear();
+        NodeStatsEntry* entry = new NodeStatsEntry(master);
+        pthread_mutex_lock(&_metrics_mutex);
+        iter = _node_stats.insert(std::make_pair(node, entry)).first;
+        pthread_mutex_unlock(&_metrics_mutex);
     }
     else
     {
-        _nodes_string = _raw_nodes_string;
-    }
-    for (std::vector<struct NodeInfo>::size_type i=0; i<nodes_info.size(); ++i) // Traversing all master nodes
-    {
-        const struct NodeInfo& nodeinfo = nodes_info[i];
-
-        if (nodes_info.size() > 1)
-        {
-            update_nodes_string(nodeinfo);
-        }
-        if (nodeinfo.is_master() && !nodeinfo.is_fail())
-        {
-            update_slots(nodeinfo);
-            if (add_master_node(nodeinfo, errinfo))
-                ++connected;
-        }
-        else if (nodeinfo.is_replica() && !nodeinfo.is_fail())
-        {
-            replication_nodes_info->push_back(nodeinfo);
-        }
+        // 主从切换后角色可能已变
+        iter->second->master = master;
     }
-
-    // 至少要有一个能够连接上
-    return connected > 0;
+    return iter->second;
 }
 
-void CRedisClient::init_replica_nodes(const std::vector<struct NodeInfo>& replication_nodes_info)
+void CRedisClient::count_reconnect(CRedisNode* redis_node)
 {
-    for (std::vector<struct NodeInfo>::size_type i=0; i<replication_nodes_info.size(); ++i)
+    if (_enable_metrics)
     {
-        const struct NodeInfo& nodeinfo = replication_nodes_info[i];
-        const NodeId& master_nodeid = nodeinfo.master_id;
-        const NodeId& replica_nodeid = nodeinfo.id;
-        const Node& replica_node = nodeinfo.node;
-
-        CRedisMasterNode* redis_master_node = get_redis_master_node(master_nodeid);
-        if (redis_master_node != NULL)
-        {
-            struct ErrorInfo errinfo;
-            redisContext* redis_context = connect_redis_node(replica_node, &errinfo, true);
-            if (redis_context != NULL)
-            {
-                CRedisReplicaNode* redis_replica_node = new CRedisReplicaNode(replica_nodeid, replica_node, redis_context);
-                redis_master_node->add_replica_node(redis_replica_node);
-            }
-        }
-    }
-}
+        NodeStatsEntry* stats = redis_node->get_stats();
 
-void CRedisClient::update_slots(const struct NodeInfo& nodeinfo)
-{
-    for (SlotSegment::size_type i=0; i<nodeinfo.slots.size(); ++i)
-    {
-        const std::pair<int, int>& slot_segment = nodeinfo.slots[i];
-        for (int slot=slot_segment.first; slot<=slot_segment.second; ++slot)
-            _slot2node[slot] = nodeinfo.node;
+        __sync_fetch_and_add(&_num_reconnects, 1);
+        __sync_fetch_and_add(&stats->num_reconnects, 1);
+        pthread_mutex_lock(&_metrics_mutex);
+        stats->reconnect_milliseconds.push_back(get_current_milliseconds());
+        if (stats->reconnect_milliseconds.size() > NodeStatsEntry::MAX_RECONNECTS)
+            stats->reconnect_milliseconds.pop_front();
+        pthread_mutex_unlock(&_metrics_mutex);
     }
 }
 
-// 几种需要刷新master情况：
-// 1) 遇到MOVED错误（可立即重刷）
-// 2) master挂起（能够连接，但不能服务，立即重刷一般无效，得等主从切换后）
-void CRedisClient::refresh_master_node_table(struct ErrorInfo* errinfo, const Node* error_node)
+void CRedisClient::record_node_error(CRedisNode* redis_node, const struct ErrorInfo& errinfo)
 {
-    const int num_nodes = static_cast<int>(_redis_master_nodes.size());
-    uint64_t seed = reinterpret_cast<uint64_t>(this) - num_nodes;
-    const int k = static_cast<int>(seed % num_nodes);
-    RedisMasterNodeTable::iterator iter = _redis_master_nodes.begin();
-
-    for (int i=0; i<k; ++i)
-    {
-        ++iter;
-        if (iter == _redis_master_nodes.end())
-            iter = _redis_master_nodes.begin();
-    }
-    for (int i=0; i<num_nodes; ++i)
-    {
-        const Node& node = iter->first;
-        CRedisMasterNode* redis_node = iter->second;
-        ++iter;
+    NodeStatsEntry* stats = redis_node->get_stats();
 
-        // error_node可能已是一个有问题的节点，所以最好避开它
-        if ((NULL==error_node) || (node!=*error_node))
-        {
-            redisContext* redis_context = redis_node->get_redis_context();
+    pthread_mutex_lock(&_metrics_mutex);
+    stats->last_error = errinfo.raw_errmsg;
+    stats->last_error_milliseconds = get_current_milliseconds();
+    pthread_mutex_unlock(&_metrics_mutex);
+}
 
-            if (NULL == redis_context)
-            {
-                redis_context = connect_redis_node(node, errinfo, false);
-            }
-            if (redis_context != NULL)
-            {
-                std::vector<struct NodeInfo> nodes_info;
+void CRedisClient::record_latency(CRedisNode* redis_node, const CommandArgs& command_args, int64_t cost_us, HandleResult errcode)
+{
+    if (_enable_metrics)
+    {
+        CommandMetricsEntry* entry = get_command_metrics(redis_node, command_args.get_command());
 
-                redis_node->set_redis_context(redis_context);
-                if (list_cluster_nodes(&nodes_info, errinfo, redis_context, node))
-                {
-                    std::vector<struct NodeInfo> replication_nodes_info;
-                    clear_and_update_master_nodes(nodes_info, &replication_nodes_info, errinfo);
-                    if (_read_policy != RP_ONLY_MASTER)
-                        init_replica_nodes(replication_nodes_info);
-                    break; // Continue is not safe, because `clear_and_update_master_nodes` will modify _redis_master_nodes
-                }
-            }
-        }
-        if (iter == _redis_master_nodes.end())
-        {
-            iter = _redis_master_nodes.begin();
-        }
+        entry->latency.record(cost_us);
+        if (errcode != HR_SUCCESS)
+            __sync_fetch_and_add(&entry->num_errors, 1);
     }
 }
 
-void CRedisClient::clear_and_update_master_nodes(
-        const std::vector<struct NodeInfo>& nodes_info,
-        std::vector<struct NodeInfo>* replication_nodes_info,
-        struct ErrorInfo* errinfo)
+void CRedisClient::account_command(const Node& node, const CommandArgs& command_args, const struct CommandCost& io_cost)
 {
-    NodeInfoTable master_nodeinfo_table;
-    std::string nodes_string;
+    CommandMetricsEntry* entry = get_command_metrics(node, command_args.get_command());
 
-    if (nodes_info.size() > 1)
+    // 上一个命令的响应在其返回后才被解析
+    if (_last_cost_entry != NULL)
+        _last_cost_entry->cost.add(_decode_cost);
+    _decode_cost.clear();
+
+    _build_cost.num_commands = 1;
+    _build_cost.num_allocations += io_cost.num_allocations;
+    _build_cost.allocated_bytes += io_cost.allocated_bytes;
+    _build_cost.modelled_copied_bytes += io_cost.modelled_copied_bytes;
+    _build_cost.num_reads += io_cost.num_reads;
+    _build_cost.num_writes += io_cost.num_writes;
+    entry->cost.add(_build_cost);
+    _build_cost.clear();
+    _last_cost_entry = entry;
+}
+
+void CRedisClient::monitor_attempt(
+        struct CommandSpan* command_span, int64_t start_us, CRedisNode* redis_node,
+        size_t request_bytes, const redisReply* redis_reply, HandleResult errcode)
+{
+    const RedisMasterNodeTable::const_iterator iter = _redis_master_nodes.find(redis_node->get_node());
+    struct CommandSpan attempt_span;
+
+    attempt_span.command_args = command_span->command_args;
+    attempt_span.slot = command_span->slot;
+    attempt_span.readonly = command_span->readonly;
+    attempt_span.node = redis_node->get_node();
+    attempt_span.replica = (iter == _redis_master_nodes.end()) || (iter->second != redis_node);
+    attempt_span.attempt = command_span->attempt;
+    attempt_span.num_redirects = command_span->num_redirects;
+    attempt_span.start_us = start_us;
+    attempt_span.stop_us = get_current_microseconds();
+    attempt_span.result = errcode;
+    attempt_span.request_bytes = request_bytes;
+    if (redis_reply != NULL)
     {
-        _nodes_string.clear();
+        attempt_span.reply_bytes = get_reply_size(redis_reply);
+        if (REDIS_REPLY_ERROR == redis_reply->type)
+            extract_errtype(redis_reply, &attempt_span.errtype);
     }
-    for (std::vector<struct NodeInfo>::size_type i=0; i<nodes_info.size(); ++i) // Traversing all master nodes
+    if (_command_monitor != NULL)
+        _command_monitor->on_attempt(attempt_span);
+    if (_enable_slowlog)
+        _attempts_cost_us.push_back(attempt_span.cost_us());
+
+    command_span->node = attempt_span.node;
+    command_span->replica = attempt_span.replica;
+    command_span->result = attempt_span.result;
+    command_span->errtype = attempt_span.errtype;
+    command_span->request_bytes += attempt_span.request_bytes;
+    command_span->reply_bytes += attempt_span.reply_bytes;
+    ++command_span->attempt;
+    if (is_moved_error(attempt_span.errtype) || is_ask_error(attempt_span.errtype))
+        ++command_span->num_redirects;
+}
+
+void CRedisClient::monitor_command(struct CommandSpan* command_span)
+{
+    command_span->stop_us = get_current_microseconds();
+    if (_command_monitor != NULL)
+        _command_monitor->on_command(*command_span);
+    if (_enable_slowlog)
+        add_slowlog(*command_span);
+}
+
+void CRedisClient::add_slowlog(const struct CommandSpan& command_span)
+{
+    const bool slow = command_span.cost_us() >= _slowlog_threshold_us;
+    const bool sampled = (_slowlog_sample_interval > 0) && (0 == ++_num_slowlog_commands % _slowlog_sample_interval);
+
+    if (slow || sampled)
     {
-        const struct NodeInfo& nodeinfo = nodes_info[i];
+        const std::string& key = command_span.command_args->get_key();
+        struct SlowLogEntry entry;
 
-        if (nodes_info.size() > 1)
-        {
-            update_nodes_string(nodeinfo);
-        }
-        if (nodeinfo.is_master() && !nodeinfo.is_fail())
-        {
-            // 可能只是一个或多个slot从一个master迁到另一个master，
-            // 简单的全量更新slot和node间的关系，
-            // 如果一对master和replica同时异常，则_slot2node会出现空洞
-            update_slots(nodeinfo);
-            master_nodeinfo_table.insert(std::make_pair(nodeinfo.node, nodeinfo));
+        entry.timestamp_us = command_span.start_us;
+        entry.command = command_span.command_args->get_command();
+        entry.key = (static_cast<int>(key.size()) > _slowlog_max_key_length)? key.substr(0, _slowlog_max_key_length): key;
+        entry.slot = command_span.slot;
+        entry.node = command_span.node;
+        entry.cost_us = command_span.cost_us();
+        entry.attempts_cost_us = _attempts_cost_us;
+        entry.reply_bytes = command_span.reply_bytes;
+        entry.result = command_span.result;
+        entry.sampled = !slow;
 
-            if (_redis_master_nodes.count(nodeinfo.node) <= 0)
-            {
-                // New master
-                add_master_node(nodeinfo, errinfo);
-            }
-        }
-        else if (nodeinfo.is_replica() && !nodeinfo.is_fail())
-        {
-            replication_nodes_info->push_back(nodeinfo);
-        }
+        pthread_mutex_lock(&_metrics_mutex);
+        entry.id = _num_slowlog_entries++;
+        _slowlog.push_front(entry);
+        if (static_cast<int>(_slowlog.size()) > _slowlog_max_entries)
+            _slowlog.pop_back();
+        pthread_mutex_unlock(&_metrics_mutex);
     }
+}
 
-    clear_invalid_master_nodes(master_nodeinfo_table);
+void CRedisClient::count_metric(uint64_t* counter, uint64_t n) const
+{
+    if (_enable_metrics)
+        __sync_fetch_and_add(counter, n);
 }
 
-void CRedisClient::clear_invalid_master_nodes(const NodeInfoTable& master_nodeinfo_table)
+void CRedisClient::update_topology_metrics(bool slots_changed)
 {
-    for (RedisMasterNodeTable::iterator node_iter=_redis_master_nodes.begin(); node_iter!=_redis_master_nodes.end();)
+    int num_replicas = 0;
+    int num_connected_nodes = 0;
+
+    for (RedisMasterNodeTable::const_iterator iter=_redis_master_nodes.begin(); iter!=_redis_master_nodes.end(); ++iter)
     {
-        const Node& node = node_iter->first;
-        const NodeInfoTable::const_iterator info_iter = master_nodeinfo_table.find(node);
+        const CRedisMasterNode* redis_master_node = iter->second;
+        num_replicas += redis_master_node->get_num_replica_nodes();
+        num_connected_nodes += redis_master_node->get_num_connected_replica_nodes();
+        if (redis_master_node->is_connected())
+            ++num_connected_nodes;
+    }
+    _num_masters = static_cast<int>(_redis_master_nodes.size());
+    _num_replicas = num_replicas;
+    _num_connected_nodes = num_connected_nodes;
 
-        if (info_iter != master_nodeinfo_table.end())
-        {
-            // 保持不变，仍然是master
-            ++node_iter;
-        }
-        else
-        {
-            CRedisMasterNode* master_node = node_iter->second;
-            const NodeId nodeid = master_node->get_nodeid();
-            if (_enable_info_log)
-                (*g_info_log)("[R3C_CLEAR_INVALID][%s:%d] %s is removed because it is not a master now\n", __FILE__, __LINE__, master_node->str().c_str());
+    if (slots_changed && cluster_mode())
+    {
+        int num_unmapped_slots = 0;
+        bool mapped = false;
 
-#if __cplusplus < 201103L
-            _redis_master_nodes.erase(node_iter++);
-#else
-            node_iter = _redis_master_nodes.erase(node_iter);
-#endif
-            delete master_node;
-            _redis_master_nodes_id.erase(nodeid);
+        for (std::vector<Node>::size_type slot=0; slot<_slot2node.size(); ++slot)
+        {
+            // 连续的slot一般属于同一个master，只在变化时查找
+            if (0==slot || _slot2node[slot]!=_slot2node[slot-1])
+                mapped = _redis_master_nodes.find(_slot2node[slot]) != _redis_master_nodes.end();
+            if (!mapped)
+                ++num_unmapped_slots;
         }
+        _num_unmapped_slots = num_unmapped_slots;
     }
 }
 
-bool CRedisClient::add_master_node(const NodeInfo& nodeinfo, struct ErrorInfo* errinfo)
+bool CRedisClient::hedged_reads_enabled(bool readonly, int slot) const
 {
-    const NodeId& nodeid = nodeinfo.id;
-    const Node& node = nodeinfo.node;
-    redisContext* redis_context = connect_redis_node(node, errinfo, false);
-    CRedisMasterNode* master_node = new CRedisMasterNode(nodeid, node, redis_context);
-
-    const std::pair<RedisMasterNodeTable::iterator, bool> ret =
-            _redis_master_nodes.insert(std::make_pair(node, master_node));
-    R3C_ASSERT(ret.second);
-    if (!ret.second)
-        delete master_node;
-    _redis_master_nodes_id[nodeid] = node;
-    return redis_context != NULL;
+    return readonly && slot>=0 && _hedge_percentile>0 &&
+           (RP_PRIORITY_REPLICA==_read_policy || RP_READ_REPLICA==_read_policy);
 }
 
-void CRedisClient::clear_all_master_nodes()
+void CRedisClient::add_read_latency(int64_t cost_us)
 {
-    for (RedisMasterNodeTable::iterator iter=_redis_master_nodes.begin(); iter!=_redis_master_nodes.end(); ++iter)
+    // The cost is measured by gettimeofday, drop it if the wall clock stepped backwards
+    if (cost_us < 0)
+        return;
+    _read_latencies[_num_read_latencies++ % _read_latencies.size()] = cost_us;
+
+    if (_num_read_latencies>=HEDGE_MIN_SAMPLES && 0==_num_read_latencies%HEDGE_UPDATE_INTERVAL)
     {
-        CRedisMasterNode* master_node = iter->second;
-        delete master_node;
+        const uint64_t num_samples = std::min<uint64_t>(_num_read_latencies, _read_latencies.size());
+        std::vector<int64_t> samples(_read_latencies.begin(), _read_latencies.begin()+num_samples);
+        const std::vector<int64_t>::iterator nth = samples.begin() + (num_samples*_hedge_percentile/100);
+
+        std::nth_element(samples.begin(), nth, samples.end());
+        _hedge_delay_us = *nth;
     }
-    _redis_master_nodes.clear();
-    _redis_master_nodes_id.clear();
 }
 
-void CRedisClient::update_nodes_string(const NodeInfo& nodeinfo)
+// 只写入发送缓冲并发送，不等待响应
+static bool send_command_argv(redisContext* redis_context, const CommandArgs& command_args)
 {
-    std::string node_str;
-    if (_nodes_string.empty())
-        _nodes_string = node2string(nodeinfo.node, &node_str);
-    else
-        _nodes_string = _nodes_string + std::string(",") + node2string(nodeinfo.node, &node_str);
+    int done = 0;
+
+    if (REDIS_OK != redisAppendCommandArgv(redis_context, command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen()))
+        return false;
+    do
+    {
+        if (REDIS_OK != redisBufferWrite(redis_context, &done))
+            return false;
+    } while (!done);
+    return true;
 }
 
-redisContext* CRedisClient::connect_redis_node(const Node& node, struct ErrorInfo* errinfo, bool readonly) const
+redisReply* CRedisClient::hedged_command(int slot, CRedisNode** redis_node, const CommandArgs& command_args)
 {
-    redisContext* redis_context = NULL;
+    CRedisNode* redis_nodes[2] = { *redis_node, NULL }; // [0] the node chosen first, [1] the hedge node
+    bool alives[2] = { true, true };
+    int readwrite_timeout_milliseconds = redis_nodes[0]->get_readwrite_timeout();
+    int hedge_delay_milliseconds = static_cast<int>((_hedge_delay_us + 999) / 1000);
+    void* reply = NULL;
+    int winner = -1;
 
-    errinfo->clear();
-    if (_enable_debug_log)
+    if (-1 == readwrite_timeout_milliseconds)
+        readwrite_timeout_milliseconds = (_readwrite_timeout_milliseconds > 0)? _readwrite_timeout_milliseconds: 0;
+    if (hedge_delay_milliseconds < _hedge_min_delay_milliseconds)
+        hedge_delay_milliseconds = _hedge_min_delay_milliseconds;
+    if ((_hedge_delay_us < 0) ||
+        (readwrite_timeout_milliseconds>0 && hedge_delay_milliseconds>=readwrite_timeout_milliseconds))
     {
-        (*g_debug_log)("[R3C_CONN][%s:%d] To connect %s with timeout: %dms\n",
-                __FILE__, __LINE__, node2string(node).c_str(), _connect_timeout_milliseconds);
+        // 样本不足，或者对冲延迟不小于超时，则不对冲
+        return (redisReply*)redisCommandArgv(
+                redis_nodes[0]->get_redis_context(),
+                command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
     }
-    if (_connect_timeout_milliseconds <= 0)
+    if (!send_command_argv(redis_nodes[0]->get_redis_context(), command_args))
     {
-        redis_context = redisConnect(node.first.c_str(), node.second);
+        return NULL;
     }
     else
     {
-        struct timeval timeout;
-        timeout.tv_sec = _connect_timeout_milliseconds / 1000;
-        timeout.tv_usec = (_connect_timeout_milliseconds % 1000) * 1000;
-        redis_context = redisConnectWithTimeout(node.first.c_str(), node.second, timeout);
-    }
+        struct pollfd pfd;
+        pfd.fd = redis_nodes[0]->get_redis_context()->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
 
-    if (NULL == redis_context)
+        // 0 means no reply within the hedge delay,
+        // otherwise read the reply (or the error) in blocking mode.
+        if (poll(&pfd, 1, hedge_delay_milliseconds) != 0)
+        {
+            if (REDIS_OK != redisGetReply(redis_nodes[0]->get_redis_context(), &reply))
+                return NULL;
+            return (redisReply*)reply;
+        }
+    }
     {
-        // can't allocate redis context
-        errinfo->errcode = ERROR_REDIS_CONTEXT;
-        errinfo->raw_errmsg = "can not allocate redis context";
-        errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] %s",
-                __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
-        if (_enable_error_log)
-            (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+        const RedisMasterNodeTable::const_iterator iter = _redis_master_nodes.find(_slot2node[slot]);
+        if (iter != _redis_master_nodes.end())
+            redis_nodes[1] = iter->second->choose_hedge_node(redis_nodes[0]);
     }
-    else if (redis_context->err != 0)
+    if (redis_nodes[1]!=NULL &&
+        (!update_readwrite_timeout(redis_nodes[1]) || !send_command_argv(redis_nodes[1]->get_redis_context(), command_args)))
     {
-        // #define REDIS_ERR_IO 1 /* Error in read or write */
-        // redis_context->errstr
-        //
-        // Connection refused
-        //
-        // errno: EADDRNOTAVAIL(99)
-        // err: REDIS_ERR_IO(1)
-        // Cannot assign requested address
+        redis_nodes[1]->inc_conn_errors();
+        redis_nodes[1]->close();
+        redis_nodes[1] = NULL;
+    }
+    if (NULL == redis_nodes[1])
+    {
+        // 没有可对冲的节点
+        if (REDIS_OK != redisGetReply(redis_nodes[0]->get_redis_context(), &reply))
+            return NULL;
+        return (redisReply*)reply;
+    }
 
-        errinfo->errcode = ERROR_INIT_REDIS_CONN;
-        errinfo->raw_errmsg = redis_context->errstr;
-        if (REDIS_ERR_IO == redis_context->err)
+    ++_num_hedges;
+    {
+        // 先到的响应胜出
+        const int64_t wait_milliseconds = readwrite_timeout_milliseconds - hedge_delay_milliseconds;
+        const int64_t start_milliseconds = get_monotonic_milliseconds(); // 不受墙上时钟调整的影响
+
+        while (-1==winner && (alives[0] || alives[1]))
         {
-            errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] (errno:%d,err:%d)%s",
-                    __FILE__, __LINE__, node.first.c_str(), node.second,
-                    errno, redis_context->err, errinfo->raw_errmsg.c_str());
+            struct pollfd pfds[2];
+            int indexes[2];
+            int num_fds = 0;
+            int timeout_milliseconds = -1;
+
+            for (int i=0; i<2; ++i)
+            {
+                if (alives[i])
+                {
+                    pfds[num_fds].fd = redis_nodes[i]->get_redis_context()->fd;
+                    pfds[num_fds].events = POLLIN;
+                    pfds[num_fds].revents = 0;
+                    indexes[num_fds++] = i;
+                }
+            }
+            if (readwrite_timeout_milliseconds > 0)
+            {
+                const int64_t elapsed_milliseconds = get_monotonic_milliseconds() - start_milliseconds;
+                if (elapsed_milliseconds >= wait_milliseconds)
+                    break;
+                timeout_milliseconds = static_cast<int>(wait_milliseconds - elapsed_milliseconds);
+            }
+
+            const int ret = poll(pfds, num_fds, timeout_milliseconds);
+            if (-1==ret && EINTR==errno)
+                continue;
+            if (ret <= 0)
+                break;
+            for (int j=0; j<num_fds && -1==winner; ++j)
+            {
+                if (pfds[j].revents != 0)
+                {
+                    const int i = indexes[j];
+                    redisContext* redis_context = redis_nodes[i]->get_redis_context();
+
+                    if (REDIS_OK!=redisBufferRead(redis_context) || REDIS_OK!=redisGetReplyFromReader(redis_context, &reply))
+                        alives[i] = false;
+                    else if (reply != NULL)
+                        winner = i;
+                }
+            }
         }
-        else
+    }
+
+    const int errcode = errno;
+    for (int i=0; i<2; ++i)
+    {
+        if (i == winner)
+            continue;
+        if (alives[i])
         {
-            errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] (err:%d)%s",
-                    __FILE__, __LINE__, node.first.c_str(), node.second,
-                    redis_context->err, errinfo->raw_errmsg.c_str());
+            // 输掉的响应留待下次使用该连接前丢弃
+            redis_nodes[i]->inc_pending_replies();
         }
-        if (_enable_error_log)
+        else if (i==1 || winner!=-1)
         {
-            (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+            // 出错的连接，第一个节点如果也没有胜出者则交由调用者处理
+            redis_nodes[i]->inc_conn_errors();
+            redis_nodes[i]->close();
         }
-        redisFree(redis_context);
-        redis_context = NULL;
+    }
+    if (_command_monitor != NULL)
+        _command_monitor->on_hedge(redis_nodes[0]->get_node(), redis_nodes[1]->get_node(), command_args.get_command(), 1==winner);
+    if (winner != -1)
+    {
+        if (1 == winner)
+            ++_num_hedge_wins;
+        *redis_node = redis_nodes[winner];
+        return (redisReply*)reply;
     }
     else
     {
-        if (_enable_debug_log)
+        redisContext* redis_context = redis_nodes[0]->get_redis_context();
+
+        if (alives[0])
         {
-            (*g_debug_log)("[R3C_CONN][%s:%d] Connect %s successfully with readwrite timeout: %dms\n",
-                    __FILE__, __LINE__, node2string(node).c_str(), _readwrite_timeout_milliseconds);
+            // 同读超时
+            redis_context->err = REDIS_ERR_IO;
+            snprintf(redis_context->errstr, sizeof(redis_context->errstr), "%s", strerror(EAGAIN));
+            errno = EAGAIN;
         }
-        if (_readwrite_timeout_milliseconds > 0)
+        else
         {
-            struct timeval data_timeout;
-            data_timeout.tv_sec = _readwrite_timeout_milliseconds / 1000;
-            data_timeout.tv_usec = (_readwrite_timeout_milliseconds % 1000) * 1000;
-
-            if (REDIS_ERR == redisSetTimeout(redis_context, data_timeout))
-            {
-                // REDIS_ERR_IO == redis_context->err
-                errinfo->errcode = ERROR_INIT_REDIS_CONN;
-                errinfo->raw_errmsg = redis_context->errstr;
-                errinfo->errmsg = format_string("[R3C_CONN][%s:%d][%s:%d] (errno:%d,err:%d)%s",
-                        __FILE__, __LINE__, node.first.c_str(), node.second,
-                        errno, redis_context->err, errinfo->raw_errmsg.c_str());
-                if (_enable_error_log)
-                    (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-                redisFree(redis_context);
-                redis_context = NULL;
-            }
+            errno = errcode;
         }
-        if ((0 == errinfo->errcode) && !_password.empty())
-        {
-            const RedisReplyHelper redis_reply = (redisReply*)redisCommand(redis_context, "AUTH %s", _password.c_str());
+        return NULL;
+    }
+}
 
-            if (redis_reply && 0==strcmp(redis_reply->str, "OK"))
-            {
-                // AUTH success
-                if (_enable_info_log)
-                    (*g_info_log)("[R3C_AUTH][%s:%d] Connect redis://%s:%d success\n",
-                            __FILE__, __LINE__, node.first.c_str(), node.second);
-            }
-            else
-            {
-                // AUTH failed
-                if (!redis_reply)
-                {
-                    errinfo->errcode = ERROR_REDIS_AUTH;
-                    errinfo->raw_errmsg = "authorization failed";
-                }
-                else
-                {
-                    extract_errtype(redis_reply.get(), &errinfo->errtype);
-                    errinfo->errcode = ERROR_REDIS_AUTH;
-                    errinfo->raw_errmsg = redis_reply->str;
-                }
+bool CRedisClient::discard_pending_replies(CRedisNode* redis_node)
+{
+    redisContext* redis_context = redis_node->get_redis_context();
 
-                errinfo->errmsg = format_string("[R3C_AUTH][%s:%d][%s:%d] %s",
-                        __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
-                if (_enable_error_log)
-                    (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-                redisFree(redis_context);
-                redis_context = NULL;
-            }
+    // 只丢弃已到达的响应，不为输掉的对冲读阻塞
+    while (redis_node->get_pending_replies() > 0)
+    {
+        struct pollfd pfd;
+        void* reply = NULL;
+
+        if (REDIS_OK != redisGetReplyFromReader(redis_context, &reply))
+            return false;
+        if (reply != NULL)
+        {
+            freeReplyObject(reply);
+            redis_node->dec_pending_replies();
+            continue;
         }
+
+        pfd.fd = redis_context->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) <= 0)
+            break;
+        if (REDIS_OK != redisBufferRead(redis_context))
+            return false;
     }
-    if (readonly && redis_context!=NULL)
+    if (redis_node->get_pending_replies() > 0)
     {
-        const RedisReplyHelper redis_reply = (redisReply*)redisCommand(redis_context, "READONLY");
+        // 慢响应还未到达，重建连接，以免下一个命令等待它
+        const RedisMasterNodeTable::const_iterator iter = _redis_master_nodes.find(redis_node->get_node());
+        const bool replica = (iter == _redis_master_nodes.end()) || (iter->second != redis_node);
+        struct ErrorInfo errinfo;
 
-        if (redis_reply && 0==strcmp(redis_reply->str, "OK"))
+        redis_node->close();
+        redis_context = connect_redis_node(redis_node->get_node(), &errinfo, replica);
+        redis_node->set_redis_context(redis_context);
+        if (NULL == redis_context)
         {
-            // READONLY success
-            if (_enable_info_log)
-                (*g_debug_log)("[R3C_READONLY][%s:%d] READONLY redis://%s:%d success\n",
-                        __FILE__, __LINE__, node.first.c_str(), node.second);
+            record_node_error(redis_node, errinfo);
+            return false;
         }
-        else
-        {
-            // READONLY failed
-            if (!redis_reply)
-            {
-                errinfo->errcode = ERROR_REDIS_READONLY;
-                errinfo->raw_errmsg = "readonly failed";
-            }
-            else
-            {
-                extract_errtype(redis_reply.get(), &errinfo->errtype);
-                errinfo->errcode = ERROR_REDIS_READONLY;
-                errinfo->raw_errmsg = redis_reply->str;
-            }
+        count_reconnect(redis_node);
+    }
+    return true;
+}
 
-            errinfo->errmsg = format_string("[R3C_READONLY][%s:%d][%s:%d] %s",
-                    __FILE__, __LINE__, node.first.c_str(), node.second, errinfo->raw_errmsg.c_str());
-            if (_enable_error_log)
-                (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-            redisFree(redis_context);
-            redis_context = NULL;
-        }
+// Parse the reply from the protocol, like "-CLUSTERDOWN The cluster is down\r\n"
+static redisReply* make_redis_reply(const std::string& protocol)
+{
+    redisReader* reader = redisReaderCreate();
+    void* reply = NULL;
+
+    if (reader != NULL)
+    {
+        if (REDIS_OK != redisReaderFeed(reader, protocol.data(), protocol.size()) ||
+            REDIS_OK != redisReaderGetReply(reader, &reply))
+            reply = NULL;
+        redisReaderFree(reader);
     }
+    return static_cast<redisReply*>(reply);
+}
 
-    return redis_context;
+redisReply* CRedisClient::inject_fault(int fault, int slot, CRedisNode* redis_node, const CommandArgs& command_args)
+{
+    redisContext* redis_context = redis_node->get_redis_context();
+
+    switch (fault)
+    {
+    case FaultInjector::FAULT_TIMEOUT:
+        // 同读超时
+        redis_context->err = REDIS_ERR_IO;
+        snprintf(redis_context->errstr, sizeof(redis_context->errstr), "%s (injected)", strerror(EAGAIN));
+        errno = EAGAIN;
+        return NULL;
+
+    case FaultInjector::FAULT_EOF:
+        // 命令已发出，但在响应前连接被对端关闭，
+        // 出错后连接会被关闭，所以未读的响应不影响后续的命令
+        if (!send_command_argv(redis_context, command_args))
+            return NULL;
+        redis_context->err = REDIS_ERR_EOF;
+        snprintf(redis_context->errstr, sizeof(redis_context->errstr), "%s", "Server closed the connection (injected)");
+        errno = 0;
+        return NULL;
+
+    case FaultInjector::FAULT_PARTIAL_READ:
+        return partial_read_command(redis_context, command_args);
+
+    case FaultInjector::FAULT_MOVED:
+        // 重定向到自身，效果同槽表过期，会触发刷新
+        return make_redis_reply(format_string("-MOVED %d %s\r\n",
+                (slot >= 0)? slot: 0, node2string(redis_node->get_node()).c_str()));
+
+    case FaultInjector::FAULT_CLUSTERDOWN:
+        return make_redis_reply("-CLUSTERDOWN The cluster is down (injected)\r\n");
+
+    default:
+        return (redisReply*)redisCommandArgv(
+                redis_context,
+                command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen());
+    }
 }
 
-CRedisNode* CRedisClient::get_redis_node(
-        int slot, bool readonly,
-        const Node* ask_node, struct ErrorInfo* errinfo)
+// The copies of hiredis to build the reply, modelled after the reply objects of hiredis 0.14
+static void model_reply(const redisReply* redis_reply, struct CommandCost* cost)
 {
-    CRedisNode* redis_node = NULL;
-    redisContext* redis_context = NULL;
+    switch (redis_reply->type)
+    {
+    case REDIS_REPLY_STRING:
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_ERROR:
+        model_copy(cost, redis_reply->len);
+        break;
+    case REDIS_REPLY_ARRAY:
+        for (size_t i=0; i<redis_reply->elements; ++i)
+            model_reply(redis_reply->element[i], cost);
+        break;
+    default:
+        break;
+    }
+}
+
+redisReply* CRedisClient::accounted_command(redisContext* redis_context, const CommandArgs& command_args, struct CommandCost* cost)
+{
+    const size_t command_size = get_command_size(command_args);
+    void* reply = NULL;
+    int done = 0;
 
+    // 格式化到临时缓冲，再追加到输出缓冲
+    if (REDIS_OK != redisAppendCommandArgv(redis_context, command_args.get_argc(), command_args.get_argv(), command_args.get_argvlen()))
+        return NULL;
+    model_copy(cost, command_size*2);
     do
     {
-        if (-1 == slot)
-        {
-            // Standalone（单机redis）
-            R3C_ASSERT(!_redis_master_nodes.empty());
-            redis_node = _redis_master_nodes.begin()->second;
-            redis_context = redis_node->get_redis_context();
-            if (NULL == redis_context)
-            {
-                redis_context = connect_redis_node(redis_node->get_node(), errinfo, false);
-                redis_node->set_redis_context(redis_context);
-            }
+        ++cost->num_writes;
+        if (REDIS_OK != redisBufferWrite(redis_context, &done))
+            return NULL;
+    } while (!done);
+
+    for (;;)
+    {
+        if (REDIS_OK != redisGetReplyFromReader(redis_context, &reply))
+            return NULL;
+        if (reply != NULL)
             break;
-        }
-        else
-        {
-            // Cluster（集群redis）
-            R3C_ASSERT(slot>=0 && slot<CLUSTER_SLOTS);
+        ++cost->num_reads;
+        if (REDIS_OK != redisBufferRead(redis_context))
+            return NULL;
+    }
 
-            // clear_invalid_master_nodes可能将整个_master_nodes清空了，比如当整个集群短暂不可用时
-            if (_redis_master_nodes.empty())
-            {
-                const int num_nodes = parse_nodes(&_nodes, _nodes_string);
+    // 读到的数据先追加到读缓冲，再解析成响应
+    model_copy(cost, get_reply_size(static_cast<redisReply*>(reply)));
+    model_reply(static_cast<redisReply*>(reply), cost);
+    return static_cast<redisReply*>(reply);
+}
 
-                R3C_ASSERT(num_nodes > 1);
-                if (!init_cluster(errinfo))
-                {
-                    break;
-                }
-            }
-            {
-                const Node& node = (NULL==ask_node)? _slot2node[slot]: *ask_node;
-                const RedisMasterNodeTable::const_iterator iter = _redis_master_nodes.find(node);
-                if (iter != _redis_master_nodes.end())
-                {
-                    redis_node = iter->second;
-                }
-            }
-        }
+redisReply* CRedisClient::partial_read_command(redisContext* redis_context, const CommandArgs& command_args)
+{
+    void* reply = NULL;
 
-        if (NULL == redis_node)
+    if (!send_command_argv(redis_context, command_args))
+        return NULL;
+    for (int num_reads=0;; ++num_reads)
+    {
+        // 每次只读1到7个字节，以检验响应被拆分成多段时的处理
+        char buf[8];
+        const size_t size = 1 + num_reads%7;
+        ssize_t n;
+
+        if (REDIS_OK != redisGetReplyFromReader(redis_context, &reply))
+            return NULL;
+        if (reply != NULL)
+            break;
+
+        n = read(redis_context->fd, buf, size);
+        if (-1 == n)
         {
-            // 遇到空的slot，随机选一个
-            redis_node = random_redis_master_node();
+            if (EINTR == errno)
+                continue;
+            redis_context->err = REDIS_ERR_IO;
+            snprintf(redis_context->errstr, sizeof(redis_context->errstr), "%s", strerror(errno));
+            return NULL;
         }
-        if (redis_node != NULL)
+        else if (0 == n)
         {
-            redis_context = redis_node->get_redis_context();
+            redis_context->err = REDIS_ERR_EOF;
+            snprintf(redis_context->errstr, sizeof(redis_context->errstr), "%s", "Server closed the connection");
+            return NULL;
+        }
+        else if (REDIS_OK != redisReaderFeed(redis_context->reader, buf, static_cast<size_t>(n)))
+        {
+            redis_context->err = redis_context->reader->err;
+            snprintf(redis_context->errstr, sizeof(redis_context->errstr), "%s", redis_context->reader->errstr);
+            return NULL;
+        }
+    }
+    return static_cast<redisReply*>(reply);
+}
 
-            if (NULL == redis_context)
-            {
-                redis_context = connect_redis_node(redis_node->get_node(), errinfo, false);
-                redis_node->set_redis_context(redis_context);
-            }
-            if (!readonly || RP_ONLY_MASTER==_read_policy)
-            {
-                break;
-            }
-            if (redis_context!=NULL && RP_PRIORITY_MASTER==_read_policy)
-            {
-                break;
-            }
+NodeId CRedisClient::get_slot_nodeid(int slot) const
+{
+    if (slot<0 || slot>=static_cast<int>(_slot2node.size()))
+        return NodeId();
+    return get_master_nodeid(_slot2node[slot]);
+}
 
-            CRedisMasterNode* redis_master_node = (CRedisMasterNode*)redis_node;
-            redis_node = redis_master_node->choose_node(_read_policy);
-            redis_context = redis_node->get_redis_context();
-            if (NULL == redis_context)
-            {
-                redis_context = connect_redis_node(redis_node->get_node(), errinfo, false);
-                redis_node->set_redis_context(redis_context);
-            }
-            if (NULL == redis_context)
-            {
-                redis_node = redis_master_node;
-            }
-        }
-    } while(false);
+NodeId CRedisClient::get_master_nodeid(const Node& node) const
+{
+    const RedisMasterNodeTable::const_iterator iter = _redis_master_nodes.find(node);
+    return (iter == _redis_master_nodes.end())? NodeId(): iter->second->get_nodeid();
+}
 
-    return redis_node;
+int CRedisClient::get_nodeid_slot(const NodeId& nodeid) const
+{
+    const RedisMasterNodeIdTable::const_iterator iter = _redis_master_nodes_id.find(nodeid);
+
+    if (iter != _redis_master_nodes_id.end())
+    {
+        for (std::vector<Node>::size_type slot=0; slot<_slot2node.size(); ++slot)
+        {
+            if (_slot2node[slot] == iter->second)
+                return static_cast<int>(slot);
+        }
+    }
+    return -1;
 }
 
 CRedisMasterNode* CRedisClient::get_redis_master_node(const NodeId& nodeid) const
@@ -5434,6 +11056,11 @@ CRedisMasterNode* CRedisClient::get_redis_master_node(const NodeId& nodeid) cons
     return redis_master_node;
 }
 
+void CRedisClient::select_connection(CRedisNode* redis_node, unsigned int key_hash) const
+{
+    redis_node->select_connection(key_hash);
+}
+
 CRedisMasterNode* CRedisClient::random_redis_master_node() const
 {
     if (_redis_master_nodes.empty())
@@ -5521,92 +11148,92 @@ CRedisClient::list_cluster_nodes(
          *
          * e008649f6f8340a495fc860f7a9a8155f91fcb93 10.212.2.72:6379@11382 myself,master - 0 1547374698000 35 connected 5461-10922 14148 [14148->-ec19be9a50b5416999ac0305c744d9b6c957c18d]
          */
-        std::vector<std::string> lines;
-        const int num_lines = split(&lines, std::string(redis_reply->str), std::string("\n"));
+        std::string error_line;
 
-        if (num_lines < 1)
+        if (!parse_cluster_nodes(redis_reply->str, nodes_info, &error_line))
         {
             errinfo->errcode = ERROR_REPLY_FORMAT;
-            errinfo->raw_errmsg = "reply nothing";
-            errinfo->errmsg = format_string("[R3C_LIST_NODES][%s:%d][NODE:%s][REPLY:%s] %s",
-                    __FILE__, __LINE__, node2string(node).c_str(), redis_reply->str, "reply nothing");
-            if (_enable_error_log)
-                (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-        }
-        for (int row=0; row<num_lines; ++row)
-        {
-            std::vector<std::string> tokens;
-            const std::string& line = lines[row];
-            const int num_tokens = split(&tokens, line, std::string(" "));
-
-            if (0 == num_tokens)
+            if (error_line.empty())
             {
-                // Over
-                errinfo->clear();
-                break;
+                errinfo->raw_errmsg = "reply nothing";
+                errinfo->errmsg = format_string("[R3C_LIST_NODES][%s:%d][NODE:%s][REPLY:%s] %s",
+                        __FILE__, __LINE__, node2string(node).c_str(), redis_reply->str, "reply nothing");
             }
-            else if (num_tokens < 8)
+            else
             {
-                nodes_info->clear();
-                errinfo->errcode = ERROR_REPLY_FORMAT;
                 errinfo->raw_errmsg = "reply format error";
                 errinfo->errmsg = format_string("[R3C_LIST_NODES][%s:%d][NODE:%s][LINE:%s] %s",
-                        __FILE__, __LINE__, node2string(node).c_str(), line.c_str(), "reply format error");
-                if (_enable_error_log)
-                    (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-                break;
+                        __FILE__, __LINE__, node2string(node).c_str(), error_line.c_str(), "reply format error");
             }
-            else
+            if (_enable_error_log)
+                (*g_error_log)("%s\n", errinfo->errmsg.c_str());
+        }
+        else if (_enable_debug_log)
+        {
+            for (std::vector<struct NodeInfo>::size_type i=0; i<nodes_info->size(); ++i)
+                (*g_debug_log)("[R3C_LIST_NODES][%s:%d][NODE:%s] %s\n",
+                        __FILE__, __LINE__, node2string(node).c_str(), (*nodes_info)[i].str().c_str());
+        }
+    }
+
+    return !nodes_info->empty();
+}
+
+bool CRedisClient::parse_cluster_nodes(const char* nodes_string, std::vector<struct NodeInfo>* nodes_info, std::string* error_line)
+{
+    std::vector<std::string> lines;
+    const int num_lines = split(&lines, std::string(nodes_string), std::string("\n"));
+
+    nodes_info->clear();
+    error_line->clear();
+    for (int row=0; row<num_lines; ++row)
+    {
+        std::vector<std::string> tokens;
+        const std::string& line = lines[row];
+        const int num_tokens = split(&tokens, line, std::string(" "));
+
+        if (0 == num_tokens)
+        {
+            // Over
+            break;
+        }
+
+        NodeInfo nodeinfo;
+        if ((num_tokens < 8) ||
+            !parse_node_string(tokens[1], &nodeinfo.node.first, &nodeinfo.node.second))
+        {
+            nodes_info->clear();
+            *error_line = line;
+            break;
+        }
+
+        nodeinfo.id = tokens[0];
+        nodeinfo.flags = tokens[2];
+        nodeinfo.master_id = tokens[3];
+        nodeinfo.ping_sent = atoi(tokens[4].c_str());
+        nodeinfo.pong_recv = atoi(tokens[5].c_str());
+        nodeinfo.epoch = atoi(tokens[6].c_str());
+        nodeinfo.connected = (tokens[7] == "connected");
+
+        // 49cadd758538f821b922738fd000b5a16ef64fc7 127.0.0.1:1384@11384 master - 0 1546317629187 14 connected 10923-16383
+        // a27a1ce7f8c5c5f79a1d09227eb80b73919ec795 127.0.0.1:1383@11383 master,fail - 1546317518930 1546317515000 12 connected
+        if (nodeinfo.is_master() && !nodeinfo.is_fail())
+        {
+            for (int col=8; col<num_tokens; ++col)
             {
-                NodeInfo nodeinfo;
-                nodeinfo.id = tokens[0];
+                const std::string& token = tokens[col];
 
-                if (!parse_node_string(tokens[1], &nodeinfo.node.first, &nodeinfo.node.second))
+                // 排除掉正在迁移的：
+                // [14148->-ec19be9a50b5416999ac0305c744d9b6c957c18d]
+                if (token[0] != '[')
                 {
-                    nodes_info->clear();
-                    errinfo->errcode = ERROR_REPLY_FORMAT;
-                    errinfo->raw_errmsg = "reply format error";
-                    errinfo->errmsg = format_string("[R3C_LIST_NODES][%s:%d][NODE:%s][TOKEN:%s][LINE:%s] %s",
-                            __FILE__, __LINE__, node2string(node).c_str(), tokens[1].c_str(), line.c_str(), "reply format error");
-                    if (_enable_error_log)
-                        (*g_error_log)("%s\n", errinfo->errmsg.c_str());
-                    break;
-                }
-                else
-                {
-                    nodeinfo.flags = tokens[2];
-                    nodeinfo.master_id = tokens[3];
-                    nodeinfo.ping_sent = atoi(tokens[4].c_str());
-                    nodeinfo.pong_recv = atoi(tokens[5].c_str());
-                    nodeinfo.epoch = atoi(tokens[6].c_str());
-                    nodeinfo.connected = (tokens[7] == "connected");
-
-                    // 49cadd758538f821b922738fd000b5a16ef64fc7 127.0.0.1:1384@11384 master - 0 1546317629187 14 connected 10923-16383
-                    // a27a1ce7f8c5c5f79a1d09227eb80b73919ec795 127.0.0.1:1383@11383 master,fail - 1546317518930 1546317515000 12 connected
-                    if (nodeinfo.is_master() && !nodeinfo.is_fail())
-                    {
-                        for (int col=8; col<num_tokens; ++col)
-                        {
-                            const std::string& token = tokens[col];
-
-                            // 排除掉正在迁移的：
-                            // [14148->-ec19be9a50b5416999ac0305c744d9b6c957c18d]
-                            if (token[0] != '[')
-                            {
-                                std::pair<int, int> slot;
-                                parse_slot_string(token, &slot.first, &slot.second);
-                                nodeinfo.slots.push_back(slot);
-                            }
-                        }
-                    }
-
-                    if (_enable_debug_log)
-                        (*g_debug_log)("[R3C_LIST_NODES][%s:%d][NODE:%s] %s\n",
-                                __FILE__, __LINE__, node2string(node).c_str(), nodeinfo.str().c_str());
-                    nodes_info->push_back(nodeinfo);
+                    std::pair<int, int> slot;
+                    parse_slot_string(token, &slot.first, &slot.second);
+                    nodeinfo.slots.push_back(slot);
                 }
             }
         }
+        nodes_info->push_back(nodeinfo);
     }
 
     return !nodes_info->empty();
@@ -5646,6 +11273,8 @@ int64_t CRedisClient::get_value(const redisReply* redis_reply)
 
 bool CRedisClient::get_value(const redisReply* redis_reply, std::string* value)
 {
+    AllocationScope allocation_scope(sg_decode_cost);
+
     value->clear();
 
     if (REDIS_REPLY_NIL == redis_reply->type)
@@ -5658,12 +11287,15 @@ bool CRedisClient::get_value(const redisReply* redis_reply, std::string* value)
             value->assign(redis_reply->str, redis_reply->len);
         else
             value->clear();
+        model_copy(sg_decode_cost, value->size());
         return true;
     }
 }
 
 int CRedisClient::get_values(const redisReply* redis_reply, std::vector<std::string>* values)
 {
+    AllocationScope allocation_scope(sg_decode_cost);
+
     values->clear();
 
     if (redis_reply->elements > 0)
@@ -5677,6 +11309,7 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::vector<std::str
             if (value_reply->type != REDIS_REPLY_NIL)
             {
                 value.assign(value_reply->str, value_reply->len);
+                model_copy(sg_decode_cost, value_reply->len);
             }
         }
     }
@@ -5685,6 +11318,8 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::vector<std::str
 
 int CRedisClient::get_values(const redisReply* redis_reply, std::set<std::string>* values)
 {
+    AllocationScope allocation_scope(sg_decode_cost);
+
     values->clear();
 
     if (redis_reply->elements > 0)
@@ -5697,6 +11332,7 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::set<std::string
             {
                 const std::string v(value_reply->str, value_reply->len);
                 values->insert(v);
+                model_copy(sg_decode_cost, value_reply->len*2);
             }
         }
     }
@@ -5705,6 +11341,7 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::set<std::string
 
 int CRedisClient::get_values(const redisReply* redis_reply, std::vector<std::pair<std::string, int64_t> >* vec, bool withscores)
 {
+    AllocationScope allocation_scope(sg_decode_cost);
     size_t steps;
 
     vec->clear();
@@ -5726,6 +11363,7 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::vector<std::pai
             const struct redisReply* v_reply = redis_reply->element[i];
             (*vec)[i].first.assign(v_reply->str, v_reply->len);
             (*vec)[i].second = 0;
+            model_copy(sg_decode_cost, v_reply->len);
         }
         else
         {
@@ -5736,6 +11374,7 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::vector<std::pai
             const std::string v(v_reply->str, v_reply->len);
             (*vec)[j].first = k;
             (*vec)[j].second = static_cast<int64_t>(atoll(v.c_str()));
+            model_copy(sg_decode_cost, k_reply->len*2 + v_reply->len);
         }
     }
 
@@ -5744,6 +11383,8 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::vector<std::pai
 
 int CRedisClient::get_values(const redisReply* redis_reply, std::map<std::string, std::string>* map)
 {
+    AllocationScope allocation_scope(sg_decode_cost);
+
     map->clear();
 
     for (size_t i=0; i<redis_reply->elements; i+=2)
@@ -5753,6 +11394,7 @@ int CRedisClient::get_values(const redisReply* redis_reply, std::map<std::string
         const std::string f(f_reply->str, f_reply->len);
         const std::string v(v_reply->str, v_reply->len);
         (*map)[f] = v;
+        model_copy(sg_decode_cost, (f_reply->len + v_reply->len)*2);
     }
 
     return static_cast<int>(redis_reply->elements/2);
@@ -5765,6 +11407,8 @@ CRedisClient::get_values(
         bool keep_null,
         std::map<std::string, std::string>* map)
 {
+    AllocationScope allocation_scope(sg_decode_cost);
+
     map->clear();
 
     for (size_t i=0; i<redis_reply->elements; ++i)
@@ -5774,6 +11418,7 @@ CRedisClient::get_values(
         if (value_reply->type != REDIS_REPLY_NIL)
         {
             (*map)[fields[i]].assign(value_reply->str, value_reply->len);
+            model_copy(sg_decode_cost, fields[i].size() + value_reply->len);
         }
         else
         {
@@ -6187,6 +11832,95 @@ void CRedisClient::get_value(const redisReply* redis_reply, struct StreamInfo* i
 //         [2:7]REPLY_STRING: v3
 //         [2:8]REPLY_STRING: f4
 //         [2:9]REPLY_STRING: v4
+int CRedisClient::get_values(const redisReply* redis_reply, StreamBatch* batch)
+{
+    R3C_ASSERT(REDIS_REPLY_NIL==redis_reply->type || REDIS_REPLY_ARRAY==redis_reply->type);
+
+    if (NULL == batch)
+    {
+        return -1;
+    }
+
+    batch->clear();
+    if (REDIS_REPLY_NIL == redis_reply->type)
+    {
+        return 0;
+    }
+    else
+    {
+        const size_t num_keys = redis_reply->elements;
+        size_t buffer_size = 0;
+        size_t num_strings = 0;
+        size_t num_entries = 0;
+
+        // 先计算大小，一次性预留空间
+        for (size_t i=0; i<num_keys; ++i)
+        {
+            const redisReply* key_redis_reply = redis_reply->element[i];
+            buffer_size += key_redis_reply->element[0]->len;
+            ++num_strings;
+            num_entries += key_redis_reply->element[1]->elements;
+            batch->reserve(key_redis_reply->element[1], &buffer_size, &num_strings);
+        }
+        batch->_buffer.reserve(buffer_size);
+        batch->_string_offsets.reserve(num_strings+1);
+        batch->_entry_offsets.reserve(num_entries+1);
+        batch->_stream_offsets.reserve(num_keys+1);
+        batch->_stream_keys.reserve(num_keys);
+
+        for (size_t i=0; i<num_keys; ++i)
+        {
+            const redisReply* keyname_redis_reply = redis_reply->element[i]->element[0];
+            batch->_stream_keys.push_back(batch->_string_offsets.size()-1);
+            batch->append_string(keyname_redis_reply->str, keyname_redis_reply->len);
+        }
+        batch->_entry_offsets.push_back(batch->_string_offsets.size()-1);
+        for (size_t i=0; i<num_keys; ++i) // Traversing all keys
+        {
+            const redisReply* entries_redis_reply = redis_reply->element[i]->element[1];
+
+            for (size_t j=0; j<entries_redis_reply->elements; ++j) // Traversing all entries
+                batch->append_entry(entries_redis_reply->element[j]);
+            batch->_stream_offsets.push_back(static_cast<int>(batch->_entry_offsets.size()-1));
+        }
+        return static_cast<int>(num_keys);
+    }
+}
+
+int CRedisClient::get_values(const redisReply* redis_reply, const std::string& key, StreamBatch* batch)
+{
+    R3C_ASSERT(REDIS_REPLY_NIL==redis_reply->type || REDIS_REPLY_ARRAY==redis_reply->type);
+
+    if (NULL == batch)
+    {
+        return -1;
+    }
+
+    batch->clear();
+    if (REDIS_REPLY_NIL == redis_reply->type)
+    {
+        return 0;
+    }
+    else
+    {
+        size_t buffer_size = key.size();
+        size_t num_strings = 1;
+
+        batch->reserve(redis_reply, &buffer_size, &num_strings);
+        batch->_buffer.reserve(buffer_size);
+        batch->_string_offsets.reserve(num_strings+1);
+        batch->_entry_offsets.reserve(redis_reply->elements+1);
+
+        batch->_stream_keys.push_back(0);
+        batch->append_string(key.data(), key.size());
+        batch->_entry_offsets.push_back(batch->_string_offsets.size()-1);
+        for (size_t j=0; j<redis_reply->elements; ++j) // Traversing all entries
+            batch->append_entry(redis_reply->element[j]);
+        batch->_stream_offsets.push_back(static_cast<int>(batch->_entry_offsets.size()-1));
+        return static_cast<int>(redis_reply->elements);
+    }
+}
+
 void CRedisClient::get_entry(const redisReply* entry_redis_reply, struct StreamEntry* entry)
 {
     const redisReply* id_redis_reply = entry_redis_reply->element[0];
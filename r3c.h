@@ -4,7 +4,11 @@
 #define REDIS_CLUSTER_CLIENT_H
 #include <hiredis/hiredis.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -34,6 +38,12 @@ enum ReadPolicy
     RP_READ_REPLICA
 };
 
+// How to stripe the requests across the connections of a node (see CRedisClient::set_connections_per_node)
+enum StripePolicy
+{
+    SP_KEY_HASH // By the hash of key, requests of the same key always go through the same connection
+};
+
 enum ZADDFLAG
 {
     Z_NS, // Don't set options
@@ -57,6 +67,10 @@ struct NodeHasher
 std::string& node2string(const Node& node, std::string* str);
 std::string node2string(const Node& node);
 
+// A node given as "unix:/path/to/redis.sock" in nodes string,
+// its first is "unix:/path/to/redis.sock" and second is 0.
+bool is_unix_socket_node(const Node& node);
+
 struct NodeInfo
 {
     Node node;
@@ -115,6 +129,7 @@ bool is_wrongtype_error(const std::string& errtype);
 bool is_busygroup_error(const std::string& errtype);
 bool is_nogroup_error(const std::string& errtype);
 bool is_crossslot_error(const std::string& errtype);
+bool is_tryagain_error(const std::string& errtype);
 
 // NOTICE: not thread safe
 // A redis client than support redis cluster
@@ -145,9 +160,15 @@ bool is_crossslot_error(const std::string& errtype);
 struct FVPair;
 struct SlotInfo;
 class CRedisNode;
+struct NodeStatsEntry;
+struct CommandMetricsEntry;
 class CRedisMasterNode;
 class CRedisReplicaNode;
 class CommandMonitor;
+class FaultInjector;
+class ParallelScanner;
+class Pipeline;
+struct PipelineGroup;
 
 // Redis命令参数
 class CommandArgs
@@ -158,6 +179,10 @@ public:
     void set_key(const std::string& key);
     void set_command(const std::string& command);
 
+    // For the blocking commands (BLPOP, XREAD with BLOCK, etc.), which are executed on a dedicated connection,
+    // 0 means blocking indefinitely, and -1 (the default) means not a blocking command.
+    void set_block_milliseconds(int64_t block_milliseconds);
+
 public:
     void add_arg(const std::string& arg);
     void add_arg(char arg);
@@ -177,10 +202,12 @@ public:
     const size_t* get_argvlen() const;
     const std::string& get_command() const;
     const std::string& get_key() const;
+    int64_t get_block_milliseconds() const;
 
 private:
     std::string _key;
     std::string _command;
+    int64_t _block_milliseconds;
 
 private:
     std::vector<std::string> _args;
@@ -259,6 +286,88 @@ struct Stream
     std::vector<struct StreamEntry> entries;
 };
 
+// A compact representation of the entries of streams:
+// the keys, IDs, fields and values are copied into one contiguous buffer and addressed by offsets,
+// instead of a std::string per ID, field and value as Stream & StreamEntry.
+// The capacity is kept by clear, so reusing a StreamBatch reads without allocations once warmed up.
+//
+// EXAMPLE:
+// r3c::StreamBatch batch;
+// redis.xreadgroup(group, consumer, keys, ids, 1000, 0, false, &batch);
+// for (int i=0; i<batch.num_entries(); ++i)
+// {
+//     const r3c::StreamBatch::EntryView entry = batch.entry(i);
+//     for (int j=0; j<entry.num_fields(); ++j)
+//         process(entry.field(j), entry.value(j));
+// }
+class StreamBatch
+{
+    friend class CRedisClient;
+
+public:
+    // A view of the bytes in the buffer, invalidated by the next read or clear
+    struct Slice
+    {
+        const char* data;
+        size_t size;
+
+        Slice(): data(NULL), size(0) {}
+        Slice(const char* data_, size_t size_): data(data_), size(size_) {}
+        std::string str() const { return std::string(data, size); }
+        bool operator ==(const std::string& other) const { return other.size()==size && 0==memcmp(other.data(), data, size); }
+        bool operator !=(const std::string& other) const { return !(*this == other); }
+    };
+
+    class EntryView
+    {
+    public:
+        EntryView(const StreamBatch* batch, int index): _batch(batch), _index(index) {}
+        int index() const { return _index; }
+        Slice key() const; // Key of the stream the entry belongs to
+        Slice id() const;
+        int num_fields() const;
+        Slice field(int i) const;
+        Slice value(int i) const;
+        void get(struct StreamEntry* entry) const; // Copy into a StreamEntry
+
+    private:
+        const StreamBatch* _batch;
+        int _index;
+    };
+
+public:
+    StreamBatch() { clear(); }
+    void clear(); // Keep the capacity
+    bool empty() const { return _entry_offsets.size() <= 1; }
+
+    int num_streams() const { return _stream_offsets.empty()? 0: static_cast<int>(_stream_offsets.size()-1); }
+    Slice key(int stream_index) const;
+    int first_entry(int stream_index) const; // Index of the first entry of the stream
+    int last_entry(int stream_index) const; // Index after the last entry of the stream
+
+    int num_entries() const { return _entry_offsets.empty()? 0: static_cast<int>(_entry_offsets.size()-1); }
+    EntryView entry(int entry_index) const { return EntryView(this, entry_index); }
+    size_t buffer_size() const { return _buffer.size(); }
+
+    // Convert to the representation of strings
+    void get(std::vector<Stream>* streams) const;
+
+private:
+    StreamBatch(const StreamBatch&);
+    StreamBatch& operator =(const StreamBatch&);
+    Slice slice(size_t string_index) const;
+    void append_string(const char* str, size_t len);
+    void append_entry(const redisReply* entry_redis_reply);
+    void reserve(const redisReply* entries_redis_reply, size_t* buffer_size, size_t* num_strings) const;
+
+private:
+    std::vector<char> _buffer;
+    std::vector<size_t> _string_offsets; // String i is [_string_offsets[i], _string_offsets[i+1]) of the buffer
+    std::vector<size_t> _entry_offsets; // Entry i is strings [_entry_offsets[i], _entry_offsets[i+1]): the ID, fields and values
+    std::vector<int> _stream_offsets; // The entries of stream i are [_stream_offsets[i], _stream_offsets[i+1])
+    std::vector<size_t> _stream_keys; // The key of stream i is string _stream_keys[i]
+};
+
 std::ostream& operator <<(std::ostream& os, const std::vector<struct Stream>& streams);
 std::ostream& operator <<(std::ostream& os, const std::vector<struct StreamEntry>& entries);
 // Returns the number of IDs
@@ -314,10 +423,184 @@ struct StreamInfo
 };
 std::ostream& operator <<(std::ostream& os, const struct StreamInfo& streaminfo);
 
+// Log-bucketed latency histogram in the style of HdrHistogram:
+// values below 8 have a bucket each, and every power of 2 above is split into 8 buckets,
+// so the relative error of a percentile is no more than 12.5%.
+//
+// record is lock-free (atomic increments only), and can be called concurrently with
+// the readers and reset, a reader may see a record half done.
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        SUB_BUCKET_BITS = 3,
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        MAX_VALUE_BITS = 40, // Larger values are counted in the last bucket
+        NUM_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS
+    };
+
+public:
+    LatencyHistogram();
+    void record(int64_t value);
+    void reset();
+    void merge(const LatencyHistogram& other);
+
+    uint64_t count() const { return _count; }
+    int64_t sum() const { return static_cast<int64_t>(_sum); }
+    int64_t max() const { return static_cast<int64_t>(_max); }
+    double mean() const;
+
+    // Returns the upper bound of the bucket containing the given percentile (0~100),
+    // 0 if the histogram is empty.
+    int64_t percentile(double percentile) const;
+
+    uint64_t bucket_count(int bucket) const { return _buckets[bucket]; }
+
+    // Number of the values not greater than the given value,
+    // counted by the buckets whose upper bound is not greater than it.
+    uint64_t cumulative_count(int64_t value) const;
+    static int bucket_index(int64_t value);
+    static int64_t bucket_lower(int bucket); // Inclusive
+    static int64_t bucket_upper(int bucket); // Inclusive
+
+private:
+    uint64_t _buckets[NUM_BUCKETS];
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _max;
+};
+
+// Client side costs of the commands, counted if CRedisClient::enable_accounting is called.
+//
+// The allocations are measured only if the program is linked with r3c_allocation_hook.cpp (like r3c_bench),
+// which hooks malloc and the global operator new to count the heap allocations made by the thread
+// inside CommandArgs, get_value(s) and redis_command, including the ones of hiredis, std::string and the STL containers.
+// They are 0 if the program is not linked with the hook.
+//
+// The copies can not be hooked, so modelled_copied_bytes is derived from the sizes of the command and the reply:
+// the arguments copied by CommandArgs, the command formatted and appended to the output buffer by hiredis,
+// the reply appended to the input buffer and then to the reply objects by hiredis, and the values copied by get_value(s).
+//
+// The syscalls are the read(2) and write(2) on the connection, counted as hiredis is called.
+struct CommandCost
+{
+    uint64_t num_commands;
+    uint64_t num_allocations;   // Of r3c and hiredis, measured by the allocation hook
+    uint64_t allocated_bytes;   // Of r3c and hiredis, measured by the allocation hook
+    uint64_t modelled_copied_bytes; // By r3c and hiredis, not measured
+    uint64_t num_reads;
+    uint64_t num_writes;
+
+    CommandCost();
+    void clear();
+    void add(const struct CommandCost& other); // Atomically, the readers may be in other threads
+};
+
+// Called by the allocation hook (see r3c_allocation_hook.cpp) for each allocation,
+// counted to the command being accounted by the thread if any.
+void count_allocation(size_t bytes);
+
+// Latencies of the attempts of a command on a node, in microseconds
+struct CommandMetrics
+{
+    Node node;
+    std::string command;
+    LatencyHistogram latency;
+    uint64_t num_errors; // Number of the attempts failed, including the error replies
+    struct CommandCost cost; // Sum of the commands whose last attempt is on the node
+};
+
+// I/O statistics of the connections to a node, to tell which connection is saturated when a shard gets slow.
+// The bytes are the sizes in the protocol of the commands and the replies read by r3c,
+// the replies of the hedged reads lost are not counted.
+// The bytes, the replies and the reconnects are counted only if the metrics enabled.
+struct NodeStats
+{
+    Node node;
+    bool master;                // The role when the node learned
+    uint64_t bytes_sent;        // Including the ASKING
+    uint64_t bytes_received;
+    uint64_t num_replies;       // Including the error replies
+    int64_t inflight;           // Commands sent but the replies not read yet, including the ones of the hedged reads lost
+    uint64_t num_connects;      // Connections established
+    uint64_t num_reconnects;    // Connections closed by errors, which are reconnected when used
+    std::vector<int64_t> reconnect_milliseconds; // When the recent reconnects happened, the oldest first
+    int num_connections;        // Connections established now
+    int64_t connected_milliseconds; // When the newest connection established, 0 if never
+    std::string last_error;     // Of the connection, like the timeout or refused
+    int64_t last_error_milliseconds;
+
+    NodeStats();
+    int64_t connection_age_milliseconds(int64_t now_milliseconds) const; // Of the newest connection, 0 if not connected
+    double average_reply_size() const;
+    std::string str() const;
+};
+
+// Snapshot of the metrics of CRedisClient since created or the last reset
+struct ClientMetrics
+{
+    int64_t start_milliseconds; // When the metrics created or reset
+    int64_t snapshot_milliseconds;
+    uint64_t num_retries;    // Number of the attempts after the first of a command, or the commands of a pipeline resent
+    uint64_t num_moved;      // Number of the MOVED replies
+    uint64_t num_asks;       // Number of the ASK replies
+    uint64_t num_reconnects; // Number of the connections closed by errors, which are reconnected when used
+    uint64_t num_timeouts;   // Number of the attempts timed out
+    uint64_t num_refreshes;  // Number of the refreshes of the master nodes table
+    std::vector<struct CommandMetrics> commands;
+    std::vector<struct NodeStats> nodes;
+
+    // Topology, sampled when the nodes refreshed or a connection established or closed
+    int num_masters;
+    int num_replicas;
+    int num_connected_nodes; // Masters and replicas having at least a connection
+    int num_unmapped_slots;  // Slots not owned by any known master
+
+    ClientMetrics();
+    void clear();
+
+    // Add the metrics of another client, like the clients of the threads to the same cluster,
+    // the counters and histograms are summed, and the topology takes the larger.
+    // The nodes are summed too, but the last error and the timestamps take the newer.
+    void merge(const struct ClientMetrics& other);
+};
+
+// Render the metrics in OpenMetrics text format (also accepted by Prometheus), ended with "# EOF".
+// The names are prefixed by the namespace, EXAMPLE:
+// # TYPE r3c_command_duration_seconds histogram
+// r3c_command_duration_seconds_bucket{node="127.0.0.1:6379",command="GET",le="0.001"} 1024
+// # TYPE r3c_redirects counter
+// r3c_redirects_total{type="moved"} 3
+// # TYPE r3c_unmapped_slots gauge
+// r3c_unmapped_slots 0
+std::string render_openmetrics(const struct ClientMetrics& metrics, const std::string& name_space=std::string("r3c"));
+
+// A command kept by the slow log of CRedisClient
+struct SlowLogEntry
+{
+    uint64_t id;          // Unique and increasing
+    int64_t timestamp_us; // When the command started, microseconds since the Epoch
+    std::string command;
+    std::string key;      // Truncated to the max_key_length of enable_slowlog
+    int slot;             // -1 in standalone mode
+    Node node;            // The node of the last attempt
+    int64_t cost_us;      // Total time across the attempts
+    std::vector<int64_t> attempts_cost_us;
+    size_t reply_bytes;   // Size of the replies in the protocol
+    int result;           // CRedisClient::HandleResult of the last attempt
+    bool sampled;         // True if kept by sampling but not slow
+};
+std::ostream& operator <<(std::ostream& os, const struct SlowLogEntry& entry);
+
 // NOTICE:
 // 1) ALL keys and values can be binary except EVAL commands.
 class CRedisClient
 {
+    friend class ClusterScanner;
+    friend class ParallelScanner;
+    friend class StreamConsumer;
+
 public:
     // raw_nodes_string - Redis cluster nodes separated by comma,
     //                    EXAMPLE: 127.0.0.1:6379,127.0.0.1:6380,127.0.0.2:6379,127.0.0.3:6379,
@@ -325,6 +608,8 @@ public:
     //
     // Particularly same nodes are allowed for cluster mode:
     // const std::string nodes = "127.0.0.1:6379,127.0.0.1:6379";
+    //
+    // A node can also be a unix domain socket, EXAMPLE: unix:/tmp/redis.sock
     CRedisClient(
             const std::string& raw_nodes_string,
             int connect_timeout_milliseconds=CONNECT_TIMEOUT_MILLISECONDS,
@@ -364,9 +649,119 @@ public: // Control logs
     void enable_error_log();
     void disable_error_log();
 
+public: // Deadline
+    // Set an absolute deadline in milliseconds of the monotonic clock (see get_monotonic_milliseconds)
+    // for all the subsequent commands, 0 to disable.
+    // The monotonic clock is used so that a step of the wall clock (like by NTP) neither expires nor stretches the deadline.
+    //
+    // The deadline bounds the total time of a command across retries, reconnects and redirects,
+    // and because it is kept by the client, a multi-key call like mget or mset which is split into
+    // several requests in cluster mode shares the same budget.
+    // The receive and send timeout of each attempt is reduced to the remaining budget.
+    //
+    // CRedisException with ERROR_DEADLINE_EXCEEDED is thrown when the deadline is exceeded.
+    void set_deadline(int64_t deadline_milliseconds);
+    // Set the deadline to budget_milliseconds from now, the same as:
+    // set_deadline(r3c::get_monotonic_milliseconds()+budget_milliseconds)
+    void set_deadline_after(int64_t budget_milliseconds);
+    int64_t get_deadline() const;
+    void clear_deadline();
+
+public: // Connections
+    // Reach the co-located nodes through unix domain socket instead of TCP,
+    // the key is the node as listed by CLUSTER NODES (or given in nodes string),
+    // and the value is the path of the unix socket of the same redis instance.
+    //
+    // Nodes given as "unix:/path/to/redis.sock" in nodes string are always connected through the unix socket.
+    // The connections established already are closed, and reestablished when used.
+    void set_unix_socket_table(const std::map<Node, std::string>& unix_socket_table);
+
+    // Set the number of connections per master and per replica (at least 1, the default),
+    // and how the requests are striped across them.
+    // Connections are established lazily, and each one keeps its own error count.
+    //
+    // The commands of the client are synchronous, so more connections add throughput only to pipeline,
+    // whose commands to a node are written to and read from all its connections in parallel.
+    void set_connections_per_node(int num_master_connections, int num_replica_connections, StripePolicy stripe_policy=SP_KEY_HASH);
+
+public: // Hedged reads
+    // Enable hedged reads for the readonly commands when the read policy is RP_PRIORITY_REPLICA or RP_READ_REPLICA:
+    // if the node chosen first has not replied within the given percentile of the recent read latencies
+    // (but not less than min_delay_milliseconds), the same command is sent to another replica or the master,
+    // and the first reply wins.
+    //
+    // Hedging starts after enough latencies are sampled,
+    // and only a node already connected is chosen as the second node.
+    void enable_hedged_reads(int percentile=95, int min_delay_milliseconds=2);
+    void disable_hedged_reads();
+    uint64_t get_num_hedges() const;     // Number of the reads sent to a second node
+    uint64_t get_num_hedge_wins() const; // Number of the hedged reads won by the second node
+
+public: // Metrics
+    // The latency of every attempt of redis_command is recorded in a histogram per node and command,
+    // and the retries, redirects, reconnects, timeouts and refreshes are counted,
+    // the recording is lock-free and enabled by default.
+    //
+    // get_metrics and reset_metrics are safe to be called by another thread,
+    // EXAMPLE:
+    // r3c::ClientMetrics metrics;
+    // redis.get_metrics(&metrics);
+    // for (size_t i=0; i<metrics.commands.size(); ++i)
+    //     printf("%s %s p99:%" PRId64 "us\n", r3c::node2string(metrics.commands[i].node).c_str(),
+    //            metrics.commands[i].command.c_str(), metrics.commands[i].latency.percentile(99));
+    void enable_metrics();
+    void disable_metrics();
+    void get_metrics(struct ClientMetrics* metrics) const;
+    void reset_metrics();
+
+    // Render the metrics by render_openmetrics,
+    // see MetricsServer for serving them over HTTP.
+    std::string get_openmetrics(const std::string& name_space=std::string("r3c")) const;
+
+public: // Accounting
+    // Count the costs of each command into CommandMetrics::cost, see CommandCost.
+    // The costs of the CommandArgs built and of get_value(s) called by the thread are counted to the client,
+    // so call them in the thread using the client, and enable only one client per thread.
+    // The copies of get_value(s) are added at the next command of the client.
+    // The syscalls are counted for the commands not hedged, redirected or blocking, nor the pipeline.
+    // Default: disabled.
+    void enable_accounting();
+    void disable_accounting();
+
+public: // Slow log
+    // Keep the commands taking threshold_us or more in a ring of max_entries,
+    // and one of every sample_interval commands regardless of the cost (0 to disable sampling).
+    // Pipelines are not logged.
+    //
+    // get_slowlog and reset_slowlog are safe to be called by another thread.
+    void enable_slowlog(int64_t threshold_us=10000, int max_entries=128, int sample_interval=0, int max_key_length=64);
+    void disable_slowlog();
+
+    // Get the newest count entries (all if count is negative), the newest first,
+    // returns the number of the entries got.
+    int get_slowlog(std::vector<struct SlowLogEntry>* entries, int count=-1) const;
+    void reset_slowlog();
+
+public: // Pipeline
+    // Execute all commands of the pipeline, the commands are grouped by node and sent in pipelining,
+    // with at most window_size commands in flight per connection.
+    // MOVED, ASK, TRYAGAIN and CLUSTERDOWN are followed transparently,
+    // but a command whose result is unknown because of connection error is resent only if num_retries > 0,
+    // while a command not sent yet is always resent.
+    // The commands resent are executed after the others on the same node, so the order is not kept for them.
+    //
+    // Unlike the other commands no exception is thrown, check the result of each command by Pipeline::get_reply.
+    // Returns the number of commands succeeded (the reply is not an error).
+    int pipeline(Pipeline* pipeline, int window_size=100, int num_retries=0);
+
 public:
     int list_nodes(std::vector<struct NodeInfo>* nodes_info);
 
+    // The I/O statistics of the nodes ever used, including the ones removed from the cluster since,
+    // returns the number of the nodes got.
+    // Safe to be called by another thread like get_metrics, see also ClientMetrics::nodes.
+    int get_node_stats(std::vector<struct NodeStats>* nodes_stats) const;
+
     // NOT SUPPORT CLUSTER
     //
     // Remove all keys from all databases.
@@ -469,6 +864,8 @@ public: // KV
     // including enough command calls for the cursor to return back to 0. N is the number of elements inside the collection.
     //
     // Returns an updated cursor that the user needs to use as the cursor argument in the next call.
+    //
+    // Only for standalone, use ClusterScanner to iterate the keyspace of a cluster.
     int64_t scan(int64_t cursor, std::vector<std::string>* values, Node* which=NULL, int num_retries=NUM_RETRIES);
     int64_t scan(int64_t cursor, int count, std::vector<std::string>* values, Node* which=NULL, int num_retries=NUM_RETRIES);
     int64_t scan(int64_t cursor, const std::string& pattern, std::vector<std::string>* values, Node* which=NULL, int num_retries=NUM_RETRIES);
@@ -944,6 +1341,20 @@ public: // STREAM (key like kafka's topic), available since 5.0.0.
             const std::vector<FVPair>& values,
             Node* which=NULL, int num_retries=0);
 
+    // Append the entries of many streams in pipelining (see pipeline), the streams are grouped by node.
+    // The ID of an entry is auto-generated if it is empty or "*".
+    // maxlen - Trim each stream by MAXLEN with c ('~' or '='), 0 to not trim
+    //
+    // ids is set to the IDs of all entries, in the order of streams and then the order of entries in a stream,
+    // the ID is empty if failed to add the entry.
+    // The entries of a stream are appended in order when the stripe policy is SP_KEY_HASH,
+    // except the entries resent after redirected.
+    //
+    // Returns the number of entries added.
+    // Not atomic, unlike r3c::xadd of r3c_helper.h, some entries may be added while the others failed.
+    int xadd(const std::vector<Stream>& streams, std::vector<std::string>* ids,
+            int64_t maxlen=0, char c='~', int window_size=100, int num_retries=0);
+
     // Create a new consumer group associated with a stream.
     // There are no hard limits to the number of consumer groups you can associate to a given stream.
     //
@@ -979,6 +1390,10 @@ public: // STREAM (key like kafka's topic), available since 5.0.0.
     void xread(const std::vector<std::string>& keys, const std::vector<std::string>& ids,
             std::vector<Stream>* values,
             Node* which=NULL, int num_retries=0);
+    // Read into a StreamBatch, reuse the batch to avoid allocations
+    void xread(const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+            int64_t count, int64_t block_milliseconds, StreamBatch* batch,
+            Node* which=NULL, int num_retries=0);
 
     // Only read one key
     void xread(const std::string& key, const std::string& id,
@@ -1025,6 +1440,11 @@ public: // STREAM (key like kafka's topic), available since 5.0.0.
             const std::vector<std::string>& keys, const std::vector<std::string>& ids,
             bool noack, std::vector<Stream>* values,
             Node* which=NULL, int num_retries=0);
+    // Read into a StreamBatch, reuse the batch to avoid allocations
+    void xreadgroup(const std::string& groupname, const std::string& consumername,
+            const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+            int64_t count, int64_t block_milliseconds, bool noack, StreamBatch* batch,
+            Node* which=NULL, int num_retries=0);
     void xreadgroup(const std::string& groupname, const std::string& consumername,
             const std::string& key, const std::string& id,
             int64_t count, int64_t block_milliseconds, bool noack, std::vector<StreamEntry>* values,
@@ -1065,6 +1485,14 @@ public: // STREAM (key like kafka's topic), available since 5.0.0.
     void xrevrange(const std::string& key,
             const std::string& end, const std::string& start, std::vector<StreamEntry>* values,
             Node* which=NULL, int num_retries=0);
+    // Read into a StreamBatch of one stream, reuse the batch to avoid allocations
+    // count -1 to read all entries in the range
+    void xrange(const std::string& key,
+            const std::string& start, const std::string& end, int64_t count, StreamBatch* batch,
+            Node* which=NULL, int num_retries=0);
+    void xrevrange(const std::string& key,
+            const std::string& end, const std::string& start, int64_t count, StreamBatch* batch,
+            Node* which=NULL, int num_retries=0);
 
     // Fetching data from a stream via a consumer group,
     // and not acknowledging such data, has the effect of creating pending entries.
@@ -1167,6 +1595,22 @@ public: // HyperLogLog
     // which is 0 if the variable does not exist.
     int64_t pfcount(const std::string& key, Node* which=NULL, int num_retries=NUM_RETRIES);
 
+private:
+    const RedisReplyHelper xread_command(
+            const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+            int64_t count, int64_t block_milliseconds,
+            Node* which, int num_retries);
+    const RedisReplyHelper xreadgroup_command(
+            const std::string& groupname, const std::string& consumername,
+            const std::vector<std::string>& keys, const std::vector<std::string>& ids,
+            int64_t count, int64_t block_milliseconds, bool noack,
+            Node* which, int num_retries);
+    // command - XRANGE or XREVRANGE
+    const RedisReplyHelper xrange_command(
+            const std::string& command, const std::string& key,
+            const std::string& first, const std::string& second, int64_t count,
+            Node* which, int num_retries);
+
 public:
     // Standlone: key should be empty
     // Cluse mode: key used to locate node
@@ -1175,7 +1619,14 @@ public:
             const std::string& key, const CommandArgs& command_args,
             Node* which);
 
-private:
+    // Standlone: slot is ignored
+    // Cluse mode: slot used to locate node, for the commands without key like SCAN
+    const RedisReplyHelper redis_command(
+            bool readonly, int num_retries,
+            int slot, const CommandArgs& command_args,
+            Node* which);
+
+public:
     // 有些错误可安全无条件地重试，有些则需调用者决定是否重试，
     // 如果是网络连接断开错误，则还需要重建立连接
     //
@@ -1191,12 +1642,16 @@ private:
     // HR_RECONN_COND 有条件重连接并重试
     // HR_RECONN_UNCOND 无条件重连接并重试
     // HR_REDIRECT 服务端返回ASK需要重定向
+    //
+    // Public for CommandSpan::result
     enum HandleResult { HR_SUCCESS, HR_ERROR, HR_RETRY_COND, HR_RETRY_UNCOND, HR_RECONN_COND, HR_RECONN_UNCOND, HR_REDIRECT };
 
+private:
+
     // Handle the redis command error
     // Return -1 to break, return 1 to retry conditionally
     // 因为网络错误结果是未定义的，对于读操作一般可无条件的重试，对于写操作则需由调用者决定
-    HandleResult handle_redis_command_error(int64_t cost_us, CRedisNode* redis_node, const CommandArgs& command_args, struct ErrorInfo* errinfo);
+    HandleResult handle_redis_command_error(int64_t cost_us, CRedisNode* redis_node, redisContext* redis_context, const CommandArgs& command_args, struct ErrorInfo* errinfo);
 
     // Handle the redis reply
     // Success returns 0,
@@ -1220,10 +1675,83 @@ private:
     void clear_all_master_nodes();
     void update_nodes_string(const NodeInfo& nodeinfo);
     redisContext* connect_redis_node(const Node& node, struct ErrorInfo* errinfo, bool readonly) const;
-    CRedisNode* get_redis_node(int slot, bool readonly, const Node* ask_node, struct ErrorInfo* errinfo);
+    CRedisNode* get_redis_node(int slot, unsigned int key_hash, bool readonly, const Node* ask_node, struct ErrorInfo* errinfo);
+    void select_connection(CRedisNode* redis_node, unsigned int key_hash) const;
     CRedisMasterNode* get_redis_master_node(const NodeId& nodeid) const;
+
+    // Called by: ClusterScanner
+    // The ID of the master serving the slot, or of the master node, as known by the client, empty if unknown
+    NodeId get_slot_nodeid(int slot) const;
+    NodeId get_master_nodeid(const Node& node) const;
+    // The first slot served by the master, -1 if none
+    int get_nodeid_slot(const NodeId& nodeid) const;
     CRedisMasterNode* random_redis_master_node() const;
 
+private:
+    // Returns -1 if there is no deadline, 0 if the deadline is exceeded, or the remaining milliseconds
+    int64_t get_remaining_milliseconds() const;
+
+    // Reduce the receive and send timeout to the remaining milliseconds of the deadline,
+    // or restore it to _readwrite_timeout_milliseconds if there is no deadline
+    bool update_readwrite_timeout(CRedisNode* redis_node);
+
+private:
+    // Called by: redis_command
+    // Execute a blocking command on a connection checked out from the blocking pool of the node,
+    // so that the shared connection of the node is not blocked.
+    // The connection is in READONLY mode for the readonly commands, which may be routed to a replica.
+    HandleResult blocking_command(
+            CRedisNode* redis_node, bool readonly, const Node* ask_node, const CommandArgs& command_args,
+            RedisReplyHelper* redis_reply, struct ErrorInfo* errinfo);
+
+    // The receive and send timeout of a blocking command is the block time plus _readwrite_timeout_milliseconds
+    bool set_blocking_timeout(redisContext* redis_context, int64_t block_milliseconds) const;
+
+private:
+    // Called by: redis_command
+    bool hedged_reads_enabled(bool readonly, int slot) const;
+    void add_read_latency(int64_t cost_us);
+
+    // Send the command to the node chosen first, and to a second node if no reply within the hedge delay,
+    // redis_node is set to the node whose reply wins, or remains the first node if both failed.
+    redisReply* hedged_command(int slot, CRedisNode** redis_node, const CommandArgs& command_args);
+
+    // Discard the replies left by the hedged reads lost without blocking,
+    // and reconnect the connection if any of them has not arrived yet.
+    // Returns false on error, and the connection is closed if failed to reconnect.
+    bool discard_pending_replies(CRedisNode* redis_node);
+
+private:
+    // Called by: redis_command
+    // Execute the attempt with the fault of FaultInjector,
+    // returns NULL with the error set in the redis context like redisCommandArgv.
+    redisReply* inject_fault(int fault, int slot, CRedisNode* redis_node, const CommandArgs& command_args);
+    redisReply* partial_read_command(redisContext* redis_context, const CommandArgs& command_args);
+
+private:
+    // Called by: redis_command
+    // Report an attempt to the monitor and add it to the span of the command
+    void monitor_attempt(
+            struct CommandSpan* command_span, int64_t start_us, CRedisNode* redis_node,
+            size_t request_bytes, const redisReply* redis_reply, HandleResult errcode);
+    void monitor_command(struct CommandSpan* command_span);
+    void add_slowlog(const struct CommandSpan& command_span);
+
+private:
+    // Called by: pipeline
+    // Send the given commands of the pipeline in one round,
+    // the commands redirected or failed but retriable are added to retries.
+    void pipeline_round(
+            Pipeline* pipeline, const std::vector<int>& indexes, int window_size, int num_retries,
+            std::vector<int>* retries, bool* need_refresh, bool* need_sleep);
+
+    // Returns false if the connection of the group failed
+    bool write_pipeline_group(Pipeline* pipeline, PipelineGroup* group, int window_size);
+    bool read_pipeline_group(Pipeline* pipeline, PipelineGroup* group, std::vector<int>* retries, bool* need_refresh, bool* need_sleep);
+
+    // Close the connection of the group, and the commands in flight fail unless retriable
+    void fail_pipeline_group(Pipeline* pipeline, PipelineGroup* group, int num_retries, std::vector<int>* retries);
+
 private:
     // List the information of all cluster nodes
     bool list_cluster_nodes(std::vector<struct NodeInfo>* nodes_info, struct ErrorInfo* errinfo, redisContext* redis_context, const Node& node);
@@ -1235,6 +1763,10 @@ public:
     void set_command_monitor(CommandMonitor* command_monitor) { _command_monitor = command_monitor; }
     CommandMonitor* get_command_monitor() const { return _command_monitor; }
 
+    // Set NULL to stop injecting, the injector is not owned by the client
+    void set_fault_injector(FaultInjector* fault_injector) { _fault_injector = fault_injector; }
+    FaultInjector* get_fault_injector() const { return _fault_injector; }
+
 public:
     // Called by: xgroup_destroy
     static int64_t get_value(const redisReply* redis_reply);
@@ -1267,6 +1799,14 @@ public: // Stream
     // Called by xrange & xrevrange
     static int get_values(const redisReply* redis_reply, std::vector<StreamEntry>* values);
 
+    // Called by xread & xreadgroup
+    // Returns the number of streams
+    static int get_values(const redisReply* redis_reply, StreamBatch* batch);
+
+    // Called by xrange & xrevrange
+    // Returns the number of entries
+    static int get_values(const redisReply* redis_reply, const std::string& key, StreamBatch* batch);
+
     // Called by xpending
     static int get_values(const redisReply* redis_reply, std::vector<struct DetailedPending>* pendings);
 
@@ -1286,6 +1826,10 @@ public: // Stream
     // Called by xinfo_stream
     static void get_entry(const redisReply* entry_redis_reply, struct StreamEntry* entry);
 
+    // Called by list_cluster_nodes, nodes_string is the reply of CLUSTER NODES.
+    // Returns false if nothing parsed, error_line is set to the first bad line if any.
+    static bool parse_cluster_nodes(const char* nodes_string, std::vector<struct NodeInfo>* nodes_info, std::string* error_line);
+
 private:
     bool _enable_debug_log; // Default: true
     bool _enable_info_log;  // Default: true
@@ -1293,12 +1837,93 @@ private:
 
 private:
     CommandMonitor* _command_monitor;
+    FaultInjector* _fault_injector;
     std::string _raw_nodes_string; // 最原始的
     std::string _nodes_string; // 长时间运行后，最原始的节点可能都不在了
     int _connect_timeout_milliseconds; // The connect timeout in milliseconds
     int _readwrite_timeout_milliseconds; // The receive and send timeout in milliseconds
     std::string _password;
     ReadPolicy _read_policy;
+    int64_t _deadline_milliseconds; // Absolute deadline in milliseconds, 0 means no deadline
+
+private:
+    std::map<Node, std::string> _unix_socket_table; // Node -> Path of unix socket
+
+private:
+    int _num_master_connections;  // Number of connections per master
+    int _num_replica_connections; // Number of connections per replica
+    StripePolicy _stripe_policy;
+
+private:
+    int _hedge_percentile; // 0 means hedged reads disabled
+    int _hedge_min_delay_milliseconds;
+    int64_t _hedge_delay_us; // The percentile of the recent read latencies, -1 if not enough samples
+    uint64_t _num_hedges;
+    uint64_t _num_hedge_wins;
+    uint64_t _num_read_latencies;
+    std::vector<int64_t> _read_latencies; // Ring of the recent read latencies in microseconds
+
+private:
+    // Called by: redis_command
+    // The metrics of the command on the node, created at the first time
+    struct CommandMetricsEntry* get_command_metrics(const Node& node, const std::string& command);
+    // Same as above, but looked up in the cache of the node first
+    struct CommandMetricsEntry* get_command_metrics(CRedisNode* redis_node, const std::string& command);
+    void record_latency(CRedisNode* redis_node, const CommandArgs& command_args, int64_t cost_us, HandleResult errcode);
+    void count_metric(uint64_t* counter, uint64_t n=1) const;
+
+    // The statistics of the node shared by its CRedisNode objects, created at the first time
+    struct NodeStatsEntry* get_node_stats_entry(const Node& node, bool master);
+    // Called when the connection of the node closed by an error
+    void count_reconnect(CRedisNode* redis_node);
+    void record_node_error(CRedisNode* redis_node, const struct ErrorInfo& errinfo);
+
+    // Called by: redis_command
+    // Add the costs to the command on the node, and the copies of get_value(s) to the previous command.
+    void account_command(const Node& node, const CommandArgs& command_args, const struct CommandCost& io_cost);
+    // Like redisCommandArgv, counting the syscalls and the allocations of hiredis
+    redisReply* accounted_command(redisContext* redis_context, const CommandArgs& command_args, struct CommandCost* cost);
+
+    // Sample the topology for the metrics,
+    // the unmapped slots are counted only if the slots may have changed.
+    void update_topology_metrics(bool slots_changed);
+
+private:
+    // Only the thread using the client inserts, the lookups of which need no lock,
+    // and the mutex protects the inserts from the snapshots.
+    typedef std::map<std::pair<Node, std::string>, struct CommandMetricsEntry*> CommandMetricsTable;
+    bool _enable_metrics; // Default: true
+    mutable pthread_mutex_t _metrics_mutex; // Also protect the slow log
+    CommandMetricsTable _command_metrics;
+    std::map<Node, struct NodeStatsEntry*> _node_stats; // Same as _command_metrics
+    int64_t _metrics_start_milliseconds;
+    uint64_t _num_retries;
+    uint64_t _num_moved;
+    uint64_t _num_asks;
+    uint64_t _num_reconnects;
+    uint64_t _num_timeouts;
+    uint64_t _num_refreshes;
+    int _num_masters;
+    int _num_replicas;
+    int _num_connected_nodes;
+    int _num_unmapped_slots;
+
+private:
+    bool _enable_accounting; // Default: false
+    struct CommandCost _build_cost; // Of CommandArgs since the last command
+    struct CommandCost _decode_cost; // Of get_value(s) since the last command
+    struct CommandMetricsEntry* _last_cost_entry; // Of the last command
+
+private:
+    bool _enable_slowlog; // Default: false
+    int64_t _slowlog_threshold_us;
+    int _slowlog_sample_interval;
+    int _slowlog_max_key_length;
+    uint64_t _num_slowlog_commands; // Commands seen by the slow log, for sampling
+    uint64_t _num_slowlog_entries;  // Entries added, the id of the next one
+    int _slowlog_max_entries;
+    std::deque<struct SlowLogEntry> _slowlog; // The newest first, protected by _metrics_mutex
+    std::vector<int64_t> _attempts_cost_us; // Of the current command
 
 private:
 #if __cplusplus < 201103L
@@ -1320,12 +1945,770 @@ private:
     std::string _hmincrby_shastr1;
 };
 
+// The helper for setting the deadline of a scope and restoring the previous one automatically,
+// a nested deadline never extends the outer one.
+//
+// EXAMPLE:
+// {
+//     r3c::DeadlineHelper deadline_helper(&redis, r3c::get_monotonic_milliseconds()+50);
+//     redis.mget(keys, &values); // All requests of mget share the budget of 50ms
+// }
+class DeadlineHelper
+{
+public:
+    DeadlineHelper(CRedisClient* redis_client, int64_t deadline_milliseconds);
+    ~DeadlineHelper();
+
+private:
+    CRedisClient* _redis_client;
+    int64_t _old_deadline_milliseconds;
+};
+
+// A batch of commands executed by CRedisClient::pipeline,
+// the replies are kept until the pipeline is cleared or destroyed.
+//
+// EXAMPLE:
+// r3c::Pipeline pipeline;
+// for (...)
+// {
+//     r3c::CommandArgs cmd_args;
+//     cmd_args.set_key(key);
+//     cmd_args.set_command("SET");
+//     cmd_args.add_arg(cmd_args.get_command());
+//     cmd_args.add_arg(key);
+//     cmd_args.add_arg(value);
+//     cmd_args.final();
+//     pipeline.add(cmd_args);
+// }
+// redis.pipeline(&pipeline);
+// for (int i=0; i<pipeline.size(); ++i)
+// {
+//     if (NULL == pipeline.get_reply(i))
+//         fprintf(stderr, "%s\n", pipeline.get_errinfo(i).errmsg.c_str());
+// }
+class Pipeline
+{
+    friend class CRedisClient;
+
+public:
+    Pipeline();
+    ~Pipeline();
+
+    // The key of command_args locates the node in cluster mode
+    void add(const CommandArgs& command_args);
+
+    // Add a command formatted in RESP already
+    void add(const std::string& key, const std::string& command, const std::string& formatted_command);
+    int size() const;
+    void clear();
+
+    // NULL if the command failed (see get_errinfo),
+    // else the reply, which maybe an error reply like WRONGTYPE.
+    const redisReply* get_reply(int index) const;
+    const ErrorInfo& get_errinfo(int index) const;
+    const Node& get_node(int index) const; // The node executed the command
+
+    // Take over the reply, which should be freed by freeReplyObject
+    redisReply* release_reply(int index);
+
+private:
+    Pipeline(const Pipeline&);
+    Pipeline& operator =(const Pipeline&);
+
+private:
+    struct PipelineCommand
+    {
+        std::string key;
+        std::string command;
+        std::string formatted_command; // RESP
+        redisReply* reply;
+        ErrorInfo errinfo;
+        Node node;
+        Node ask_node;
+        bool asking; // Send ASKING to ask_node before the command
+        int attempts; // Number of sends whose result is unknown
+    };
+    std::vector<PipelineCommand> _commands;
+};
+
+// Iterate the keyspace of all masters in cluster mode (or the replicas chosen by the read policy),
+// standalone is treated as a cluster with only one master.
+//
+// Each master (shard) has its own SCAN cursor, and SCAN is always sent to the master.
+// A cursor only means something on the instance issued it, so the ID of the master is recorded with the cursor:
+// when the master serving the shard changes (failover, or a redirect during the call), the shard restarts from cursor 0
+// on the new master, and when the slot used for routing migrates, another slot of the same master is used.
+// Like SCAN, a key may be returned more than once, and keys in the slots migrated during the scan may be missed.
+//
+// EXAMPLE:
+// r3c::ClusterScanner scanner(&redis, "user:*", 100);
+// std::vector<std::string> keys;
+// while (!scanner.done())
+// {
+//     scanner.next(&keys);
+//     ...
+// }
+class ClusterScanner
+{
+public:
+    // pattern - MATCH pattern, empty to match all
+    // count - COUNT hint, 0 to use the default of redis
+    // type - TYPE filter (requires redis 6.0+), empty to return all types
+    ClusterScanner(CRedisClient* redis_client, const std::string& pattern=std::string(""), int count=0, const std::string& type=std::string(""));
+
+    // Scan the next batch of the current master,
+    // returns the number of keys, which maybe 0 even if not done.
+    int next(std::vector<std::string>* keys, Node* which=NULL, int num_retries=NUM_RETRIES);
+
+    // Returns true if all masters are scanned completely
+    bool done();
+
+    // The composite cursor for resuming a scan by set_cursor, even by another process,
+    // in the format of "slot:cursor:nodeid,slot:cursor:nodeid,..." of the masters not done, empty if all done.
+    // The nodeid is optional for set_cursor, the cursor is trusted if it is missing.
+    std::string get_cursor();
+    bool set_cursor(const std::string& cursor);
+
+    // Scan from the beginning
+    void reset();
+
+private:
+    void init_shards();
+
+    // Route the shard to the master it is scanning, or restart it if the master has changed
+    void follow_shard();
+
+private:
+    struct Shard
+    {
+        int slot;       // A slot of the master, for routing
+        int64_t cursor; // Done if -1
+        NodeId nodeid;  // The master issued the cursor, empty if unknown
+    };
+    CRedisClient* _redis_client;
+    std::string _pattern;
+    int _count;
+    std::string _type;
+    bool _initialized;
+    std::vector<struct Shard> _shards; // Ordered by slot
+    size_t _index; // Index of the shard being scanned
+};
+
+// Handle the keys scanned by ParallelScanner
+class ScanHandler
+{
+public:
+    virtual ~ScanHandler() {}
+
+    // Called in the thread calling ParallelScanner::run, never concurrently,
+    // returns false to stop scanning, an exception thrown stops scanning and is rethrown by run.
+    virtual bool handle(const Node& node, const std::vector<std::string>& keys) = 0;
+};
+
+// Scan all masters concurrently, one thread and one dedicated connection per master.
+// The keys are delivered to ScanHandler through a bounded queue, so memory stays flat however large the keyspace is.
+// Unlike ClusterScanner, a master unreachable during the scan stops the whole scan with CRedisException.
+//
+// EXAMPLE:
+// r3c::ParallelScanner scanner(&redis, "session:*", 1000);
+// scanner.set_rate_limit(100); // No more than 100 SCAN per second per master
+// scanner.run(&handler);
+class ParallelScanner
+{
+public:
+    // pattern - MATCH pattern, empty to match all
+    // count - COUNT hint, 0 to use the default of redis
+    // type - TYPE filter (requires redis 6.0+), empty to return all types
+    ParallelScanner(CRedisClient* redis_client, const std::string& pattern=std::string(""), int count=0, const std::string& type=std::string(""));
+    ~ParallelScanner();
+
+    // Max number of batches queued (default: 16), the scan threads wait when full
+    void set_queue_size(int queue_size);
+
+    // Max number of SCAN per second per master, 0 (the default) means unlimited
+    void set_rate_limit(int scans_per_second);
+
+    // Returns the number of keys handled.
+    // CRedisException is thrown after all threads stopped if scanning any master failed.
+    int64_t run(ScanHandler* handler, int num_retries=NUM_RETRIES);
+
+private:
+    struct ScanBatch
+    {
+        Node node;
+        std::vector<std::string> keys;
+    };
+    struct ScanWorker
+    {
+        ParallelScanner* scanner;
+        Node node;
+        pthread_t thread;
+    };
+    static void* scan_thread(void* param);
+    void scan_node(const Node& node);
+    bool push_batch(ScanBatch* batch);
+    void stop_workers(const std::vector<ScanWorker>& workers); // Stop and join all workers
+
+private:
+    CRedisClient* _redis_client;
+    std::string _pattern;
+    int _count;
+    std::string _type;
+    int _queue_size;
+    int _scans_per_second;
+    int _num_retries;
+
+private:
+    pthread_mutex_t _mutex;
+    pthread_cond_t _not_empty;
+    pthread_cond_t _not_full;
+    std::deque<ScanBatch*> _queue;
+    int _num_active_workers;
+    bool _stop;
+    CRedisException* _exception; // The first error
+};
+
+// Export the keys matching a pattern of all masters to a file, to be imported by KeyspaceImporter.
+// The masters are scanned in parallel by ParallelScanner, the keys of each batch are dumped by DUMP and PTTL
+// in pipelining (see CRedisClient::pipeline) and written to the file, so memory stays flat however large the keyspace is.
+//
+// The file is "R3CDUMP2" followed by the records of:
+// key length (4 bytes) | key | payload length (4 bytes) | payload of DUMP | expire time (8 bytes, -1 if no TTL),
+// the expire time is the milliseconds since the Epoch when PTTL was replied, so the TTL does not drift however late
+// the file is imported, as long as the clocks of the exporting and the importing hosts agree.
+// The integers are in network byte order.
+// The files of "R3CDUMP1" (with the TTL in milliseconds instead of the expire time) can still be imported.
+//
+// EXAMPLE:
+// r3c::KeyspaceExporter exporter(&src_redis, "user:*");
+// exporter.run("/tmp/user.r3cdump");
+// r3c::KeyspaceImporter importer(&dst_redis);
+// importer.run("/tmp/user.r3cdump");
+class KeyspaceExporter: public ScanHandler
+{
+public:
+    // pattern - MATCH pattern, empty to match all
+    // count - COUNT hint of SCAN, 0 to use the default of redis
+    KeyspaceExporter(CRedisClient* redis_client, const std::string& pattern=std::string(""), int count=1000);
+    ~KeyspaceExporter();
+
+    // Max number of commands in flight per connection (default: 100)
+    void set_window_size(int window_size);
+
+    // Max number of SCAN per second per master, 0 (the default) means unlimited
+    void set_rate_limit(int scans_per_second);
+
+    // Returns the number of keys exported, the keys deleted or expired before dumped are skipped.
+    // CRedisException is thrown if failed, and the file is left incomplete.
+    int64_t run(const std::string& filepath, int num_retries=NUM_RETRIES);
+    int64_t get_num_skipped() const;
+    int64_t get_num_bytes() const; // Bytes written to the file
+
+private:
+    virtual bool handle(const Node& node, const std::vector<std::string>& keys);
+
+private:
+    CRedisClient* _redis_client;
+    std::string _pattern;
+    int _count;
+    int _window_size;
+    int _scans_per_second;
+    int _num_retries;
+    std::string _filepath;
+    FILE* _fp;
+    int64_t _num_keys;
+    int64_t _num_skipped;
+    int64_t _num_bytes;
+    ErrorInfo _errinfo; // The error stopped the export
+};
+
+// Import the keys exported by KeyspaceExporter with RESTORE in pipelining,
+// the commands are routed by the slot of key (see CRedisClient::pipeline).
+class KeyspaceImporter
+{
+public:
+    // replace - Replace the existing keys, else restoring them fails with BUSYKEY
+    KeyspaceImporter(CRedisClient* redis_client, bool replace=false);
+
+    // Max number of commands in flight per connection (default: 100)
+    void set_window_size(int window_size);
+
+    // Number of keys restored per pipeline (default: 1000)
+    void set_batch_size(int batch_size);
+
+    // Returns the number of keys imported,
+    // the keys failed to restore are logged and counted by get_num_errors,
+    // and the keys expired before imported are skipped and counted by get_num_expired.
+    // Note a RESTORE resent after a connection error fails with BUSYKEY if not replace.
+    //
+    // CRedisException is thrown if the file can not be read or is in a wrong format.
+    int64_t run(const std::string& filepath, int num_retries=NUM_RETRIES);
+    int64_t get_num_errors() const;
+    int64_t get_num_expired() const;
+
+private:
+    int64_t restore(Pipeline* pipeline, int num_retries);
+
+private:
+    CRedisClient* _redis_client;
+    bool _replace;
+    int _window_size;
+    int _batch_size;
+    int64_t _num_errors;
+    int64_t _num_expired;
+};
+
+// Accumulate the deltas of INCRBY and HINCRBY in process and flush them in pipelining,
+// so a hot counter costs one command per flush instead of one per increment.
+// The deltas are kept in a table sharded by key, and incrby and hincrby are thread-safe.
+//
+// The deltas are flushed by a thread started by start, every flush interval,
+// or as soon as a shard holds more than max_pending/num_shards keys and fields.
+// So at most one flush interval (or max_pending keys and fields) of deltas are lost if the process crashes,
+// call flush to write them through at a known point.
+//
+// The deltas of a command failed without reply (like a connection error) are merged back and flushed next time,
+// which counts them twice if the command was executed actually,
+// and the deltas of a command failed with an error reply (like WRONGTYPE) are dropped.
+//
+// EXAMPLE:
+// r3c::CounterAggregator aggregator(&redis, 100);
+// aggregator.start();
+// aggregator.incrby("pv", 1);          // From any thread
+// aggregator.hincrby("uv", "home", 1); // From any thread
+// aggregator.stop();
+class CounterAggregator
+{
+public:
+    // redis_client - Used only by the aggregator since CRedisClient is not thread-safe
+    // flush_interval_milliseconds - 0 to flush only when the threshold reached or flush called
+    // max_pending - Number of the keys and fields pending to trigger a flush
+    CounterAggregator(CRedisClient* redis_client, int flush_interval_milliseconds=100, int max_pending=10000, int num_shards=16);
+    ~CounterAggregator(); // Call stop
+
+    // Start the flush thread, CRedisException is thrown if failed
+    void start();
+
+    // Stop the flush thread and flush the pending deltas
+    void stop();
+
+    void incrby(const std::string& key, int64_t increment);
+    void hincrby(const std::string& key, const std::string& field, int64_t increment);
+
+    // Write the pending deltas through,
+    // returns the number of commands failed.
+    int flush(int window_size=100);
+
+    // Flush the fields of a key by a command of the format "COMMAND KEY FIELD1 VALUE1 FIELD2 VALUE2 ...",
+    // like the module command ex.hmincrby of tests/redis_command_extension.cpp, instead of HINCRBY per field.
+    void set_hash_command(const std::string& command);
+
+    int get_num_pending() const; // Number of the keys and fields pending
+    uint64_t get_num_increments() const; // Number of the calls of incrby and hincrby
+    uint64_t get_num_commands() const; // Number of the commands flushed
+    uint64_t get_num_errors() const; // Number of the commands failed
+
+private:
+    struct CounterShard
+    {
+        pthread_mutex_t mutex;
+        std::map<std::string, int64_t> counters; // Key -> Delta
+        std::map<std::pair<std::string, std::string>, int64_t> hash_counters; // (Key, Field) -> Delta
+        uint64_t num_increments;
+    };
+    CounterShard* get_shard(const std::string& key) const;
+    void merge(const std::map<std::string, int64_t>& counters, const std::map<std::pair<std::string, std::string>, int64_t>& hash_counters);
+    static void* flush_thread(void* param);
+    void run();
+
+private:
+    CRedisClient* _redis_client;
+    int _flush_interval_milliseconds;
+    int _max_pending_per_shard;
+    std::vector<CounterShard*> _shards;
+    std::string _hash_command;
+    pthread_mutex_t _flush_mutex; // Serialize the flushes, and protect the statistics of flush
+    uint64_t _num_commands;
+    uint64_t _num_errors;
+
+private:
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond; // Wake up the flush thread
+    pthread_t _thread;
+    bool _started;
+    bool _stop;
+    bool _flush_requested;
+};
+
+// The reply of a command submitted to CommandBatcher
+class BatchFuture
+{
+    friend class CommandBatcher;
+
+public:
+    BatchFuture();
+    ~BatchFuture(); // Wait for the command completed if submitted
+
+    // Returns true if the command is completed
+    bool ready() const;
+
+    // Wait for the reply of the command, which is kept until the future is destroyed,
+    // CRedisException is thrown if the command failed, including an error reply,
+    // or the future was never passed to CommandBatcher::submit.
+    const redisReply* get();
+
+private:
+    BatchFuture(const BatchFuture&);
+    BatchFuture& operator =(const BatchFuture&);
+    void set_submitted();
+    void complete(redisReply* redis_reply, const ErrorInfo& errinfo, const Node& node, const std::string& command, const std::string& key);
+    bool wait(); // Returns false if never submitted
+
+private:
+    mutable pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    bool _submitted; // Nothing to wait for if not submitted
+    bool _done;
+    redisReply* _reply;
+    ErrorInfo _errinfo;
+    Node _node;
+    std::string _command;
+    std::string _key;
+};
+
+// Gather the single-key commands submitted concurrently by many threads,
+// and send them in pipelining (see CRedisClient::pipeline) by a dispatcher thread.
+// A batch is sent when max_batch_size commands are gathered,
+// or max_delay_microseconds after the first command of the batch is submitted.
+//
+// Thread-safe, and the blocking commands are not supported.
+// The commands are not resent after a connection error since the result is unknown.
+//
+// EXAMPLE:
+// r3c::CommandBatcher batcher(&redis, 100);
+// batcher.start();
+// batcher.set("k1", "v1"); // From any thread, returns when the batch is done
+class CommandBatcher
+{
+public:
+    // redis_client - Used only by the batcher since CRedisClient is not thread-safe
+    CommandBatcher(CRedisClient* redis_client, int max_delay_microseconds=100, int max_batch_size=128);
+    ~CommandBatcher(); // Call stop
+
+    // Start the dispatcher thread, CRedisException is thrown if failed
+    void start();
+
+    // Stop the dispatcher thread after the commands submitted are done
+    void stop();
+
+    // The key of command_args locates the node in cluster mode,
+    // future should be kept until completed.
+    void submit(const CommandArgs& command_args, BatchFuture* future);
+
+public: // Same as the methods of CRedisClient
+    bool get(const std::string& key, std::string* value);
+    void set(const std::string& key, const std::string& value);
+    int64_t incrby(const std::string& key, int64_t increment);
+    bool del(const std::string& key);
+    bool hget(const std::string& key, const std::string& field, std::string* value);
+    bool hset(const std::string& key, const std::string& field, const std::string& value);
+
+public:
+    uint64_t get_num_batches() const;
+    uint64_t get_num_commands() const;
+
+private:
+    struct BatchCommand
+    {
+        std::string key;
+        std::string command;
+        std::string formatted_command;
+        BatchFuture* future;
+    };
+    static void* dispatch_thread(void* param);
+    void run();
+    void execute(std::vector<BatchCommand>* commands);
+
+private:
+    CRedisClient* _redis_client;
+    int _max_delay_microseconds;
+    int _max_batch_size;
+    uint64_t _num_batches;
+    uint64_t _num_commands;
+
+private:
+    mutable pthread_mutex_t _mutex;
+    pthread_cond_t _not_empty;
+    std::deque<BatchCommand> _queue;
+    int64_t _first_submit_us; // When the first command in the queue submitted, in microseconds of CLOCK_MONOTONIC
+    pthread_t _thread;
+    bool _started;
+    bool _stop;
+};
+
+// Buffer the IDs of the stream entries processed, and acknowledge them in batch:
+// the IDs of the same key and group are acknowledged by one XACK, and the XACKs are sent in pipelining.
+// The IDs not acknowledged yet (including the ones flushing or failed to flush) are observable,
+// an entry not acknowledged stays in the PEL (Pending Entries List), and will be claimed and delivered again,
+// so at-least-once is preserved even if the buffer is lost.
+//
+// The methods are thread-safe.
+class AckBuffer
+{
+public:
+    // redis_client - Used only by the buffer since CRedisClient is not thread-safe
+    // flush_interval_milliseconds - 0 to flush only when the threshold reached or flush called
+    // max_pending - Number of the IDs of a key and group to trigger a flush
+    AckBuffer(CRedisClient* redis_client, int flush_interval_milliseconds=100, int max_pending=100);
+    ~AckBuffer(); // Call stop
+
+    // Start the flush thread, CRedisException is thrown if failed
+    void start();
+
+    // Stop the flush thread and flush the pending IDs
+    void stop();
+
+    void ack(const std::string& key, const std::string& groupname, const std::string& id);
+
+    // Acknowledge the pending IDs, returns the number of XACKs failed.
+    // The IDs of a XACK failed by network are kept to retry by the next flush,
+    // and the ones failed by an error reply (like NOGROUP) are dropped.
+    int flush(int window_size=100);
+
+    int get_num_unacked() const; // Number of the IDs not acknowledged yet
+    // Get the IDs of a key and group not acknowledged yet, returns the number of the IDs
+    int get_unacked(const std::string& key, const std::string& groupname, std::vector<std::string>* ids) const;
+    uint64_t get_num_acked() const; // Number of the IDs acknowledged, by the replies of XACK
+    uint64_t get_num_commands() const; // Number of the XACKs sent
+    uint64_t get_num_errors() const; // Number of the XACKs failed
+
+private:
+    typedef std::map<std::pair<std::string, std::string>, std::vector<std::string> > AckTable; // (Key, Group) -> IDs
+    static void* flush_thread(void* param);
+    void run();
+
+private:
+    CRedisClient* _redis_client;
+    int _flush_interval_milliseconds;
+    int _max_pending;
+    pthread_mutex_t _flush_mutex; // Serialize the flushes
+
+private:
+    mutable pthread_mutex_t _mutex; // Protect the following
+    pthread_cond_t _cond; // Wake up the flush thread
+    AckTable _pending;
+    AckTable _flushing;
+    int _num_pending;
+    int _num_flushing;
+    uint64_t _num_acked;
+    uint64_t _num_commands;
+    uint64_t _num_errors;
+    pthread_t _thread;
+    bool _started;
+    bool _stop;
+    bool _flush_requested;
+};
+
+// Handle the entries delivered by StreamConsumer
+class StreamHandler
+{
+public:
+    virtual ~StreamHandler() {}
+
+    // Called by the worker threads concurrently,
+    // returns true to acknowledge the entry, or false to leave it pending to be claimed and delivered again.
+    virtual bool handle(const std::string& key, const StreamEntry& entry) = 0;
+};
+
+// Consume many streams as a consumer of a group:
+// 1) The keys are grouped by slot, since a multi-key XREADGROUP requires all keys in the same slot in cluster mode,
+//    and each group is read by a thread with a blocking XREADGROUP on its own connection;
+// 2) The entries are dispatched to the worker threads through a bounded queue;
+// 3) The entries handled are acknowledged by AckBuffer;
+// 4) The pending entries idle for too long (like the consumer owned them crashed) are claimed by XPENDING and XCLAIM,
+//    and delivered again.
+//
+// EXAMPLE:
+// r3c::StreamConsumer consumer(&redis, "group", "consumer1", keys);
+// consumer.set_num_workers(8);
+// consumer.start(&handler);
+// ...
+// consumer.stop();
+class StreamConsumer
+{
+public:
+    // redis_client - Provides the nodes and the settings of the connections of the consumer,
+    //                each thread of the consumer has its own CRedisClient.
+    StreamConsumer(CRedisClient* redis_client, const std::string& groupname, const std::string& consumername, const std::vector<std::string>& keys);
+    ~StreamConsumer(); // Call stop
+
+    void set_num_workers(int num_workers); // Default: 4
+    void set_count(int count); // Max number of entries per XREADGROUP, default: 100
+    void set_block_milliseconds(int block_milliseconds); // Block time of XREADGROUP, default: 1000
+    void set_queue_size(int queue_size); // Max number of entries queued for the workers, default: 1000
+
+    // Acknowledge every ack_interval_milliseconds (default: 100),
+    // or as soon as ack_batch_size (default: 100) entries of a key are handled.
+    void set_ack_policy(int ack_batch_size, int ack_interval_milliseconds);
+
+    // Every claim_interval_milliseconds (default: 10000), claim the pending entries
+    // idle for more than min_idle_milliseconds (default: 60000), 0 to disable.
+    void set_claim_policy(int64_t min_idle_milliseconds, int claim_interval_milliseconds);
+
+    // The ID to create the group from if not exists, default: "$"
+    void set_start_id(const std::string& id);
+
+    // Create the group of each key if not exists (with MKSTREAM), and start the threads.
+    // CRedisException is thrown if failed.
+    void start(StreamHandler* handler);
+
+    // Stop reading, and return after the entries queued are handled and acknowledged
+    void stop();
+
+    uint64_t get_num_delivered() const; // Number of entries delivered to the handler
+    uint64_t get_num_acked() const; // Number of entries acknowledged by XACK
+    int get_num_unacked() const; // Number of entries handled but not acknowledged yet
+    uint64_t get_num_claimed() const; // Number of entries claimed
+
+private:
+    struct StreamWork
+    {
+        std::string key;
+        StreamEntry entry;
+    };
+    struct StreamReader
+    {
+        StreamConsumer* consumer;
+        std::vector<std::string> keys; // Keys of the same slot
+        pthread_t thread;
+    };
+    CRedisClient* new_redis_client() const;
+    static void* read_thread(void* param);
+    static void* work_thread(void* param);
+    static void* claim_thread(void* param);
+    void read_streams(const std::vector<std::string>& keys);
+    void work();
+    void claim();
+    bool push_works(const std::vector<StreamWork>& works);
+    void claim(CRedisClient* redis_client);
+    void create_groups(CRedisClient* redis_client, const std::vector<std::string>& keys);
+
+private:
+    CRedisClient* _redis_client;
+    std::string _groupname;
+    std::string _consumername;
+    std::vector<std::string> _keys;
+    int _num_workers;
+    int _count;
+    int _block_milliseconds;
+    int _queue_size;
+    int _ack_batch_size;
+    int _ack_interval_milliseconds;
+    int64_t _min_idle_milliseconds;
+    int _claim_interval_milliseconds;
+    std::string _start_id;
+    StreamHandler* _handler;
+    std::vector<StreamReader*> _readers;
+    std::vector<pthread_t> _workers;
+    pthread_t _claimer;
+    CRedisClient* _ack_client;
+    AckBuffer* _ack_buffer;
+    bool _started;
+
+private:
+    mutable pthread_mutex_t _mutex; // Protect the queue and the statistics
+    pthread_cond_t _not_empty;
+    pthread_cond_t _not_full;
+    pthread_cond_t _stop_cond; // Wake up the claim thread
+    std::deque<StreamWork> _queue;
+    bool _stop_reading;
+    bool _stop_working;
+    uint64_t _num_delivered;
+    uint64_t _num_claimed;
+};
+
+// A tiny HTTP server exposing the metrics of the clients in OpenMetrics text format,
+// any path is answered with the metrics of all the clients merged (see ClientMetrics::merge).
+//
+// The clients are only read by get_metrics, which is thread-safe,
+// so they are still used by their own threads as usual.
+//
+// EXAMPLE:
+// r3c::MetricsServer metrics_server("0.0.0.0", 9121);
+// metrics_server.add_client(&redis);
+// metrics_server.start();
+// $ curl http://127.0.0.1:9121/metrics
+class MetricsServer
+{
+public:
+    // port - 0 to listen on a random port, see get_port
+    MetricsServer(const std::string& ip=std::string("127.0.0.1"), uint16_t port=0, const std::string& name_space=std::string("r3c"));
+    ~MetricsServer(); // Call stop
+
+    // The clients should be removed before destroyed
+    void add_client(const CRedisClient* redis_client);
+    void remove_client(const CRedisClient* redis_client);
+
+    // Listen and start the serving thread, CRedisException is thrown if failed
+    void start();
+    void stop();
+    uint16_t get_port() const { return _port; }
+    uint64_t get_num_requests() const { return _num_requests; }
+
+    // The text served
+    std::string render() const;
+
+private:
+    static void* serve_thread(void* param);
+    void run();
+    void serve(int fd);
+
+private:
+    std::string _ip;
+    uint16_t _port;
+    std::string _name_space;
+    int _listen_fd;
+    pthread_t _thread;
+    bool _started;
+    int _stop; // Set by stop and read by the serving thread with the atomic builtins
+    uint64_t _num_requests;
+
+private:
+    mutable pthread_mutex_t _mutex; // Protect the clients
+    std::vector<const CRedisClient*> _clients;
+};
+
+// An attempt of a command, or a command across all its attempts,
+// passed to CommandMonitor::on_attempt and CommandMonitor::on_command
+struct CommandSpan
+{
+    const CommandArgs* command_args;
+    int slot;            // -1 in standalone mode
+    bool readonly;
+    Node node;           // The node of the attempt, or of the last attempt for the command
+    bool replica;        // True if the node is a replica chosen by the read policy
+    int attempt;         // Index of the attempt from 0, or the number of attempts for the command
+    int num_redirects;   // Number of the MOVED and ASK followed before, or in total for the command
+    int64_t start_us;    // Microseconds since the Epoch
+    int64_t stop_us;
+    int result;          // CRedisClient::HandleResult, HR_SUCCESS or the reason to retry or fail
+    std::string errtype; // Like MOVED if the reply is an error, or empty
+    size_t request_bytes; // Size of the command in the protocol, or in total for the command
+    size_t reply_bytes;   // Size of the reply in the protocol, or in total for the command
+
+    CommandSpan();
+    int64_t cost_us() const { return stop_us - start_us; }
+};
+
 // Monitor the execution of the command by setting a CommandMonitor.
 //
 // Execution order:
 // 1) before_command
-// 2) command
-// 3) after_command
+// 2) command, on_attempt for each attempt
+// 3) after_command, on_command
+//
+// on_attempt and on_command are not called for the pipeline,
+// and the byte counts are measured only if a monitor is set.
 class CommandMonitor
 {
 public:
@@ -1337,6 +2720,89 @@ public:
     // Called after each command is executed
     // result The result of the execution of the command (0 success, 1 error, 2 timeout)
     virtual void after_execute(int result, const Node& node, const std::string& command, const redisReply* reply) = 0;
+
+    // Called after a readonly command is hedged to a second node,
+    // hedge_won is true if the reply of hedge_node wins.
+    virtual void on_hedge(const Node& /*node*/, const Node& /*hedge_node*/, const std::string& /*command*/, bool /*hedge_won*/) {}
+
+    // Called after each attempt of the command, including the ones retried or redirected
+    virtual void on_attempt(const struct CommandSpan& /*span*/) {}
+
+    // Called once the command succeeded or failed, the span covers all the attempts
+    virtual void on_command(const struct CommandSpan& /*span*/) {}
+};
+
+// Inject faults under the transport by setting a FaultInjector,
+// to test and benchmark the retry and refresh logic without killing or pausing the redis processes.
+//
+// The faults are injected into connect_redis_node and each attempt of redis_command
+// (the hedged reads, the blocking commands and the pipeline only get the connect faults),
+// and they go through the same error handling as the real ones.
+class FaultInjector
+{
+public:
+    enum FaultType
+    {
+        FAULT_NONE = 0,
+        FAULT_CONNECT,      // Connect fails like refused
+        FAULT_TIMEOUT,      // The command is not sent, and the attempt fails with EAGAIN
+        FAULT_EOF,          // The command is sent, then the connection is closed by the peer before the reply
+        FAULT_PARTIAL_READ, // The reply is read a few bytes per read
+        FAULT_MOVED,        // Replies MOVED to the node itself, which triggers to refresh the slots
+        FAULT_CLUSTERDOWN,  // Replies CLUSTERDOWN The cluster is down
+        FAULT_MAX
+    };
+
+public:
+    virtual ~FaultInjector() {}
+
+    // Called before connecting the node, returns true to fail the connect
+    virtual bool on_connect(const Node& node) = 0;
+
+    // Called before each attempt of the command, returns the FaultType to inject
+    virtual int on_command(const Node& node, const CommandArgs& command_args) = 0;
+};
+
+// Injects the faults randomly by the probabilities,
+// MOVED and CLUSTERDOWN come in bursts: once injected, the following commands get the same error.
+//
+// Not thread-safe, use one injector per client.
+//
+// EXAMPLE:
+// r3c::RandomFaultInjector fault_injector;
+// fault_injector.set_probability(r3c::FaultInjector::FAULT_EOF, 0.01);
+// fault_injector.set_probability(r3c::FaultInjector::FAULT_CLUSTERDOWN, 0.001, 50);
+// redis.set_fault_injector(&fault_injector);
+class RandomFaultInjector: public FaultInjector
+{
+public:
+    RandomFaultInjector(uint64_t seed=0); // 0 to seed by the current time
+    void set_probability(int fault_type, double probability, int burst_length=1);
+    double get_probability(int fault_type) const;
+
+    // Parse the specification like "connect=0.01,eof=0.01,partial_read=0.1,clusterdown=0.001:50",
+    // where the optional number after the colon is the burst length,
+    // returns false if the specification is invalid.
+    bool set_probabilities(const std::string& spec);
+
+    uint64_t get_num_faults(int fault_type) const; // Number of the faults injected
+    uint64_t get_num_faults() const; // Total
+    static const char* get_fault_name(int fault_type);
+
+public:
+    virtual bool on_connect(const Node& node);
+    virtual int on_command(const Node& node, const CommandArgs& command_args);
+
+private:
+    double random();
+
+private:
+    uint64_t _seed;
+    double _probabilities[FAULT_MAX];
+    int _burst_lengths[FAULT_MAX];
+    uint64_t _num_faults[FAULT_MAX];
+    int _burst_fault; // The FaultType of the current burst
+    int _burst_remaining; // Number of the commands left in the current burst
 };
 
 // Error code
@@ -1359,7 +2825,9 @@ enum
     ERROR_UNEXCEPTED_REPLY_TYPE = -15, // Unexcepted reply type
     ERROR_REPLY_FORMAT = -16,          // Reply format error
     ERROR_REDIS_READONLY = -17,
-    ERROR_NO_ANY_NODE = -18
+    ERROR_NO_ANY_NODE = -18,
+    ERROR_DEADLINE_EXCEEDED = -19,     // The deadline of the command is exceeded
+    ERROR_FILE = -20                   // Read or write file error
 };
 
 // Set NULL to discard log
@@ -1374,6 +2842,8 @@ uint16_t crc16(const char *buf, int len);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 
 void millisleep(int milliseconds);
+int64_t get_current_milliseconds(); // Milliseconds since the Epoch
+int64_t get_monotonic_milliseconds(); // Milliseconds of CLOCK_MONOTONIC, not affected by the changes of the wall clock
 std::string get_formatted_current_datetime(bool with_milliseconds=false);
 std::string format_string(const char* format, ...) __attribute__((format(printf, 1, 2)));
 int split(std::vector<std::string>* tokens, const std::string& source, const std::string& sep, bool skip_sep=false);
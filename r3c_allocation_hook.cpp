@@ -0,0 +1,43 @@
+// The allocation hook of CommandCost (see CRedisClient::enable_accounting),
+// link this file into the program (it is not a part of libr3c.a) to measure the allocations of r3c and hiredis.
+//
+// malloc, calloc and realloc are replaced by the ones counting the allocations and calling the ones of glibc,
+// the global operator new of libstdc++ and hiredis 0.14 both allocate by them, so only glibc is supported.
+// free and the aligned allocations are not replaced, and a realloc is counted as an allocation of the new size.
+#include "r3c.h"
+#include <stdlib.h>
+
+extern "C" {
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) __THROW
+{
+    void* ptr = __libc_malloc(size);
+
+    if (ptr != NULL)
+        r3c::count_allocation(size);
+    return ptr;
+}
+
+void* calloc(size_t nmemb, size_t size) __THROW
+{
+    void* ptr = __libc_calloc(nmemb, size);
+
+    if (ptr != NULL)
+        r3c::count_allocation(nmemb * size);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) __THROW
+{
+    void* new_ptr = __libc_realloc(ptr, size);
+
+    if (new_ptr != NULL)
+        r3c::count_allocation(size);
+    return new_ptr;
+}
+
+} // extern "C"
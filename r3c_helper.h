@@ -96,6 +96,8 @@ inline void hmincrby(
         CRedisClient::get_values(redis_reply.get(), newvalues);
 }
 
+// Add the field-value pairs (one entry per pair) and return the first count entries atomically by a Lua script (see xadd.lua),
+// use CRedisClient::xadd with streams to add entries of many streams in pipelining.
 inline void xadd(
         CRedisClient* redis, const std::string& key,
         int32_t maxlen, int32_t count,
@@ -0,0 +1,740 @@
+// In-process mock of redis cluster, for the tests and benchmarks without a live cluster
+#include "mock_cluster.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace r3c {
+
+static const int CLUSTER_SLOTS = 16384;
+
+static void add_status(std::string* reply, const std::string& status)
+{
+    reply->append("+").append(status).append("\r\n");
+}
+
+static void add_error(std::string* reply, const std::string& error)
+{
+    reply->append("-").append(error).append("\r\n");
+}
+
+static void add_integer(std::string* reply, int64_t n)
+{
+    reply->append(":").append(int2string(n)).append("\r\n");
+}
+
+static void add_bulk(std::string* reply, const std::string& str)
+{
+    reply->append("$").append(int2string(static_cast<uint64_t>(str.size()))).append("\r\n");
+    reply->append(str).append("\r\n");
+}
+
+static void add_nil(std::string* reply)
+{
+    reply->append("$-1\r\n");
+}
+
+static void add_array(std::string* reply, int n)
+{
+    reply->append("*").append(int2string(n)).append("\r\n");
+}
+
+static bool string2int(const std::string& str, int64_t* n)
+{
+    char* end = NULL;
+
+    if (str.empty())
+        return false;
+    errno = 0;
+    *n = static_cast<int64_t>(strtoll(str.c_str(), &end, 10));
+    return 0==errno && '\0'==*end;
+}
+
+static std::string upper(const std::string& str)
+{
+    std::string result = str;
+    for (std::string::size_type i=0; i<result.size(); ++i)
+        result[i] = static_cast<char>(toupper(result[i]));
+    return result;
+}
+
+static bool is_readonly_command(const std::string& command)
+{
+    return "GET"==command || "EXISTS"==command || "TTL"==command ||
+           "HGET"==command || "HGETALL"==command || "HLEN"==command;
+}
+
+MockCluster::MockCluster(int num_masters, int num_replicas)
+    : _num_masters((num_masters > 0)? num_masters: 1),
+      _num_replicas((num_replicas > 0)? num_replicas: 0),
+      _stop(false),
+      _slots(CLUSTER_SLOTS),
+      _asks(CLUSTER_SLOTS, -1)
+{
+    pthread_mutex_init(&_mutex, NULL);
+    for (int slot=0; slot<CLUSTER_SLOTS; ++slot)
+        _slots[slot] = static_cast<int>(static_cast<int64_t>(slot) * _num_masters / CLUSTER_SLOTS);
+    for (int i=0; i<_num_masters*(1+_num_replicas); ++i)
+    {
+        MockNode* node = new MockNode;
+        node->cluster = this;
+        node->index = i;
+        node->master_index = (i < _num_masters)? i: (i - _num_masters) / _num_replicas;
+        node->id = format_string("%040x", i+1);
+        node->listen_fd = -1;
+        node->port = 0;
+        node->num_errors = 0;
+        node->latency_milliseconds = 0;
+        node->blackhole = false;
+        node->kill_requested = false;
+        node->num_commands = 0;
+        _nodes.push_back(node);
+    }
+}
+
+MockCluster::~MockCluster()
+{
+    stop();
+    for (std::vector<MockNode*>::size_type i=0; i<_nodes.size(); ++i)
+        delete _nodes[i];
+    pthread_mutex_destroy(&_mutex);
+}
+
+void MockCluster::start()
+{
+    struct ErrorInfo errinfo;
+
+    _stop = false;
+    for (std::vector<MockNode*>::size_type i=0; i<_nodes.size() && 0==errinfo.errcode; ++i)
+    {
+        MockNode* node = _nodes[i];
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        const int on = 1;
+
+        node->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (-1 == node->listen_fd)
+        {
+            errinfo.errcode = errno;
+            break;
+        }
+        setsockopt(node->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0; // Random port
+        if (-1 == bind(node->listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+            -1 == listen(node->listen_fd, 128) ||
+            -1 == getsockname(node->listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen))
+        {
+            errinfo.errcode = errno;
+            close(node->listen_fd);
+            node->listen_fd = -1;
+            break;
+        }
+        node->port = ntohs(addr.sin_port);
+        errinfo.errcode = pthread_create(&node->thread, NULL, node_thread, node);
+        if (errinfo.errcode != 0)
+        {
+            close(node->listen_fd);
+            node->listen_fd = -1;
+            break;
+        }
+    }
+
+    if (errinfo.errcode != 0)
+    {
+        errinfo.raw_errmsg = format_string("start mock cluster error: %s", strerror(errinfo.errcode));
+        errinfo.errmsg = format_string("[R3C_MOCK][%s:%d] %s", __FILE__, __LINE__, errinfo.raw_errmsg.c_str());
+        stop();
+        throw CRedisException(errinfo, __FILE__, __LINE__);
+    }
+}
+
+void MockCluster::stop()
+{
+    _stop = true;
+    for (std::vector<MockNode*>::size_type i=0; i<_nodes.size(); ++i)
+    {
+        MockNode* node = _nodes[i];
+        if (node->listen_fd != -1)
+        {
+            pthread_join(node->thread, NULL);
+            close(node->listen_fd);
+            node->listen_fd = -1;
+        }
+    }
+}
+
+Node MockCluster::get_node(int node_index) const
+{
+    return Node("127.0.0.1", _nodes[node_index]->port);
+}
+
+std::string MockCluster::get_nodes_string() const
+{
+    std::string nodes_string;
+
+    for (int i=0; i<_num_masters; ++i)
+    {
+        if (i > 0)
+            nodes_string.append(",");
+        nodes_string.append(node2string(_nodes[i]));
+    }
+    return nodes_string;
+}
+
+int MockCluster::get_slot_owner(int slot) const
+{
+    int master_index;
+
+    pthread_mutex_lock(&_mutex);
+    master_index = _slots[slot];
+    pthread_mutex_unlock(&_mutex);
+    return master_index;
+}
+
+void MockCluster::move_slot(int slot, int master_index)
+{
+    pthread_mutex_lock(&_mutex);
+    _slots[slot] = master_index;
+    _asks[slot] = -1;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void MockCluster::set_ask(int slot, int master_index)
+{
+    pthread_mutex_lock(&_mutex);
+    _asks[slot] = master_index;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void MockCluster::inject_error(int node_index, const std::string& error, int count)
+{
+    pthread_mutex_lock(&_mutex);
+    _nodes[node_index]->error = error;
+    _nodes[node_index]->num_errors = count;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void MockCluster::set_latency(int node_index, int milliseconds)
+{
+    pthread_mutex_lock(&_mutex);
+    _nodes[node_index]->latency_milliseconds = milliseconds;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void MockCluster::set_blackhole(int node_index, bool blackhole)
+{
+    pthread_mutex_lock(&_mutex);
+    _nodes[node_index]->blackhole = blackhole;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void MockCluster::kill_connections(int node_index)
+{
+    MockNode* node = _nodes[node_index];
+
+    pthread_mutex_lock(&_mutex);
+    node->kill_requested = true;
+    pthread_mutex_unlock(&_mutex);
+    for (;;)
+    {
+        pthread_mutex_lock(&_mutex);
+        const bool killed = !node->kill_requested;
+        pthread_mutex_unlock(&_mutex);
+        if (killed || node->listen_fd==-1)
+            break;
+        millisleep(1);
+    }
+}
+
+uint64_t MockCluster::get_num_commands(int node_index) const
+{
+    uint64_t num_commands;
+
+    pthread_mutex_lock(&_mutex);
+    num_commands = _nodes[node_index]->num_commands;
+    pthread_mutex_unlock(&_mutex);
+    return num_commands;
+}
+
+void MockCluster::clear_data()
+{
+    pthread_mutex_lock(&_mutex);
+    _strings.clear();
+    _hashes.clear();
+    pthread_mutex_unlock(&_mutex);
+}
+
+void* MockCluster::node_thread(void* param)
+{
+    MockNode* node = static_cast<MockNode*>(param);
+    node->cluster->serve(node);
+    return NULL;
+}
+
+void MockCluster::serve(MockNode* node)
+{
+    std::vector<struct pollfd> fds;
+
+    while (!_stop)
+    {
+        pthread_mutex_lock(&_mutex);
+        const bool kill_requested = node->kill_requested;
+        pthread_mutex_unlock(&_mutex);
+        if (kill_requested)
+        {
+            for (std::vector<MockConnection>::size_type i=0; i<node->connections.size(); ++i)
+                close_connection(&node->connections[i]);
+            node->connections.clear();
+            pthread_mutex_lock(&_mutex);
+            node->kill_requested = false;
+            pthread_mutex_unlock(&_mutex);
+        }
+
+        fds.resize(node->connections.size()+1);
+        fds[0].fd = node->listen_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (std::vector<MockConnection>::size_type i=0; i<node->connections.size(); ++i)
+        {
+            fds[i+1].fd = node->connections[i].fd;
+            fds[i+1].events = POLLIN;
+            fds[i+1].revents = 0;
+        }
+        // 超时以便及时响应停止和断连接
+        if (poll(&fds[0], fds.size(), 10) <= 0)
+            continue;
+
+        for (std::vector<MockConnection>::size_type i=node->connections.size(); i>0; --i)
+        {
+            if (fds[i].revents != 0 && !handle_input(node, &node->connections[i-1]))
+            {
+                close_connection(&node->connections[i-1]);
+                node->connections.erase(node->connections.begin()+(i-1));
+            }
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            const int fd = accept(node->listen_fd, NULL, NULL);
+            if (fd != -1)
+            {
+                MockConnection connection;
+                connection.fd = fd;
+                connection.reader = redisReaderCreate();
+                connection.asking = false;
+                connection.readonly = false;
+                node->connections.push_back(connection);
+            }
+        }
+    }
+
+    for (std::vector<MockConnection>::size_type i=0; i<node->connections.size(); ++i)
+        close_connection(&node->connections[i]);
+    node->connections.clear();
+}
+
+void MockCluster::close_connection(MockConnection* connection)
+{
+    close(connection->fd);
+    redisReaderFree(connection->reader);
+}
+
+// Returns false if the connection should be closed
+bool MockCluster::handle_input(MockNode* node, MockConnection* connection)
+{
+    char buf[16384];
+    std::string reply;
+    const ssize_t n = read(connection->fd, buf, sizeof(buf));
+
+    if (n <= 0)
+        return false;
+    if (redisReaderFeed(connection->reader, buf, static_cast<size_t>(n)) != REDIS_OK)
+        return false;
+    for (;;)
+    {
+        void* request = NULL;
+        if (redisReaderGetReply(connection->reader, &request) != REDIS_OK)
+            return false;
+        if (NULL == request)
+            break;
+
+        const redisReply* redis_reply = static_cast<redisReply*>(request);
+        std::vector<std::string> args;
+        if (REDIS_REPLY_ARRAY == redis_reply->type)
+        {
+            for (size_t i=0; i<redis_reply->elements; ++i)
+                args.push_back(std::string(redis_reply->element[i]->str, redis_reply->element[i]->len));
+        }
+        freeReplyObject(request);
+        if (args.empty())
+            return false; // Inline commands are not supported
+        execute(node, connection, args, &reply);
+    }
+
+    pthread_mutex_lock(&_mutex);
+    const int latency_milliseconds = node->latency_milliseconds;
+    const bool blackhole = node->blackhole;
+    pthread_mutex_unlock(&_mutex);
+    if (blackhole)
+        return true;
+    if (latency_milliseconds > 0)
+        millisleep(latency_milliseconds);
+    for (std::string::size_type offset=0; offset<reply.size();)
+    {
+        const ssize_t m = write(connection->fd, reply.data()+offset, reply.size()-offset);
+        if (m <= 0)
+            return false;
+        offset += static_cast<std::string::size_type>(m);
+    }
+    return true;
+}
+
+void MockCluster::execute(MockNode* node, MockConnection* connection, const std::vector<std::string>& args, std::string* reply)
+{
+    const std::string command = upper(args[0]);
+    const bool asking = connection->asking;
+
+    pthread_mutex_lock(&_mutex);
+    ++node->num_commands;
+    connection->asking = false; // ASKING only applies to the next command
+    if ("PING" == command)
+    {
+        add_status(reply, "PONG");
+    }
+    else if ("ECHO"==command && 2==args.size())
+    {
+        add_bulk(reply, args[1]);
+    }
+    else if ("AUTH" == command || "READWRITE" == command)
+    {
+        add_status(reply, "OK");
+    }
+    else if ("READONLY" == command)
+    {
+        connection->readonly = true;
+        add_status(reply, "OK");
+    }
+    else if ("ASKING" == command)
+    {
+        connection->asking = true;
+        add_status(reply, "OK");
+    }
+    else if ("CLUSTER" == command)
+    {
+        cluster_command(node, args, reply);
+    }
+    else if (node->num_errors > 0)
+    {
+        --node->num_errors;
+        add_error(reply, node->error);
+    }
+    else if (args.size() < 2)
+    {
+        add_error(reply, format_string("ERR wrong number of arguments for '%s' command", args[0].c_str()));
+    }
+    else if (route(node, connection, args[1], is_readonly_command(command), asking, reply))
+    {
+        execute_data_command(command, args, reply);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+// Returns true if the key is served by the node, or reply MOVED or ASK
+bool MockCluster::route(MockNode* node, MockConnection* connection, const std::string& key, bool readonly, bool asking, std::string* reply) const
+{
+    const int slot = get_key_slot(&key);
+    const int owner = _slots[slot];
+    const int importing = _asks[slot];
+
+    if (node->index == node->master_index)
+    {
+        if (owner == node->index)
+        {
+            if (-1 == importing)
+                return true;
+            // 模拟key已迁移到目标节点
+            add_error(reply, format_string("ASK %d %s", slot, node2string(_nodes[importing]).c_str()));
+            return false;
+        }
+        if (importing==node->index && asking)
+            return true;
+    }
+    else if (owner==node->master_index && readonly && connection->readonly)
+    {
+        return true;
+    }
+
+    add_error(reply, format_string("MOVED %d %s", slot, node2string(_nodes[owner]).c_str()));
+    return false;
+}
+
+void MockCluster::execute_data_command(const std::string& command, const std::vector<std::string>& args, std::string* reply)
+{
+    const std::string& key = args[1];
+    std::map<std::string, std::string>::iterator iter = _strings.find(key);
+    std::map<std::string, std::map<std::string, std::string> >::iterator hash_iter = _hashes.find(key);
+    const bool is_string_command = "GET"==command || "SET"==command || "INCR"==command || "INCRBY"==command;
+    const bool is_hash_command = 'H' == command[0];
+
+    if ((is_string_command && hash_iter!=_hashes.end()) || (is_hash_command && iter!=_strings.end()))
+    {
+        add_error(reply, "WRONGTYPE Operation against a key holding the wrong kind of value");
+    }
+    else if ("GET" == command)
+    {
+        if (iter == _strings.end())
+            add_nil(reply);
+        else
+            add_bulk(reply, iter->second);
+    }
+    else if ("SET"==command && args.size()>=3)
+    {
+        bool nx = false, xx = false;
+        for (std::vector<std::string>::size_type i=3; i<args.size(); ++i)
+        {
+            if (0 == strcasecmp(args[i].c_str(), "NX"))
+                nx = true;
+            else if (0 == strcasecmp(args[i].c_str(), "XX"))
+                xx = true;
+        }
+        // EX and PX are accepted but never expire
+        if ((nx && iter!=_strings.end()) || (xx && iter==_strings.end()))
+        {
+            add_nil(reply);
+        }
+        else
+        {
+            _strings[key] = args[2];
+            add_status(reply, "OK");
+        }
+    }
+    else if ("INCR"==command || ("INCRBY"==command && 3==args.size()))
+    {
+        int64_t value = 0, increment = 1;
+        if ((iter!=_strings.end() && !string2int(iter->second, &value)) ||
+            ("INCRBY"==command && !string2int(args[2], &increment)))
+        {
+            add_error(reply, "ERR value is not an integer or out of range");
+        }
+        else
+        {
+            value += increment;
+            _strings[key] = int2string(value);
+            add_integer(reply, value);
+        }
+    }
+    else if ("DEL"==command || "EXISTS"==command)
+    {
+        int64_t n = 0;
+        for (std::vector<std::string>::size_type i=1; i<args.size(); ++i)
+        {
+            if ("DEL" == command)
+                n += static_cast<int64_t>(_strings.erase(args[i]) + _hashes.erase(args[i]));
+            else
+                n += static_cast<int64_t>(_strings.count(args[i]) + _hashes.count(args[i]));
+        }
+        add_integer(reply, n);
+    }
+    else if ("EXPIRE" == command)
+    {
+        add_integer(reply, (iter!=_strings.end() || hash_iter!=_hashes.end())? 1: 0);
+    }
+    else if ("TTL" == command)
+    {
+        add_integer(reply, (iter!=_strings.end() || hash_iter!=_hashes.end())? -1: -2);
+    }
+    else if ("HSET"==command && args.size()>=4 && 0==args.size()%2)
+    {
+        std::map<std::string, std::string>& hash = _hashes[key];
+        int64_t n = 0;
+        for (std::vector<std::string>::size_type i=2; i+1<args.size(); i+=2)
+        {
+            n += hash.count(args[i])? 0: 1;
+            hash[args[i]] = args[i+1];
+        }
+        add_integer(reply, n);
+    }
+    else if ("HGET"==command && 3==args.size())
+    {
+        std::map<std::string, std::string>::const_iterator field_iter;
+        if (hash_iter==_hashes.end() || (field_iter=hash_iter->second.find(args[2]))==hash_iter->second.end())
+            add_nil(reply);
+        else
+            add_bulk(reply, field_iter->second);
+    }
+    else if ("HDEL"==command && args.size()>=3)
+    {
+        int64_t n = 0;
+        if (hash_iter != _hashes.end())
+        {
+            for (std::vector<std::string>::size_type i=2; i<args.size(); ++i)
+                n += static_cast<int64_t>(hash_iter->second.erase(args[i]));
+            if (hash_iter->second.empty())
+                _hashes.erase(hash_iter);
+        }
+        add_integer(reply, n);
+    }
+    else if ("HGETALL" == command)
+    {
+        if (hash_iter == _hashes.end())
+        {
+            add_array(reply, 0);
+        }
+        else
+        {
+            add_array(reply, static_cast<int>(hash_iter->second.size()*2));
+            for (std::map<std::string, std::string>::const_iterator field_iter=hash_iter->second.begin(); field_iter!=hash_iter->second.end(); ++field_iter)
+            {
+                add_bulk(reply, field_iter->first);
+                add_bulk(reply, field_iter->second);
+            }
+        }
+    }
+    else if ("HINCRBY"==command && 4==args.size())
+    {
+        int64_t value = 0, increment = 0;
+        std::map<std::string, std::string>& hash = _hashes[key];
+        std::map<std::string, std::string>::iterator field_iter = hash.find(args[2]);
+        if ((field_iter!=hash.end() && !string2int(field_iter->second, &value)) || !string2int(args[3], &increment))
+        {
+            if (hash.empty())
+                _hashes.erase(key);
+            add_error(reply, "ERR hash value is not an integer");
+        }
+        else
+        {
+            value += increment;
+            hash[args[2]] = int2string(value);
+            add_integer(reply, value);
+        }
+    }
+    else if ("HLEN" == command)
+    {
+        add_integer(reply, (hash_iter == _hashes.end())? 0: static_cast<int64_t>(hash_iter->second.size()));
+    }
+    else
+    {
+        add_error(reply, format_string("ERR unknown command '%s'", args[0].c_str()));
+    }
+}
+
+void MockCluster::cluster_command(MockNode* node, const std::vector<std::string>& args, std::string* reply) const
+{
+    const std::string subcommand = (args.size() > 1)? upper(args[1]): std::string("");
+
+    if ("NODES" == subcommand)
+    {
+        add_bulk(reply, cluster_nodes(node));
+    }
+    else if ("SLOTS" == subcommand)
+    {
+        cluster_slots(reply);
+    }
+    else if ("INFO" == subcommand)
+    {
+        add_bulk(reply, format_string(
+                "cluster_state:ok\r\ncluster_slots_assigned:%d\r\ncluster_slots_ok:%d\r\ncluster_known_nodes:%d\r\ncluster_size:%d\r\n",
+                CLUSTER_SLOTS, CLUSTER_SLOTS, static_cast<int>(_nodes.size()), _num_masters));
+    }
+    else if ("KEYSLOT"==subcommand && 3==args.size())
+    {
+        add_integer(reply, get_key_slot(&args[2]));
+    }
+    else
+    {
+        add_error(reply, "ERR Unknown subcommand or wrong number of arguments");
+    }
+}
+
+// 56686c7baad565d4370b8f1f6518a67b6cedb210 127.0.0.1:6381@16381 slave 150f77d1000003811fb3c38c3768526a0b25ec31 0 1464662426768 22 connected
+// 150f77d1000003811fb3c38c3768526a0b25ec31 127.0.0.1:6379@16379 myself,master - 0 0 22 connected 0-5460 [5461->-6a7709bc680f7b224d0d20bdf7dd14db1f013baf]
+std::string MockCluster::cluster_nodes(MockNode* node) const
+{
+    std::string nodes;
+
+    for (std::vector<MockNode*>::size_type i=0; i<_nodes.size(); ++i)
+    {
+        const MockNode* n = _nodes[i];
+        const bool is_master = (n->index == n->master_index);
+
+        nodes.append(format_string("%s %s@%d %s%s %s 0 0 %d connected",
+                n->id.c_str(), node2string(n).c_str(), n->port+10000,
+                (n==node)? "myself,": "", is_master? "master": "slave",
+                is_master? "-": _nodes[n->master_index]->id.c_str(), n->master_index+1));
+        if (is_master)
+        {
+            for (int slot=0; slot<CLUSTER_SLOTS; ++slot)
+            {
+                if (_slots[slot] != n->index)
+                    continue;
+
+                int last = slot;
+                while (last+1<CLUSTER_SLOTS && _slots[last+1]==n->index)
+                    ++last;
+                if (last == slot)
+                    nodes.append(format_string(" %d", slot));
+                else
+                    nodes.append(format_string(" %d-%d", slot, last));
+                for (int s=slot; s<=last; ++s)
+                {
+                    if (_asks[s] != -1)
+                        nodes.append(format_string(" [%d->-%s]", s, _nodes[_asks[s]]->id.c_str()));
+                }
+                slot = last;
+            }
+        }
+        nodes.append("\n");
+    }
+    return nodes;
+}
+
+// 1) 1) (integer) 0
+//    2) (integer) 5460
+//    3) 1) "127.0.0.1"
+//       2) (integer) 6379
+//       3) "150f77d1000003811fb3c38c3768526a0b25ec31"
+//    4) 1) "127.0.0.1" (replica)
+void MockCluster::cluster_slots(std::string* reply) const
+{
+    std::string ranges;
+    int num_ranges = 0;
+
+    for (int slot=0; slot<CLUSTER_SLOTS; ++slot)
+    {
+        const int owner = _slots[slot];
+        int last = slot;
+
+        while (last+1<CLUSTER_SLOTS && _slots[last+1]==owner)
+            ++last;
+        add_array(&ranges, 3+_num_replicas);
+        add_integer(&ranges, slot);
+        add_integer(&ranges, last);
+        for (int i=-1; i<_num_replicas; ++i)
+        {
+            const MockNode* n = (-1 == i)? _nodes[owner]: _nodes[_num_masters+owner*_num_replicas+i];
+            add_array(&ranges, 3);
+            add_bulk(&ranges, "127.0.0.1");
+            add_integer(&ranges, n->port);
+            add_bulk(&ranges, n->id);
+        }
+        ++num_ranges;
+        slot = last;
+    }
+    add_array(reply, num_ranges);
+    reply->append(ranges);
+}
+
+std::string MockCluster::node2string(const MockNode* node) const
+{
+    return format_string("127.0.0.1:%d", node->port);
+}
+
+} // namespace r3c {
@@ -0,0 +1,130 @@
+// In-process mock of redis cluster, for the tests and benchmarks without a live cluster
+#ifndef MOCK_CLUSTER_H
+#define MOCK_CLUSTER_H
+#include "r3c.h"
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace r3c {
+
+// Stand up N masters (and M replicas per master) on loopback,
+// each node is served by a thread in the process.
+//
+// Answers CLUSTER NODES/SLOTS/INFO, and a subset of commands:
+// PING, ECHO, AUTH, READONLY, READWRITE, ASKING,
+// GET, SET, DEL, EXISTS, INCR, INCRBY, EXPIRE, TTL, HSET, HGET, HDEL, HGETALL, HINCRBY, HLEN.
+//
+// The data is shared by all nodes, so the values are kept when a slot moves,
+// but a key is only served by the node owned its slot (or its replicas after READONLY),
+// other nodes reply MOVED as a real cluster.
+//
+// EXAMPLE:
+// r3c::MockCluster cluster(3, 1);
+// cluster.start();
+// r3c::CRedisClient redis(cluster.get_nodes_string());
+// cluster.move_slot(r3c::get_key_slot(&key), 1); // The next command of the key gets MOVED
+class MockCluster
+{
+public:
+    // The nodes [0, num_masters) are masters,
+    // and the replicas of master i are [num_masters+i*num_replicas, num_masters+(i+1)*num_replicas).
+    MockCluster(int num_masters=3, int num_replicas=0);
+    ~MockCluster(); // Call stop
+
+    // Listen on random ports of 127.0.0.1 and start the threads,
+    // CRedisException is thrown if failed.
+    void start();
+    void stop();
+
+    int num_masters() const { return _num_masters; }
+    int num_nodes() const { return static_cast<int>(_nodes.size()); }
+    Node get_node(int node_index) const;
+    std::string get_nodes_string() const; // Masters only, like "127.0.0.1:6379,127.0.0.1:6380"
+    int get_slot_owner(int slot) const; // Index of the master owns the slot
+
+public: // Scripted faults, take effect on the next command
+    // Make the slot owned by the master, the previous owner replies MOVED
+    void move_slot(int slot, int master_index);
+
+    // The owner of the slot replies ASK to the master, which serves the slot after ASKING,
+    // master_index -1 to end the migration.
+    void set_ask(int slot, int master_index);
+
+    // The next count data commands on the node reply the error, like:
+    // "CLUSTERDOWN The cluster is down" or "TRYAGAIN Multiple keys request during rehashing of slot"
+    void inject_error(int node_index, const std::string& error, int count=1);
+
+    // Delay the replies of the node
+    void set_latency(int node_index, int milliseconds);
+
+    // Read the commands but never reply, the clients time out
+    void set_blackhole(int node_index, bool blackhole);
+
+    // Close all connections of the node, returns after closed
+    void kill_connections(int node_index);
+
+    // Number of the commands received by the node, including the ones failed
+    uint64_t get_num_commands(int node_index) const;
+
+    void clear_data();
+
+private:
+    struct MockConnection
+    {
+        int fd;
+        redisReader* reader;
+        bool asking;
+        bool readonly;
+    };
+    struct MockNode
+    {
+        MockCluster* cluster;
+        int index;
+        int master_index; // Self for a master
+        std::string id;
+        int listen_fd;
+        uint16_t port;
+        pthread_t thread;
+        std::vector<MockConnection> connections;
+
+        // Protected by MockCluster::_mutex
+        std::string error;
+        int num_errors;
+        int latency_milliseconds;
+        bool blackhole;
+        bool kill_requested;
+        uint64_t num_commands;
+    };
+    static void* node_thread(void* param);
+    void serve(MockNode* node);
+    void close_connection(MockConnection* connection);
+    bool handle_input(MockNode* node, MockConnection* connection);
+    void execute(MockNode* node, MockConnection* connection, const std::vector<std::string>& args, std::string* reply);
+    bool route(MockNode* node, MockConnection* connection, const std::string& key, bool readonly, bool asking, std::string* reply) const;
+    void execute_data_command(const std::string& command, const std::vector<std::string>& args, std::string* reply);
+    void cluster_command(MockNode* node, const std::vector<std::string>& args, std::string* reply) const;
+    std::string cluster_nodes(MockNode* node) const;
+    void cluster_slots(std::string* reply) const;
+    std::string node2string(const MockNode* node) const;
+
+private:
+    MockCluster(const MockCluster&);
+    MockCluster& operator =(const MockCluster&);
+    int _num_masters;
+    int _num_replicas;
+    std::vector<MockNode*> _nodes;
+    volatile bool _stop;
+
+private:
+    mutable pthread_mutex_t _mutex; // Protect the following and the faults of the nodes
+    std::vector<int> _slots; // Slot -> Index of the master
+    std::vector<int> _asks; // Slot -> Index of the master importing, -1 if not migrating
+    std::map<std::string, std::string> _strings;
+    std::map<std::string, std::map<std::string, std::string> > _hashes;
+};
+
+} // namespace r3c {
+#endif // MOCK_CLUSTER_H
@@ -0,0 +1,564 @@
+// Throughput and latency benchmark, against a live cluster or the in-process mock cluster
+//
+// Usage: r3c_bench [options]
+// Example: r3c_bench -n 192.168.1.61:6379,192.168.1.62:6379 -w get -d zipf -t 8 -c 2 -T 30 -o json
+//          r3c_bench -m 3 -w pipeline -b 100
+//          r3c_bench -m 3 -w get -F eof=0.01,partial_read=0.1,clusterdown=0.0005:20 # Availability under faults
+#include "mock_cluster.h"
+#include "r3c.h"
+#include "utils.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+
+struct BenchConfig
+{
+    std::string nodes;
+    std::string password;
+    int num_mock_masters; // > 0 to benchmark against MockCluster
+    std::string workload;
+    std::string distribution;
+    double zipf_theta;
+    int num_keys;
+    int value_size;
+    int num_threads;
+    int num_clients; // Number of clients per thread
+    int seconds;
+    int64_t num_requests; // Per thread, 0 to run for seconds
+    int batch_size; // Keys per mget/mset, commands per pipeline, entries per xreadgroup
+    std::string output; // text or json
+    std::string faults; // Specification of RandomFaultInjector, empty not to inject
+
+    BenchConfig()
+        : num_mock_masters(0), workload("get"), distribution("uniform"), zipf_theta(0.99),
+          num_keys(10000), value_size(32), num_threads(4), num_clients(1),
+          seconds(10), num_requests(0), batch_size(10), output("text")
+    {
+    }
+};
+
+struct BenchThread
+{
+    const BenchConfig* config;
+    const std::vector<double>* zipf_cdf;
+    int index;
+    pthread_t thread;
+    uint64_t seed;
+    int64_t num_ops;
+    int64_t num_commands;
+    int64_t num_errors;
+    std::vector<int32_t> latencies; // Microseconds of each op
+    std::string errmsg; // The last error
+    uint64_t num_faults; // Injected
+    r3c::ClientMetrics metrics; // Merged of the clients
+};
+
+static const char* KEY_PREFIX = "r3c_bench_";
+static const char* GROUP_NAME = "r3c_bench";
+static const char* LUA_SCRIPT = "return redis.call('GET', KEYS[1])";
+
+static int64_t get_current_microseconds();
+static void usage(const char* program);
+static void null_log_write(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static bool parse_args(int argc, char* argv[], BenchConfig* config);
+static void init_zipf(int num_keys, double theta, std::vector<double>* cdf);
+static void prepare(const BenchConfig& config);
+static void* bench_thread(void* param);
+static void report(const BenchConfig& config, const std::vector<BenchThread*>& threads, int64_t elapsed_us);
+
+int main(int argc, char* argv[])
+{
+    BenchConfig config;
+    std::vector<double> zipf_cdf;
+    std::vector<BenchThread*> threads;
+    r3c::MockCluster* mock_cluster = NULL;
+
+    if (!parse_args(argc, argv, &config))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    r3c::set_debug_log_write(null_log_write);
+    r3c::set_info_log_write(null_log_write);
+
+    try
+    {
+        if (config.num_mock_masters > 0)
+        {
+            mock_cluster = new r3c::MockCluster(config.num_mock_masters);
+            mock_cluster->start();
+            config.nodes = mock_cluster->get_nodes_string();
+        }
+        if ("zipf" == config.distribution)
+            init_zipf(config.num_keys, config.zipf_theta, &zipf_cdf);
+        prepare(config);
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        fprintf(stderr, "%s\n", ex.str().c_str());
+        delete mock_cluster;
+        exit(1);
+    }
+
+    const int64_t start_us = get_current_microseconds();
+    for (int i=0; i<config.num_threads; ++i)
+    {
+        BenchThread* thread = new BenchThread;
+        thread->config = &config;
+        thread->zipf_cdf = &zipf_cdf;
+        thread->index = i;
+        thread->seed = static_cast<uint64_t>(start_us) + static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ULL;
+        thread->num_ops = 0;
+        thread->num_commands = 0;
+        thread->num_errors = 0;
+        thread->num_faults = 0;
+        const int errcode = pthread_create(&thread->thread, NULL, bench_thread, thread);
+        if (errcode != 0)
+        {
+            fprintf(stderr, "create thread error: %s\n", strerror(errcode));
+            delete thread;
+            break;
+        }
+        threads.push_back(thread);
+    }
+    for (std::vector<BenchThread*>::size_type i=0; i<threads.size(); ++i)
+        pthread_join(threads[i]->thread, NULL);
+
+    report(config, threads, get_current_microseconds() - start_us);
+    for (std::vector<BenchThread*>::size_type i=0; i<threads.size(); ++i)
+        delete threads[i];
+    delete mock_cluster;
+    return 0;
+}
+
+int64_t get_current_microseconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+void usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  -n nodes          redis nodes, default: $REDIS_CLUSTER_NODES\n");
+    fprintf(stderr, "  -P password       password of redis\n");
+    fprintf(stderr, "  -m masters        benchmark against an in-process mock cluster of the masters instead of -n\n");
+    fprintf(stderr, "  -w workload       get|set|hget|hset|mget|mset|pipeline|eval|xadd|xreadgroup, default: get\n");
+    fprintf(stderr, "  -d distribution   uniform|zipf, default: uniform\n");
+    fprintf(stderr, "  -z theta          theta of zipf, default: 0.99\n");
+    fprintf(stderr, "  -k keys           number of keys, default: 10000\n");
+    fprintf(stderr, "  -v size           size of values in bytes, default: 32\n");
+    fprintf(stderr, "  -t threads        number of threads, default: 4\n");
+    fprintf(stderr, "  -c clients        number of clients per thread, default: 1\n");
+    fprintf(stderr, "  -T seconds        duration, default: 10\n");
+    fprintf(stderr, "  -r requests       number of requests per thread, instead of -T\n");
+    fprintf(stderr, "  -b batch          keys per mget/mset, commands per pipeline, entries per xreadgroup, default: 10\n");
+    fprintf(stderr, "  -o output         text|json, default: text\n");
+    fprintf(stderr, "  -F faults         inject faults by probabilities, like: connect=0.01,timeout=0.001,eof=0.01,partial_read=0.1,moved=0.001:20,clusterdown=0.0005:50\n");
+    fprintf(stderr, "                    the number after the colon is the burst length, the pipeline workload only gets the connect faults\n");
+    fprintf(stderr, "Example: %s -n 192.168.1.61:6379,192.168.1.62:6379 -w get -d zipf -t 8 -c 2 -T 30 -o json\n", program);
+    fprintf(stderr, "Example: %s -m 3 -w pipeline -b 100\n", program);
+    fprintf(stderr, "Example: %s -m 3 -w get -F eof=0.01,partial_read=0.1,clusterdown=0.0005:20\n", program);
+}
+
+void null_log_write(const char* format, ...)
+{
+    (void)format;
+}
+
+bool parse_args(int argc, char* argv[], BenchConfig* config)
+{
+    const char* nodes_env = getenv("REDIS_CLUSTER_NODES");
+    int opt;
+
+    if (nodes_env != NULL)
+        config->nodes = nodes_env;
+    while ((opt = getopt(argc, argv, "n:P:m:w:d:z:k:v:t:c:T:r:b:o:F:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': config->nodes = optarg; break;
+        case 'P': config->password = optarg; break;
+        case 'm': config->num_mock_masters = atoi(optarg); break;
+        case 'w': config->workload = optarg; break;
+        case 'd': config->distribution = optarg; break;
+        case 'z': config->zipf_theta = atof(optarg); break;
+        case 'k': config->num_keys = atoi(optarg); break;
+        case 'v': config->value_size = atoi(optarg); break;
+        case 't': config->num_threads = atoi(optarg); break;
+        case 'c': config->num_clients = atoi(optarg); break;
+        case 'T': config->seconds = atoi(optarg); break;
+        case 'r': config->num_requests = atoll(optarg); break;
+        case 'b': config->batch_size = atoi(optarg); break;
+        case 'o': config->output = optarg; break;
+        case 'F': config->faults = optarg; break;
+        default: return false;
+        }
+    }
+
+    const std::string& w = config->workload;
+    if (w!="get" && w!="set" && w!="hget" && w!="hset" && w!="mget" && w!="mset" &&
+        w!="pipeline" && w!="eval" && w!="xadd" && w!="xreadgroup")
+        return false;
+    if (config->distribution!="uniform" && config->distribution!="zipf")
+        return false;
+    if (config->output!="text" && config->output!="json")
+        return false;
+    if (config->nodes.empty() && config->num_mock_masters<=0)
+        return false;
+    if (!config->faults.empty())
+    {
+        r3c::RandomFaultInjector fault_injector;
+        if (!fault_injector.set_probabilities(config->faults))
+            return false;
+    }
+    return config->num_keys>0 && config->value_size>=0 && config->num_threads>0 && config->num_clients>0 &&
+           config->batch_size>0 && (config->seconds>0 || config->num_requests>0);
+}
+
+// The probability of the key of rank i is proportional to 1/(i+1)^theta
+void init_zipf(int num_keys, double theta, std::vector<double>* cdf)
+{
+    double sum = 0;
+
+    cdf->resize(num_keys);
+    for (int i=0; i<num_keys; ++i)
+    {
+        sum += 1.0 / pow(static_cast<double>(i+1), theta);
+        (*cdf)[i] = sum;
+    }
+    for (int i=0; i<num_keys; ++i)
+        (*cdf)[i] /= sum;
+}
+
+static uint64_t next_random(uint64_t* seed)
+{
+    // xorshift64*
+    uint64_t x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static int next_key_index(BenchThread* thread)
+{
+    const uint64_t n = next_random(&thread->seed);
+
+    if (thread->zipf_cdf->empty())
+        return static_cast<int>(n % static_cast<uint64_t>(thread->config->num_keys));
+    const double u = static_cast<double>(n >> 11) / static_cast<double>(1ULL << 53);
+    const std::vector<double>::const_iterator iter = std::lower_bound(thread->zipf_cdf->begin(), thread->zipf_cdf->end(), u);
+    return (iter == thread->zipf_cdf->end())? thread->config->num_keys-1: static_cast<int>(iter - thread->zipf_cdf->begin());
+}
+
+static std::string get_key(const BenchConfig& config, int key_index)
+{
+    if ("xadd"==config.workload || "xreadgroup"==config.workload)
+        return r3c::format_string("%sstream_%d", KEY_PREFIX, key_index);
+    if ("hget"==config.workload || "hset"==config.workload)
+        return r3c::format_string("%shash_%d", KEY_PREFIX, key_index);
+    return r3c::format_string("%s%d", KEY_PREFIX, key_index);
+}
+
+// Write the keys read by the workloads
+void prepare(const BenchConfig& config)
+{
+    r3c::CRedisClient redis(config.nodes, config.password);
+    const std::string value(config.value_size, 'x');
+    const bool is_read = "get"==config.workload || "hget"==config.workload || "mget"==config.workload || "eval"==config.workload;
+
+    if (is_read)
+    {
+        r3c::Pipeline pipeline;
+        for (int i=0; i<config.num_keys; ++i)
+        {
+            const std::string key = get_key(config, i);
+            r3c::CommandArgs cmd_args;
+            cmd_args.set_key(key);
+            cmd_args.set_command(("hget" == config.workload)? "HSET": "SET");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            if ("hget" == config.workload)
+                cmd_args.add_arg("field");
+            cmd_args.add_arg(value);
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+        redis.pipeline(&pipeline, 100, 1);
+    }
+    else if ("xreadgroup" == config.workload)
+    {
+        // Entries delivered but not acknowledged are read again by ID 0
+        std::vector<r3c::FVPair> fvpairs(1);
+        std::vector<r3c::StreamEntry> entries;
+        fvpairs[0].field = "field";
+        fvpairs[0].value = value;
+        for (int i=0; i<config.num_keys; ++i)
+        {
+            const std::string key = get_key(config, i);
+            redis.del(key);
+            redis.xgroup_create(key, GROUP_NAME, "$", true);
+            for (int j=0; j<config.batch_size; ++j)
+                redis.xadd(key, "*", fvpairs);
+            redis.xreadgroup(GROUP_NAME, "consumer", key, config.batch_size, -1, false, &entries);
+        }
+    }
+}
+
+static int64_t run_op(BenchThread* thread, r3c::CRedisClient* redis, const std::string& value)
+{
+    const BenchConfig& config = *thread->config;
+    const std::string& workload = config.workload;
+    const std::string key = get_key(config, next_key_index(thread));
+    std::string result;
+
+    if ("get" == workload)
+    {
+        redis->get(key, &result);
+    }
+    else if ("set" == workload)
+    {
+        redis->set(key, value);
+    }
+    else if ("hget" == workload)
+    {
+        redis->hget(key, "field", &result);
+    }
+    else if ("hset" == workload)
+    {
+        redis->hset(key, "field", value);
+    }
+    else if ("mget" == workload || "mset" == workload)
+    {
+        std::vector<std::string> keys(1, key);
+        std::vector<std::string> values;
+        std::map<std::string, std::string> kv_map;
+
+        for (int i=1; i<config.batch_size; ++i)
+            keys.push_back(get_key(config, next_key_index(thread)));
+        if ("mget" == workload)
+        {
+            redis->mget(keys, &values);
+        }
+        else
+        {
+            for (std::vector<std::string>::size_type i=0; i<keys.size(); ++i)
+                kv_map[keys[i]] = value;
+            redis->mset(kv_map);
+        }
+        return config.batch_size;
+    }
+    else if ("pipeline" == workload)
+    {
+        r3c::Pipeline pipeline;
+        for (int i=0; i<config.batch_size; ++i)
+        {
+            const std::string pipeline_key = (0 == i)? key: get_key(config, next_key_index(thread));
+            r3c::CommandArgs cmd_args;
+            cmd_args.set_key(pipeline_key);
+            cmd_args.set_command("SET");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(pipeline_key);
+            cmd_args.add_arg(value);
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+        const int num_succeeded = redis->pipeline(&pipeline, config.batch_size);
+        if (num_succeeded != config.batch_size)
+        {
+            struct r3c::ErrorInfo errinfo;
+            for (int i=0; i<config.batch_size && errinfo.errmsg.empty(); ++i)
+                errinfo = pipeline.get_errinfo(i);
+            throw r3c::CRedisException(errinfo, __FILE__, __LINE__);
+        }
+        return config.batch_size;
+    }
+    else if ("eval" == workload)
+    {
+        const std::vector<std::string> parameters;
+        redis->eval(key, LUA_SCRIPT, parameters);
+    }
+    else if ("xadd" == workload)
+    {
+        std::vector<r3c::FVPair> fvpairs(1);
+        fvpairs[0].field = "field";
+        fvpairs[0].value = value;
+        redis->xadd(key, "*", fvpairs, 1000, '~');
+    }
+    else if ("xreadgroup" == workload)
+    {
+        std::vector<r3c::StreamEntry> entries;
+        redis->xreadgroup(GROUP_NAME, "consumer", key, "0", config.batch_size, -1, false, &entries);
+    }
+    return 1;
+}
+
+void* bench_thread(void* param)
+{
+    BenchThread* thread = static_cast<BenchThread*>(param);
+    const BenchConfig& config = *thread->config;
+    const std::string value(config.value_size, 'x');
+    const int64_t deadline_us = get_current_microseconds() + static_cast<int64_t>(config.seconds) * 1000000;
+    std::vector<r3c::CRedisClient*> clients;
+    std::vector<r3c::RandomFaultInjector*> fault_injectors; // One per client
+
+    try
+    {
+        for (int i=0; i<config.num_clients; ++i)
+        {
+            clients.push_back(new r3c::CRedisClient(config.nodes, config.password));
+            if (!config.faults.empty())
+            {
+                fault_injectors.push_back(new r3c::RandomFaultInjector(next_random(&thread->seed) | 1));
+                fault_injectors.back()->set_probabilities(config.faults);
+                clients.back()->set_fault_injector(fault_injectors.back());
+            }
+        }
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        thread->errmsg = ex.str();
+        ++thread->num_errors;
+        for (std::vector<r3c::CRedisClient*>::size_type i=0; i<clients.size(); ++i)
+            delete clients[i];
+        for (std::vector<r3c::RandomFaultInjector*>::size_type i=0; i<fault_injectors.size(); ++i)
+            delete fault_injectors[i];
+        return NULL;
+    }
+
+    thread->latencies.reserve((config.num_requests > 0)? static_cast<size_t>(config.num_requests): 100000);
+    for (int64_t i=0; ; ++i)
+    {
+        if (config.num_requests > 0)
+        {
+            if (i >= config.num_requests)
+                break;
+        }
+        else if (0==i%64 && get_current_microseconds()>=deadline_us)
+        {
+            break;
+        }
+
+        r3c::CRedisClient* redis = clients[static_cast<size_t>(i) % clients.size()];
+        const int64_t start_us = get_current_microseconds();
+        try
+        {
+            thread->num_commands += run_op(thread, redis, value);
+            ++thread->num_ops;
+        }
+        catch (r3c::CRedisException& ex)
+        {
+            thread->errmsg = ex.str();
+            ++thread->num_errors;
+        }
+        thread->latencies.push_back(static_cast<int32_t>(get_current_microseconds() - start_us));
+    }
+
+    for (std::vector<r3c::CRedisClient*>::size_type i=0; i<clients.size(); ++i)
+    {
+        r3c::ClientMetrics metrics;
+        clients[i]->get_metrics(&metrics);
+        thread->metrics.merge(metrics);
+        delete clients[i];
+    }
+    for (std::vector<r3c::RandomFaultInjector*>::size_type i=0; i<fault_injectors.size(); ++i)
+    {
+        thread->num_faults += fault_injectors[i]->get_num_faults();
+        delete fault_injectors[i];
+    }
+    return NULL;
+}
+
+static int32_t get_percentile(const std::vector<int32_t>& sorted, double percentile)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = static_cast<size_t>(ceil(percentile * static_cast<double>(sorted.size())));
+    if (index > 0)
+        --index;
+    return sorted[std::min(index, sorted.size()-1)];
+}
+
+void report(const BenchConfig& config, const std::vector<BenchThread*>& threads, int64_t elapsed_us)
+{
+    std::vector<int32_t> latencies;
+    int64_t num_ops = 0, num_commands = 0, num_errors = 0;
+    uint64_t num_faults = 0;
+    r3c::ClientMetrics metrics;
+    std::string errmsg;
+
+    for (std::vector<BenchThread*>::size_type i=0; i<threads.size(); ++i)
+    {
+        num_ops += threads[i]->num_ops;
+        num_commands += threads[i]->num_commands;
+        num_errors += threads[i]->num_errors;
+        num_faults += threads[i]->num_faults;
+        metrics.merge(threads[i]->metrics);
+        latencies.insert(latencies.end(), threads[i]->latencies.begin(), threads[i]->latencies.end());
+        if (!threads[i]->errmsg.empty())
+            errmsg = threads[i]->errmsg;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const double seconds = static_cast<double>(elapsed_us) / 1000000;
+    const double qps = (seconds > 0)? static_cast<double>(num_ops) / seconds: 0;
+    const double cps = (seconds > 0)? static_cast<double>(num_commands) / seconds: 0;
+    double avg_us = 0;
+    for (std::vector<int32_t>::size_type i=0; i<latencies.size(); ++i)
+        avg_us += latencies[i];
+    if (!latencies.empty())
+        avg_us /= static_cast<double>(latencies.size());
+    // Percent of the ops succeeded, the retries hide the faults from the callers
+    const double availability = (num_ops+num_errors > 0)? static_cast<double>(num_ops) * 100 / static_cast<double>(num_ops+num_errors): 0;
+
+    if ("json" == config.output)
+    {
+        // One line per run, for the regression tracking
+        fprintf(stdout,
+                "{\"workload\":\"%s\",\"distribution\":\"%s\",\"keys\":%d,\"value_size\":%d,"
+                "\"threads\":%d,\"clients\":%d,\"batch\":%d,\"mock\":%s,\"seconds\":%.3f,"
+                "\"ops\":%" PRId64",\"commands\":%" PRId64",\"errors\":%" PRId64","
+                "\"qps\":%.1f,\"cps\":%.1f,\"avg_us\":%.1f,\"p50_us\":%d,\"p99_us\":%d,\"p999_us\":%d,\"max_us\":%d,"
+                "\"faults\":\"%s\",\"injected\":%" PRIu64",\"availability\":%.4f,"
+                "\"retries\":%" PRIu64",\"reconnects\":%" PRIu64",\"timeouts\":%" PRIu64",\"refreshes\":%" PRIu64"}\n",
+                config.workload.c_str(), config.distribution.c_str(), config.num_keys, config.value_size,
+                config.num_threads, config.num_clients, config.batch_size, (config.num_mock_masters>0)? "true": "false", seconds,
+                num_ops, num_commands, num_errors,
+                qps, cps, avg_us, get_percentile(latencies, 0.5), get_percentile(latencies, 0.99), get_percentile(latencies, 0.999),
+                latencies.empty()? 0: latencies.back(),
+                config.faults.c_str(), num_faults, availability,
+                metrics.num_retries, metrics.num_reconnects, metrics.num_timeouts, metrics.num_refreshes);
+    }
+    else
+    {
+        fprintf(stdout, "workload: %s, distribution: %s, keys: %d, value size: %d, threads: %d, clients: %d, batch: %d\n",
+                config.workload.c_str(), config.distribution.c_str(), config.num_keys, config.value_size,
+                config.num_threads, config.num_clients, config.batch_size);
+        fprintf(stdout, "seconds: %.3f, ops: %" PRId64", commands: %" PRId64", errors: %" PRId64"\n",
+                seconds, num_ops, num_commands, num_errors);
+        fprintf(stdout, "qps: %.1f, commands per second: %.1f\n", qps, cps);
+        fprintf(stdout, "latency(us): avg=%.1f, p50=%d, p99=%d, p999=%d, max=%d\n",
+                avg_us, get_percentile(latencies, 0.5), get_percentile(latencies, 0.99), get_percentile(latencies, 0.999),
+                latencies.empty()? 0: latencies.back());
+        if (!config.faults.empty())
+        {
+            fprintf(stdout, "faults: %s, injected: %" PRIu64", availability: %.4f%%\n",
+                    config.faults.c_str(), num_faults, availability);
+            fprintf(stdout, "retries: %" PRIu64", reconnects: %" PRIu64", timeouts: %" PRIu64", refreshes: %" PRIu64"\n",
+                    metrics.num_retries, metrics.num_reconnects, metrics.num_timeouts, metrics.num_refreshes);
+        }
+    }
+    if (!errmsg.empty())
+        fprintf(stderr, "last error: %s\n", errmsg.c_str());
+}
@@ -15,6 +15,283 @@ static void my_log_write(const char* format, ...)
     va_end(ap);
 }
 
+// Split a line into arguments like redis-cli,
+// an argument can be quoted by double quotes with escapes (\n, \r, \t, \xHH ...) or by single quotes.
+// Returns false if the quotes are unbalanced.
+static bool split_args(const std::string& line, std::vector<std::string>* args)
+{
+    std::string::size_type i = 0;
+
+    for (;;)
+    {
+        while (i<line.size() && isspace(static_cast<unsigned char>(line[i])))
+            ++i;
+        if (i >= line.size())
+            return true;
+
+        std::string arg;
+        const char quote = ('"'==line[i] || '\''==line[i])? line[i++]: '\0';
+        for (;;)
+        {
+            if (i >= line.size())
+            {
+                if (quote != '\0')
+                    return false;
+                break;
+            }
+
+            const char c = line[i++];
+            if ('\0' == quote)
+            {
+                if (isspace(static_cast<unsigned char>(c)))
+                    break;
+                arg.push_back(c);
+            }
+            else if (c == quote)
+            {
+                // The closing quote must be followed by a space
+                if (i<line.size() && !isspace(static_cast<unsigned char>(line[i])))
+                    return false;
+                break;
+            }
+            else if ('\\'==c && i<line.size())
+            {
+                const char e = line[i++];
+                if ('\'' == quote)
+                {
+                    if (e != '\'')
+                        arg.push_back(c);
+                    arg.push_back(e);
+                }
+                else if ('x'==e && i+1<line.size() && isxdigit(static_cast<unsigned char>(line[i])) && isxdigit(static_cast<unsigned char>(line[i+1])))
+                {
+                    arg.push_back(static_cast<char>(strtol(line.substr(i, 2).c_str(), NULL, 16)));
+                    i += 2;
+                }
+                else
+                {
+                    switch (e)
+                    {
+                    case 'n': arg.push_back('\n'); break;
+                    case 'r': arg.push_back('\r'); break;
+                    case 't': arg.push_back('\t'); break;
+                    case 'b': arg.push_back('\b'); break;
+                    case 'a': arg.push_back('\a'); break;
+                    default: arg.push_back(e); break;
+                    }
+                }
+            }
+            else
+            {
+                arg.push_back(c);
+            }
+        }
+        args->push_back(arg);
+    }
+}
+
+// Read the commands to load from a file,
+// in RESP (like the input of redis-cli --pipe) if the first character is '*',
+// else one command per line with the arguments quoted as redis-cli does.
+class CommandReader
+{
+public:
+    CommandReader(FILE* fp)
+        : _fp(fp), _reader(NULL), _line_number(0)
+    {
+        const int c = fgetc(_fp);
+        if (c != EOF)
+        {
+            ungetc(c, _fp);
+            if ('*' == c)
+                _reader = redisReaderCreate();
+        }
+    }
+
+    ~CommandReader()
+    {
+        if (_reader != NULL)
+            redisReaderFree(_reader);
+    }
+
+    // Returns 1 if a command is read, 0 at the end of file, or -1 on error (see get_errmsg)
+    int next(std::vector<std::string>* args)
+    {
+        args->clear();
+        return (NULL == _reader)? next_line(args): next_resp(args);
+    }
+
+    const std::string& get_errmsg() const
+    {
+        return _errmsg;
+    }
+
+private:
+    int next_line(std::vector<std::string>* args)
+    {
+        std::string line;
+        char buf[4096];
+
+        for (;;)
+        {
+            line.clear();
+            while (fgets(buf, sizeof(buf), _fp) != NULL)
+            {
+                line.append(buf);
+                if ('\n' == line[line.size()-1])
+                    break;
+            }
+            if (line.empty())
+                return 0; // End of file
+
+            ++_line_number;
+            if (!split_args(line, args))
+            {
+                _errmsg = r3c::format_string("line %d: unbalanced quotes", _line_number);
+                return -1;
+            }
+            if (!args->empty() && (*args)[0].compare(0, 1, "#")!=0)
+                return 1;
+            args->clear(); // Empty line or comment
+        }
+    }
+
+    int next_resp(std::vector<std::string>* args)
+    {
+        char buf[65536];
+
+        for (;;)
+        {
+            void* reply = NULL;
+
+            if (REDIS_OK != redisReaderGetReply(_reader, &reply))
+            {
+                _errmsg = r3c::format_string("protocol error: %s", _reader->errstr);
+                return -1;
+            }
+            if (reply != NULL)
+            {
+                const redisReply* redis_reply = static_cast<redisReply*>(reply);
+                int ret = 1;
+
+                if (redis_reply->type != REDIS_REPLY_ARRAY || 0 == redis_reply->elements)
+                {
+                    _errmsg = "protocol error: a command should be a non-empty array";
+                    ret = -1;
+                }
+                for (size_t i=0; 1==ret && i<redis_reply->elements; ++i)
+                    args->push_back(std::string(redis_reply->element[i]->str, redis_reply->element[i]->len));
+                freeReplyObject(reply);
+                return ret;
+            }
+
+            const size_t n = fread(buf, 1, sizeof(buf), _fp);
+            if (0 == n)
+                return 0;
+            redisReaderFeed(_reader, buf, n);
+        }
+    }
+
+private:
+    FILE* _fp;
+    redisReader* _reader;
+    int _line_number;
+    std::string _errmsg;
+};
+
+// Get the first key of the command for routing, like the commands of CRedisClient:
+// EVAL and EVALSHA take the key after numkeys, XREAD and XREADGROUP the one after STREAMS,
+// BITOP, OBJECT, MEMORY, XGROUP and XINFO the third argument, and the others the second argument.
+// Returns false for the keyless commands (like PING and CLUSTER) and the commands whose keys can not be told (like MIGRATE).
+static bool get_command_key(const std::vector<std::string>& args, std::string* key)
+{
+    static const char* keyless_commands[] =
+    {
+        "AUTH", "BGREWRITEAOF", "BGSAVE", "CLIENT", "CLUSTER", "COMMAND", "CONFIG", "DBSIZE", "DEBUG", "ECHO",
+        "EXEC", "FLUSHALL", "FLUSHDB", "INFO", "KEYS", "LASTSAVE", "MIGRATE", "MONITOR", "MULTI", "PING",
+        "PSUBSCRIBE", "PUBLISH", "PUBSUB", "RANDOMKEY", "READONLY", "READWRITE", "SAVE", "SCAN", "SCRIPT",
+        "SELECT", "SHUTDOWN", "SLOWLOG", "SUBSCRIBE", "SWAPDB", "TIME", "UNWATCH", "WAIT"
+    };
+    const std::string& command = args[0];
+    std::vector<std::string>::size_type index = 1;
+
+    for (size_t i=0; i<sizeof(keyless_commands)/sizeof(keyless_commands[0]); ++i)
+    {
+        if (0 == strcasecmp(command.c_str(), keyless_commands[i]))
+            return false;
+    }
+    if (0==strcasecmp(command.c_str(), "EVAL") || 0==strcasecmp(command.c_str(), "EVALSHA"))
+    {
+        // EVAL script numkeys key [key ...] arg [arg ...]
+        if (args.size()<4 || atoi(args[2].c_str())<1)
+            return false;
+        index = 3;
+    }
+    else if (0==strcasecmp(command.c_str(), "XREAD") || 0==strcasecmp(command.c_str(), "XREADGROUP"))
+    {
+        // XREADGROUP GROUP group consumer [COUNT count] [BLOCK milliseconds] STREAMS key [key ...] id [id ...]
+        for (index=1; index<args.size() && strcasecmp(args[index].c_str(), "STREAMS")!=0; ++index);
+        ++index;
+    }
+    else if (0==strcasecmp(command.c_str(), "BITOP") || 0==strcasecmp(command.c_str(), "OBJECT") ||
+             0==strcasecmp(command.c_str(), "MEMORY") || 0==strcasecmp(command.c_str(), "XGROUP") ||
+             0==strcasecmp(command.c_str(), "XINFO"))
+    {
+        // BITOP operation destkey key [key ...]
+        index = 2;
+    }
+    if (index >= args.size())
+        return false;
+    *key = args[index];
+    return true;
+}
+
+// The commands not changing the data, which are safe to retry
+static bool is_readonly_command(const std::string& command)
+{
+    static const char* readonly_commands[] =
+    {
+        "BITCOUNT", "DUMP", "EXISTS", "GET", "GETBIT", "GETRANGE", "HEXISTS", "HGET", "HGETALL", "HKEYS",
+        "HLEN", "HMGET", "HSCAN", "HSTRLEN", "HVALS", "LINDEX", "LLEN", "LRANGE", "MGET", "PFCOUNT",
+        "PTTL", "SCARD", "SISMEMBER", "SMEMBERS", "SRANDMEMBER", "SSCAN", "STRLEN", "TTL", "TYPE", "XLEN",
+        "XRANGE", "XREVRANGE", "ZCARD", "ZCOUNT", "ZRANGE", "ZRANGEBYSCORE", "ZRANK", "ZREVRANGE",
+        "ZREVRANGEBYSCORE", "ZREVRANK", "ZSCAN", "ZSCORE"
+    };
+
+    for (size_t i=0; i<sizeof(readonly_commands)/sizeof(readonly_commands[0]); ++i)
+    {
+        if (0 == strcasecmp(command.c_str(), readonly_commands[i]))
+            return true;
+    }
+    return false;
+}
+
+// Execute the commands of the pipeline, and print the failed
+static int64_t load_commands(r3c::CRedisClient* redis_client, r3c::Pipeline* pipeline, int window_size, int64_t first_number)
+{
+    int64_t num_errors = 0;
+
+    redis_client->pipeline(pipeline, window_size);
+    for (int i=0; i<pipeline->size(); ++i)
+    {
+        const redisReply* redis_reply = pipeline->get_reply(i);
+
+        if (NULL == redis_reply)
+        {
+            ++num_errors;
+            fprintf(stderr, "[%" PRId64"] %s\n", first_number+i, pipeline->get_errinfo(i).errmsg.c_str());
+        }
+        else if (REDIS_REPLY_ERROR == redis_reply->type)
+        {
+            ++num_errors;
+            fprintf(stderr, "[%" PRId64"][%s:%d] %s\n", first_number+i,
+                    pipeline->get_node(i).first.c_str(), pipeline->get_node(i).second, redis_reply->str);
+        }
+    }
+    pipeline->clear();
+    return num_errors;
+}
+
 int main(int argc, char* argv[])
 {
     if (argc < 2)
@@ -111,6 +388,169 @@ int main(int argc, char* argv[])
             fprintf(stdout, "[" PRINT_COLOR_YELLOW"NOTICE" PRINT_COLOR_NONE"] To clear only a node, set `HOSTS` to a single node\n\n");
             redis_client.flushall();
         }
+        else if (0 == strcasecmp(cmd, "load"))
+        {
+            // Load the commands of a file in pipelining, routed by the key (see get_command_key),
+            // the commands without a known key are skipped as errors
+            if (argc<3 || argc>5)
+            {
+                fprintf(stderr, "Usage1: r3c_cmd load file\n");
+                fprintf(stderr, "Usage2: r3c_cmd load file window_size\n");
+                fprintf(stderr, "Usage3: r3c_cmd load file window_size batch_size\n");
+                fprintf(stderr, "The file is '-' for stdin, in RESP or one command per line\n");
+                exit(1);
+            }
+
+            FILE* fp = (0 == strcmp(key, "-"))? stdin: fopen(key, "r");
+            if (NULL == fp)
+            {
+                fprintf(stderr, "open %s failed: %s\n", key, strerror(errno));
+                exit(1);
+            }
+
+            const int window_size = (argc > 3)? atoi(argv[3]): 100;
+            const int batch_size = (argc > 4)? atoi(argv[4]): 10000;
+            CommandReader command_reader(fp);
+            r3c::Pipeline pipeline;
+            int64_t num_commands = 0;
+            int64_t num_errors = 0;
+            const int64_t start_ms = r3c::get_current_milliseconds();
+
+            for (;;)
+            {
+                std::string command_key;
+
+                ret = command_reader.next(&vec);
+                if (1==ret && !get_command_key(vec, &command_key))
+                {
+                    ++num_errors;
+                    fprintf(stderr, "[%" PRId64"] %s: the key is unknown\n", num_commands+pipeline.size(), vec[0].c_str());
+                }
+                else if (1 == ret)
+                {
+                    r3c::CommandArgs cmd_args;
+                    cmd_args.set_command(vec[0]);
+                    cmd_args.set_key(command_key);
+                    cmd_args.add_args(vec);
+                    cmd_args.final();
+                    pipeline.add(cmd_args);
+                }
+                if (pipeline.size()>=batch_size || (ret!=1 && pipeline.size()>0))
+                {
+                    const int num_batch_commands = pipeline.size();
+                    num_errors += load_commands(&redis_client, &pipeline, window_size, num_commands);
+                    num_commands += num_batch_commands;
+                }
+                if (ret != 1)
+                    break;
+            }
+            if (fp != stdin)
+                fclose(fp);
+
+            const int64_t cost_ms = r3c::get_current_milliseconds() - start_ms;
+            if (-1 == ret)
+                fprintf(stderr, "%s\n", command_reader.get_errmsg().c_str());
+            fprintf(stdout, "commands: %" PRId64", errors: %" PRId64", cost: %" PRId64"ms, %" PRId64"/s\n",
+                    num_commands, num_errors, cost_ms, (cost_ms > 0)? num_commands*1000/cost_ms: num_commands);
+        }
+        else if (0 == strcasecmp(cmd, "slowlog"))
+        {
+            // Execute the commands of a file one by one, and dump the slow log
+            if (argc<3 || argc>6)
+            {
+                fprintf(stderr, "Usage1: r3c_cmd slowlog file\n");
+                fprintf(stderr, "Usage2: r3c_cmd slowlog file threshold_us\n");
+                fprintf(stderr, "Usage3: r3c_cmd slowlog file threshold_us count\n");
+                fprintf(stderr, "Usage4: r3c_cmd slowlog file threshold_us count sample_interval\n");
+                fprintf(stderr, "The file is '-' for stdin, in RESP or one command per line\n");
+                exit(1);
+            }
+
+            FILE* fp = (0 == strcmp(key, "-"))? stdin: fopen(key, "r");
+            if (NULL == fp)
+            {
+                fprintf(stderr, "open %s failed: %s\n", key, strerror(errno));
+                exit(1);
+            }
+
+            const int64_t threshold_us = (argc > 3)? atoll(argv[3]): 10000;
+            count = (argc > 4)? atoi(argv[4]): 128;
+            CommandReader command_reader(fp);
+            std::vector<r3c::SlowLogEntry> entries;
+            int64_t num_commands = 0;
+            int64_t num_errors = 0;
+
+            redis_client.enable_slowlog(threshold_us, count, (argc > 5)? atoi(argv[5]): 0);
+            while (1 == (ret = command_reader.next(&vec)))
+            {
+                r3c::CommandArgs cmd_args;
+                std::string command_key;
+
+                ++num_commands;
+                if (!get_command_key(vec, &command_key))
+                {
+                    ++num_errors;
+                    fprintf(stderr, "[%" PRId64"] %s: the key is unknown\n", num_commands, vec[0].c_str());
+                    continue;
+                }
+                cmd_args.set_command(vec[0]);
+                cmd_args.set_key(command_key);
+                cmd_args.add_args(vec);
+                cmd_args.final();
+                try
+                {
+                    // The writes are not retried, as they may be not idempotent (like INCRBY)
+                    const int num_retries = is_readonly_command(vec[0])? r3c::NUM_RETRIES: 0;
+                    redis_client.redis_command(false, num_retries, cmd_args.get_key(), cmd_args, NULL);
+                }
+                catch (r3c::CRedisException& ex)
+                {
+                    ++num_errors;
+                    fprintf(stderr, "[%" PRId64"] %s\n", num_commands, ex.str().c_str());
+                }
+            }
+            if (fp != stdin)
+                fclose(fp);
+            if (-1 == ret)
+                fprintf(stderr, "%s\n", command_reader.get_errmsg().c_str());
+
+            redis_client.get_slowlog(&entries);
+            for (std::vector<r3c::SlowLogEntry>::size_type j=0; j<entries.size(); ++j)
+                std::cout << entries[j] << std::endl;
+            fprintf(stdout, "commands: %" PRId64", errors: %" PRId64", slow: %d\n", num_commands, num_errors, static_cast<int>(entries.size()));
+        }
+        else if (0 == strcasecmp(cmd, "export"))
+        {
+            // Export the keys matching pattern of all masters by DUMP
+            if (argc<4 || argc>5)
+            {
+                fprintf(stderr, "Usage1: r3c_cmd export pattern file\n");
+                fprintf(stderr, "Usage2: r3c_cmd export pattern file count\n");
+                exit(1);
+            }
+
+            const int64_t start_ms = r3c::get_current_milliseconds();
+            r3c::KeyspaceExporter exporter(&redis_client, argv[2], (argc > 4)? atoi(argv[4]): 1000);
+            ret64 = exporter.run(argv[3]);
+            fprintf(stdout, "keys: %" PRId64", skipped: %" PRId64", bytes: %" PRId64", cost: %" PRId64"ms\n",
+                    ret64, exporter.get_num_skipped(), exporter.get_num_bytes(), r3c::get_current_milliseconds()-start_ms);
+        }
+        else if (0 == strcasecmp(cmd, "import"))
+        {
+            // Import the keys exported by RESTORE
+            if (argc<3 || argc>4 || (4==argc && strcasecmp(argv[3], "replace")!=0))
+            {
+                fprintf(stderr, "Usage1: r3c_cmd import file\n");
+                fprintf(stderr, "Usage2: r3c_cmd import file replace\n");
+                exit(1);
+            }
+
+            const int64_t start_ms = r3c::get_current_milliseconds();
+            r3c::KeyspaceImporter importer(&redis_client, 4==argc);
+            ret64 = importer.run(key);
+            fprintf(stdout, "keys: %" PRId64", errors: %" PRId64", expired: %" PRId64", cost: %" PRId64"ms\n",
+                    ret64, importer.get_num_errors(), importer.get_num_expired(), r3c::get_current_milliseconds()-start_ms);
+        }
         ////////////////////////////////////////////////////////////////////////////
         // KEY VALUE
         else if (0 == strcasecmp(cmd, "type"))
@@ -365,6 +805,32 @@ int main(int argc, char* argv[])
             for (i=0; i<static_cast<int>(values.size()); ++i)
                 fprintf(stdout, "%s\n", values[i].c_str());
         }
+        else if (0 == strcasecmp(cmd, "cscan"))
+        {
+            // SCAN all masters of cluster
+            if (argc > 5)
+            {
+                fprintf(stderr, "Usage1: r3c_cmd cscan\n");
+                fprintf(stderr, "Usage2: r3c_cmd cscan pattern\n");
+                fprintf(stderr, "Usage3: r3c_cmd cscan pattern count\n");
+                fprintf(stderr, "Usage4: r3c_cmd cscan pattern count type\n");
+                exit(1);
+            }
+
+            r3c::ClusterScanner scanner(
+                    &redis_client,
+                    (argc > 2)? argv[2]: "",
+                    (argc > 3)? atoi(argv[3]): 0,
+                    (argc > 4)? argv[4]: "");
+            while (!scanner.done())
+            {
+                scanner.next(&values, &which_node);
+                for (i=0; i<static_cast<int>(values.size()); ++i)
+                    fprintf(stdout, "%s\n", values[i].c_str());
+                count += static_cast<int>(values.size());
+            }
+            fprintf(stdout, "count: %d\n", count);
+        }
         ////////////////////////////////////////////////////////////////////////////
         // LIST
         else if (0 == strcasecmp(cmd, "llen"))
@@ -0,0 +1,715 @@
+// Microbenchmarks of the hot-path primitives, needs no redis
+//
+// Each benchmark is calibrated to run about -t milliseconds per repetition,
+// warmed up once, then repeated -r times, the min/median/max of ns per op are reported.
+// Pin to a CPU with -c to reduce the noise of migrations.
+//
+// Usage: r3c_microbench [options]
+// Example: r3c_microbench -c 2 -r 9 > baseline.txt
+//          r3c_microbench -c 2 -r 9 -b baseline.txt -x 10 # Exit 2 if any median regresses more than 10%
+#include "r3c.h"
+#include "utils.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+struct MicrobenchConfig
+{
+    int cpu; // -1 not to pin
+    int repetitions;
+    int milliseconds; // Target time of a repetition
+    std::string filter; // Substring of the benchmark names
+    std::string output; // text or json
+    std::string baseline; // File of a previous text output
+    double threshold; // Percent of the median allowed to regress
+
+    MicrobenchConfig()
+        : cpu(-1), repetitions(5), milliseconds(200), output("text"), threshold(10.0)
+    {
+    }
+};
+
+struct Benchmark
+{
+    const char* name;
+    void (*run)(int64_t iterations);
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    int64_t iterations; // Per repetition
+    double min_ns;
+    double median_ns;
+    double max_ns;
+};
+
+// Sink of the results, so the compiler can not drop the benchmarked calls
+static volatile uint64_t g_sink = 0;
+
+// One volatile read and write per benchmark, compound assignments to volatile are deprecated since C++20
+static inline void sink(uint64_t sum)
+{
+    g_sink = g_sink + sum;
+}
+
+static int64_t get_monotonic_nanoseconds();
+static void usage(const char* program);
+static void null_log_write(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static bool parse_args(int argc, char* argv[], MicrobenchConfig* config);
+static bool pin_cpu(int cpu);
+static void init_fixtures();
+static void fini_fixtures();
+static redisReply* make_reply(const std::string& resp);
+static BenchmarkResult run_benchmark(const MicrobenchConfig& config, const Benchmark& benchmark);
+static void report(const MicrobenchConfig& config, const std::vector<BenchmarkResult>& results);
+static int compare_baseline(const MicrobenchConfig& config, const std::vector<BenchmarkResult>& results);
+
+////////////////////////////////////////////////////////////////////////////////
+// Fixtures
+
+static std::vector<std::string> g_keys; // Some with hashtag
+static std::vector<std::string> g_values;
+static std::vector<std::string> g_numbers; // Decimal strings of int64_t
+static std::vector<int64_t> g_integers;
+static std::string g_nodes_string; // Reply of CLUSTER NODES
+static redisReply* g_strings_reply = NULL; // Array of 100 bulk strings, some are nil
+static redisReply* g_scores_reply = NULL; // ZRANGE WITHSCORES of 50 members
+static redisReply* g_hash_reply = NULL; // HGETALL of 50 fields
+static redisReply* g_hmget_reply = NULL; // HMGET of 50 fields
+static std::vector<std::string> g_hmget_fields;
+static redisReply* g_integers_reply = NULL; // Array of 100 integers
+static redisReply* g_xrange_reply = NULL; // XRANGE of 20 entries with 4 fields
+static redisReply* g_xread_reply = NULL; // XREADGROUP of 2 streams with 10 entries each
+
+static void bulk(std::string* resp, const std::string& str)
+{
+    *resp += r3c::format_string("$%d\r\n", static_cast<int>(str.size()));
+    *resp += str;
+    *resp += "\r\n";
+}
+
+static void stream_entries(std::string* resp, int num_entries)
+{
+    *resp += r3c::format_string("*%d\r\n", num_entries);
+    for (int i=0; i<num_entries; ++i)
+    {
+        *resp += "*2\r\n";
+        bulk(resp, r3c::format_string("1546317629187-%d", i));
+        *resp += "*8\r\n";
+        for (int j=0; j<4; ++j)
+        {
+            bulk(resp, r3c::format_string("field%d", j));
+            bulk(resp, g_values[(i+j) % g_values.size()]);
+        }
+    }
+}
+
+void init_fixtures()
+{
+    for (int i=0; i<1024; ++i)
+    {
+        if (0 == i%8)
+            g_keys.push_back(r3c::format_string("{user:%d}:profile", i));
+        else
+            g_keys.push_back(r3c::format_string("r3c_microbench_key_%d", i));
+        g_values.push_back(std::string(16 + i%48, static_cast<char>('a' + i%26)));
+        g_integers.push_back((i%2 == 0)? static_cast<int64_t>(i) * 7919: -static_cast<int64_t>(i) * 1000000007LL);
+        g_numbers.push_back(r3c::int2string(g_integers.back()));
+    }
+
+    // 6 masters and 6 replicas, like a small production cluster,
+    // the last master is migrating a slot.
+    for (int i=0; i<6; ++i)
+    {
+        const int start_slot = i * 16384 / 6;
+        const int end_slot = (i+1) * 16384 / 6 - 1;
+        const std::string master_id = r3c::strsha1(r3c::format_string("master%d", i));
+        const std::string replica_id = r3c::strsha1(r3c::format_string("replica%d", i));
+
+        g_nodes_string += r3c::format_string("%s 10.212.2.%d:6379@16379 %smaster - 0 1546317629187 %d connected %d-%d",
+                master_id.c_str(), 71+i, (0==i)? "myself,": "", 10+i, start_slot, end_slot);
+        if (5 == i)
+            g_nodes_string += r3c::format_string(" [%d->-%s]", end_slot, replica_id.c_str());
+        g_nodes_string += "\n";
+        g_nodes_string += r3c::format_string("%s 10.212.3.%d:6379@16379 slave %s 0 1546317629187 %d connected\n",
+                replica_id.c_str(), 71+i, master_id.c_str(), 10+i);
+    }
+
+    std::string resp = "*100\r\n";
+    for (int i=0; i<100; ++i)
+    {
+        if (0 == i%10)
+            resp += "$-1\r\n";
+        else
+            bulk(&resp, g_values[i]);
+    }
+    g_strings_reply = make_reply(resp);
+
+    resp = "*100\r\n";
+    for (int i=0; i<50; ++i)
+    {
+        bulk(&resp, g_keys[i]);
+        bulk(&resp, g_numbers[i]);
+    }
+    g_scores_reply = make_reply(resp);
+
+    resp = "*100\r\n";
+    for (int i=0; i<50; ++i)
+    {
+        bulk(&resp, r3c::format_string("field%d", i));
+        bulk(&resp, g_values[i]);
+    }
+    g_hash_reply = make_reply(resp);
+
+    resp = "*50\r\n";
+    for (int i=0; i<50; ++i)
+    {
+        g_hmget_fields.push_back(r3c::format_string("field%d", i));
+        if (0 == i%10)
+            resp += "$-1\r\n";
+        else
+            bulk(&resp, g_values[i]);
+    }
+    g_hmget_reply = make_reply(resp);
+
+    resp = "*100\r\n";
+    for (int i=0; i<100; ++i)
+        resp += r3c::format_string(":%" PRId64"\r\n", g_integers[i]);
+    g_integers_reply = make_reply(resp);
+
+    resp.clear();
+    stream_entries(&resp, 20);
+    g_xrange_reply = make_reply(resp);
+
+    resp = "*2\r\n";
+    for (int i=0; i<2; ++i)
+    {
+        resp += "*2\r\n";
+        bulk(&resp, r3c::format_string("topic%d", i));
+        stream_entries(&resp, 10);
+    }
+    g_xread_reply = make_reply(resp);
+}
+
+void fini_fixtures()
+{
+    freeReplyObject(g_strings_reply);
+    freeReplyObject(g_scores_reply);
+    freeReplyObject(g_hash_reply);
+    freeReplyObject(g_hmget_reply);
+    freeReplyObject(g_integers_reply);
+    freeReplyObject(g_xrange_reply);
+    freeReplyObject(g_xread_reply);
+}
+
+// Build the reply by the reader of hiredis, the same as the replies of the server
+redisReply* make_reply(const std::string& resp)
+{
+    redisReader* reader = redisReaderCreate();
+    void* reply = NULL;
+
+    if ((REDIS_OK != redisReaderFeed(reader, resp.data(), resp.size())) ||
+        (REDIS_OK != redisReaderGetReply(reader, &reply)) ||
+        (NULL == reply))
+    {
+        fprintf(stderr, "bad fixture: %s\n", resp.c_str());
+        exit(1);
+    }
+    redisReaderFree(reader);
+    return static_cast<redisReply*>(reply);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+
+static void bench_keyHashSlot(int64_t iterations)
+{
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        const std::string& key = g_keys[i & 1023];
+        sum += r3c::keyHashSlot(key.data(), key.size());
+    }
+    sink(sum);
+}
+
+static void bench_crc16(int64_t iterations)
+{
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        const std::string& key = g_keys[i & 1023];
+        sum += r3c::crc16(key.data(), static_cast<int>(key.size()));
+    }
+    sink(sum);
+}
+
+static void bench_get_key_slot(int64_t iterations)
+{
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::get_key_slot(&g_keys[i & 1023]);
+    sink(sum);
+}
+
+// Like CRedisClient::get
+static void bench_command_args_get(int64_t iterations)
+{
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        const std::string& key = g_keys[i & 1023];
+        r3c::CommandArgs cmd_args;
+        cmd_args.set_key(key);
+        cmd_args.set_command("GET");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(key);
+        cmd_args.final();
+        sum += cmd_args.get_argvlen()[1];
+    }
+    sink(sum);
+}
+
+// Like CRedisClient::hmset of 10 fields
+static void bench_command_args_hmset(int64_t iterations)
+{
+    std::map<std::string, std::string> map;
+    for (int i=0; i<10; ++i)
+        map[r3c::format_string("field%d", i)] = g_values[i];
+
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        const std::string& key = g_keys[i & 1023];
+        r3c::CommandArgs cmd_args;
+        cmd_args.set_key(key);
+        cmd_args.set_command("HMSET");
+        cmd_args.add_arg(cmd_args.get_command());
+        cmd_args.add_arg(key);
+        cmd_args.add_args(map);
+        cmd_args.final();
+        sum += cmd_args.get_argc();
+    }
+    sink(sum);
+}
+
+static void bench_redisFormatCommandArgv(int64_t iterations)
+{
+    std::map<std::string, std::string> map;
+    for (int i=0; i<10; ++i)
+        map[r3c::format_string("field%d", i)] = g_values[i];
+
+    r3c::CommandArgs cmd_args;
+    cmd_args.set_key(g_keys[0]);
+    cmd_args.set_command("HMSET");
+    cmd_args.add_arg(cmd_args.get_command());
+    cmd_args.add_arg(g_keys[0]);
+    cmd_args.add_args(map);
+    cmd_args.final();
+
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        char* command = NULL;
+        const int len = redisFormatCommandArgv(&command, cmd_args.get_argc(), cmd_args.get_argv(), cmd_args.get_argvlen());
+        sum += static_cast<uint64_t>(len);
+        redisFreeCommand(command);
+    }
+    sink(sum);
+}
+
+static void bench_get_values_vector(int64_t iterations)
+{
+    std::vector<std::string> values;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_strings_reply, &values);
+    sink(sum);
+}
+
+static void bench_get_values_set(int64_t iterations)
+{
+    std::set<std::string> values;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_strings_reply, &values);
+    sink(sum);
+}
+
+static void bench_get_values_withscores(int64_t iterations)
+{
+    std::vector<std::pair<std::string, int64_t> > vec;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_scores_reply, &vec, true);
+    sink(sum);
+}
+
+static void bench_get_values_map(int64_t iterations)
+{
+    std::map<std::string, std::string> map;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_hash_reply, &map);
+    sink(sum);
+}
+
+static void bench_get_values_hmget(int64_t iterations)
+{
+    std::map<std::string, std::string> map;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_hmget_reply, g_hmget_fields, false, &map);
+    sink(sum);
+}
+
+static void bench_get_values_integers(int64_t iterations)
+{
+    std::vector<int64_t> values;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_integers_reply, &values);
+    sink(sum);
+}
+
+static void bench_get_values_stream_entries(int64_t iterations)
+{
+    std::vector<r3c::StreamEntry> values;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_xrange_reply, &values);
+    sink(sum);
+}
+
+static void bench_get_values_streams(int64_t iterations)
+{
+    std::vector<r3c::Stream> values;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_xread_reply, &values);
+    sink(sum);
+}
+
+static void bench_get_values_stream_batch(int64_t iterations)
+{
+    r3c::StreamBatch batch;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::CRedisClient::get_values(g_xread_reply, &batch);
+    sink(sum);
+}
+
+static void bench_parse_cluster_nodes(int64_t iterations)
+{
+    std::vector<r3c::NodeInfo> nodes_info;
+    std::string error_line;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        r3c::CRedisClient::parse_cluster_nodes(g_nodes_string.c_str(), &nodes_info, &error_line);
+        sum += nodes_info.size();
+    }
+    sink(sum);
+}
+
+static void bench_split(int64_t iterations)
+{
+    const std::string source = "127.0.0.1:6379,127.0.0.1:6380,127.0.0.1:6381,127.0.0.1:6382,127.0.0.1:6383,127.0.0.1:6384";
+    const std::string sep = ",";
+    std::vector<std::string> tokens;
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        tokens.clear();
+        sum += r3c::split(&tokens, source, sep);
+    }
+    sink(sum);
+}
+
+static void bench_int2string(int64_t iterations)
+{
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += r3c::int2string(g_integers[i & 1023]).size();
+    sink(sum);
+}
+
+static void bench_string2int(int64_t iterations)
+{
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+    {
+        const std::string& str = g_numbers[i & 1023];
+        int64_t n = 0;
+        r3c::string2int(str.data(), str.size(), &n);
+        sum += static_cast<uint64_t>(n);
+    }
+    sink(sum);
+}
+
+static void bench_strsha1(int64_t iterations)
+{
+    const std::string script = "local v=redis.call('GET',KEYS[1]);if v then return redis.call('INCRBY',KEYS[1],ARGV[1]) end;return nil";
+    uint64_t sum = 0;
+    for (int64_t i=0; i<iterations; ++i)
+        sum += static_cast<unsigned char>(r3c::strsha1(script)[0]);
+    sink(sum);
+}
+
+static const Benchmark g_benchmarks[] =
+{
+    { "keyHashSlot", bench_keyHashSlot },
+    { "crc16", bench_crc16 },
+    { "get_key_slot", bench_get_key_slot },
+    { "CommandArgs.get", bench_command_args_get },
+    { "CommandArgs.hmset10", bench_command_args_hmset },
+    { "redisFormatCommandArgv.hmset10", bench_redisFormatCommandArgv },
+    { "get_values.vector100", bench_get_values_vector },
+    { "get_values.set100", bench_get_values_set },
+    { "get_values.withscores50", bench_get_values_withscores },
+    { "get_values.map50", bench_get_values_map },
+    { "get_values.hmget50", bench_get_values_hmget },
+    { "get_values.int64_100", bench_get_values_integers },
+    { "get_values.xrange20", bench_get_values_stream_entries },
+    { "get_values.xreadgroup2x10", bench_get_values_streams },
+    { "get_values.stream_batch2x10", bench_get_values_stream_batch },
+    { "parse_cluster_nodes12", bench_parse_cluster_nodes },
+    { "split", bench_split },
+    { "int2string", bench_int2string },
+    { "string2int", bench_string2int },
+    { "strsha1", bench_strsha1 }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+    MicrobenchConfig config;
+    std::vector<BenchmarkResult> results;
+
+    if (!parse_args(argc, argv, &config))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    r3c::set_debug_log_write(null_log_write);
+    r3c::set_info_log_write(null_log_write);
+    r3c::set_error_log_write(null_log_write);
+    if ((config.cpu >= 0) && !pin_cpu(config.cpu))
+    {
+        fprintf(stderr, "pin to cpu %d error: %s\n", config.cpu, strerror(errno));
+        exit(1);
+    }
+
+    init_fixtures();
+    for (size_t i=0; i<sizeof(g_benchmarks)/sizeof(g_benchmarks[0]); ++i)
+    {
+        const Benchmark& benchmark = g_benchmarks[i];
+        if (config.filter.empty() || (strstr(benchmark.name, config.filter.c_str()) != NULL))
+            results.push_back(run_benchmark(config, benchmark));
+    }
+    fini_fixtures();
+
+    report(config, results);
+    return config.baseline.empty()? 0: compare_baseline(config, results);
+}
+
+int64_t get_monotonic_nanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  -c cpu           pin to the cpu, default not to pin\n");
+    fprintf(stderr, "  -r repetitions   default 5\n");
+    fprintf(stderr, "  -t milliseconds  target time of a repetition, default 200\n");
+    fprintf(stderr, "  -f filter        run the benchmarks whose names contain the filter\n");
+    fprintf(stderr, "  -o text|json     default text\n");
+    fprintf(stderr, "  -b baseline      a previous text output, exit 2 if any median regresses more than the threshold\n");
+    fprintf(stderr, "  -x threshold     percent, default 10\n");
+    fprintf(stderr, "Benchmarks:");
+    for (size_t i=0; i<sizeof(g_benchmarks)/sizeof(g_benchmarks[0]); ++i)
+        fprintf(stderr, " %s", g_benchmarks[i].name);
+    fprintf(stderr, "\n");
+}
+
+void null_log_write(const char* UNUSED(format), ...)
+{
+}
+
+bool parse_args(int argc, char* argv[], MicrobenchConfig* config)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:r:t:f:o:b:x:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config->cpu = atoi(optarg);
+            break;
+        case 'r':
+            config->repetitions = atoi(optarg);
+            break;
+        case 't':
+            config->milliseconds = atoi(optarg);
+            break;
+        case 'f':
+            config->filter = optarg;
+            break;
+        case 'o':
+            config->output = optarg;
+            break;
+        case 'b':
+            config->baseline = optarg;
+            break;
+        case 'x':
+            config->threshold = atof(optarg);
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return (config->repetitions > 0) &&
+           (config->milliseconds > 0) &&
+           (config->threshold >= 0) &&
+           (("text" == config->output) || ("json" == config->output));
+}
+
+bool pin_cpu(int cpu)
+{
+    cpu_set_t cpu_set;
+
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return 0 == sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+}
+
+BenchmarkResult run_benchmark(const MicrobenchConfig& config, const Benchmark& benchmark)
+{
+    const int64_t target_ns = static_cast<int64_t>(config.milliseconds) * 1000000;
+    std::vector<double> ns_per_op;
+    BenchmarkResult result;
+    int64_t iterations = 1;
+
+    // Calibrate, which warms up the caches and the branch predictors as well
+    for (;;)
+    {
+        const int64_t start_ns = get_monotonic_nanoseconds();
+        (*benchmark.run)(iterations);
+        const int64_t cost_ns = get_monotonic_nanoseconds() - start_ns;
+
+        if (cost_ns >= target_ns / 10)
+        {
+            iterations = std::max<int64_t>(1, iterations * target_ns / std::max<int64_t>(1, cost_ns));
+            break;
+        }
+        iterations *= 10;
+    }
+    (*benchmark.run)(iterations);
+
+    for (int i=0; i<config.repetitions; ++i)
+    {
+        const int64_t start_ns = get_monotonic_nanoseconds();
+        (*benchmark.run)(iterations);
+        const int64_t cost_ns = get_monotonic_nanoseconds() - start_ns;
+        ns_per_op.push_back(static_cast<double>(cost_ns) / static_cast<double>(iterations));
+    }
+
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    result.name = benchmark.name;
+    result.iterations = iterations;
+    result.min_ns = ns_per_op.front();
+    result.median_ns = ns_per_op[ns_per_op.size() / 2];
+    result.max_ns = ns_per_op.back();
+    return result;
+}
+
+void report(const MicrobenchConfig& config, const std::vector<BenchmarkResult>& results)
+{
+    if ("json" == config.output)
+    {
+        printf("{\"cpu\":%d,\"repetitions\":%d,\"milliseconds\":%d,\"benchmarks\":[",
+                config.cpu, config.repetitions, config.milliseconds);
+        for (std::vector<BenchmarkResult>::size_type i=0; i<results.size(); ++i)
+        {
+            const BenchmarkResult& result = results[i];
+            printf("%s{\"name\":\"%s\",\"iterations\":%" PRId64",\"min_ns\":%.2f,\"median_ns\":%.2f,\"max_ns\":%.2f}",
+                    (0 == i)? "": ",", result.name.c_str(), result.iterations,
+                    result.min_ns, result.median_ns, result.max_ns);
+        }
+        printf("]}\n");
+    }
+    else
+    {
+        // The same columns are read back by compare_baseline
+        printf("# name iterations min_ns median_ns max_ns\n");
+        for (std::vector<BenchmarkResult>::size_type i=0; i<results.size(); ++i)
+        {
+            const BenchmarkResult& result = results[i];
+            printf("%-32s %12" PRId64" %12.2f %12.2f %12.2f\n",
+                    result.name.c_str(), result.iterations,
+                    result.min_ns, result.median_ns, result.max_ns);
+        }
+    }
+}
+
+// Returns 2 if any median regresses more than the threshold
+int compare_baseline(const MicrobenchConfig& config, const std::vector<BenchmarkResult>& results)
+{
+    std::ifstream fs(config.baseline.c_str());
+    std::map<std::string, double> baseline;
+    std::string line;
+    int exit_code = 0;
+
+    if (!fs)
+    {
+        fprintf(stderr, "open %s error: %s\n", config.baseline.c_str(), strerror(errno));
+        return 1;
+    }
+    while (std::getline(fs, line))
+    {
+        std::istringstream is(line);
+        std::string name;
+        int64_t iterations;
+        double min_ns, median_ns;
+
+        if (line.empty() || ('#' == line[0]))
+            continue;
+        if (is >> name >> iterations >> min_ns >> median_ns)
+            baseline[name] = median_ns;
+    }
+
+    for (std::vector<BenchmarkResult>::size_type i=0; i<results.size(); ++i)
+    {
+        const BenchmarkResult& result = results[i];
+        const std::map<std::string, double>::const_iterator iter = baseline.find(result.name);
+
+        if ((iter != baseline.end()) && (iter->second > 0))
+        {
+            const double change = (result.median_ns - iter->second) * 100 / iter->second;
+            const bool regressed = change > config.threshold;
+
+            fprintf(stderr, "%s%-32s %12.2f => %12.2f (%+.1f%%)%s\n",
+                    regressed? PRINT_COLOR_RED: "", result.name.c_str(), iter->second, result.median_ns, change,
+                    regressed? PRINT_COLOR_NONE: "");
+            if (regressed)
+                exit_code = 2;
+        }
+    }
+    return exit_code;
+}
@@ -0,0 +1,1093 @@
+// Test the routing, retry and refresh against the in-process mock cluster,
+// needs no live redis cluster.
+//
+// Usage: r3c_mock
+#include "mock_cluster.h"
+#include "r3c.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+
+#define TIPS_PRINT() tips_print(__FUNCTION__)
+#define ERROR_PRINT(format, ...) \
+    do { sg_faild_cases.push_back(__FUNCTION__); error_print(__FILE__, __LINE__, __FUNCTION__, format, __VA_ARGS__); } while(false)
+#define SUCCESS_PRINT(format, ...) \
+    do { sg_success_cases.push_back(__FUNCTION__); success_print(__FILE__, __LINE__, __FUNCTION__, format, __VA_ARGS__); } while(false)
+
+static std::vector<std::string> sg_success_cases;
+static std::vector<std::string> sg_faild_cases;
+
+static void tips_print(const char* function);
+static void error_print(const char* file, int line, const char* function, const char* format, ...);
+static void success_print(const char* file, int line, const char* function, const char* format, ...);
+static void null_log_write(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static void test_routing(r3c::MockCluster& cluster);
+static void test_moved(r3c::MockCluster& cluster);
+static void test_ask(r3c::MockCluster& cluster);
+static void test_clusterdown(r3c::MockCluster& cluster);
+static void test_timeout(r3c::MockCluster& cluster);
+static void test_connection_killed(r3c::MockCluster& cluster);
+static void test_read_replica(r3c::MockCluster& cluster);
+static void test_hedged_reads(r3c::MockCluster& cluster);
+static void test_blocking_replica(r3c::MockCluster& cluster);
+static void test_pipeline(r3c::MockCluster& cluster);
+static void test_metrics(r3c::MockCluster& cluster);
+static void test_openmetrics(r3c::MockCluster& cluster);
+static void test_command_span(r3c::MockCluster& cluster);
+static void test_slowlog(r3c::MockCluster& cluster);
+static void test_fault_injector(r3c::MockCluster& cluster);
+static void test_accounting(r3c::MockCluster& cluster);
+static void test_node_stats(r3c::MockCluster& cluster);
+
+int main(int argc, char* argv[])
+{
+    (void)argc;
+    (void)argv;
+    r3c::set_debug_log_write(null_log_write);
+    r3c::set_info_log_write(null_log_write);
+    r3c::set_error_log_write(null_log_write);
+
+    try
+    {
+        r3c::MockCluster cluster(3, 1);
+        cluster.start();
+        fprintf(stdout, "mock cluster: %s\n", cluster.get_nodes_string().c_str());
+
+        test_routing(cluster);
+        test_moved(cluster);
+        test_ask(cluster);
+        test_clusterdown(cluster);
+        test_timeout(cluster);
+        test_connection_killed(cluster);
+        test_read_replica(cluster);
+        test_hedged_reads(cluster);
+        test_blocking_replica(cluster);
+        test_pipeline(cluster);
+        test_metrics(cluster);
+        test_openmetrics(cluster);
+        test_command_span(cluster);
+        test_slowlog(cluster);
+        test_fault_injector(cluster);
+        test_accounting(cluster);
+        test_node_stats(cluster);
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        fprintf(stderr, "%s\n", ex.str().c_str());
+        return 1;
+    }
+
+    printf("\n");
+    for (std::vector<std::string>::size_type i=0; i<sg_faild_cases.size(); ++i)
+    {
+        const char* function = sg_faild_cases[i].c_str();
+        error_print(__FILE__, __LINE__, function, "%s", "FAILED");
+    }
+    printf("TOTAL SUCCESS: %zd, FAILED: %zd\n", sg_success_cases.size(), sg_faild_cases.size());
+    return sg_faild_cases.empty()? 0: 1;
+}
+
+void tips_print(const char* function)
+{
+    fprintf(stdout, "\n========%s========\n", function);
+}
+
+void error_print(const char* file, int line, const char* function, const char* format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+
+    printf(PRINT_COLOR_RED"[%s:%d][%s]", file, line, function);
+    vprintf(format ,ap);
+    printf(PRINT_COLOR_NONE);
+    printf("\n");
+    va_end(ap);
+}
+
+void success_print(const char* file, int line, const char* function, const char* format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+
+    printf(PRINT_COLOR_YELLOW"[%s:%d][%s]", file, line, function);
+    vprintf(format ,ap);
+    printf(PRINT_COLOR_NONE);
+    printf("\n");
+    va_end(ap);
+}
+
+void null_log_write(const char* format, ...)
+{
+    (void)format;
+}
+
+// Keys spread over all masters, and each master receives the commands of its keys only
+void test_routing(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        std::vector<uint64_t> num_commands(cluster.num_masters());
+        std::string value;
+
+        for (int i=0; i<cluster.num_masters(); ++i)
+            num_commands[i] = cluster.get_num_commands(i);
+        for (int i=0; i<100; ++i)
+        {
+            const std::string key = r3c::format_string("r3c_mock_%d", i);
+            const std::string hash_key = key + "_h";
+
+            rc.set(key, r3c::int2string(i));
+            if (!rc.get(key, &value) || value!=r3c::int2string(i))
+            {
+                ERROR_PRINT("%s: %s", key.c_str(), value.c_str());
+                return;
+            }
+            if (rc.incrby(key, 1) != i+1 || !rc.hset(hash_key, "f", "v"))
+            {
+                ERROR_PRINT("%s: incrby or hset", key.c_str());
+                return;
+            }
+            num_commands[cluster.get_slot_owner(r3c::get_key_slot(&key))] += 3;
+            num_commands[cluster.get_slot_owner(r3c::get_key_slot(&hash_key))] += 1;
+        }
+        for (int i=0; i<cluster.num_masters(); ++i)
+        {
+            // Exactly except the commands like CLUSTER NODES
+            if (cluster.get_num_commands(i) < num_commands[i] || cluster.get_num_commands(i) > num_commands[i]+10)
+            {
+                ERROR_PRINT("master%d: %d", i, static_cast<int>(cluster.get_num_commands(i)));
+                return;
+            }
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// The slot table is refreshed after MOVED
+void test_moved(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_moved";
+        const int slot = r3c::get_key_slot(&key);
+        const int owner = cluster.get_slot_owner(slot);
+        const int new_owner = (owner + 1) % cluster.num_masters();
+        std::string value;
+
+        rc.set(key, "v1");
+        cluster.move_slot(slot, new_owner);
+        const uint64_t num_commands = cluster.get_num_commands(new_owner);
+        if (!rc.get(key, &value) || value!="v1")
+        {
+            ERROR_PRINT("get: %s", value.c_str());
+            return;
+        }
+        rc.set(key, "v2");
+        if (cluster.get_num_commands(new_owner) <= num_commands)
+        {
+            ERROR_PRINT("%s", "not routed to the new owner");
+            return;
+        }
+        cluster.move_slot(slot, owner);
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// ASKING is sent to the importing node, and the slot table stays
+void test_ask(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_ask";
+        const int slot = r3c::get_key_slot(&key);
+        const int owner = cluster.get_slot_owner(slot);
+        const int importing = (owner + 1) % cluster.num_masters();
+        std::string value;
+
+        rc.set(key, "v1");
+        cluster.set_ask(slot, importing);
+        const uint64_t num_commands = cluster.get_num_commands(importing);
+        if (!rc.get(key, &value) || value!="v1")
+        {
+            cluster.set_ask(slot, -1);
+            ERROR_PRINT("get: %s", value.c_str());
+            return;
+        }
+        cluster.set_ask(slot, -1);
+        if (cluster.get_num_commands(importing) < num_commands+2) // ASKING and GET
+        {
+            ERROR_PRINT("%s", "ASKING not sent");
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// CLUSTERDOWN is retried, and thrown after the retries are used up
+void test_clusterdown(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_clusterdown";
+        const int owner = cluster.get_slot_owner(r3c::get_key_slot(&key));
+        std::string value;
+
+        rc.set(key, "v1");
+        cluster.inject_error(owner, "CLUSTERDOWN The cluster is down", 1);
+        if (!rc.get(key, &value, NULL, 2) || value!="v1")
+        {
+            ERROR_PRINT("get: %s", value.c_str());
+            return;
+        }
+
+        cluster.inject_error(owner, "CLUSTERDOWN The cluster is down", 100);
+        try
+        {
+            rc.get(key, &value, NULL, 0);
+            cluster.inject_error(owner, "", 0);
+            ERROR_PRINT("%s", "no exception");
+            return;
+        }
+        catch (r3c::CRedisException& ex)
+        {
+            cluster.inject_error(owner, "", 0);
+            if (!r3c::is_clusterdown_error(ex.errtype()))
+            {
+                ERROR_PRINT("ERROR: %s", ex.str().c_str());
+                return;
+            }
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// Read timeout by latency and no reply, and the client recovers
+void test_timeout(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string(), 1000, 100);
+        const std::string key = "r3c_mock_timeout";
+        const int owner = cluster.get_slot_owner(r3c::get_key_slot(&key));
+        std::string value;
+
+        rc.set(key, "v1");
+        cluster.set_latency(owner, 50);
+        if (!rc.get(key, &value) || value!="v1")
+        {
+            cluster.set_latency(owner, 0);
+            ERROR_PRINT("get: %s", value.c_str());
+            return;
+        }
+
+        cluster.set_blackhole(owner, true);
+        try
+        {
+            rc.get(key, &value, NULL, 0);
+            cluster.set_blackhole(owner, false);
+            cluster.set_latency(owner, 0);
+            ERROR_PRINT("%s", "no exception");
+            return;
+        }
+        catch (r3c::CRedisException& ex)
+        {
+            // Resource temporarily unavailable
+            cluster.set_blackhole(owner, false);
+            cluster.set_latency(owner, 0);
+            fprintf(stdout, "%s\n", ex.str().c_str());
+        }
+        if (!rc.get(key, &value) || value!="v1")
+        {
+            ERROR_PRINT("get after timeout: %s", value.c_str());
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// The connection is reestablished after killed
+void test_connection_killed(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_killed";
+        const int owner = cluster.get_slot_owner(r3c::get_key_slot(&key));
+        std::string value;
+
+        rc.set(key, "v1");
+        cluster.kill_connections(owner);
+        if (!rc.get(key, &value, NULL, 1) || value!="v1")
+        {
+            ERROR_PRINT("get: %s", value.c_str());
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// Reads are served by the replicas with RP_READ_REPLICA
+void test_read_replica(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string(), r3c::RP_READ_REPLICA);
+        std::vector<uint64_t> num_commands(cluster.num_nodes());
+        uint64_t num_replica_commands = 0;
+        std::string value;
+
+        for (int i=0; i<cluster.num_nodes(); ++i)
+            num_commands[i] = cluster.get_num_commands(i);
+        for (int i=0; i<100; ++i)
+        {
+            const std::string key = r3c::format_string("r3c_mock_%d", i);
+            if (!rc.get(key, &value) || value!=r3c::int2string(i+1))
+            {
+                ERROR_PRINT("%s: %s", key.c_str(), value.c_str());
+                return;
+            }
+        }
+        for (int i=cluster.num_masters(); i<cluster.num_nodes(); ++i)
+            num_replica_commands += cluster.get_num_commands(i) - num_commands[i];
+        if (0 == num_replica_commands)
+        {
+            ERROR_PRINT("%s", "no read on replicas");
+            return;
+        }
+        SUCCESS_PRINT("%d commands on replicas", static_cast<int>(num_replica_commands));
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// The reads after a hedge lost by a slow replica are not blocked by the reply left on it
+void test_hedged_reads(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string(), r3c::RP_READ_REPLICA);
+        const std::string key = "r3c_mock_hedge";
+        const int replica = cluster.num_masters() + cluster.get_slot_owner(r3c::get_key_slot(&key));
+        std::string value;
+        int64_t start_milliseconds, cost_milliseconds;
+
+        rc.set(key, "hedged");
+        rc.enable_hedged_reads(50, 0);
+        for (int i=0; i<200; ++i)
+            rc.get(key, &value);
+
+        cluster.set_latency(replica, 300);
+        start_milliseconds = r3c::get_monotonic_milliseconds();
+        for (int i=0; i<10; ++i)
+        {
+            if (!rc.get(key, &value) || value!="hedged")
+            {
+                cluster.set_latency(replica, 0);
+                ERROR_PRINT("get: %s", value.c_str());
+                return;
+            }
+        }
+        cost_milliseconds = r3c::get_monotonic_milliseconds() - start_milliseconds;
+        cluster.set_latency(replica, 0);
+        if (0==rc.get_num_hedge_wins() || cost_milliseconds>=300)
+        {
+            ERROR_PRINT("hedges: %" PRIu64 ", wins: %" PRIu64 ", cost: %" PRId64 "ms",
+                    rc.get_num_hedges(), rc.get_num_hedge_wins(), cost_milliseconds);
+            return;
+        }
+        SUCCESS_PRINT("hedges: %" PRIu64 ", wins: %" PRIu64 ", cost: %" PRId64 "ms",
+                rc.get_num_hedges(), rc.get_num_hedge_wins(), cost_milliseconds);
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// A blocking read routed to a replica runs on a READONLY connection, so it is not MOVED
+void test_blocking_replica(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string(), r3c::RP_READ_REPLICA);
+        const std::string key = "r3c_mock_blocking";
+        const int replica = cluster.num_masters() + cluster.get_slot_owner(r3c::get_key_slot(&key));
+        const uint64_t num_commands = cluster.get_num_commands(replica);
+        r3c::ClientMetrics metrics;
+
+        rc.set(key, "blocking");
+        for (int i=0; i<4; ++i)
+        {
+            r3c::CommandArgs cmd_args;
+            cmd_args.set_key(key);
+            cmd_args.set_command("GET");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            cmd_args.set_block_milliseconds(100);
+            cmd_args.final();
+
+            const r3c::RedisReplyHelper redis_reply = rc.redis_command(true, 0, key, cmd_args, NULL);
+            if (!redis_reply || redis_reply->type!=REDIS_REPLY_STRING || std::string(redis_reply->str, redis_reply->len)!="blocking")
+            {
+                ERROR_PRINT("%s", "reply error");
+                return;
+            }
+        }
+        rc.get_metrics(&metrics);
+        if (metrics.num_moved!=0 || cluster.get_num_commands(replica)==num_commands)
+        {
+            ERROR_PRINT("moved: %" PRIu64 ", commands on replica: %" PRIu64, metrics.num_moved, cluster.get_num_commands(replica)-num_commands);
+            return;
+        }
+        SUCCESS_PRINT("%" PRIu64 " commands on replica", cluster.get_num_commands(replica)-num_commands);
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// Pipelining across nodes, with a slot moved
+void test_pipeline(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string moved_key = "r3c_mock_0";
+        const int slot = r3c::get_key_slot(&moved_key);
+        const int owner = cluster.get_slot_owner(slot);
+        r3c::Pipeline pipeline;
+
+        for (int i=0; i<100; ++i)
+        {
+            r3c::CommandArgs cmd_args;
+            const std::string key = r3c::format_string("r3c_mock_%d", i);
+            cmd_args.set_key(key);
+            cmd_args.set_command("GET");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+        cluster.move_slot(slot, (owner + 1) % cluster.num_masters());
+        const int num_succeeded = rc.pipeline(&pipeline, 10, 1);
+        cluster.move_slot(slot, owner);
+        if (num_succeeded != 100)
+        {
+            ERROR_PRINT("%d succeeded", num_succeeded);
+            return;
+        }
+        for (int i=0; i<100; ++i)
+        {
+            const redisReply* redis_reply = pipeline.get_reply(i);
+            if (NULL==redis_reply || REDIS_REPLY_STRING!=redis_reply->type || r3c::int2string(i+1)!=redis_reply->str)
+            {
+                ERROR_PRINT("%d: %s", i, pipeline.get_errinfo(i).errmsg.c_str());
+                return;
+            }
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// The latencies are recorded per node and command, and the redirects and retries are counted
+void test_metrics(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_metrics";
+        const int slot = r3c::get_key_slot(&key);
+        const int owner = cluster.get_slot_owner(slot);
+        const int new_owner = (owner + 1) % cluster.num_masters();
+        r3c::LatencyHistogram histogram;
+        r3c::ClientMetrics metrics;
+        uint64_t num_gets = 0;
+        std::string value;
+
+        for (int i=1; i<=1000; ++i)
+            histogram.record(i);
+        if (histogram.count()!=1000 || histogram.max()!=1000 ||
+            histogram.percentile(50)<500 || histogram.percentile(50)>500*9/8 || histogram.percentile(100)!=1000)
+        {
+            ERROR_PRINT("histogram: p50=%" PRId64", p100=%" PRId64, histogram.percentile(50), histogram.percentile(100));
+            return;
+        }
+
+        rc.reset_metrics();
+        rc.set(key, "v1");
+        for (int i=0; i<10; ++i)
+            rc.get(key, &value);
+        cluster.move_slot(slot, new_owner);
+        rc.get(key, &value);
+        cluster.move_slot(slot, owner);
+        rc.get(key, &value);
+
+        rc.get_metrics(&metrics);
+        if (metrics.num_moved<2 || metrics.num_retries<2 || metrics.num_refreshes<2)
+        {
+            ERROR_PRINT("moved: %" PRIu64", retries: %" PRIu64", refreshes: %" PRIu64,
+                    metrics.num_moved, metrics.num_retries, metrics.num_refreshes);
+            return;
+        }
+        for (std::vector<r3c::CommandMetrics>::size_type i=0; i<metrics.commands.size(); ++i)
+        {
+            const r3c::CommandMetrics& command_metrics = metrics.commands[i];
+            if (command_metrics.command == "GET")
+                num_gets += command_metrics.latency.count();
+            if (command_metrics.node==cluster.get_node(owner) && command_metrics.command=="GET" &&
+                (command_metrics.latency.count()<11 || command_metrics.num_errors<1))
+            {
+                ERROR_PRINT("GET on master%d: %" PRIu64" attempts, %" PRIu64" errors",
+                        owner, command_metrics.latency.count(), command_metrics.num_errors);
+                return;
+            }
+        }
+        if (num_gets != 14) // 10 + (MOVED + GET) + (MOVED + GET)
+        {
+            ERROR_PRINT("%" PRIu64" attempts of GET", num_gets);
+            return;
+        }
+
+        rc.reset_metrics();
+        rc.get_metrics(&metrics);
+        if (metrics.num_moved!=0 || metrics.commands.empty() || metrics.commands[0].latency.count()!=0)
+        {
+            ERROR_PRINT("%s", "not reset");
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// Fetch the metrics over HTTP, returns the body
+static std::string http_get(uint16_t port)
+{
+    const char request[] = "GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    struct sockaddr_in addr;
+    std::string response;
+    char buf[4096];
+    ssize_t n;
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (-1 == connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+        static_cast<ssize_t>(sizeof(request)-1) != write(fd, request, sizeof(request)-1))
+    {
+        close(fd);
+        return response;
+    }
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        response.append(buf, n);
+    close(fd);
+
+    const std::string::size_type pos = response.find("\r\n\r\n");
+    return (pos == std::string::npos)? std::string(""): response.substr(pos+4);
+}
+
+// The metrics are rendered in OpenMetrics text format, and served over HTTP
+void test_openmetrics(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_openmetrics";
+        const int slot = r3c::get_key_slot(&key);
+        const int owner = cluster.get_slot_owner(slot);
+        const std::string node = r3c::node2string(cluster.get_node(owner));
+        r3c::MetricsServer metrics_server;
+        std::string text;
+        std::string value;
+
+        rc.set(key, "v1");
+        cluster.move_slot(slot, (owner + 1) % cluster.num_masters());
+        rc.get(key, &value);
+        cluster.move_slot(slot, owner);
+        rc.get(key, &value);
+
+        text = rc.get_openmetrics();
+        if (text.find("# TYPE r3c_command_duration_seconds histogram\n") == std::string::npos ||
+            text.find(r3c::format_string("r3c_command_duration_seconds_count{node=\"%s\",command=\"SET\"} 1\n", node.c_str())) == std::string::npos ||
+            text.find("r3c_redirects_total{type=\"moved\"} 2\n") == std::string::npos ||
+            text.find(r3c::format_string("r3c_masters %d\n", cluster.num_masters())) == std::string::npos ||
+            text.find("r3c_unmapped_slots 0\n") == std::string::npos ||
+            text.size()<6 || text.substr(text.size()-6)!="# EOF\n")
+        {
+            ERROR_PRINT("%s", text.c_str());
+            return;
+        }
+
+        metrics_server.add_client(&rc);
+        metrics_server.start();
+        text = http_get(metrics_server.get_port());
+        metrics_server.stop();
+        if (text.find("r3c_redirects_total{type=\"moved\"} 2\n")==std::string::npos || metrics_server.get_num_requests()!=1)
+        {
+            ERROR_PRINT("%s", text.c_str());
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+class SpanMonitor: public r3c::CommandMonitor
+{
+public:
+    virtual void before_execute(const r3c::Node& node, const std::string& command, const r3c::CommandArgs& command_args, bool readonly)
+    {
+        (void)node; (void)command; (void)command_args; (void)readonly;
+    }
+
+    virtual void after_execute(int result, const r3c::Node& node, const std::string& command, const redisReply* reply)
+    {
+        (void)result; (void)node; (void)command; (void)reply;
+    }
+
+    virtual void on_attempt(const r3c::CommandSpan& span)
+    {
+        attempts.push_back(span);
+    }
+
+    virtual void on_command(const r3c::CommandSpan& span)
+    {
+        commands.push_back(span);
+    }
+
+    std::vector<r3c::CommandSpan> attempts;
+    std::vector<r3c::CommandSpan> commands;
+};
+
+// Each attempt is reported with the node, the retry reason and the byte counts
+void test_command_span(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_monitor";
+        const int slot = r3c::get_key_slot(&key);
+        const int owner = cluster.get_slot_owner(slot);
+        const int importing = (owner + 1) % cluster.num_masters();
+        const size_t get_bytes = sizeof("*2\r\n$3\r\nGET\r\n$16\r\nr3c_mock_monitor\r\n") - 1;
+        const size_t reply_bytes = sizeof("$2\r\nv1\r\n") - 1;
+        SpanMonitor monitor;
+        std::string value;
+
+        rc.set(key, "v1");
+        rc.set_command_monitor(&monitor);
+        cluster.set_ask(slot, importing);
+        rc.get(key, &value);
+        cluster.set_ask(slot, -1);
+        rc.set_command_monitor(NULL);
+
+        if (monitor.attempts.size()!=2 || monitor.commands.size()!=1)
+        {
+            ERROR_PRINT("%d attempts, %d commands", static_cast<int>(monitor.attempts.size()), static_cast<int>(monitor.commands.size()));
+            return;
+        }
+        const r3c::CommandSpan& first = monitor.attempts[0];
+        const r3c::CommandSpan& second = monitor.attempts[1];
+        const r3c::CommandSpan& command = monitor.commands[0];
+        if (first.node!=cluster.get_node(owner) || first.result!=r3c::CRedisClient::HR_REDIRECT || first.errtype!="ASK" ||
+            first.slot!=slot || first.replica || first.request_bytes!=get_bytes)
+        {
+            ERROR_PRINT("first attempt: %s %d %s %d bytes", r3c::node2string(first.node).c_str(),
+                    first.result, first.errtype.c_str(), static_cast<int>(first.request_bytes));
+            return;
+        }
+        if (second.node!=cluster.get_node(importing) || second.result!=r3c::CRedisClient::HR_SUCCESS || second.attempt!=1 ||
+            second.num_redirects!=1 || second.request_bytes!=get_bytes+16 || second.reply_bytes!=reply_bytes)
+        {
+            ERROR_PRINT("second attempt: %s %d %d bytes", r3c::node2string(second.node).c_str(),
+                    second.result, static_cast<int>(second.request_bytes));
+            return;
+        }
+        if (command.attempt!=2 || command.num_redirects!=1 || command.result!=r3c::CRedisClient::HR_SUCCESS ||
+            command.start_us>first.start_us || command.stop_us<second.stop_us || command.request_bytes!=get_bytes*2+16)
+        {
+            ERROR_PRINT("command: %d attempts, %d redirects, %d", command.attempt, command.num_redirects, command.result);
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// The slow commands and the sampled ones are kept in the slow log
+void test_slowlog(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_slowlog_with_a_long_key";
+        const int owner = cluster.get_slot_owner(r3c::get_key_slot(&key));
+        std::vector<r3c::SlowLogEntry> entries;
+        std::string value;
+
+        rc.set(key, "v1");
+        rc.enable_slowlog(10000, 2, 0, 16);
+        for (int i=0; i<10; ++i)
+            rc.get(key, &value);
+        cluster.set_latency(owner, 20);
+        rc.get(key, &value);
+        rc.get(key, &value);
+        rc.get(key, &value);
+        cluster.set_latency(owner, 0);
+
+        if (rc.get_slowlog(&entries) != 2) // The oldest slow one is evicted
+        {
+            ERROR_PRINT("%d entries", static_cast<int>(entries.size()));
+            return;
+        }
+        if (entries[0].id!=2 || entries[1].id!=1 || entries[0].command!="GET" || entries[0].key!=key.substr(0, 16) ||
+            entries[0].cost_us<10000 || entries[0].attempts_cost_us.size()!=1 || entries[0].sampled ||
+            entries[0].node!=cluster.get_node(owner) || entries[0].reply_bytes!=sizeof("$2\r\nv1\r\n")-1)
+        {
+            std::cout << entries[0] << std::endl;
+            ERROR_PRINT("%s", "entry error");
+            return;
+        }
+
+        rc.enable_slowlog(1000000, 10, 2);
+        for (int i=0; i<10; ++i)
+            rc.get(key, &value);
+        if (rc.get_slowlog(&entries) != 5 || !entries[0].sampled)
+        {
+            ERROR_PRINT("%d sampled", static_cast<int>(entries.size()));
+            return;
+        }
+        rc.reset_slowlog();
+        if (rc.get_slowlog(&entries) != 0)
+        {
+            ERROR_PRINT("%d entries after reset", static_cast<int>(entries.size()));
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// Injects the faults in order, one per command, and fails the connects as many as required
+class ScriptedFaultInjector: public r3c::FaultInjector
+{
+public:
+    ScriptedFaultInjector(): num_connect_failures(0) {}
+    virtual bool on_connect(const r3c::Node&)
+    {
+        if (num_connect_failures <= 0)
+            return false;
+        --num_connect_failures;
+        return true;
+    }
+    virtual int on_command(const r3c::Node&, const r3c::CommandArgs&)
+    {
+        if (faults.empty())
+            return FAULT_NONE;
+        const int fault = faults.front();
+        faults.pop_front();
+        return fault;
+    }
+
+public:
+    std::deque<int> faults;
+    int num_connect_failures;
+};
+
+// Each fault is retried transparently, and counted as the real one
+void test_fault_injector(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_fault";
+        const int faults[] =
+        {
+            r3c::FaultInjector::FAULT_TIMEOUT,
+            r3c::FaultInjector::FAULT_EOF,
+            r3c::FaultInjector::FAULT_PARTIAL_READ,
+            r3c::FaultInjector::FAULT_MOVED,
+            r3c::FaultInjector::FAULT_CLUSTERDOWN
+        };
+        ScriptedFaultInjector scripted;
+        r3c::RandomFaultInjector random_injector(2019);
+        r3c::ClientMetrics metrics;
+        std::string value;
+
+        rc.set(key, "0123456789abcdef");
+        rc.set_fault_injector(&scripted);
+        for (size_t i=0; i<sizeof(faults)/sizeof(faults[0]); ++i)
+        {
+            scripted.faults.push_back(faults[i]);
+            if (r3c::FaultInjector::FAULT_EOF == faults[i])
+                scripted.num_connect_failures = 1; // The reconnect fails once too
+            if (!rc.get(key, &value) || value!="0123456789abcdef" || !scripted.faults.empty() || scripted.num_connect_failures!=0)
+            {
+                ERROR_PRINT("%s: %s", r3c::RandomFaultInjector::get_fault_name(faults[i]), value.c_str());
+                return;
+            }
+        }
+        rc.get_metrics(&metrics);
+        if (metrics.num_timeouts!=1 || metrics.num_moved!=1 || metrics.num_reconnects<2 || metrics.num_refreshes<1)
+        {
+            ERROR_PRINT("timeouts: %" PRIu64", moved: %" PRIu64", reconnects: %" PRIu64", refreshes: %" PRIu64,
+                    metrics.num_timeouts, metrics.num_moved, metrics.num_reconnects, metrics.num_refreshes);
+            return;
+        }
+
+        if (random_injector.set_probabilities("eof=0.1,bad=0.1") ||
+            random_injector.set_probabilities("eof=2") ||
+            !random_injector.set_probabilities("eof=0.05,partial_read=0.5,clusterdown=0.01:3") ||
+            random_injector.get_probability(r3c::FaultInjector::FAULT_PARTIAL_READ) != 0.5)
+        {
+            ERROR_PRINT("%s", "set_probabilities error");
+            return;
+        }
+        rc.set_fault_injector(&random_injector);
+        for (int i=0; i<200; ++i)
+        {
+            const std::string k = r3c::format_string("r3c_mock_fault_%d", i);
+            rc.set(k, r3c::int2string(i));
+            if (!rc.get(k, &value) || value!=r3c::int2string(i))
+            {
+                ERROR_PRINT("%s: %s", k.c_str(), value.c_str());
+                return;
+            }
+        }
+        rc.set_fault_injector(NULL);
+        if (random_injector.get_num_faults(r3c::FaultInjector::FAULT_PARTIAL_READ) == 0 ||
+            random_injector.get_num_faults() == 0)
+        {
+            ERROR_PRINT("%" PRIu64" faults", random_injector.get_num_faults());
+            return;
+        }
+        SUCCESS_PRINT("%" PRIu64" faults", random_injector.get_num_faults());
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// The copies of a 100 bytes value are modelled at each layer,
+// and no allocation is counted as r3c_mock is not linked with the allocation hook
+void test_accounting(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_accounting";
+        const std::string value100(100, 'v');
+        const r3c::Node node = cluster.get_node(cluster.get_slot_owner(r3c::get_key_slot(&key)));
+        r3c::ClientMetrics metrics;
+        r3c::CommandCost set_cost, get_cost;
+        std::string value;
+
+        rc.set(key, value100); // Not accounted
+        rc.enable_accounting();
+        rc.set(key, value100);
+        rc.get(key, &value);
+        rc.disable_accounting(); // Adds the copies of get_value
+        rc.get(key, &value);
+
+        rc.get_metrics(&metrics);
+        for (std::vector<r3c::CommandMetrics>::size_type i=0; i<metrics.commands.size(); ++i)
+        {
+            if (metrics.commands[i].node != node)
+                continue;
+            if ("SET" == metrics.commands[i].command)
+                set_cost = metrics.commands[i].cost;
+            else if ("GET" == metrics.commands[i].command)
+                get_cost = metrics.commands[i].cost;
+        }
+        // SET: CommandArgs::add_arg, final, format and append to the output buffer
+        // GET: read buffer, reply object, get_value
+        if (set_cost.num_commands!=1 || set_cost.num_writes!=1 || set_cost.num_reads<1 || set_cost.modelled_copied_bytes<400 ||
+            get_cost.num_commands!=1 || get_cost.num_writes!=1 || get_cost.num_reads<1 || get_cost.modelled_copied_bytes<300)
+        {
+            ERROR_PRINT("SET: %" PRIu64"/%" PRIu64"/%" PRIu64"/%" PRIu64", GET: %" PRIu64"/%" PRIu64"/%" PRIu64"/%" PRIu64,
+                    set_cost.num_commands, set_cost.modelled_copied_bytes, set_cost.num_reads, set_cost.num_writes,
+                    get_cost.num_commands, get_cost.modelled_copied_bytes, get_cost.num_reads, get_cost.num_writes);
+            return;
+        }
+        if (set_cost.num_allocations!=0 || get_cost.num_allocations!=0)
+        {
+            ERROR_PRINT("SET: %" PRIu64"/%" PRIu64", GET: %" PRIu64"/%" PRIu64,
+                    set_cost.num_allocations, set_cost.allocated_bytes, get_cost.num_allocations, get_cost.allocated_bytes);
+            return;
+        }
+        if (rc.get_openmetrics().find("r3c_command_modelled_copied_bytes_total{node=\"" + r3c::node2string(node) + "\",command=\"GET\"}") == std::string::npos)
+        {
+            ERROR_PRINT("%s", "no costs rendered");
+            return;
+        }
+        SUCCESS_PRINT("SET copied %" PRIu64" bytes, GET copied %" PRIu64" bytes", set_cost.modelled_copied_bytes, get_cost.modelled_copied_bytes);
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+// The bytes, the replies and the reconnects are counted per node
+void test_node_stats(r3c::MockCluster& cluster)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(cluster.get_nodes_string());
+        const std::string key = "r3c_mock_node_stats";
+        const std::string value100(100, 'v');
+        const int owner = cluster.get_slot_owner(r3c::get_key_slot(&key));
+        const r3c::Node node = cluster.get_node(owner);
+        std::vector<r3c::NodeStats> nodes_stats;
+        r3c::NodeStats node_stats;
+        r3c::Pipeline pipeline;
+        std::string value;
+
+        rc.set(key, value100); // "*3\r\n$3\r\nSET\r\n$19\r\nr3c_mock_node_stats\r\n$100\r\n...\r\n" and "+OK\r\n"
+        rc.get(key, &value);   // "*2\r\n$3\r\nGET\r\n$19\r\nr3c_mock_node_stats\r\n" and "$100\r\n...\r\n"
+        for (int i=0; i<10; ++i)
+        {
+            r3c::CommandArgs cmd_args;
+            cmd_args.set_key(key);
+            cmd_args.set_command("GET");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+        rc.pipeline(&pipeline);
+
+        rc.get_node_stats(&nodes_stats);
+        for (std::vector<r3c::NodeStats>::size_type i=0; i<nodes_stats.size(); ++i)
+        {
+            if (nodes_stats[i].node == node)
+                node_stats = nodes_stats[i];
+        }
+        if (!node_stats.master || node_stats.bytes_sent!=(147+39*11) || node_stats.bytes_received!=(5+108*11) ||
+            node_stats.num_replies!=12 || node_stats.inflight!=0 || node_stats.num_connections!=1 || node_stats.num_connects!=1 ||
+            node_stats.connection_age_milliseconds(r3c::get_current_milliseconds()) < 0)
+        {
+            ERROR_PRINT("%s", node_stats.str().c_str());
+            return;
+        }
+
+        cluster.kill_connections(owner);
+        if (!rc.get(key, &value, NULL, 1) || value!=value100)
+        {
+            ERROR_PRINT("get: %s", value.c_str());
+            return;
+        }
+        rc.get_node_stats(&nodes_stats);
+        for (std::vector<r3c::NodeStats>::size_type i=0; i<nodes_stats.size(); ++i)
+        {
+            if (nodes_stats[i].node == node)
+                node_stats = nodes_stats[i];
+        }
+        if (node_stats.num_reconnects!=1 || node_stats.reconnect_milliseconds.size()!=1 || node_stats.num_connects!=2 ||
+            node_stats.num_connections!=1 || node_stats.inflight!=0 || node_stats.last_error.empty())
+        {
+            ERROR_PRINT("%s", node_stats.str().c_str());
+            return;
+        }
+        if (rc.get_openmetrics().find("r3c_node_inflight_commands{node=\"" + r3c::node2string(node) + "\"} 0") == std::string::npos)
+        {
+            ERROR_PRINT("%s", "no node stats rendered");
+            return;
+        }
+        SUCCESS_PRINT("%s average reply size: %.1f", node_stats.str().c_str(), node_stats.average_reply_size());
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
@@ -22,7 +22,7 @@ int main(int argc, char* argv[])
         try
         {
             const int n = atoi(argv[2]);
-            const int num_testcases = 10;
+            const int num_testcases = 12;
             TESTCASE testcase[num_testcases];
             r3c::CRedisClient redis(argv[1], r3c::RP_READ_REPLICA);
             init_testcase(testcase);
@@ -352,6 +352,164 @@ static void testcase7(r3c::CRedisClient& redis)
     }
 }
 
+// test xadd in batch
+static void testcase8(r3c::CRedisClient& redis)
+{
+    std::vector<r3c::Stream> streams(3);
+    std::vector<std::string> ids;
+    std::vector<r3c::StreamEntry> entries;
+
+    for (int i=0; i<static_cast<int>(streams.size()); ++i)
+    {
+        streams[i].key = r3c::format_string("k%d", i);
+        streams[i].entries.resize(100);
+        for (int j=0; j<static_cast<int>(streams[i].entries.size()); ++j)
+        {
+            r3c::FVPair fvpair;
+            fvpair.field = "f";
+            fvpair.value = r3c::int2string(j);
+            streams[i].entries[j].fvpairs.push_back(fvpair);
+        }
+        redis.del(streams[i].key);
+    }
+
+    const int n = redis.xadd(streams, &ids, 1000);
+    fprintf(stdout, "added: %d/%d\n", n, static_cast<int>(ids.size()));
+    for (int i=0; i<static_cast<int>(streams.size()); ++i)
+    {
+        redis.xrange(streams[i].key, "-", "+", &entries);
+        for (int j=0; j<static_cast<int>(entries.size()); ++j)
+        {
+            // The IDs are returned in the order of entries
+            if (entries[j].id!=ids[i*100+j] || entries[j].fvpairs[0].value!=r3c::int2string(j))
+            {
+                fprintf(stderr, "%s: %s != %s\n", streams[i].key.c_str(), entries[j].id.c_str(), ids[i*100+j].c_str());
+                exit(1);
+            }
+        }
+        fprintf(stdout, "%s: %d entries\n", streams[i].key.c_str(), static_cast<int>(entries.size()));
+    }
+}
+
+// test StreamConsumer
+class CountingHandler: public r3c::StreamHandler
+{
+public:
+    CountingHandler(): _num_handled(0) { pthread_mutex_init(&_mutex, NULL); }
+    ~CountingHandler() { pthread_mutex_destroy(&_mutex); }
+    int get_num_handled() const { return _num_handled; }
+
+private:
+    virtual bool handle(const std::string& key, const r3c::StreamEntry& entry)
+    {
+        (void)key;
+        (void)entry;
+        pthread_mutex_lock(&_mutex);
+        ++_num_handled;
+        pthread_mutex_unlock(&_mutex);
+        return true;
+    }
+
+private:
+    pthread_mutex_t _mutex;
+    int _num_handled;
+};
+
+static void testcase9(r3c::CRedisClient& redis)
+{
+    const std::string group = "group";
+    std::vector<std::string> keys;
+    CountingHandler handler;
+    const int num_entries = 1000;
+
+    for (int i=0; i<10; ++i)
+    {
+        keys.push_back(r3c::format_string("k%d", i));
+        redis.del(keys.back());
+    }
+
+    r3c::StreamConsumer consumer(&redis, group, "consumer", keys);
+    consumer.set_block_milliseconds(100);
+    consumer.set_start_id("0");
+    consumer.start(&handler);
+    for (int i=0; i<num_entries; ++i)
+    {
+        std::vector<r3c::FVPair> fvpairs(1);
+        fvpairs[0].field = "f";
+        fvpairs[0].value = r3c::int2string(i);
+        redis.xadd(keys[i%keys.size()], "*", fvpairs);
+    }
+    for (int i=0; i<100 && static_cast<int>(consumer.get_num_acked())<num_entries; ++i)
+        r3c::millisleep(100);
+    consumer.stop();
+
+    fprintf(stdout, "delivered: %d, handled: %d, acked: %d, unacked: %d\n",
+            static_cast<int>(consumer.get_num_delivered()), handler.get_num_handled(),
+            static_cast<int>(consumer.get_num_acked()), consumer.get_num_unacked());
+    for (std::vector<std::string>::size_type i=0; i<keys.size(); ++i)
+    {
+        std::vector<struct r3c::DetailedPending> pendings;
+        redis.xpending(keys[i], group, "-", "+", 100, &pendings);
+        if (!pendings.empty() || consumer.get_num_unacked()!=0 || consumer.get_num_acked()!=static_cast<uint64_t>(num_entries))
+        {
+            fprintf(stderr, "%s: %d pending\n", keys[i].c_str(), static_cast<int>(pendings.size()));
+            exit(1);
+        }
+    }
+}
+
+// test StreamBatch
+static void testcase10(r3c::CRedisClient& redis)
+{
+    const std::string key = "k0";
+    const std::vector<std::string> keys(1, key);
+    const std::vector<std::string> ids(1, "0");
+    std::vector<r3c::StreamEntry> entries;
+    std::vector<r3c::Stream> streams;
+    r3c::StreamBatch batch;
+
+    redis.del(key);
+    for (int i=0; i<100; ++i)
+    {
+        std::vector<r3c::FVPair> fvpairs(2);
+        fvpairs[0].field = "f0";
+        fvpairs[0].value = r3c::int2string(i);
+        fvpairs[1].field = "f1";
+        fvpairs[1].value = std::string(i, 'x');
+        redis.xadd(key, "*", fvpairs);
+    }
+
+    redis.xrange(key, "-", "+", &entries);
+    redis.xrange(key, "-", "+", -1, &batch);
+    for (int i=0; i<batch.num_entries(); ++i)
+    {
+        const r3c::StreamBatch::EntryView entry = batch.entry(i);
+        if (entry.id()!=entries[i].id || entry.num_fields()!=2
+                || entry.value(0)!=entries[i].fvpairs[0].value || entry.value(1)!=entries[i].fvpairs[1].value)
+        {
+            fprintf(stderr, "xrange: %s != %s\n", entry.id().str().c_str(), entries[i].id.c_str());
+            exit(1);
+        }
+    }
+
+    redis.xrevrange(key, "+", "-", 10, &batch);
+    if (batch.num_entries()!=10 || batch.entry(0).id()!=entries.back().id)
+    {
+        fprintf(stderr, "xrevrange: %d entries\n", batch.num_entries());
+        exit(1);
+    }
+
+    // The batch is reused
+    redis.xread(keys, ids, 1000, -1, &batch);
+    batch.get(&streams);
+    if (batch.num_streams()!=1 || batch.key(0)!=key || streams[0].entries.size()!=entries.size())
+    {
+        fprintf(stderr, "xread: %d streams\n", batch.num_streams());
+        exit(1);
+    }
+    fprintf(stdout, "%d entries, %d bytes\n", batch.num_entries(), static_cast<int>(batch.buffer_size()));
+}
+
 void init_testcase(TESTCASE testcase[])
 {
     int i = 0;
@@ -363,4 +521,7 @@ void init_testcase(TESTCASE testcase[])
     testcase[i++] = testcase5;
     testcase[i++] = testcase6;
     testcase[i++] = testcase7;
+    testcase[i++] = testcase8;
+    testcase[i++] = testcase9;
+    testcase[i++] = testcase10;
 }
@@ -4,6 +4,7 @@
 // Usage2: set enviroment variable REDIS_CLUSTER_NODES, example: export REDIS_CLUSTER_NODES=127.0.0.1:6379,127.0.0.1:6380,
 //         and run without any parameter.
 // To test slots, please set environment varialbe TEST_SLOSTS to 1.
+// To test unix domain socket, please set environment variable REDIS_UNIX_SOCKET to the path of the socket.
 #include "r3c.h"
 #include "utils.h"
 #include <math.h>
@@ -11,6 +12,7 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <stdexcept>
 
 #define PRECISION 0.000001
 
@@ -30,6 +32,17 @@ static void success_print(const char* file, int line, const char* function, cons
 ////////////////////////////////////////////////////////////////////////////
 // MISC
 static void test_slots(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_deadline(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_hedged_reads(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_blocking_connection(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_multiple_connections(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_unix_socket(const std::string& redis_unix_socket, const std::string& redis_password);
+static void test_cluster_scanner(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_parallel_scanner(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_pipeline(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_export_and_import(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_counter_aggregator(const std::string& redis_cluster_nodes, const std::string& redis_password);
+static void test_command_batcher(const std::string& redis_cluster_nodes, const std::string& redis_password);
 
 // EVAL
 
@@ -179,6 +192,19 @@ if (false) {
 }
     ////////////////////////////////////////////////////////////////////////////
     // MISC
+    test_deadline(redis_cluster_nodes, redis_password);
+    test_hedged_reads(redis_cluster_nodes, redis_password);
+    test_blocking_connection(redis_cluster_nodes, redis_password);
+    test_multiple_connections(redis_cluster_nodes, redis_password);
+    test_cluster_scanner(redis_cluster_nodes, redis_password);
+    test_parallel_scanner(redis_cluster_nodes, redis_password);
+    test_pipeline(redis_cluster_nodes, redis_password);
+    test_export_and_import(redis_cluster_nodes, redis_password);
+    test_counter_aggregator(redis_cluster_nodes, redis_password);
+    test_command_batcher(redis_cluster_nodes, redis_password);
+    const char* redis_unix_socket_env = getenv("REDIS_UNIX_SOCKET");
+    if (redis_unix_socket_env != NULL)
+        test_unix_socket(redis_unix_socket_env, redis_password);
     const char* test_slots_env = getenv("TEST_SLOSTS");
     if ((test_slots_env != NULL) && (0 == strcmp(test_slots_env, "1")))
         test_slots(redis_cluster_nodes, redis_password);
@@ -282,6 +308,661 @@ void test_slots(const std::string& redis_cluster_nodes, const std::string& redis
     SUCCESS_PRINT("%s", "OK");
 }
 
+void test_deadline(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        const std::string key = "r3c_kk";
+
+        {
+            // Enough budget
+            r3c::DeadlineHelper deadline_helper(&rc, r3c::get_monotonic_milliseconds()+1000);
+            rc.set(key, "deadline");
+        }
+        if (rc.get_deadline() != 0)
+        {
+            ERROR_PRINT("deadline not restored: %" PRId64, rc.get_deadline());
+            return;
+        }
+
+        {
+            // A nested deadline never extends the outer one
+            const int64_t deadline = r3c::get_monotonic_milliseconds() + 1000;
+            r3c::DeadlineHelper deadline_helper1(&rc, deadline);
+            r3c::DeadlineHelper deadline_helper2(&rc, deadline+1000);
+            if (rc.get_deadline() != deadline)
+            {
+                ERROR_PRINT("deadline extended: %" PRId64 ", %" PRId64, rc.get_deadline(), deadline);
+                return;
+            }
+        }
+
+        // Relative budget
+        rc.set_deadline_after(1000);
+        rc.set(key, "deadline");
+        rc.clear_deadline();
+
+        try
+        {
+            // Exceeded already
+            r3c::DeadlineHelper deadline_helper(&rc, r3c::get_monotonic_milliseconds()-1);
+            std::string value;
+            rc.get(key, &value);
+            ERROR_PRINT("%s", "deadline not exceeded");
+            return;
+        }
+        catch (r3c::CRedisException& ex)
+        {
+            if (ex.errcode() != r3c::ERROR_DEADLINE_EXCEEDED)
+            {
+                ERROR_PRINT("ERROR: %s", ex.str().c_str());
+                return;
+            }
+        }
+
+        rc.del(key);
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+void test_hedged_reads(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, r3c::RP_PRIORITY_REPLICA, redis_password);
+        const std::string key = "r3c_kk";
+        const std::string value = "hedged";
+
+        rc.set(key, value);
+        r3c::millisleep(100); // Wait for the replication
+        rc.enable_hedged_reads(50, 0);
+        for (int i=0; i<1000; ++i)
+        {
+            std::string result;
+
+            if (!rc.get(key, &result) || result != value)
+            {
+                ERROR_PRINT("get error: %s", result.c_str());
+                return;
+            }
+        }
+
+        printf("hedges: %" PRIu64 ", wins: %" PRIu64 "\n", rc.get_num_hedges(), rc.get_num_hedge_wins());
+        if (rc.get_num_hedge_wins() > rc.get_num_hedges())
+        {
+            ERROR_PRINT("hedge wins error: %" PRIu64 ", %" PRIu64, rc.get_num_hedge_wins(), rc.get_num_hedges());
+            return;
+        }
+
+        rc.disable_hedged_reads();
+        rc.del(key);
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+void test_blocking_connection(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        // The readwrite timeout (500ms) is less than the block time (1s)
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password, 1000, 500);
+        const std::string key = "r3c_kk";
+        std::string value;
+
+        rc.del(key);
+        if (rc.blpop(key, &value, 1))
+        {
+            ERROR_PRINT("blpop error: %s", value.c_str());
+            return;
+        }
+
+        rc.rpush(key, "blocking");
+        if (!rc.blpop(key, &value, 1) || value != "blocking")
+        {
+            ERROR_PRINT("blpop error: %s", value.c_str());
+            return;
+        }
+
+        // The shared connection is still usable
+        if (rc.exists(key))
+        {
+            ERROR_PRINT("%s", "exists error");
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+void test_multiple_connections(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        const r3c::StripePolicy stripe_policies[] = { r3c::SP_KEY_HASH };
+
+        for (size_t i=0; i<sizeof(stripe_policies)/sizeof(stripe_policies[0]); ++i)
+        {
+            rc.set_connections_per_node(4, 2, stripe_policies[i]);
+            for (int j=0; j<100; ++j)
+            {
+                const std::string key = r3c::format_string("r3c_kk_%d", j);
+                const std::string value = r3c::int2string(j);
+                std::string result;
+
+                rc.set(key, value);
+                if (!rc.get(key, &result) || result != value)
+                {
+                    ERROR_PRINT("[%d] get error: %s", static_cast<int>(stripe_policies[i]), result.c_str());
+                    return;
+                }
+                rc.del(key);
+            }
+        }
+
+        // Fewer connections
+        rc.set_connections_per_node(1, 1);
+        rc.set("r3c_kk", "1");
+        rc.del("r3c_kk");
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+void test_unix_socket(const std::string& redis_unix_socket, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(std::string("unix:") + redis_unix_socket, redis_password);
+        const std::string key = "r3c_kk";
+        std::string value;
+        r3c::Node which;
+
+        rc.set(key, "unix");
+        if (!rc.get(key, &value, &which) || value != "unix")
+        {
+            ERROR_PRINT("get error: %s", value.c_str());
+            return;
+        }
+        if (!r3c::is_unix_socket_node(which))
+        {
+            ERROR_PRINT("node error: %s", r3c::node2string(which).c_str());
+            return;
+        }
+
+        rc.del(key);
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+void test_cluster_scanner(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        const int num_keys = 1000;
+        std::set<std::string> keys;
+        std::vector<std::string> values;
+
+        for (int i=0; i<num_keys; ++i)
+            rc.set(r3c::format_string("r3c_scan_%d", i), r3c::int2string(i));
+
+        {
+            r3c::ClusterScanner scanner(&rc, "r3c_scan_*", 10);
+            std::string cursor;
+
+            // Stop halfway
+            while (!scanner.done() && static_cast<int>(keys.size())<num_keys/2)
+            {
+                scanner.next(&values);
+                keys.insert(values.begin(), values.end());
+            }
+            cursor = scanner.get_cursor();
+            printf("cursor: %s\n", cursor.c_str());
+
+            // Resume by another scanner
+            r3c::ClusterScanner scanner2(&rc, "r3c_scan_*", 10);
+            if (!scanner2.set_cursor(cursor))
+            {
+                ERROR_PRINT("set cursor error: %s", cursor.c_str());
+                return;
+            }
+            while (!scanner2.done())
+            {
+                scanner2.next(&values);
+                keys.insert(values.begin(), values.end());
+            }
+            if (!scanner2.get_cursor().empty())
+            {
+                ERROR_PRINT("cursor error: %s", scanner2.get_cursor().c_str());
+                return;
+            }
+        }
+        if (static_cast<int>(keys.size()) != num_keys)
+        {
+            ERROR_PRINT("scan error: %d", static_cast<int>(keys.size()));
+            return;
+        }
+
+        for (int i=0; i<num_keys; ++i)
+            rc.del(r3c::format_string("r3c_scan_%d", i));
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+class CScanHandler: public r3c::ScanHandler
+{
+public:
+    virtual bool handle(const r3c::Node& node, const std::vector<std::string>& keys)
+    {
+        nodes.insert(node);
+        this->keys.insert(keys.begin(), keys.end());
+        return true;
+    }
+
+public:
+    std::set<r3c::Node> nodes;
+    std::set<std::string> keys;
+};
+
+class CThrowingScanHandler: public r3c::ScanHandler
+{
+public:
+    virtual bool handle(const r3c::Node&, const std::vector<std::string>&)
+    {
+        throw std::runtime_error("handler failed");
+    }
+};
+
+void test_parallel_scanner(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        const int num_keys = 1000;
+        CScanHandler handler;
+
+        for (int i=0; i<num_keys; ++i)
+            rc.set(r3c::format_string("r3c_pscan_%d", i), r3c::int2string(i));
+
+        r3c::ParallelScanner scanner(&rc, "r3c_pscan_*", 10);
+        scanner.set_queue_size(2);
+        scanner.set_rate_limit(1000);
+        const int64_t n = scanner.run(&handler);
+        printf("nodes: %d, keys: %" PRId64 "\n", static_cast<int>(handler.nodes.size()), n);
+        if (static_cast<int>(handler.keys.size()) != num_keys)
+        {
+            ERROR_PRINT("scan error: %d", static_cast<int>(handler.keys.size()));
+            return;
+        }
+
+        // The exception of the handler is thrown after the workers stopped
+        try
+        {
+            CThrowingScanHandler throwing_handler;
+            scanner.run(&throwing_handler);
+            ERROR_PRINT("%s", "no exception from handler");
+            return;
+        }
+        catch (std::runtime_error& ex)
+        {
+        }
+
+        for (int i=0; i<num_keys; ++i)
+            rc.del(r3c::format_string("r3c_pscan_%d", i));
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+void test_pipeline(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        r3c::Pipeline pipeline;
+        const int num_keys = 1000;
+
+        for (int i=0; i<num_keys; ++i)
+        {
+            const std::string key = r3c::format_string("r3c_pipeline_%d", i);
+            r3c::CommandArgs cmd_args;
+            cmd_args.set_key(key);
+            cmd_args.set_command("SET");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(key);
+            cmd_args.add_arg(i);
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+        {
+            // An error reply does not fail the others
+            r3c::CommandArgs cmd_args;
+            cmd_args.set_key("r3c_pipeline_0");
+            cmd_args.set_command("LPUSH");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(cmd_args.get_key());
+            cmd_args.add_arg("x");
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+
+        int n = rc.pipeline(&pipeline, 16);
+        if (n != num_keys)
+        {
+            ERROR_PRINT("pipeline error: %d", n);
+            return;
+        }
+        if (pipeline.get_reply(num_keys)==NULL || pipeline.get_reply(num_keys)->type!=REDIS_REPLY_ERROR)
+        {
+            ERROR_PRINT("%s", "no WRONGTYPE");
+            return;
+        }
+        for (int i=0; i<num_keys; i+=100)
+        {
+            std::string value;
+            if (!rc.get(r3c::format_string("r3c_pipeline_%d", i), &value) || value!=r3c::int2string(i))
+            {
+                ERROR_PRINT("value error: %d", i);
+                return;
+            }
+        }
+
+        pipeline.clear();
+        for (int i=0; i<num_keys; ++i)
+        {
+            r3c::CommandArgs cmd_args;
+            cmd_args.set_key(r3c::format_string("r3c_pipeline_%d", i));
+            cmd_args.set_command("DEL");
+            cmd_args.add_arg(cmd_args.get_command());
+            cmd_args.add_arg(cmd_args.get_key());
+            cmd_args.final();
+            pipeline.add(cmd_args);
+        }
+        n = rc.pipeline(&pipeline, 1);
+        if (n != num_keys)
+        {
+            ERROR_PRINT("pipeline error: %d", n);
+            return;
+        }
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+void test_export_and_import(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        const std::string filepath = "/tmp/r3c_test.r3cdump";
+        const int num_keys = 100;
+        std::string value;
+
+        for (int i=0; i<num_keys; ++i)
+            rc.set(r3c::format_string("r3c_export_%d", i), r3c::int2string(i));
+        rc.expire("r3c_export_0", 600);
+
+        r3c::KeyspaceExporter exporter(&rc, "r3c_export_*", 10);
+        int64_t n = exporter.run(filepath);
+        if (n != num_keys)
+        {
+            ERROR_PRINT("export error: %" PRId64, n);
+            return;
+        }
+
+        for (int i=0; i<num_keys; ++i)
+            rc.del(r3c::format_string("r3c_export_%d", i));
+        r3c::KeyspaceImporter importer(&rc);
+        n = importer.run(filepath);
+        if (n!=num_keys || importer.get_num_errors()!=0)
+        {
+            ERROR_PRINT("import error: %" PRId64"/%" PRId64, n, importer.get_num_errors());
+            return;
+        }
+        if (!rc.get("r3c_export_9", &value) || value!="9")
+        {
+            ERROR_PRINT("value error: %s", value.c_str());
+            return;
+        }
+        if (rc.ttl("r3c_export_0")<=0 || rc.ttl("r3c_export_0")>600)
+        {
+            ERROR_PRINT("%s", "ttl lost");
+            return;
+        }
+
+        // Existing keys are not replaced by default
+        n = importer.run(filepath);
+        if (n!=0 || importer.get_num_errors()!=num_keys)
+        {
+            ERROR_PRINT("import error: %" PRId64"/%" PRId64, n, importer.get_num_errors());
+            return;
+        }
+
+        for (int i=0; i<num_keys; ++i)
+            rc.del(r3c::format_string("r3c_export_%d", i));
+        unlink(filepath.c_str());
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+static void* counter_thread(void* param)
+{
+    r3c::CounterAggregator* aggregator = static_cast<r3c::CounterAggregator*>(param);
+
+    for (int i=0; i<10000; ++i)
+    {
+        aggregator->incrby("r3c_counter", 1);
+        aggregator->hincrby("r3c_hcounter", (i%2==0)? "even": "odd", 2);
+    }
+    return NULL;
+}
+
+void test_counter_aggregator(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        r3c::CRedisClient aggregator_rc(redis_cluster_nodes, redis_password);
+        r3c::CounterAggregator aggregator(&aggregator_rc, 10);
+        pthread_t threads[4];
+        std::string value;
+
+        rc.del("r3c_counter");
+        rc.del("r3c_hcounter");
+        aggregator.start();
+        for (int i=0; i<4; ++i)
+            pthread_create(&threads[i], NULL, counter_thread, &aggregator);
+        for (int i=0; i<4; ++i)
+            pthread_join(threads[i], NULL);
+        aggregator.stop();
+
+        if (!rc.get("r3c_counter", &value) || value!="40000")
+        {
+            ERROR_PRINT("counter error: %s", value.c_str());
+            return;
+        }
+        if (!rc.hget("r3c_hcounter", "odd", &value) || value!="40000")
+        {
+            ERROR_PRINT("hash counter error: %s", value.c_str());
+            return;
+        }
+        if (aggregator.get_num_increments()!=80000 || aggregator.get_num_pending()!=0)
+        {
+            ERROR_PRINT("increments: %" PRIu64", pending: %d", aggregator.get_num_increments(), aggregator.get_num_pending());
+            return;
+        }
+        printf("increments: %" PRIu64", commands: %" PRIu64"\n", aggregator.get_num_increments(), aggregator.get_num_commands());
+
+        rc.del("r3c_counter");
+        rc.del("r3c_hcounter");
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
+static void* batcher_thread(void* param)
+{
+    r3c::CommandBatcher* batcher = static_cast<r3c::CommandBatcher*>(param);
+
+    try
+    {
+        for (int i=0; i<1000; ++i)
+        {
+            const std::string key = r3c::format_string("r3c_batcher_%d", i%100);
+            std::string value;
+
+            batcher->set(key, key);
+            if (!batcher->get(key, &value) || value!=key)
+                return param; // Error
+            batcher->incrby("r3c_batcher_counter", 1);
+        }
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+        return param;
+    }
+    return NULL;
+}
+
+void test_command_batcher(const std::string& redis_cluster_nodes, const std::string& redis_password)
+{
+    TIPS_PRINT();
+
+    try
+    {
+        r3c::CRedisClient rc(redis_cluster_nodes, redis_password);
+        r3c::CRedisClient batcher_rc(redis_cluster_nodes, redis_password);
+        r3c::CommandBatcher batcher(&batcher_rc, 200, 64);
+        pthread_t threads[8];
+        int num_errors = 0;
+        std::string value;
+
+        rc.del("r3c_batcher_counter");
+        batcher.start();
+        for (int i=0; i<8; ++i)
+            pthread_create(&threads[i], NULL, batcher_thread, &batcher);
+        for (int i=0; i<8; ++i)
+        {
+            void* ret = NULL;
+            pthread_join(threads[i], &ret);
+            if (ret != NULL)
+                ++num_errors;
+        }
+        printf("batches: %" PRIu64", commands: %" PRIu64"\n", batcher.get_num_batches(), batcher.get_num_commands());
+        if (num_errors > 0)
+        {
+            ERROR_PRINT("threads failed: %d", num_errors);
+            return;
+        }
+        if (!rc.get("r3c_batcher_counter", &value) || value!="8000")
+        {
+            ERROR_PRINT("counter error: %s", value.c_str());
+            return;
+        }
+
+        // An error reply is thrown to the caller only
+        rc.del("r3c_batcher_list");
+        rc.lpush("r3c_batcher_list", "x");
+        try
+        {
+            batcher.hget("r3c_batcher_list", "field", &value);
+            ERROR_PRINT("%s", "no WRONGTYPE");
+            return;
+        }
+        catch (r3c::CRedisException& ex)
+        {
+            if (!r3c::is_wrongtype_error(ex.errtype()))
+            {
+                ERROR_PRINT("ERROR: %s", ex.str().c_str());
+                return;
+            }
+        }
+        batcher.stop();
+
+        // A future never submitted neither blocks get() nor its destruction
+        {
+            r3c::BatchFuture future;
+            try
+            {
+                future.get();
+                ERROR_PRINT("%s", "no exception for unsubmitted future");
+                return;
+            }
+            catch (r3c::CRedisException& ex)
+            {
+            }
+        }
+
+        for (int i=0; i<100; ++i)
+            rc.del(r3c::format_string("r3c_batcher_%d", i));
+        rc.del("r3c_batcher_counter");
+        rc.del("r3c_batcher_list");
+        SUCCESS_PRINT("%s", "OK");
+    }
+    catch (r3c::CRedisException& ex)
+    {
+        ERROR_PRINT("ERROR: %s", ex.str().c_str());
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////
 // EVAL
 
@@ -145,6 +145,18 @@ std::ostream& operator <<(std::ostream& os, const struct StreamInfo& streaminfo)
     return os;
 }
 
+std::ostream& operator <<(std::ostream& os, const struct SlowLogEntry& entry)
+{
+    os << "[" << entry.id << "] " << entry.command << " " << entry.key
+       << " cost:" << entry.cost_us << "us attempts:" << entry.attempts_cost_us.size() << "(";
+    for (std::vector<int64_t>::size_type i=0; i<entry.attempts_cost_us.size(); ++i)
+        os << ((i > 0)? ",": "") << entry.attempts_cost_us[i];
+    os << ") node:" << node2string(entry.node) << " slot:" << entry.slot
+       << " reply:" << entry.reply_bytes << "B result:" << entry.result
+       << " time:" << entry.timestamp_us/1000 << (entry.sampled? " sampled": "");
+    return os;
+}
+
 int extract_ids(const std::vector<StreamEntry>& entries, std::vector<std::string>* ids)
 {
     const int num_ids = static_cast<int>(entries.size());
@@ -563,6 +575,20 @@ void millisleep(int milliseconds)
 #endif
 }
 
+int64_t get_current_milliseconds()
+{
+    struct timeval current;
+    gettimeofday(&current, NULL);
+    return static_cast<int64_t>(current.tv_sec) * 1000 + static_cast<int64_t>(current.tv_usec / 1000);
+}
+
+int64_t get_monotonic_milliseconds()
+{
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+    return static_cast<int64_t>(current.tv_sec) * 1000 + static_cast<int64_t>(current.tv_nsec / 1000000);
+}
+
 std::string get_formatted_current_datetime(bool with_milliseconds)
 {
     char datetime_buffer[sizeof("YYYY-MM-DD hh:mm:ss/0123456789")];
@@ -667,7 +693,12 @@ int parse_nodes(std::vector<std::pair<std::string, uint16_t> >* nodes, const std
         {
             const std::string& str = nodes_string.substr(pos, len);
             const std::string::size_type colon_pos = str.find(':');
-            if (colon_pos != std::string::npos)
+            if (0 == str.compare(0, sizeof("unix:")-1, "unix:"))
+            {
+                // Unix domain socket, example: unix:/tmp/redis.sock
+                nodes->push_back(std::make_pair(str, (uint16_t)0));
+            }
+            else if (colon_pos != std::string::npos)
             {
                 const std::string& ip_str = str.substr(0, colon_pos);
                 const std::string& port_str = str.substr(colon_pos + 1);